@@ -0,0 +1,120 @@
+/* format_detection:
+ *   detections per second of Formater::get_format(), by extension, by a
+ *   magic number in memory and by one at the start of a FILE*. Every
+ *   lookup is checked, so a wrong table shows up as a failure rather
+ *   than as a fast number.
+ *
+ *     make bench
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "gil/core/FileFormat.h"
+
+using gil::FileFormat;
+using gil::Formater;
+
+namespace {
+
+	struct Name {
+		const char* name;
+		FileFormat format;
+	};
+
+	const Name NAMES[] = {
+		{ "/shots/sq010/plate.1001.exr", gil::FF_EXR },
+		{ "beauty.EXR", gil::FF_EXR },
+		{ "thumb.png", gil::FF_PNG },
+		{ "photo.JPG", gil::FF_JPEG },
+		{ "photo.jpeg", gil::FF_JPEG },
+		{ "scan.tiff", gil::FF_TIFF },
+		{ "probe.hdr", gil::FF_HDR },
+		{ "depth.pfm", gil::FF_PFM },
+		{ "notes.txt", gil::FF_UNKNOWN },
+		{ "README", gil::FF_UNKNOWN }
+	};
+
+	struct Magic {
+		unsigned char bytes[12];
+		FileFormat format;
+	};
+
+	const Magic MAGICS[] = {
+		{ { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' }, gil::FF_PNG },
+		{ { 0xff, 0xd8, 0xff, 0xe0 }, gil::FF_JPEG },
+		{ { 'I', 'I', 0x2a, 0 }, gil::FF_TIFF },
+		{ { 0x76, 0x2f, 0x31, 0x01, 2 }, gil::FF_EXR },
+		{ { '#', '?', 'R', 'A', 'D', 'I', 'A', 'N', 'C', 'E', '\n' }, gil::FF_HDR },
+		{ { 'P', 'F', '\n' }, gil::FF_PFM },
+		{ { 'x', 'x', 'x', 'x' }, gil::FF_UNKNOWN }
+	};
+
+	const size_t N_NAMES = sizeof(NAMES) / sizeof(NAMES[0]);
+	const size_t N_MAGICS = sizeof(MAGICS) / sizeof(MAGICS[0]);
+
+	double seconds(std::clock_t start)
+	{
+		return static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+	}
+
+	void report(const char* what, size_t n, double t)
+	{
+		std::printf("%-22s %8.1f M/s\n", what, n / t / 1e6);
+	}
+
+	void fail(const char* what, size_t i)
+	{
+		std::fprintf(stderr, "format_detection: wrong format for %s %lu\n",
+			what, static_cast<unsigned long>(i));
+		std::exit(1);
+	}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	const size_t n = (argc > 1) ? std::strtoul(argv[1], NULL, 10) : 20000000;
+
+	// the strings a loader has at hand, built once
+	std::vector<std::string> names;
+	for (size_t i = 0; i < N_NAMES; ++i)
+		names.push_back(NAMES[i].name);
+	size_t wrong = 0;
+	std::clock_t start = std::clock();
+	for (size_t i = 0; i < n; ++i) {
+		const Name& name = NAMES[i % N_NAMES];
+		wrong += Formater::get_format(names[i % N_NAMES]) != name.format;
+	}
+	report("extension (string)", n, seconds(start));
+	if (wrong)
+		fail("name", wrong);
+
+	start = std::clock();
+	for (size_t i = 0; i < n; ++i) {
+		const Magic& magic = MAGICS[i % N_MAGICS];
+		wrong += Formater::get_format(magic.bytes, sizeof(magic.bytes)) !=
+			magic.format;
+	}
+	report("magic (memory)", n, seconds(start));
+	if (wrong)
+		fail("magic", wrong);
+
+	// a FILE* costs a read and a seek back on top of the lookup
+	std::FILE* f = std::tmpfile();
+	if (f == NULL)
+		return 1;
+	std::fwrite(MAGICS[3].bytes, 1, sizeof(MAGICS[3].bytes), f);
+	std::rewind(f);
+	const size_t files = n / 10;
+	start = std::clock();
+	for (size_t i = 0; i < files; ++i)
+		wrong += Formater::get_format(f) != gil::FF_EXR;
+	report("magic (FILE*)", files, seconds(start));
+	std::fclose(f);
+	if (wrong)
+		fail("file", wrong);
+	return 0;
+}
@@ -0,0 +1,425 @@
+#ifndef GIL_BATCH_H
+#define GIL_BATCH_H
+
+#include <cstddef>
+#include <cstdio>
+#include <ctime>
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "Exception.h"
+#include "Converter.h"
+#include "ImageIO.h"
+#include "Parallel.h"
+
+#ifdef GIL_THREADS
+#include <chrono>
+#endif
+
+namespace gil {
+
+	// a batch stage that leaves the image as it is
+	struct NullTransform {
+		template<class I>
+		void operator ()(I&) const
+		{
+			// empty
+		}
+	};
+
+	/* BatchConvert:
+	 *   converts many files at once, each read into an image of type I,
+	 *   passed through transform and written in the format of its
+	 *   destination name:
+	 *
+	 *     BatchConvert<FloatImage3> batch;
+	 *     batch.add("plate.0001.exr", "plate.0001.png");
+	 *     batch.add<ClampConverter>("ref.exr", "ref.png");  // a converter of yours
+	 *     ...
+	 *     BatchConvert<FloatImage3>::Report report = batch.run();
+	 *     printf("%.1f files/s\n", report.files_per_second());
+	 *
+	 *   Each job reads and writes with the converter it was added with,
+	 *   the Converter of the batch unless add() is given another.
+	 *
+	 *   Decoding, transforming and encoding are pipelined, each stage on
+	 *   threads of its own with a bounded queue in front of the next
+	 *   one. Images are recycled from stage to stage, so a batch of
+	 *   frames of the same size allocates them once. Threads of a stage
+	 *   are not the ones of parallel_for, so codecs and filters that use
+	 *   it still run in parallel.
+	 *
+	 *   A file that fails does not stop the batch; it is counted and
+	 *   listed in the report. Builds without threads convert the files
+	 *   one after the other.
+	 */
+	template<
+		class I,
+		template<typename, typename> class Converter = DefaultConverter,
+		class Transform = NullTransform
+	>
+	class BatchConvert {
+		public:
+			typedef bool (*ReadFunction)(I&, const std::string&);
+			typedef bool (*WriteFunction)(const I&, const std::string&);
+
+			struct Job {
+				std::string src;
+				std::string dst;
+				ReadFunction read;		// read<C>, write<C> of the converter
+				WriteFunction write;	// C the job was added with
+			};
+
+			struct Failure {
+				size_t job;				// index in the order of add()
+				std::string message;
+
+				bool operator <(const Failure& other) const
+				{
+					return job < other.job;
+				}
+			};
+
+			// threads and queue depth per stage
+			struct Stages {
+				Stages()
+					: read_threads(2), transform_threads(1), write_threads(2),
+					  read_depth(4), write_depth(4)
+				{
+					// empty
+				}
+
+				size_t read_threads;
+				size_t transform_threads;
+				size_t write_threads;
+				size_t read_depth;		// decoded images waiting to transform
+				size_t write_depth;		// images waiting to be encoded
+			};
+
+			struct Report {
+				size_t files;			// converted
+				size_t failed;
+				size_t bytes_read;		// sizes of the sources converted
+				size_t bytes_written;	// sizes of the files written
+				double seconds;			// wall clock of run()
+				std::vector<Failure> failures;	// in the order of the jobs
+
+				double files_per_second() const
+				{
+					return seconds > 0.0 ? files / seconds : 0.0;
+				}
+
+				// megabytes of sources per second
+				double mb_per_second() const
+				{
+					return seconds > 0.0 ? bytes_read / seconds / 1e6 : 0.0;
+				}
+			};
+
+			explicit BatchConvert(
+				const Stages& stages = Stages(),
+				const Transform& transform = Transform()
+			): my_stages(stages), my_transform(transform)
+			{
+				// empty
+			}
+
+			void add(const std::string& src, const std::string& dst)
+			{
+				add<Converter>(src, dst);
+			}
+
+			// a job converting with C instead of the batch's Converter
+			template<template<typename, typename> class C>
+			void add(const std::string& src, const std::string& dst)
+			{
+				Job job;
+				job.src = src;
+				job.dst = dst;
+				job.read = &BatchConvert::template load<C>;
+				job.write = &BatchConvert::template save<C>;
+				my_jobs.push_back(job);
+			}
+
+			const std::vector<Job>& jobs() const
+			{
+				return my_jobs;
+			}
+
+			// convert every job added, then forget them
+			Report run()
+			{
+				my_report = Report();
+				my_report.files = my_report.failed = 0;
+				my_report.bytes_read = my_report.bytes_written = 0;
+				my_report.seconds = 0.0;
+#ifdef GIL_THREADS
+				const Clock::time_point start = Clock::now();
+				run_pipeline();
+				my_report.seconds =
+					std::chrono::duration<double>(Clock::now() - start).count();
+#else
+				const std::clock_t start = std::clock();
+				I image;
+				for (size_t i = 0; i < my_jobs.size(); ++i)
+					try {
+						decode(i, image);
+						my_transform(image);
+						encode(i, image);
+					} catch (const std::exception& e) {
+						fail(i, e.what());
+					} catch (...) {
+						fail(i, "unknown error");
+					}
+				my_report.seconds =
+					static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+#endif
+				// the stages fail jobs in whatever order they finish
+				std::stable_sort(
+					my_report.failures.begin(), my_report.failures.end()
+				);
+				my_jobs.clear();
+				return my_report;
+			}
+
+		private:
+			BatchConvert(const BatchConvert&);
+			BatchConvert& operator =(const BatchConvert&);
+
+			static size_t file_size(const std::string& filename)
+			{
+				FILE *f = fopen(filename.c_str(), "rb");
+				if (f == NULL)
+					return 0;
+				fseek(f, 0, SEEK_END);
+				const long size = ftell(f);
+				fclose(f);
+				return size > 0 ? static_cast<size_t>(size) : 0;
+			}
+
+			template<template<typename, typename> class C>
+			static bool load(I& image, const std::string& filename)
+			{
+				return read<C>(image, filename);
+			}
+
+			template<template<typename, typename> class C>
+			static bool save(const I& image, const std::string& filename)
+			{
+				return write<C>(image, filename);
+			}
+
+			void decode(size_t job, I& image)
+			{
+				if (!my_jobs[job].read(image, my_jobs[job].src))
+					throw IOError("cannot read " + my_jobs[job].src);
+			}
+
+			void encode(size_t job, const I& image)
+			{
+				if (!my_jobs[job].write(image, my_jobs[job].dst))
+					throw IOError("cannot write " + my_jobs[job].dst);
+				const size_t read = file_size(my_jobs[job].src);
+				const size_t written = file_size(my_jobs[job].dst);
+				Lock lock(*this);
+				++my_report.files;
+				my_report.bytes_read += read;
+				my_report.bytes_written += written;
+			}
+
+			void fail(size_t job, const std::string& message)
+			{
+				Failure failure;
+				failure.job = job;
+				failure.message = message;
+				Lock lock(*this);
+				++my_report.failed;
+				my_report.failures.push_back(failure);
+			}
+
+#ifdef GIL_THREADS
+			typedef std::chrono::steady_clock Clock;
+
+			struct Lock {
+				Lock(BatchConvert& batch): my_lock(batch.my_mutex)
+				{
+					// empty
+				}
+
+				std::lock_guard<std::mutex> my_lock;
+			};
+
+			// (job, image) pairs between two stages. pop() waits for an
+			// item and gives false once the stage before is done.
+			class Queue {
+				public:
+					Queue(size_t depth, size_t producers)
+						: my_depth(std::max<size_t>(depth, 1)),
+						  my_producers(producers)
+					{
+						// empty
+					}
+
+					void push(size_t job, size_t image)
+					{
+						std::unique_lock<std::mutex> lock(my_mutex);
+						while (my_items.size() >= my_depth)
+							my_space.wait(lock);
+						my_items.push_back(std::make_pair(job, image));
+						my_ready.notify_one();
+					}
+
+					bool pop(size_t& job, size_t& image)
+					{
+						std::unique_lock<std::mutex> lock(my_mutex);
+						while (my_items.empty() && my_producers)
+							my_ready.wait(lock);
+						if (my_items.empty())
+							return false;
+						job = my_items.front().first;
+						image = my_items.front().second;
+						my_items.pop_front();
+						my_space.notify_one();
+						return true;
+					}
+
+					// a producer has no more items
+					void close()
+					{
+						std::lock_guard<std::mutex> lock(my_mutex);
+						if (--my_producers == 0)
+							my_ready.notify_all();
+					}
+
+				private:
+					std::deque< std::pair<size_t, size_t> > my_items;
+					size_t my_depth;
+					size_t my_producers;
+					std::mutex my_mutex;
+					std::condition_variable my_ready;
+					std::condition_variable my_space;
+			};
+
+			void run_pipeline()
+			{
+				const size_t readers = std::max<size_t>(my_stages.read_threads, 1);
+				const size_t transformers =
+					std::max<size_t>(my_stages.transform_threads, 1);
+				const size_t writers = std::max<size_t>(my_stages.write_threads, 1);
+
+				// enough images for every thread and queue slot
+				const size_t images = readers + transformers + writers +
+					my_stages.read_depth + my_stages.write_depth;
+				my_images.resize(images);
+				Queue free_images(images, 1);
+				for (size_t i = 0; i < images; ++i)
+					free_images.push(0, i);
+				Queue decoded(my_stages.read_depth, readers);
+				Queue transformed(my_stages.write_depth, transformers);
+				my_free = &free_images;
+				my_decoded = &decoded;
+				my_transformed = &transformed;
+				my_next_job = 0;
+
+				std::vector<std::thread> threads;
+				for (size_t i = 0; i < readers; ++i)
+					threads.push_back( std::thread(&BatchConvert::read_stage, this) );
+				for (size_t i = 0; i < transformers; ++i)
+					threads.push_back(
+						std::thread(&BatchConvert::transform_stage, this)
+					);
+				for (size_t i = 0; i < writers; ++i)
+					threads.push_back( std::thread(&BatchConvert::write_stage, this) );
+				for (size_t i = 0; i < threads.size(); ++i)
+					threads[i].join();
+			}
+
+			void read_stage()
+			{
+				for (;;) {
+					size_t job = 0, image = 0, unused = 0;
+					{
+						Lock lock(*this);
+						if (my_next_job == my_jobs.size())
+							break;
+						job = my_next_job++;
+					}
+					my_free->pop(unused, image);
+					try {
+						decode(job, my_images[image]);
+					} catch (const std::exception& e) {
+						fail(job, e.what());
+						my_free->push(0, image);
+						continue;
+					} catch (...) {
+						fail(job, "unknown error");
+						my_free->push(0, image);
+						continue;
+					}
+					my_decoded->push(job, image);
+				}
+				my_decoded->close();
+			}
+
+			void transform_stage()
+			{
+				size_t job, image;
+				while (my_decoded->pop(job, image)) {
+					try {
+						my_transform(my_images[image]);
+					} catch (const std::exception& e) {
+						fail(job, e.what());
+						my_free->push(0, image);
+						continue;
+					} catch (...) {
+						fail(job, "unknown error");
+						my_free->push(0, image);
+						continue;
+					}
+					my_transformed->push(job, image);
+				}
+				my_transformed->close();
+			}
+
+			void write_stage()
+			{
+				size_t job, image;
+				while (my_transformed->pop(job, image)) {
+					try {
+						encode(job, my_images[image]);
+					} catch (const std::exception& e) {
+						fail(job, e.what());
+					} catch (...) {
+						fail(job, "unknown error");
+					}
+					my_free->push(0, image);
+				}
+			}
+
+			std::vector<I> my_images;
+			Queue* my_free;				// images no stage holds
+			Queue* my_decoded;
+			Queue* my_transformed;
+			size_t my_next_job;
+			std::mutex my_mutex;
+#else
+			struct Lock {
+				Lock(BatchConvert&)
+				{
+					// empty
+				}
+			};
+#endif
+
+			Stages my_stages;
+			Transform my_transform;
+			std::vector<Job> my_jobs;
+			Report my_report;
+	};
+
+}
+
+#endif // GIL_BATCH_H
@@ -0,0 +1,58 @@
+#ifndef GIL_BOX_H
+#define GIL_BOX_H
+
+#include <cstddef>
+#include <algorithm>
+
+namespace gil {
+
+	/* Box:
+	 *   a rectangle of pixels, x and y its top left corner. It is the
+	 *   region of interest of readers that decode only part of a file,
+	 *   and the window of a SubImage.
+	 */
+	struct Box {
+		Box(): x(0), y(0), width(0), height(0)
+		{
+			// empty
+		}
+
+		Box(size_t x, size_t y, size_t width, size_t height)
+			: x(x), y(y), width(width), height(height)
+		{
+			// empty
+		}
+
+		bool empty() const
+		{
+			return width == 0 || height == 0;
+		}
+
+		// the part of the box inside a w x h image
+		Box clip(size_t w, size_t h) const
+		{
+			if (x >= w || y >= h)
+				return Box(std::min(x, w), std::min(y, h), 0, 0);
+			return Box(x, y, std::min(width, w - x), std::min(height, h - y));
+		}
+
+		size_t x;
+		size_t y;
+		size_t width;
+		size_t height;
+	};
+
+	inline bool operator ==(const Box& a, const Box& b)
+	{
+		return a.x == b.x && a.y == b.y &&
+			a.width == b.width && a.height == b.height;
+	}
+
+	inline bool operator !=(const Box& a, const Box& b)
+	{
+		return !(a == b);
+	}
+
+}
+
+#endif // GIL_BOX_H
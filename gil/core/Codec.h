@@ -0,0 +1,420 @@
+#ifndef GIL_CODEC_H
+#define GIL_CODEC_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Color.h"
+#include "Converter.h"
+#include "FileFormat.h"
+#include "Formatter.h"
+#include "Parallel.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define GIL_MEMSTREAM
+#endif
+
+namespace gil {
+
+	/* MemoryFile:
+	 *   a FILE* over memory, for the codecs, which all read and write
+	 *   FILE*s. open() reads the bytes given, without copying them;
+	 *   create() writes into a buffer that data() and size() give once
+	 *   close() is called.
+	 *
+	 *   Platforms without fmemopen and open_memstream go through a
+	 *   tmpfile() instead.
+	 */
+	class MemoryFile {
+		public:
+			MemoryFile()
+				: my_file(NULL), my_data(NULL), my_size(0), my_writing(false)
+			{
+				// empty
+			}
+
+			~MemoryFile()
+			{
+				close();
+				clear();
+			}
+
+			// for reading size bytes at data, which must outlive the file
+			FILE* open(const void* data, size_t size)
+			{
+				close();
+				clear();
+				if (size == 0)
+					return NULL;
+#ifdef GIL_MEMSTREAM
+				my_file = fmemopen(const_cast<void*>(data), size, "rb");
+#else
+				my_file = tmpfile();
+				if (my_file && fwrite(data, 1, size, my_file) != size) {
+					fclose(my_file);
+					my_file = NULL;
+				}
+				if (my_file)
+					rewind(my_file);
+#endif
+				return my_file;
+			}
+
+			// for writing
+			FILE* create()
+			{
+				close();
+				clear();
+#ifdef GIL_MEMSTREAM
+				my_file = open_memstream(&my_data, &my_size);
+#else
+				my_file = tmpfile();
+#endif
+				my_writing = true;
+				return my_file;
+			}
+
+			// false if the bytes written could not be kept
+			bool close()
+			{
+				if (my_file == NULL)
+					return true;
+				bool ok = true;
+#ifdef GIL_MEMSTREAM
+				ok = (fclose(my_file) == 0);
+#else
+				if (my_writing) {
+					fflush(my_file);
+					fseek(my_file, 0, SEEK_END);
+					const long size = ftell(my_file);
+					rewind(my_file);
+					my_data = size > 0 ?
+						static_cast<char*>( malloc(static_cast<size_t>(size)) ) :
+						NULL;
+					my_size = my_data ?
+						fread(my_data, 1, static_cast<size_t>(size), my_file) : 0;
+					ok = (size <= 0 || my_size == static_cast<size_t>(size));
+				}
+				fclose(my_file);
+#endif
+				my_file = NULL;
+				return ok;
+			}
+
+			FILE* file() const
+			{
+				return my_file;
+			}
+
+			// the bytes written, after close()
+			const char* data() const
+			{
+				return my_data;
+			}
+
+			size_t size() const
+			{
+				return my_size;
+			}
+
+		private:
+			MemoryFile(const MemoryFile&);
+			MemoryFile& operator =(const MemoryFile&);
+
+			void clear()
+			{
+				free(my_data);
+				my_data = NULL;
+				my_size = 0;
+				my_writing = false;
+			}
+
+			FILE* my_file;
+			char* my_data;
+			size_t my_size;
+			bool my_writing;
+	};
+
+	/* Stream:
+	 *   callbacks standing for a file, e.g. a cache or a socket. read
+	 *   gives fewer than size bytes at the end only, write returns the
+	 *   bytes it took. Either may be NULL for a stream that only does the
+	 *   other.
+	 */
+	struct Stream {
+		Stream(): user(NULL), read(NULL), write(NULL)
+		{
+			// empty
+		}
+
+		void* user;
+		size_t (*read)(void* user, void* data, size_t size);
+		size_t (*write)(void* user, const void* data, size_t size);
+	};
+
+	/* CodecTable:
+	 *   the codecs of one kind, readers or writers, that read() and
+	 *   write() pick from, by magic number and by extension. It starts
+	 *   with the codecs of the library; more may be added at run time
+	 *   and are tried before them. Function is what a codec is called
+	 *   through; see ReaderRegistry and WriterRegistry. The table is safe
+	 *   to use from any thread.
+	 */
+	template<typename Function>
+	class CodecTable {
+		public:
+			struct Codec {
+				std::string name;
+				FileFormat format;		// FF_UNKNOWN for codecs added
+				std::string magic;		// empty for the library codecs
+				std::vector<std::string> extensions;	// lower case
+				Function function;		// NULL if it cannot use a FILE*
+			};
+
+			// magic numbers longer than this cannot be told
+			enum { MAX_MAGIC = 64 };
+
+			// extensions separated by spaces, without their dots
+			void add(
+				const std::string& name, const std::string& magic,
+				const std::string& extensions, Function function
+			){
+				if (magic.size() > MAX_MAGIC)
+					throw std::invalid_argument("magic number too long");
+				Codec codec = make(name, FF_UNKNOWN, function);
+				codec.magic = magic;
+				std::string::size_type pos = 0;
+				while (pos < extensions.size()) {
+					std::string::size_type end = extensions.find(' ', pos);
+					if (end == std::string::npos)
+						end = extensions.size();
+					if (end > pos)
+						codec.extensions.push_back(
+							lower( extensions.substr(pos, end - pos) )
+						);
+					pos = end + 1;
+				}
+				Lock lock(*this);
+				my_added.push_front(codec);
+			}
+
+			// by the magic number at the start of data, NULL if none
+			const Codec* find(const void* data, size_t size) const
+			{
+				{
+					Lock lock(*this);
+					for (size_t i = 0; i < my_added.size(); ++i) {
+						const std::string& magic = my_added[i].magic;
+						if (!magic.empty() && magic.size() <= size &&
+								std::memcmp(magic.data(), data, magic.size()) == 0)
+							return &my_added[i];
+					}
+				}
+				return find( Formater::get_format(data, size) );
+			}
+
+			// by the magic number at the position of f, which stays there
+			const Codec* find(FILE* f) const
+			{
+				unsigned char buf[MAX_MAGIC];
+				const size_t n = fread(buf, 1, MAX_MAGIC, f);
+				fseek(f, -static_cast<long>(n), SEEK_CUR);
+				return find(buf, n);
+			}
+
+			// by the extension of filename; a name without a dot is taken
+			// as an extension itself
+			const Codec* find(const std::string& filename) const
+			{
+				const std::string::size_type dot = filename.rfind('.');
+				const std::string ext = lower(
+					dot == std::string::npos ? filename : filename.substr(dot + 1)
+				);
+				{
+					Lock lock(*this);
+					for (size_t i = 0; i < my_added.size(); ++i)
+						for (size_t j = 0; j < my_added[i].extensions.size(); ++j)
+							if (my_added[i].extensions[j] == ext)
+								return &my_added[i];
+				}
+				const FileFormat format = Formater::get_format(
+					dot == std::string::npos ? "." + ext : filename
+				);
+				return find(format);
+			}
+
+			// the library codec of a format, NULL if none
+			const Codec* find(FileFormat format) const
+			{
+				for (size_t i = 0; i < my_library.size(); ++i)
+					if (my_library[i].format == format)
+						return &my_library[i];
+				return NULL;
+			}
+
+		protected:
+			CodecTable()
+			{
+				// empty
+			}
+
+			// a codec of the library, from the constructor of a registry
+			void library(
+				const std::string& name, FileFormat format, Function function
+			){
+				my_library.push_back( make(name, format, function) );
+			}
+
+		private:
+			CodecTable(const CodecTable&);
+			CodecTable& operator =(const CodecTable&);
+
+			static Codec make(
+				const std::string& name, FileFormat format, Function function
+			){
+				Codec codec;
+				codec.name = name;
+				codec.format = format;
+				codec.function = function;
+				return codec;
+			}
+
+			static std::string lower(std::string s)
+			{
+				for (size_t i = 0; i < s.size(); ++i)
+					if (s[i] >= 'A' && s[i] <= 'Z')
+						s[i] += 'a' - 'A';
+				return s;
+			}
+
+#ifdef GIL_THREADS
+			struct Lock {
+				Lock(const CodecTable& table)
+					: my_lock(table.my_mutex)
+				{
+					// empty
+				}
+
+				std::lock_guard<std::mutex> my_lock;
+			};
+
+			mutable std::mutex my_mutex;
+#else
+			struct Lock {
+				Lock(const CodecTable&)
+				{
+					// empty
+				}
+			};
+#endif
+
+			std::vector<Codec> my_library;	// never changes once built
+			std::deque<Codec> my_added;		// newest first; push_front
+											// keeps the others in place
+	};
+
+	/* ReaderRegistry, WriterRegistry:
+	 *   the readers of images of type I read with Converter, and the
+	 *   writers of images of type I written with it. They are apart so
+	 *   that writing never instantiates a reader, which needs an image
+	 *   it can allocate, and reading never a writer:
+	 *
+	 *     typedef ReaderRegistry<FloatImage3> Readers;
+	 *     Readers::instance().add("mine", "MINE", "mne",
+	 *         &Readers::read_with<MineReader>);
+	 *     typedef WriterRegistry<FloatImage3> Writers;
+	 *     Writers::instance().add("mine", "MINE", "mne",
+	 *         &Writers::write_with<MineWriter>);
+	 *
+	 *   Readers and writers are the classes PngReader and the others are:
+	 *   default constructible with a templated operator () on a FILE*.
+	 */
+	template<
+		class I,
+		template<typename, typename> class Converter = DefaultConverter
+	>
+	class ReaderRegistry : public CodecTable<void (*)(I& image, FILE* f)> {
+		public:
+			static ReaderRegistry& instance()
+			{
+				static ReaderRegistry registry;
+				return registry;
+			}
+
+			template<class R>
+			static void read_with(I& image, FILE* f)
+			{
+				R reader;
+#ifdef _MSC_VER
+				reader.operator()<Converter>(image, f);
+#else
+				reader.template operator()<Converter>(image, f);
+#endif
+			}
+
+		private:
+			ReaderRegistry()
+			{
+				// TIFF is read by name only, see read()
+				this->library("tiff", FF_TIFF, NULL);
+				this->library("png", FF_PNG, &read_with<PngReader>);
+				this->library("jpeg", FF_JPEG, &read_with<JpegReader>);
+				this->library("exr", FF_EXR, &read_with<ExrReader>);
+				this->library("hdr", FF_HDR, &read_with<HdrReader>);
+				this->library("ppm", FF_PPM, &read_with< PpmReader<Byte3, '6'> >);
+				this->library("pgm", FF_PGM, &read_with< PpmReader<Byte1, '5'> >);
+				this->library("pfm", FF_PFM, &read_with<PfmReader>);
+				this->library("bmp", FF_BMP, &read_with<BmpReader>);
+				this->library("flt", FF_FLT, &read_with<FltReader>);
+			}
+	};
+
+	template<
+		class I,
+		template<typename, typename> class Converter = DefaultConverter
+	>
+	class WriterRegistry : public CodecTable<void (*)(const I& image, FILE* f)> {
+		public:
+			static WriterRegistry& instance()
+			{
+				static WriterRegistry registry;
+				return registry;
+			}
+
+			template<class W>
+			static void write_with(const I& image, FILE* f)
+			{
+				W writer;
+#ifdef _MSC_VER
+				writer.operator()<Converter>(image, f);
+#else
+				writer.template operator()<Converter>(image, f);
+#endif
+			}
+
+		private:
+			WriterRegistry()
+			{
+				// TIFF is written by name only, see write()
+				this->library("tiff", FF_TIFF, NULL);
+				this->library("png", FF_PNG, &write_with<PngWriter>);
+				this->library("jpeg", FF_JPEG, &write_with<JpegWriter>);
+				this->library("exr", FF_EXR, &write_with<ExrWriter>);
+				this->library("hdr", FF_HDR, &write_with<HdrWriter>);
+				this->library("ppm", FF_PPM, &write_with< PpmWriter<Byte3, '6'> >);
+				this->library("pgm", FF_PGM, &write_with< PpmWriter<Byte1, '5'> >);
+				this->library("pfm", FF_PFM, &write_with<PfmWriter>);
+				this->library("bmp", FF_BMP, &write_with<BmpWriter>);
+				this->library("flt", FF_FLT, &write_with<FltWriter>);
+			}
+	};
+
+} // namespace gil
+
+#endif // GIL_CODEC_H
@@ -7,6 +7,8 @@
 #include <functional>
 #include <limits>
 
+#include "Half.h"
+
 // set DLLAPI if we're using VC
 
 #ifdef _MSC_VER
@@ -29,6 +31,7 @@ namespace gil {
 	typedef unsigned short Short1;
 	typedef float Float1;
 	typedef double Double1;
+	typedef Half Half1;
 
 	// utilities
 	template <typename T>
@@ -57,6 +60,7 @@ namespace gil {
 	
 	template <> inline Float1 TypeTrait<float>::opaque() { return 1.0f; }
 	template <> inline Double1 TypeTrait<double>::opaque() { return 1.0; }
+	template <> inline Half1 TypeTrait<Half1>::opaque() { return 1.0f; }
 
 	// Basic features for a pixel
 	template <typename Type, size_t Channel>
@@ -379,6 +383,8 @@ namespace gil {
 	typedef Color<Float1, 4> Float4;
 	typedef Color<Double1, 3> Double3;
 	typedef Color<Double1, 4> Double4;
+	typedef Color<Half1, 3> Half3;
+	typedef Color<Half1, 4> Half4;
 
 } // namespace gil
 
@@ -2,7 +2,10 @@
 #define GIL_CONVERTER_H
 
 #include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include "Color.h"
+#include "Simd.h"
 
 namespace gil {
 
@@ -25,7 +28,10 @@ namespace gil {
 		{
 			const Float1 ratio = 
 				static_cast<Float1>(TypeTrait<Byte1>::opaque());
-			return static_cast<Byte1>(from * ratio);
+			// saturate, NaN gives 0
+			return static_cast<Byte1>(
+				std::min(std::max(Float1(0), from * ratio), ratio)
+			);
 		}
 	};
 
@@ -75,8 +81,11 @@ namespace gil {
 		typedef Float1 From;
 		const Short1 operator()(Float1 from) const
 		{
-			const Short1 ratio = TypeTrait<Short1>::opaque();
-			return static_cast<Short1>(from * ratio);
+			const Float1 ratio = TypeTrait<Short1>::opaque();
+			// saturate, NaN gives 0
+			return static_cast<Short1>(
+				std::min(std::max(Float1(0), from * ratio), ratio)
+			);
 		}
 	};
 
@@ -92,6 +101,47 @@ namespace gil {
 		}
 	};
 
+	// halves scale like floats: Byte1/Short1 <-> Half1 go through Float1
+	template <>
+	struct DefaultConverter<Half1, Byte1> {
+		typedef Half1 To;
+		typedef Byte1 From;
+		const Half1 operator()(Byte1 from) const
+		{
+			return DefaultConverter<Float1, Byte1>()(from);
+		}
+	};
+
+	template <>
+	struct DefaultConverter<Byte1, Half1> {
+		typedef Byte1 To;
+		typedef Half1 From;
+		const Byte1 operator()(Half1 from) const
+		{
+			return DefaultConverter<Byte1, Float1>()(from);
+		}
+	};
+
+	template <>
+	struct DefaultConverter<Half1, Short1> {
+		typedef Half1 To;
+		typedef Short1 From;
+		const Half1 operator()(Short1 from) const
+		{
+			return DefaultConverter<Float1, Short1>()(from);
+		}
+	};
+
+	template <>
+	struct DefaultConverter<Short1, Half1> {
+		typedef Short1 To;
+		typedef Half1 From;
+		const Short1 operator()(Half1 from) const
+		{
+			return DefaultConverter<Short1, Float1>()(from);
+		}
+	};
+
     // exactly same 
     template <typename T, size_t C>
     struct DefaultConverter< Color<T,C>, Color<T,C> > {
@@ -250,6 +300,434 @@ namespace gil {
 		}
 	};
 
+	/* RowConverter:
+	 *   converts a row of n pixels with Converter<To, From>. The generic
+	 *   version calls the converter once per pixel; the common pairs of
+	 *   DefaultConverter are specialized below, with SSE2 where it is
+	 *   available, and give the same values as the per-pixel converter.
+	 */
+	template<
+		template<typename, typename> class Converter,
+		typename To, typename From
+	>
+	struct RowConverter {
+		static void convert(To* to, const From* from, size_t n)
+		{
+			Converter<To, From> converter;
+			for (size_t i = 0; i < n; ++i)
+				to[i] = converter(from[i]);
+		}
+	};
+
+	template<
+		template<typename, typename> class Converter,
+		typename To, typename From
+	>
+	inline void convert_row(To* to, const From* from, size_t n)
+	{
+		RowConverter<Converter, To, From>::convert(to, from, n);
+	}
+
+	template<typename To, typename From>
+	inline void convert_row(To* to, const From* from, size_t n)
+	{
+		RowConverter<DefaultConverter, To, From>::convert(to, from, n);
+	}
+
+	template<typename T>
+	struct RowConverter<DefaultConverter, T, T> {
+		static void convert(T* to, const T* from, size_t n)
+		{
+			std::copy(from, from + n, to);
+		}
+	};
+
+	template<typename T, size_t C>
+	struct RowConverter< DefaultConverter, Color<T,C>, Color<T,C> > {
+		static void convert(Color<T,C>* to, const Color<T,C>* from, size_t n)
+		{
+			std::copy(from, from + n, to);
+		}
+	};
+
+	// channel by channel, a row of Color<F,C> is a row of n*C samples
+	template<typename T, typename F, size_t C>
+	struct RowConverter< DefaultConverter, Color<T,C>, Color<F,C> > {
+		static void convert(Color<T,C>* to, const Color<F,C>* from, size_t n)
+		{
+			RowConverter<DefaultConverter, T, F>::convert(
+				reinterpret_cast<T*>(to), reinterpret_cast<const F*>(from), n*C
+			);
+		}
+	};
+
+	// Byte1 -> Float1
+	template<>
+	struct RowConverter<DefaultConverter, Float1, Byte1> {
+		static void convert(Float1* to, const Byte1* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_SSE2
+			const __m128 ratio = _mm_set1_ps(
+				static_cast<Float1>(TypeTrait<Byte1>::opaque())
+			);
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 16 <= n; i += 16) {
+				const __m128i b = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(from + i)
+				);
+				const __m128i lo = _mm_unpacklo_epi8(b, zero);
+				const __m128i hi = _mm_unpackhi_epi8(b, zero);
+				_mm_storeu_ps(to + i, _mm_div_ps(_mm_cvtepi32_ps(
+					_mm_unpacklo_epi16(lo, zero)), ratio));
+				_mm_storeu_ps(to + i + 4, _mm_div_ps(_mm_cvtepi32_ps(
+					_mm_unpackhi_epi16(lo, zero)), ratio));
+				_mm_storeu_ps(to + i + 8, _mm_div_ps(_mm_cvtepi32_ps(
+					_mm_unpacklo_epi16(hi, zero)), ratio));
+				_mm_storeu_ps(to + i + 12, _mm_div_ps(_mm_cvtepi32_ps(
+					_mm_unpackhi_epi16(hi, zero)), ratio));
+			}
+#endif
+			DefaultConverter<Float1, Byte1> converter;
+			for (; i < n; ++i)
+				to[i] = converter(from[i]);
+		}
+	};
+
+	// Float1 -> Byte1
+	template<>
+	struct RowConverter<DefaultConverter, Byte1, Float1> {
+		static void convert(Byte1* to, const Float1* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_SSE2
+			const __m128 ratio = _mm_set1_ps(
+				static_cast<Float1>(TypeTrait<Byte1>::opaque())
+			);
+			const __m128 zero = _mm_setzero_ps();
+			__m128i q[4];
+			for (; i + 16 <= n; i += 16) {
+				// max(x, 0) gives 0 for NaN like the scalar converter
+				for (size_t k = 0; k < 4; ++k)
+					q[k] = _mm_cvttps_epi32( _mm_min_ps( _mm_max_ps(
+						_mm_mul_ps(_mm_loadu_ps(from + i + 4*k), ratio),
+						zero), ratio) );
+				_mm_storeu_si128(
+					reinterpret_cast<__m128i*>(to + i),
+					_mm_packus_epi16(
+						_mm_packs_epi32(q[0], q[1]),
+						_mm_packs_epi32(q[2], q[3])
+					)
+				);
+			}
+#endif
+			DefaultConverter<Byte1, Float1> converter;
+			for (; i < n; ++i)
+				to[i] = converter(from[i]);
+		}
+	};
+
+	// Short1 -> Float1
+	template<>
+	struct RowConverter<DefaultConverter, Float1, Short1> {
+		static void convert(Float1* to, const Short1* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_SSE2
+			const __m128 ratio = _mm_set1_ps(
+				static_cast<Float1>(TypeTrait<Short1>::opaque())
+			);
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 8 <= n; i += 8) {
+				const __m128i s = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(from + i)
+				);
+				_mm_storeu_ps(to + i, _mm_div_ps(_mm_cvtepi32_ps(
+					_mm_unpacklo_epi16(s, zero)), ratio));
+				_mm_storeu_ps(to + i + 4, _mm_div_ps(_mm_cvtepi32_ps(
+					_mm_unpackhi_epi16(s, zero)), ratio));
+			}
+#endif
+			DefaultConverter<Float1, Short1> converter;
+			for (; i < n; ++i)
+				to[i] = converter(from[i]);
+		}
+	};
+
+	// Float1 -> Short1
+	template<>
+	struct RowConverter<DefaultConverter, Short1, Float1> {
+		static void convert(Short1* to, const Float1* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_SSE2
+			const __m128 ratio = _mm_set1_ps(
+				static_cast<Float1>(TypeTrait<Short1>::opaque())
+			);
+			const __m128 zero = _mm_setzero_ps();
+			// SSE2 only packs signed words, so pack around 32768
+			const __m128i bias = _mm_set1_epi32(32768);
+			const __m128i sign = _mm_set1_epi16(-32768);
+			__m128i q[2];
+			for (; i + 8 <= n; i += 8) {
+				for (size_t k = 0; k < 2; ++k)
+					q[k] = _mm_sub_epi32( _mm_cvttps_epi32( _mm_min_ps(
+						_mm_max_ps(
+							_mm_mul_ps(_mm_loadu_ps(from + i + 4*k), ratio),
+							zero
+						), ratio) ), bias );
+				_mm_storeu_si128(
+					reinterpret_cast<__m128i*>(to + i),
+					_mm_xor_si128(_mm_packs_epi32(q[0], q[1]), sign)
+				);
+			}
+#endif
+			DefaultConverter<Short1, Float1> converter;
+			for (; i < n; ++i)
+				to[i] = converter(from[i]);
+		}
+	};
+
+	// Half1 -> Float1, eight at a time with F16C
+	template<>
+	struct RowConverter<DefaultConverter, Float1, Half1> {
+		static void convert(Float1* to, const Half1* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_F16C
+			for (; i + 8 <= n; i += 8)
+				_mm256_storeu_ps(to + i, _mm256_cvtph_ps( _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(from + i)
+				) ));
+#endif
+			for (; i < n; ++i)
+				to[i] = from[i];
+		}
+	};
+
+	// Float1 -> Half1, rounded to nearest even like the scalar path
+	template<>
+	struct RowConverter<DefaultConverter, Half1, Float1> {
+		static void convert(Half1* to, const Float1* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_F16C
+			for (; i + 8 <= n; i += 8)
+				_mm_storeu_si128(
+					reinterpret_cast<__m128i*>(to + i),
+					_mm256_cvtps_ph(_mm256_loadu_ps(from + i), 0)
+				);
+#endif
+			for (; i < n; ++i)
+				to[i] = from[i];
+		}
+	};
+
+	// Float3 -> Float4, the alpha is opaque
+	template<>
+	struct RowConverter<DefaultConverter, Float4, Float3> {
+		static void convert(Float4* to, const Float3* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_SSE2
+			// each load takes the red of the next pixel, so the last
+			// pixel is left to the scalar loop
+			const float *in = reinterpret_cast<const float*>(from);
+			float *out = reinterpret_cast<float*>(to);
+			const __m128 rgb = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+			const __m128 alpha = _mm_set_ps(
+				TypeTrait<Float1>::opaque(), 0.0f, 0.0f, 0.0f
+			);
+			for (; i + 1 < n; ++i)
+				_mm_storeu_ps(out + 4*i, _mm_or_ps(
+					_mm_and_ps(_mm_loadu_ps(in + 3*i), rgb), alpha
+				));
+#endif
+			DefaultConverter<Float4, Float3> converter;
+			for (; i < n; ++i)
+				to[i] = converter(from[i]);
+		}
+	};
+
+	// Float4 -> Float3, the alpha is dropped
+	template<>
+	struct RowConverter<DefaultConverter, Float3, Float4> {
+		static void convert(Float3* to, const Float4* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_SSE2
+			// each store spills the alpha over the next pixel, which
+			// overwrites it; the last pixel is left to the scalar loop
+			const float *in = reinterpret_cast<const float*>(from);
+			float *out = reinterpret_cast<float*>(to);
+			for (; i + 1 < n; ++i)
+				_mm_storeu_ps(out + 3*i, _mm_loadu_ps(in + 4*i));
+#endif
+			DefaultConverter<Float3, Float4> converter;
+			for (; i < n; ++i)
+				to[i] = converter(from[i]);
+		}
+	};
+
+	/* RowTrait:
+	 *   whether the pixels of a row of an image are contiguous, starting at
+	 *   &image(0, y). Image types say so by specializing it. store_row and
+	 *   load_row convert whole rows of such images with convert_row, and
+	 *   fall back to one pixel at a time for the others.
+	 */
+	template<class I>
+	struct RowTrait {
+		enum { Contiguous = false };
+	};
+
+	/* OrderTrait:
+	 *   whether the rows of an image must be visited top down, one after
+	 *   the other, like the streams of dip/Stream.h. Codecs of formats
+	 *   stored bottom up reverse the order of their rows for such images
+	 *   only, and visit the others in file order.
+	 */
+	template<class I>
+	struct OrderTrait {
+		enum { TopDown = false };
+	};
+
+	template<bool Contiguous>
+	struct RowAccess {
+		template<
+			template<typename, typename> class Converter,
+			class I, typename From
+		>
+		static void store(I& image, size_t y, const From* from, size_t n)
+		{
+			Converter<typename I::ColorType, From> converter;
+			for (size_t x = 0; x < n; ++x)
+				image(x, y) = converter(from[x]);
+		}
+
+		template<
+			template<typename, typename> class Converter,
+			typename To, class I
+		>
+		static void load(To* to, const I& image, size_t y, size_t n)
+		{
+			Converter<To, typename I::ColorType> converter;
+			for (size_t x = 0; x < n; ++x)
+				to[x] = converter( image(x, y) );
+		}
+	};
+
+	template<>
+	struct RowAccess<true> {
+		template<
+			template<typename, typename> class Converter,
+			class I, typename From
+		>
+		static void store(I& image, size_t y, const From* from, size_t n)
+		{
+			if (n)
+				convert_row<Converter>(&image(0, y), from, n);
+		}
+
+		template<
+			template<typename, typename> class Converter,
+			typename To, class I
+		>
+		static void load(To* to, const I& image, size_t y, size_t n)
+		{
+			if (n)
+				convert_row<Converter>(to, &image(0, y), n);
+		}
+	};
+
+	// convert n pixels from `from' into row y of image
+	template<
+		template<typename, typename> class Converter,
+		class I, typename From
+	>
+	inline void store_row(I& image, size_t y, const From* from, size_t n)
+	{
+		RowAccess<RowTrait<I>::Contiguous>::template
+			store<Converter>(image, y, from, n);
+	}
+
+	// convert the first n pixels of row y of image into `to'
+	template<
+		template<typename, typename> class Converter,
+		typename To, class I
+	>
+	inline void load_row(To* to, const I& image, size_t y, size_t n)
+	{
+		RowAccess<RowTrait<I>::Contiguous>::template
+			load<Converter>(to, image, y, n);
+	}
+
+	// assign n pixels, one every `from_step' of from, to one every
+	// `to_step' of to
+	template<typename T, typename F>
+	inline void copy_strided(
+		T* to, std::ptrdiff_t to_step,
+		const F* from, std::ptrdiff_t from_step, size_t n
+	)
+	{
+		for (size_t i = 0; i < n; ++i, to += to_step, from += from_step)
+			*to = *from;
+	}
+
+	template<typename T, typename F>
+	inline void copy_span(T* to, const F* from, size_t n)
+	{
+		for (size_t i = 0; i < n; ++i)
+			to[i] = from[i];
+	}
+
+	// pixels of the same type are copied as bytes. memmove lets views of
+	// the same image overlap.
+	template<typename T>
+	inline void copy_span(T* to, const T* from, size_t n)
+	{
+		std::memmove(to, from, n * sizeof(T));
+	}
+
+	template<bool Contiguous>
+	struct RowCopy {
+		template<class D, class S>
+		static void copy(D& dst, const S& src, size_t x, size_t y)
+		{
+			for (size_t iy = 0; iy < src.height(); ++iy)
+				for (size_t ix = 0; ix < src.width(); ++ix)
+					dst(x + ix, y + iy) = src(ix, iy);
+		}
+	};
+
+	template<>
+	struct RowCopy<true> {
+		template<class D, class S>
+		static void copy(D& dst, const S& src, size_t x, size_t y)
+		{
+			if (src.width() == 0)
+				return;
+			for (size_t iy = 0; iy < src.height(); ++iy)
+				copy_span(&dst(x, y + iy), &src(0, iy), src.width());
+		}
+	};
+
+	/* copy_rows:
+	 *   assigns src to the block of dst at (x, y), like
+	 *
+	 *     dst(x + ix, y + iy) = src(ix, iy);
+	 *
+	 *   for every pixel of src, but a row at a time when both images have
+	 *   contiguous rows (see RowTrait), with memmove when the pixel types
+	 *   match. SliceImage adds strided overloads.
+	 */
+	template<class D, class S>
+	inline void copy_rows(D& dst, const S& src, size_t x = 0, size_t y = 0)
+	{
+		RowCopy<RowTrait<D>::Contiguous && RowTrait<S>::Contiguous>::copy(
+			dst, src, x, y
+		);
+	}
+
 } // namespace gil
 
 #endif // GIL_CONVERTER_H
@@ -2,11 +2,9 @@
 #define GIL_FILE_FORMAT_H
 
 #include <string>
+#include <cstddef>
 #include <cstdio>
-#include <cctype>
-#include <map>
-#include <vector>
-#include <algorithm>
+#include <cstring>
 
 #include "Color.h" // to define DLLAPI on windows
 
@@ -18,137 +16,146 @@ namespace gil {
 		FF_SIZE
 	};
 
-	typedef std::map<std::string,FileFormat> FormatTable;
-
+	/* Formater:
+	 *   tells the format of a file from its extension or its magic number.
+	 *   The tables are constant data, so both lookups are safe from any
+	 *   thread and allocate nothing:
+	 *
+	 *   - an extension of up to 4 letters is packed in an unsigned int,
+	 *     lowercase, and found with a perfect hash: one multiplication, a
+	 *     shift and one compare.
+	 *   - a magic number is compared against the prefixes that start with
+	 *     its first byte only.
+	 */
 	class Formater {
 		public:
 			// get file format by filename extension
 			// this will be used in write()
 			static FileFormat get_format(const std::string& filename)
 			{
-				using namespace std;
+				return get_format(filename.c_str(), filename.size());
+			}
 
-				string::size_type pos = filename.rfind('.');
-				if (pos == string::npos)
-					return FF_UNKNOWN;
-				string ext = filename.substr(pos + 1);
-				// convert to lower case
-				transform(
-					ext.begin(), 
-					ext.end(), 
-					ext.begin(), 
-					ptr_fun<int,int>(tolower)
-				);
-
-				const FormatTable table = get_ext_table();
-				FormatTable::const_iterator it = table.find(ext);
-				if(it == table.end())
+			static FileFormat get_format(const char* filename)
+			{
+				return get_format(filename, std::strlen(filename));
+			}
+
+			static FileFormat get_format(const char* filename, size_t length)
+			{
+				size_t pos = length;
+				while (pos > 0 && filename[pos - 1] != '.')
+					--pos;
+				if (pos == 0 || length - pos > 4)
 					return FF_UNKNOWN;
-				else
-					return it->second;
+
+				// lower case, first letter in the low byte
+				unsigned int key = 0;
+				for (size_t i = 0; pos + i < length; ++i) {
+					unsigned int c = static_cast<unsigned char>(filename[pos + i]);
+					if (c >= 'A' && c <= 'Z')
+						c += 'a' - 'A';
+					key |= c << (8 * i);
+				}
+
+				const Extension& e = extension_table()[ext_hash(key)];
+				return (e.key == key && key != 0) ? e.format : FF_UNKNOWN;
 			}
 
 			// get file format by its magic number
 			// this will be used in read()
 			static FileFormat get_format(FILE* f)
 			{
-				using namespace std;
-
-				const int MAGIC_LENGTH = 12;
-
-				char buf[MAGIC_LENGTH];
+				unsigned char buf[MAGIC_LENGTH];
 				int n_read = (int)fread(buf, 1, MAGIC_LENGTH, f);
 				fseek(f, -n_read, SEEK_CUR);
 				if(n_read < MAGIC_LENGTH){
 					return FF_UNKNOWN;
 				}
+				return get_format(buf, n_read);
+			}
 
-				string magic(buf, n_read);
-				const FormatTable& table = get_magic_table();
-				FormatTable::const_iterator it = table.upper_bound(magic);
-				if(it == table.begin()) // smaller than the first key
+			// by the magic number at the start of data, size bytes long
+			static FileFormat get_format(const void* data, size_t size)
+			{
+				const unsigned char* bytes = static_cast<const unsigned char*>(data);
+				if (size < MAGIC_LENGTH)
 					return FF_UNKNOWN;
-				--it;
-				if( magic.compare(0, it->first.length(), it->first) == 0)
-					return it->second;
 
+				const Magic* table = magic_table();
+				for (size_t i = 0; table[i].length; ++i)
+					if (static_cast<unsigned char>(table[i].bytes[0]) == bytes[0] &&
+							std::memcmp(table[i].bytes, bytes, table[i].length) == 0)
+						return table[i].format;
 				return FF_UNKNOWN;
 			}
 
+			// bytes get_format() needs to tell a magic number
+			enum { MAGIC_LENGTH = 12 };
 
-			static const FormatTable& get_ext_table()
+		private:
+			struct Extension {
+				unsigned int key;		// as packed by get_format()
+				FileFormat format;
+			};
+
+			struct Magic {
+				const char* bytes;
+				size_t length;
+				FileFormat format;
+			};
+
+			// collision free for the extensions of extension_table()
+			static size_t ext_hash(unsigned int key)
 			{
-				using namespace std;
-
-				static FormatTable ext_table;   // table by extension
-				static bool built = false;
-
-				// this method is not thread safe.
-				// however, it is acceptable because this doesn't make memory 
-				// leak, but only rebuild the table.
-				if(built == true)
-					return ext_table;
-
-				// not built yet
-				built = true;
-				ext_table["png"]  = FF_PNG;
-				ext_table["jpg"]  = FF_JPEG;
-				ext_table["jpeg"] = FF_JPEG;
-				ext_table["tif"]  = FF_TIFF;
-				ext_table["tiff"] = FF_TIFF;
-				ext_table["bmp"] = FF_BMP;
-				ext_table["tga"] = FF_TARGA;
-				ext_table["ppm"] = FF_PPM;
-				ext_table["pgm"] = FF_PGM;
-				ext_table["exr"] = FF_EXR;
-				ext_table["hdr"] = FF_HDR;
-				ext_table["pfm"] = FF_PFM;
-				ext_table["dpx"] = FF_DPX;
-				ext_table["crw"] = FF_CRW;
-				ext_table["flt"] = FF_FLT;
-
-				return ext_table;
+				return ((key * 0xd4e59e41u) & 0xffffffffu) >> 28;
 			}
 
-			static const FormatTable& get_magic_table()
+			// by ext_hash(); keys are the letters little endian
+			static const Extension* extension_table()
 			{
-				using namespace std;
-
-				static FormatTable magic_table;
-				static bool built = false;
-
-				// not thread safe as above
-				if(built == true)
-					return magic_table;
-
-				// not built yet
-				built = true;
-
-				magic_table["\x89PNG"]  = FF_PNG;
-
-				magic_table["\xFF\xD8"]  = FF_JPEG;
-
-				magic_table[string("MM\0\x2A",4)] = FF_TIFF;
-				magic_table[string("II\x2A\0",4)] = FF_TIFF;
-
-				magic_table["\x76\x2F\x31\x01"] = FF_EXR;
-
-				magic_table["BM"] = FF_BMP;
-
-				magic_table[string("\0\0\x02\0",4)] = FF_TARGA;
-				magic_table[string("\0\0\x03\0",4)] = FF_TARGA;
-
-				magic_table["#?RADIANCE"] = FF_HDR;
-
-				magic_table["P5"] = FF_PGM;
-				magic_table["P6"] = FF_PPM;
-
-				magic_table["PF"] = FF_PFM;
-				magic_table["Pf"] = FF_PFM;
+				static const Extension table[16] = {
+					{ 0x006d6670, FF_PFM },		// pfm
+					{ 0x00727865, FF_EXR },		// exr
+					{ 0x00777263, FF_CRW },		// crw
+					{ 0x6765706a, FF_JPEG },	// jpeg
+					{ 0x0067706a, FF_JPEG },	// jpg
+					{ 0x00000000, FF_UNKNOWN },
+					{ 0x00746c66, FF_FLT },		// flt
+					{ 0x00676e70, FF_PNG },		// png
+					{ 0x00706d62, FF_BMP },		// bmp
+					{ 0x66666974, FF_TIFF },	// tiff
+					{ 0x00726468, FF_HDR },		// hdr
+					{ 0x00666974, FF_TIFF },	// tif
+					{ 0x00787064, FF_DPX },		// dpx
+					{ 0x00616774, FF_TARGA },	// tga
+					{ 0x006d6770, FF_PGM },		// pgm
+					{ 0x006d7070, FF_PPM }		// ppm
+				};
+				return table;
+			}
 
-				return magic_table;
+			// ends with a zero length entry
+			static const Magic* magic_table()
+			{
+				static const Magic table[] = {
+					{ "\x89PNG", 4, FF_PNG },
+					{ "\xFF\xD8", 2, FF_JPEG },
+					{ "MM\0\x2A", 4, FF_TIFF },
+					{ "II\x2A\0", 4, FF_TIFF },
+					{ "\x76\x2F\x31\x01", 4, FF_EXR },
+					{ "BM", 2, FF_BMP },
+					{ "\0\0\x02\0", 4, FF_TARGA },
+					{ "\0\0\x03\0", 4, FF_TARGA },
+					{ "#?RADIANCE", 10, FF_HDR },
+					{ "P5", 2, FF_PGM },
+					{ "P6", 2, FF_PPM },
+					{ "PF", 2, FF_PFM },
+					{ "Pf", 2, FF_PFM },
+					{ 0, 0, FF_UNKNOWN }
+				};
+				return table;
 			}
-		private:
 	};
 
 } // namespace gil
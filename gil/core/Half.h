@@ -0,0 +1,158 @@
+#ifndef GIL_HALF_H
+#define GIL_HALF_H
+
+#include <cstring>
+#include <limits>
+
+namespace gil {
+
+	/* Half:
+	 *   an IEEE 754 binary16 value, the half of OpenEXR. It converts to and
+	 *   from float implicitly, so arithmetic on halves is done in float and
+	 *   rounded back on assignment. Rounding is to nearest even, which is
+	 *   what F16C does; the row converters use F16C when it is enabled
+	 *   (see Simd.h) and give the same bits.
+	 *
+	 *   Half3/Half4 pixels take half the memory of Float3/Float4 for the
+	 *   same dynamic range, at 11 bits of precision.
+	 */
+	class Half {
+		public:
+			Half(): my_bits(0)
+			{
+				// empty
+			}
+
+			Half(float f): my_bits(from_float(f))
+			{
+				// empty
+			}
+
+			operator float() const
+			{
+				return to_float(my_bits);
+			}
+
+			unsigned short bits() const
+			{
+				return my_bits;
+			}
+
+			static Half from_bits(unsigned short bits)
+			{
+				Half h;
+				h.my_bits = bits;
+				return h;
+			}
+
+			static unsigned short from_float(float f)
+			{
+				const unsigned int F32_INF = 255u << 23;
+				const unsigned int F16_MAX = (127u + 16) << 23;
+				const unsigned int DENORM_MAGIC =
+					((127u - 15) + (23 - 10) + 1) << 23;
+
+				unsigned int x = as_bits(f);
+				const unsigned int sign = x & 0x80000000u;
+				x ^= sign;
+
+				unsigned int h;
+				if (x >= F16_MAX) {
+					// Inf stays Inf, NaN keeps the top of its payload and
+					// becomes quiet
+					h = (x > F32_INF) ? 0x7e00 | ((x >> 13) & 0x3ff) : 0x7c00;
+				} else if (x < (113u << 23)) {
+					// the float addition rounds the denormal for us
+					h = as_bits(as_float(x) + as_float(DENORM_MAGIC));
+					h -= DENORM_MAGIC;
+				} else {
+					const unsigned int odd = (x >> 13) & 1;
+					x += ((15u - 127) << 23) + 0xfff + odd;
+					h = x >> 13;
+				}
+				return static_cast<unsigned short>(h | (sign >> 16));
+			}
+
+			static float to_float(unsigned short h)
+			{
+				const unsigned int EXPONENT = 0x7c00u << 13;
+
+				unsigned int x = (h & 0x7fffu) << 13;
+				const unsigned int exponent = x & EXPONENT;
+				x += (127u - 15) << 23;
+				if (exponent == EXPONENT) {
+					x += (128u - 16) << 23;			// Inf or NaN
+					if (h & 0x3ff)
+						x |= 0x400000;				// NaN becomes quiet
+				} else if (exponent == 0) {
+					x += 1u << 23;					// zero or denormal
+					x = as_bits(as_float(x) - as_float(113u << 23));
+				}
+				return as_float(x | ((h & 0x8000u) << 16));
+			}
+
+		private:
+			static unsigned int as_bits(float f)
+			{
+				unsigned int x;
+				std::memcpy(&x, &f, sizeof(x));
+				return x;
+			}
+
+			static float as_float(unsigned int x)
+			{
+				float f;
+				std::memcpy(&f, &x, sizeof(f));
+				return f;
+			}
+
+			unsigned short my_bits;
+	};
+
+} // namespace gil
+
+namespace std {
+
+	// lets the numeric code paths (the SIMD convolution engine) take
+	// halves; every member of the standard ones, for IEEE binary16
+	template<>
+	class numeric_limits<gil::Half> {
+		public:
+			static const bool is_specialized = true;
+			static const bool is_signed = true;
+			static const bool is_integer = false;
+			static const bool is_exact = false;
+			static const bool has_infinity = true;
+			static const bool has_quiet_NaN = true;
+			static const bool has_signaling_NaN = true;
+			static const float_denorm_style has_denorm = denorm_present;
+			static const bool has_denorm_loss = false;
+			static const float_round_style round_style = round_to_nearest;
+			static const bool is_iec559 = true;
+			static const bool is_bounded = true;
+			static const bool is_modulo = false;
+			static const int digits = 11;
+			static const int digits10 = 3;
+			static const int max_digits10 = 5;
+			static const int radix = 2;
+			static const int min_exponent = -13;
+			static const int min_exponent10 = -4;
+			static const int max_exponent = 16;
+			static const int max_exponent10 = 4;
+			static const bool traps = false;
+			static const bool tinyness_before = false;
+
+			static gil::Half min() { return gil::Half::from_bits(0x0400); }
+			static gil::Half max() { return gil::Half::from_bits(0x7bff); }
+			static gil::Half lowest() { return gil::Half::from_bits(0xfbff); }
+			static gil::Half epsilon() { return gil::Half::from_bits(0x1400); }
+			static gil::Half round_error() { return gil::Half::from_bits(0x3800); }
+			static gil::Half infinity() { return gil::Half::from_bits(0x7c00); }
+			static gil::Half quiet_NaN() { return gil::Half::from_bits(0x7e00); }
+			static gil::Half signaling_NaN() { return gil::Half::from_bits(0x7d00); }
+			static gil::Half denorm_min() { return gil::Half::from_bits(0x0001); }
+	};
+
+} // namespace std
+
+#endif // GIL_HALF_H
@@ -7,10 +7,22 @@
 #include <cstddef>
 #include <cassert>
 #include <vector>
+#include <iterator>
+#include <new>
+#include <utility>
 
 #include "Color.h"
+#include "Converter.h"
 #include "ImageProxy.h"
 
+// rvalue references: temporary images hand over their pixels instead of
+// being copied
+#ifndef GIL_MOVE
+	#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+		#define GIL_MOVE
+	#endif
+#endif // GIL_MOVE
+
 namespace gil {
 
 	template<typename, template<typename> class> class Image;
@@ -21,13 +33,16 @@ namespace gil {
 	template<typename Type, template<typename> class Allocator=std::allocator >
 	class Image {
 		public:
+			template<typename P> class Iterator;
+
 			// STL-compliance
 			typedef Type 		value_type;
-			typedef Type* 		iterator;
-			typedef const Type*	const_iterator;
+			typedef Iterator<Type>	iterator;
+			typedef Iterator<const Type>	const_iterator;
 			typedef Type&		reference;
 			typedef const Type&	const_reference;
 			typedef Type*		pointer;
+			typedef const Type*	const_pointer;
 			typedef std::ptrdiff_t	difference_type;
 			typedef std::size_t		size_type;
 
@@ -37,40 +52,63 @@ namespace gil {
 			typedef Type& RefType;
 			typedef const Type& ConstRefType;
 
+			// every row of an aligned image starts on this boundary (bytes)
+			static const size_type ALIGNMENT = 64;
+
 			Image()
-				: my_width(0), my_height(0), my_data(0), my_row(0)
+				: my_width(0), my_height(0), my_stride(0), my_origin(0),
+				  my_border(0), my_pitch(0), my_aligned(false)
 			{
 				// empty
 			}
 
 			Image(size_t w, size_t h)
-				: my_width(0), my_height(0), my_data(0), my_row(0)
+				: my_width(0), my_height(0), my_stride(0), my_origin(0),
+				  my_border(0), my_pitch(0), my_aligned(false)
+			{
+				resize(w, h);
+			}
+
+			// padded storage: every row is ALIGNMENT-aligned, at least
+			// `pitch' pixels long, and surrounded by `border' guard pixels.
+			Image(size_t w, size_t h, size_t border, size_t pitch = 0)
+				: my_width(0), my_height(0), my_stride(0), my_origin(0),
+				  my_border(border), my_pitch(pitch), my_aligned(true)
 			{
 				resize(w, h);
 			}
 
 			Image(const Image& img)
-				: my_width(0), my_height(0), my_data(0), my_row(0)
+				: my_width(0), my_height(0), my_stride(0), my_origin(0),
+				  my_border(img.my_border), my_pitch(img.my_pitch),
+				  my_aligned(img.my_aligned)
 			{
 				*this = img;
 			}
 
+#ifdef GIL_MOVE
+			// takes the pixels of img, which is left empty
+			Image(Image&& img) noexcept
+				: my_width(img.my_width), my_height(img.my_height),
+				  my_stride(img.my_stride), my_origin(img.my_origin),
+				  my_border(img.my_border), my_pitch(img.my_pitch),
+				  my_aligned(img.my_aligned), my_data(std::move(img.my_data))
+			{
+				img.my_width = img.my_height = img.my_stride = 0;
+				img.my_origin = 0;
+			}
+#endif
+
 			template <typename I>
 			Image(const I& img)
-				: my_width(0), my_height(0), my_data(0), my_row(0)
+				: my_width(0), my_height(0), my_stride(0), my_origin(0),
+				  my_border(0), my_pitch(0), my_aligned(false)
 			{
 				*this = img;
 			}
 
 			~Image() { 
-				/*
-				delete [] my_data; 
-				delete [] my_row; 
-				my_data = 0;
-				my_row = 0;
-				*/
-				my_data.resize(0);
-				my_row.resize(0);
+				release();
 			}
 
 			size_type width() const 
@@ -93,9 +131,56 @@ namespace gil {
 				return ColorTrait<Type>::channels();
 			}
 
+			// distance between two vertically adjacent pixels, in pixels
+			size_type stride() const
+			{
+				return my_stride;
+			}
+
+			size_type border() const
+			{
+				return my_border;
+			}
+
+			// true if the rows are packed without padding
+			bool contiguous() const
+			{
+				return my_stride == my_width;
+			}
+
+			// first pixel of row y. When the image has a border, the guard
+			// pixels are at row(y)[-border()] and row(y) -/+ k*stride().
+			pointer row(size_type y)
+			{
+				return my_origin + y*my_stride;
+			}
+
+			const_pointer row(size_type y) const
+			{
+				return my_origin + y*my_stride;
+			}
+
 			void fill(const_reference pixel)
 			{
-				std::fill(begin(), end(), pixel);
+				for (size_type y = 0; y < my_height; ++y)
+					std::fill(row(y), row(y) + my_width, pixel);
+			}
+
+			// change the storage layout, keeping the pixels.
+			// border/pitch are in pixels, pitch 0 means the image width.
+			void set_layout(size_type border, size_type pitch = 0, bool aligned = true)
+			{
+				if (border == my_border && pitch == my_pitch && aligned == my_aligned)
+					return;
+
+				Image tmp;
+				tmp.my_border = border;
+				tmp.my_pitch = pitch;
+				tmp.my_aligned = aligned;
+				tmp.resize(my_width, my_height);
+				for (size_type y = 0; y < my_height; ++y)
+					std::copy(row(y), row(y) + my_width, tmp.row(y));
+				swap(tmp);
 			}
 
 			// deprecated
@@ -106,34 +191,20 @@ namespace gil {
 
 			void resize(size_t w, size_t h){
 				if (w != my_width || h != my_height) {
-					// the delete operator will automatically check for NULL
-					// delete [] my_data;
-					// delete [] my_row;
-
-					if (w != 0 && h != 0) {
-						// my_data = new Type[w*h];
-						my_data.resize(w*h);
-						// my_row = new Type*[h];
-						my_row.resize(h);
-						my_width = w;
-						my_height = h;
-						init_row();
-					} else {
-						my_width = my_height = 0;
-						my_data.resize(0);
-						my_row.resize(0);
-					}
+					release();
+					if (w != 0 && h != 0)
+						reserve(w, h);
 				}
 			}
 
 			reference operator ()(size_type x, size_type y)
 			{
-				return my_row[y][x];
+				return my_origin[y*my_stride + x];
 			}
 
 			const_reference operator ()(size_type x, size_type y) const
 			{
-				return my_row[y][x];
+				return my_origin[y*my_stride + x];
 			}
 
 			template<class Filter, class To, class From>
@@ -147,12 +218,23 @@ namespace gil {
 				return this->operator=<Image>(img);
 			}
 
+#ifdef GIL_MOVE
+			Image& operator =(Image&& img) noexcept
+			{
+				if (this != &img) {
+					release();
+					swap(img);
+				}
+				return *this;
+			}
+#endif
+
 			template <typename I>
 			Image& operator =(const I& img)
 			{
 				if (this != reinterpret_cast<const Image*>(&img)) {
 					resize(img.width(), img.height());
-					std::copy(img.begin(), img.end(), this->begin());
+					copy_rows(*this, img);
 				}
 				return *this;
 			}
@@ -166,9 +248,7 @@ namespace gil {
 				assert( pos_x + img.width() <= this->width() );
 				assert( pos_y + img.height() <= this->height() );
 
-				for (size_type y(pos_y), iy(0); iy < img.height(); ++iy, ++y)
-					for (size_type x(pos_x), ix(0); ix < img.width(); ++ix, ++x)
-						(*this)(x, y) = img(ix, iy);
+				copy_rows(*this, img, pos_x, pos_y);
 			}
 
 			// bilinear interpolation, quite useful
@@ -181,17 +261,19 @@ namespace gil {
 				double xf = x - x0;
 				double yf = y - y0;
 
+				const_pointer r0 = row(y0);
 				if (xf == 0 && yf == 0)
-					return my_row[y0][x0];
+					return r0[x0];
 
 				if (xf == 0) {
-					return mix( my_row[y0][x0], my_row[y0+1][x0], yf );
+					return mix( r0[x0], r0[x0+my_stride], yf );
 				} else if (yf == 0) {
-					return mix( my_row[y0][x0], my_row[y0][x0+1], xf );
+					return mix( r0[x0], r0[x0+1], xf );
 				} else {
+					const_pointer r1 = r0 + my_stride;
 					return mix(
-							mix( my_row[y0][x0], my_row[y0][x0+1], xf ),
-							mix( my_row[y0+1][x0], my_row[y0+1][x0+1], xf ),
+							mix( r0[x0], r0[x0+1], xf ),
+							mix( r1[x0], r1[x0+1], xf ),
 							yf );
 				}
 			}
@@ -203,52 +285,314 @@ namespace gil {
 				using std::swap;
 				swap(my_width, i.my_width);
 				swap(my_height, i.my_height);
+				swap(my_stride, i.my_stride);
+				swap(my_origin, i.my_origin);
+				swap(my_border, i.my_border);
+				swap(my_pitch, i.my_pitch);
+				swap(my_aligned, i.my_aligned);
 				my_data.swap(i.my_data);
-				my_row.swap(i.my_row);
 			}
 
+			// iterates row by row, stepping over the padding between rows.
+			// It is a random access iterator; on packed images it moves
+			// like a pointer, on padded ones n steps cost a division.
+			template<typename P>
+			class Iterator {
+				friend class Image<Type, Allocator>;
+				template<typename> friend class Iterator;
+				public:
+					typedef std::random_access_iterator_tag iterator_category;
+					typedef Type value_type;
+					typedef std::ptrdiff_t difference_type;
+					typedef P* pointer;
+					typedef P& reference;
+					typedef Iterator<P> self_type;
+
+					Iterator()
+						: my_ptr(0), my_row_end(0), my_origin(0),
+						  my_width(0), my_stride(0)
+					{
+						// empty
+					}
+
+					// iterator to const_iterator
+					template<typename Q>
+					Iterator(const Iterator<Q>& i)
+						: my_ptr(i.my_ptr), my_row_end(i.my_row_end),
+						  my_origin(i.my_origin), my_width(i.my_width),
+						  my_stride(i.my_stride)
+					{
+						// empty
+					}
+
+					P& operator *() const
+					{
+						return *my_ptr;
+					}
+
+					P* operator ->() const
+					{
+						return my_ptr;
+					}
+
+					P& operator [](difference_type n) const
+					{
+						return *(*this + n);
+					}
+
+					self_type& operator ++()
+					{
+						if (++my_ptr == my_row_end) {
+							my_ptr += my_stride - my_width;
+							my_row_end += my_stride;
+						}
+						return *this;
+					}
+
+					self_type operator ++(int)
+					{
+						self_type tmp = *this;
+						++*this;
+						return tmp;
+					}
+
+					self_type& operator --()
+					{
+						if (my_ptr == my_row_end - my_width) {
+							my_ptr -= my_stride - my_width;
+							my_row_end -= my_stride;
+						}
+						--my_ptr;
+						return *this;
+					}
+
+					self_type operator --(int)
+					{
+						self_type tmp = *this;
+						--*this;
+						return tmp;
+					}
+
+					// on packed rows my_row_end may be left behind: the
+					// steps at row ends are all 0 there
+					self_type& operator +=(difference_type n)
+					{
+						if (my_stride == my_width)
+							my_ptr += n;
+						else
+							seek(index() + n);
+						return *this;
+					}
+
+					self_type& operator -=(difference_type n)
+					{
+						return *this += -n;
+					}
+
+					self_type operator +(difference_type n) const
+					{
+						self_type tmp = *this;
+						return tmp += n;
+					}
+
+					self_type operator -(difference_type n) const
+					{
+						self_type tmp = *this;
+						return tmp += -n;
+					}
+
+					template<typename Q>
+					difference_type operator -(const Iterator<Q>& rhs) const
+					{
+						return index() - rhs.index();
+					}
+
+					// rows are laid out in order, so pointers compare like
+					// the pixels they point at
+					template<typename Q>
+					bool operator ==(const Iterator<Q>& rhs) const
+					{
+						return my_ptr == rhs.my_ptr;
+					}
+
+					template<typename Q>
+					bool operator !=(const Iterator<Q>& rhs) const
+					{
+						return my_ptr != rhs.my_ptr;
+					}
+
+					template<typename Q>
+					bool operator <(const Iterator<Q>& rhs) const
+					{
+						return my_ptr < rhs.my_ptr;
+					}
+
+					template<typename Q>
+					bool operator >(const Iterator<Q>& rhs) const
+					{
+						return my_ptr > rhs.my_ptr;
+					}
+
+					template<typename Q>
+					bool operator <=(const Iterator<Q>& rhs) const
+					{
+						return my_ptr <= rhs.my_ptr;
+					}
+
+					template<typename Q>
+					bool operator >=(const Iterator<Q>& rhs) const
+					{
+						return my_ptr >= rhs.my_ptr;
+					}
+
+					friend self_type operator +(difference_type n, const self_type& i)
+					{
+						return i + n;
+					}
+
+				private:
+					// my_row_end is one past the current row, which starts
+					// my_width pixels before it
+					P* my_ptr;
+					P* my_row_end;
+					P* my_origin;
+					difference_type my_width;
+					difference_type my_stride;
+
+					Iterator(P* p, P* row_end, P* origin, difference_type width, difference_type stride)
+						: my_ptr(p), my_row_end(row_end), my_origin(origin),
+						  my_width(width), my_stride(stride)
+					{
+						// empty
+					}
+
+					// the pixel counted from pixel (0, 0), row by row
+					difference_type index() const
+					{
+						if (my_stride == my_width)
+							return my_ptr - my_origin;
+						const difference_type y =
+							(my_row_end - my_width - my_origin) / my_stride;
+						return y*my_width + (my_ptr - (my_row_end - my_width));
+					}
+
+					void seek(difference_type i)
+					{
+						const difference_type y = i / my_width;
+						P* row = my_origin + y*my_stride;
+						my_ptr = row + (i - y*my_width);
+						my_row_end = row + my_width;
+					}
+			};
+
 			iterator begin()
 			{
-				return my_data.size() ? &my_data[0] : 0;
+				return make_iterator<Type>(my_origin, 0);
 			}
 
 			const_iterator begin() const
 			{
-				return my_data.size() ? &my_data[0] : 0;
+				return make_iterator<const Type>(my_origin, 0);
 			}
 
 			iterator end()
 			{
-				return my_data.size() ? &my_data[0] + my_width*my_height : 0;
+				return make_iterator<Type>(my_origin, my_height);
 			}
 
 			const_iterator end() const
 			{
-				return my_data.size() ? &my_data[0] + my_width*my_height : 0;
+				return make_iterator<const Type>(my_origin, my_height);
 			}
 
 		protected:
-			void init_row(){
-				my_row[0] = &my_data[0];
-				for (size_t i = 1; i < my_height; ++i)
-					my_row[i] = my_row[i-1] + my_width;
+			template<typename P>
+			Iterator<P> make_iterator(P* origin, size_type y) const
+			{
+				if (origin == 0)
+					return Iterator<P>();
+
+				P* p = origin + y*my_stride;
+				return Iterator<P>(p, p + my_width, origin, my_width, my_stride);
+			}
+
+			void reserve(size_type w, size_type h)
+			{
+				// align the stride so every row starts on ALIGNMENT
+				const size_type step = my_aligned ? 
+					ALIGNMENT / gcd(ALIGNMENT, sizeof(value_type)) : 1;
+				// the guard pixels left and right of a row must not reach
+				// into its neighbours
+				size_type stride = std::max(w + 2*my_border, my_pitch);
+				stride = (stride + step - 1) / step * step;
+
+				const size_type count = (h + 2*my_border) * stride;
+				const size_type head = my_border*stride + my_border;
+				my_data.resize(count*sizeof(value_type) + ALIGNMENT);
+
+				// the first interior pixel is aligned, not the buffer itself
+				unsigned char *base = &my_data[0] + head*sizeof(value_type);
+				base += (ALIGNMENT - reinterpret_cast<std::size_t>(base) % ALIGNMENT) % ALIGNMENT;
+
+				pointer first = reinterpret_cast<pointer>(base) - head;
+				for (size_type i = 0; i < count; ++i)
+					new (first + i) value_type();
+
+				my_width = w;
+				my_height = h;
+				my_stride = stride;
+				my_origin = first + head;
+			}
+
+			void release()
+			{
+				if (my_origin) {
+					pointer first = my_origin - (my_border*my_stride + my_border);
+					const size_type count = (my_height + 2*my_border) * my_stride;
+					for (size_type i = 0; i < count; ++i)
+						first[i].~value_type();
+				}
+				my_width = my_height = my_stride = 0;
+				my_origin = 0;
+				my_data.resize(0);
+			}
+
+			static size_type gcd(size_type a, size_type b)
+			{
+				while (b) {
+					size_type t = a % b;
+					a = b;
+					b = t;
+				}
+				return a;
 			}
 
 		private:
 			size_type my_width;
 			size_type my_height;
-			// value_type *my_data;
-			std::vector<value_type, Allocator<value_type> > my_data;
-			// value_type **my_row;
-			std::vector<iterator, Allocator<iterator> > my_row;
+			size_type my_stride;
+			pointer my_origin; // pixel (0, 0), inside my_data
+			size_type my_border;
+			size_type my_pitch;
+			bool my_aligned;
+			std::vector<unsigned char, Allocator<unsigned char> > my_data;
 	};
 
-	template<typename Type>
-	inline void swap(Image<Type>& a, Image<Type>& b)
+	template<typename Type, template<typename> class Allocator>
+	const typename Image<Type, Allocator>::size_type
+	Image<Type, Allocator>::ALIGNMENT;
+
+	template<typename Type, template<typename> class Allocator>
+	inline void swap(Image<Type, Allocator>& a, Image<Type, Allocator>& b)
 	{
 		a.swap(b);
 	}
 
+	template<typename Type, template<typename> class Allocator>
+	struct RowTrait< Image<Type, Allocator> > {
+		enum { Contiguous = true };
+	};
+
 	typedef Image<Byte1> ByteImage1;
 	typedef Image<Byte3> ByteImage3;
 	typedef Image<Byte4> ByteImage4;
@@ -258,6 +602,9 @@ namespace gil {
 	typedef Image<Float1> FloatImage1;
 	typedef Image<Float3> FloatImage3;
 	typedef Image<Float4> FloatImage4;
+	typedef Image<Half1> HalfImage1;
+	typedef Image<Half3> HalfImage3;
+	typedef Image<Half4> HalfImage4;
 
 } // namespace gil
 
@@ -4,14 +4,61 @@
 #include <iostream>
 
 #include <string>
+#include <vector>
 #include <cstdio>
 #include "Image.h"
+#include "SubImage.h"
 #include "Formatter.h"
 #include "FileFormat.h"
 #include "Converter.h"
+#include "Codec.h"
 
 namespace gil {
 
+	namespace io_detail {
+
+		// closes a FILE* when it goes out of scope, a codec having thrown
+		// or not
+		class FileGuard {
+			public:
+				explicit FileGuard(FILE* f): my_file(f)
+				{
+					// empty
+				}
+
+				~FileGuard()
+				{
+					close();
+				}
+
+				// false if the file could not be flushed
+				bool close()
+				{
+					const bool ok = (my_file == NULL || fclose(my_file) == 0);
+					my_file = NULL;
+					return ok;
+				}
+
+			private:
+				FileGuard(const FileGuard&);
+				FileGuard& operator =(const FileGuard&);
+
+				FILE* my_file;
+		};
+
+		// true if ExrReader::open() decodes the EXR file at the current
+		// position of f, which is kept
+		inline bool exr_openable(FILE* f)
+		{
+			const long start = ftell(f);
+			exr_detail::Header header;
+			exr_detail::read_header(f, header);
+			exr_detail::seek(f, start);
+			return exr_readable(header.compression);
+		}
+
+	} // namespace io_detail
+
 	// Read functions
 	template <
 		template<typename, typename> class Converter, 
@@ -58,8 +105,8 @@ namespace gil {
 		FILE* f = fopen(filename.c_str(), "rb");
 		if(f == NULL)
 			return false;
+		io_detail::FileGuard guard(f);
 		read<Converter>(image, f, reader);
-		fclose(f);
 		return true;
 	}
 	template <typename R, typename I>
@@ -110,63 +157,28 @@ namespace gil {
 		return read<DefaultConverter, R>(image, filename);
 	}
 
+	// the codec is picked from the magic number, see ReaderRegistry
 	template <template<typename, typename> class Converter, typename I>
 	bool read(I& image, const std::string& filename)
 	{
+		typedef ReaderRegistry<I, Converter> Readers;
+
 		FILE* f = fopen(filename.c_str(), "rb");
 		if(f == NULL)
 			return false;
-
-		switch( Formater::get_format(f) ){
-			case FF_PNG:
-				read<Converter, PngReader>(image, f);
-				break;
-
-			case FF_JPEG:
-				read<Converter, JpegReader>(image, f);
-				break;
-
-			case FF_TIFF: {
-				fclose(f);
-				//return read<Converter, TiffReader>(image, filename);
-				TiffReader reader;
-				return reader.operator()<Converter>(image, filename);
-			}
-
-			case FF_EXR:
-				read<Converter, ExrReader>(image, f);
-				break;
-
-			case FF_HDR:
-				read<Converter, HdrReader>(image, f);
-				break;
-
-			case FF_PPM:
-				read<Converter, PpmReader<Byte3, '6'> >(image, f);
-				break;
-
-			case FF_PGM:
-				read<Converter, PpmReader<Byte1, '5'> >(image, f);
-				break;
-
-			case FF_PFM:
-				read<Converter, PfmReader>(image, f);
-				break;
-
-			case FF_BMP:
-				read<Converter, BmpReader>(image, f);
-				break;
-
-			case FF_FLT:
-				read<Converter, FltReader>(image, f);
-				break;
-
-			default:
-				fclose(f);
-				return false;
+		io_detail::FileGuard guard(f);
+
+		const typename Readers::Codec* codec = Readers::instance().find(f);
+		if(codec && codec->format == FF_TIFF){
+			guard.close();
+			//return read<Converter, TiffReader>(image, filename);
+			TiffReader reader;
+			return reader.operator()<Converter>(image, filename);
 		}
+		if(codec == NULL || codec->function == NULL)
+			return false;
 
-		fclose(f);
+		codec->function(image, f);
 		return true;
 	}
 	template <typename I>
@@ -175,6 +187,45 @@ namespace gil {
 		return read<DefaultConverter>(image, filename);
 	}
 
+	// the region roi of a file, the image gets its size. EXR files
+	// decode only the tiles or line blocks overlapping it, when
+	// ExrReader::open() takes their compression; other files are read
+	// whole and cropped.
+	template <template<typename, typename> class Converter, typename I>
+	bool read(I& image, const std::string& filename, const Box& roi)
+	{
+		FILE* f = fopen(filename.c_str(), "rb");
+		if(f == NULL)
+			return false;
+		io_detail::FileGuard guard(f);
+
+		if( Formater::get_format(f) == FF_EXR && io_detail::exr_openable(f) ){
+			ExrReader reader;
+			reader.open(f);
+			reader.read<Converter>(
+				image,
+				reader.rgba( ColorTrait<typename I::ColorType>::channels() ),
+				roi
+			);
+			reader.close();
+			return true;
+		}
+		guard.close();
+
+		Image<typename I::value_type> whole;
+		if( !read<Converter>(whole, filename) )
+			return false;
+		const Box box = roi.clip( whole.width(), whole.height() );
+		image.allocate(box.width, box.height);
+		copy_rows( image, SubImage< Image<typename I::value_type> >(whole, box) );
+		return true;
+	}
+	template <typename I>
+	bool read(I& image, const std::string& filename, const Box& roi)
+	{
+		return read<DefaultConverter>(image, filename, roi);
+	}
+
 	// Write functions
 	template <
 		template<typename, typename> class Converter,
@@ -222,9 +273,9 @@ namespace gil {
 		FILE* f = fopen(filename.c_str(), "wb");
 		if(f == NULL)
 			return false;
+		io_detail::FileGuard guard(f);
 		write<Converter>(image, f, writer);
-		fclose(f);
-		return true;
+		return guard.close();
 	}
 	template<typename W, typename I>
 	bool write(const I& image, const std::string& filename, W& writer)
@@ -278,51 +329,121 @@ namespace gil {
 		return write<DefaultConverter, W>(image, filename);
 	}
 
+	// the codec is picked from the extension, see WriterRegistry
 	template <template<typename, typename> class Converter, typename I>
 	bool write(const I& image, const std::string& filename)
 	{
-		switch( Formater::get_format(filename) ){
-			case FF_PNG:
-				return write<Converter, PngWriter>(image, filename);
-
-			case FF_JPEG:
-				return write<Converter, JpegWriter>(image, filename);
+		typedef WriterRegistry<I, Converter> Writers;
 
-			case FF_TIFF: {
-				//return write<Converter, TiffWriter>(image, filename);
-				TiffWriter writer;
-				return writer.operator()<Converter>(image, filename);
-			}
+		const typename Writers::Codec* codec = Writers::instance().find(filename);
+		if(codec && codec->format == FF_TIFF){
+			//return write<Converter, TiffWriter>(image, filename);
+			TiffWriter writer;
+			return writer.operator()<Converter>(image, filename);
+		}
+		if(codec == NULL || codec->function == NULL)
+			return false;
 
-			case FF_EXR:
-				return write<Converter, ExrWriter>(image, filename);
+		FILE* f = fopen(filename.c_str(), "wb");
+		if(f == NULL)
+			return false;
+		io_detail::FileGuard guard(f);
+		codec->function(image, f);
+		return guard.close();
+	}
+	template <typename I>
+	bool write(const I& image, const std::string& filename)
+	{
+		return write<DefaultConverter>(image, filename);
+	}
 
-			case FF_HDR:
-				return write<Converter, HdrWriter>(image, filename);
+	// Memory and stream functions
+	// TIFF cannot be read or written this way.
 
-			case FF_PPM:
-				return write<Converter, PpmWriter<Byte3, '6'> >(image, filename);
+	// from size bytes at data, the codec picked from the magic number
+	template <template<typename, typename> class Converter, typename I>
+	bool read(I& image, const void* data, size_t size)
+	{
+		typedef ReaderRegistry<I, Converter> Readers;
 
-			case FF_PGM:
-				return write<Converter, PpmWriter<Byte1, '5'> >(image, filename);
+		const typename Readers::Codec* codec =
+			Readers::instance().find(data, size);
+		if(codec == NULL || codec->function == NULL)
+			return false;
+		MemoryFile file;
+		FILE* f = file.open(data, size);
+		if(f == NULL)
+			return false;
+		codec->function(image, f);
+		return true;
+	}
+	template <typename I>
+	bool read(I& image, const void* data, size_t size)
+	{
+		return read<DefaultConverter>(image, data, size);
+	}
 
-			case FF_PFM:
-				return write<Converter, PfmWriter>(image, filename);
+	// from all the stream has left; it is read into memory first
+	template <template<typename, typename> class Converter, typename I>
+	bool read(I& image, Stream& stream)
+	{
+		if(stream.read == NULL)
+			return false;
+		std::vector<char> data;
+		size_t n;
+		do {
+			const size_t size = data.size();
+			data.resize(size + 65536);
+			n = stream.read(stream.user, &data[size], 65536);
+			data.resize(size + n);
+		} while(n == 65536);
+		return !data.empty() && read<Converter>(image, &data[0], data.size());
+	}
+	template <typename I>
+	bool read(I& image, Stream& stream)
+	{
+		return read<DefaultConverter>(image, stream);
+	}
 
-			case FF_BMP:
-				return write<Converter, BmpWriter>(image, filename);
+	// into data, in the format of an extension ("png") or a filename
+	template <template<typename, typename> class Converter, typename I>
+	bool write(const I& image, std::vector<char>& data, const std::string& format)
+	{
+		typedef WriterRegistry<I, Converter> Writers;
 
-			case FF_FLT:
-				return write<Converter, FltWriter>(image, filename);
+		const typename Writers::Codec* codec = Writers::instance().find(format);
+		if(codec == NULL || codec->function == NULL)
+			return false;
+		MemoryFile file;
+		FILE* f = file.create();
+		if(f == NULL)
+			return false;
+		codec->function(image, f);
+		if(!file.close())
+			return false;
+		data.assign(file.data(), file.data() + file.size());
+		return true;
+	}
+	template <typename I>
+	bool write(const I& image, std::vector<char>& data, const std::string& format)
+	{
+		return write<DefaultConverter>(image, data, format);
+	}
 
-			default:
-				return false;
-		}
+	// to the stream, which is given the whole file at once
+	template <template<typename, typename> class Converter, typename I>
+	bool write(const I& image, Stream& stream, const std::string& format)
+	{
+		std::vector<char> data;
+		if(stream.write == NULL || !write<Converter>(image, data, format))
+			return false;
+		return data.empty() ||
+			stream.write(stream.user, &data[0], data.size()) == data.size();
 	}
 	template <typename I>
-	bool write(const I& image, const std::string& filename)
+	bool write(const I& image, Stream& stream, const std::string& format)
 	{
-		return write<DefaultConverter>(image, filename);
+		return write<DefaultConverter>(image, stream, format);
 	}
 
 } // namespace gil
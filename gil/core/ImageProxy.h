@@ -1,29 +1,305 @@
 #ifndef IMAGE_PROXY_H
 #define IMAGE_PROXY_H
 
+#include <cstddef>
+#include <algorithm>
+
+#include "Converter.h"
+#include "Int2Type.h"
+#include "Parallel.h"
+
+// pixels per tile of a fused pipeline. Every point-wise stage keeps one
+// tile of its input on the stack.
+#ifndef GIL_PIPELINE_TILE
+#define GIL_PIPELINE_TILE 256
+#endif
+
 namespace gil {
 
+	/* StageTrait:
+	 *   how a filter takes part in a chain of ImageProxy objects.
+	 *
+	 *   Pointwise filters compute any span of an output row from the
+	 *   matching spans of their source. They provide
+	 *
+	 *     size_t width(const SrcImage& src) const;
+	 *     size_t height(const SrcImage& src) const;
+	 *     void read(value_type* out, const SrcImage& src,
+	 *               size_t x, size_t y, size_t n) const;
+	 *
+	 *   and a chain of them is evaluated in one pass, tile by tile,
+	 *   without intermediate images.
+	 *
+	 *   Streaming filters read their source one row at a time, so a
+	 *   point-wise chain feeding them is evaluated on the fly into their
+	 *   own row buffers. Any other filter gets its source materialized.
+	 */
+	template<class Filter>
+	struct StageTrait {
+		enum { Pointwise = false };
+		enum { Streaming = false };
+	};
+
+	template<class Filter, class DstImage, class SrcImage>
+	class ImageProxy;
+
+	// copy the n pixels of row y starting at x from src to out
+	template<class I>
+	inline void read_span(
+		const I& src, typename I::value_type* out,
+		size_t x, size_t y, size_t n
+	)
+	{
+		for (size_t i = 0; i < n; ++i)
+			out[i] = src(x + i, y);
+	}
+
+	template<class Filter, class DstImage, class SrcImage>
+	inline void read_span(
+		const ImageProxy<Filter, DstImage, SrcImage>& src,
+		typename DstImage::value_type* out,
+		size_t x, size_t y, size_t n
+	)
+	{
+		src.read(out, x, y, n);
+	}
+
+	// make src readable from several threads: materialize what cannot be
+	// computed on the fly
+	template<class I>
+	inline const I& prepare(const I& src)
+	{
+		return src;
+	}
+
+	template<class Filter, class DstImage, class SrcImage>
+	inline const ImageProxy<Filter, DstImage, SrcImage>&
+	prepare(const ImageProxy<Filter, DstImage, SrcImage>& src)
+	{
+		src.prepare();
+		return src;
+	}
+
+	// src as an image, evaluating it if it is a proxy
+	template<class I>
+	inline const I& materialize(const I& src)
+	{
+		return src;
+	}
+
+	template<class Filter, class DstImage, class SrcImage>
+	inline const DstImage&
+	materialize(const ImageProxy<Filter, DstImage, SrcImage>& src)
+	{
+		return src.materialized();
+	}
+
+	/* ImageProxy:
+	 *   the result of applying a filter to a source image (or another
+	 *   proxy), computed when it is assigned to an image.
+	 *
+	 *   A proxy of a point-wise filter is fused with its source: its pixels
+	 *   are computed span by span as they are read. Other proxies evaluate
+	 *   the filter into an image of their own the first time they are read.
+	 *   Like before, a chain of proxies refers to its sources and must be
+	 *   evaluated within the expression that built it.
+	 */
 	template<class Filter, class DstImage, class SrcImage>
 	class ImageProxy {
 		public:
 			typedef typename DstImage::value_type value_type;
 
+			enum { Pointwise = StageTrait<Filter>::Pointwise };
+
 			ImageProxy(const Filter& filter, const SrcImage& src):
-				my_filter(filter), my_src(src)
+				my_filter(filter), my_src(src), my_ready(false)
 			{
 				// empty
 			}
 
 			inline DstImage& operator ()(DstImage& dst) const
 			{
-				my_filter(dst, my_src);
+				evaluate(dst, Int2Type<Pointwise>());
+				return dst;
+			}
+
+			inline DstImage& operator ()(
+				DstImage& dst, const Execution& exec
+			) const
+			{
+				evaluate(dst, exec, Int2Type<Pointwise>());
 				return dst;
 			}
 
+			size_t width() const
+			{
+				return width(Int2Type<Pointwise>());
+			}
+
+			size_t height() const
+			{
+				return height(Int2Type<Pointwise>());
+			}
+
+			// n pixels of row y starting at x
+			void read(value_type* out, size_t x, size_t y, size_t n) const
+			{
+				read(out, x, y, n, Int2Type<Pointwise>());
+			}
+
+			const value_type operator ()(size_t x, size_t y) const
+			{
+				value_type pixel;
+				read(&pixel, x, y, 1);
+				return pixel;
+			}
+
+			// evaluate everything the chain cannot compute on the fly, so
+			// that read() may be called from several threads
+			void prepare() const
+			{
+				prepare(Int2Type<Pointwise>());
+			}
+
+			const DstImage& materialized() const
+			{
+				if (!my_ready) {
+					evaluate(my_cache, Int2Type<Pointwise>());
+					my_ready = true;
+				}
+				return my_cache;
+			}
+
+			// evaluate a point-wise chain into dst in one pass
+			void fuse(DstImage& dst, const Execution& exec) const
+			{
+				prepare();
+				dst.resize(width(), height());
+				parallel_bands(
+					*this, &ImageProxy::fuse_rows,
+					dst, my_src, 0, dst.height(), exec
+				);
+			}
+
 		protected:
 		private:
+			// without an execution, filters are called as they were
+			// before execution policies, see Filter
+			void evaluate(DstImage& dst, Int2Type<true>) const
+			{
+				fuse(dst, Execution::global());
+			}
+
+			void evaluate(DstImage& dst, Int2Type<false>) const
+			{
+				my_filter(dst, my_src);
+			}
+
+			void evaluate(
+				DstImage& dst, const Execution& exec, Int2Type<true>
+			) const
+			{
+				fuse(dst, exec);
+			}
+
+			void evaluate(
+				DstImage& dst, const Execution& exec, Int2Type<false>
+			) const
+			{
+				my_filter(dst, my_src, exec);
+			}
+
+			void fuse_rows(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1
+			) const
+			{
+				fuse_rows(
+					dst, src, y0, y1, Int2Type<RowTrait<DstImage>::Contiguous>()
+				);
+			}
+
+			// tiles are computed straight into rows of dst
+			void fuse_rows(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1,
+				Int2Type<true>
+			) const
+			{
+				const size_t width = dst.width();
+				for (size_t y = y0; y < y1; ++y)
+					for (size_t x = 0; x < width; x += GIL_PIPELINE_TILE) {
+						const size_t n =
+							std::min<size_t>(GIL_PIPELINE_TILE, width - x);
+						my_filter.read(&dst(x, y), src, x, y, n);
+					}
+			}
+
+			// other images (e.g. slices) get each tile assigned
+			void fuse_rows(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1,
+				Int2Type<false>
+			) const
+			{
+				const size_t width = dst.width();
+				value_type tile[GIL_PIPELINE_TILE];
+				for (size_t y = y0; y < y1; ++y)
+					for (size_t x = 0; x < width; x += GIL_PIPELINE_TILE) {
+						const size_t n =
+							std::min<size_t>(GIL_PIPELINE_TILE, width - x);
+						my_filter.read(tile, src, x, y, n);
+						for (size_t i = 0; i < n; ++i)
+							dst(x + i, y) = tile[i];
+					}
+			}
+
+			size_t width(Int2Type<true>) const
+			{
+				return my_filter.width(my_src);
+			}
+
+			size_t width(Int2Type<false>) const
+			{
+				return materialized().width();
+			}
+
+			size_t height(Int2Type<true>) const
+			{
+				return my_filter.height(my_src);
+			}
+
+			size_t height(Int2Type<false>) const
+			{
+				return materialized().height();
+			}
+
+			void read(
+				value_type* out, size_t x, size_t y, size_t n, Int2Type<true>
+			) const
+			{
+				my_filter.read(out, my_src, x, y, n);
+			}
+
+			void read(
+				value_type* out, size_t x, size_t y, size_t n, Int2Type<false>
+			) const
+			{
+				read_span(materialized(), out, x, y, n);
+			}
+
+			void prepare(Int2Type<true>) const
+			{
+				gil::prepare(my_src);
+			}
+
+			void prepare(Int2Type<false>) const
+			{
+				materialized();
+			}
+
 			const Filter& my_filter;
 			const SrcImage& my_src;
+
+			mutable DstImage my_cache;
+			mutable bool my_ready;
 	};
 }
 
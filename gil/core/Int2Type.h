@@ -0,0 +1,19 @@
+#ifndef GIL_INT2TYPE_H
+#define GIL_INT2TYPE_H
+
+namespace gil {
+
+	/* Int2Type:
+	 *   a type for each integer, to pick an overload at compile time from
+	 *   a trait, as in
+	 *
+	 *     filter(dst, src, exec, Int2Type<Engine::Supported>());
+	 */
+	template<int v>
+	struct Int2Type {
+		enum { value = v };
+	};
+
+} // namespace gil
+
+#endif // GIL_INT2TYPE_H
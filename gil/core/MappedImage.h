@@ -0,0 +1,513 @@
+#ifndef GIL_MAPPED_IMAGE_H
+#define GIL_MAPPED_IMAGE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "Exception.h"
+#include "Color.h"
+#include "Converter.h"
+#include "io/pfm.h"
+
+#if defined(_WIN32)
+	#ifndef NOMINMAX
+	#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+	#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#define GIL_MMAP
+#endif
+
+namespace gil {
+
+	/* MappedFile:
+	 *   a whole file mapped into memory, read only. With copy set the
+	 *   pages may be written, and written pages become private copies;
+	 *   the file itself never changes.
+	 *
+	 *   Platforms without mmap or MapViewOfFile read the file instead.
+	 */
+	class MappedFile {
+		public:
+			MappedFile(): my_data(0), my_size(0)
+#if defined(_WIN32)
+				, my_file(INVALID_HANDLE_VALUE), my_mapping(0)
+#endif
+			{
+				// empty
+			}
+
+			~MappedFile()
+			{
+				close();
+			}
+
+			// false if the file cannot be opened or mapped
+			bool open(const std::string& filename, bool copy = false)
+			{
+				close();
+#if defined(_WIN32)
+				my_file = CreateFileA(
+					filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+					OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0
+				);
+				if (my_file == INVALID_HANDLE_VALUE)
+					return false;
+				LARGE_INTEGER size;
+				if (!GetFileSizeEx(my_file, &size)) {
+					close();
+					return false;
+				}
+				my_size = static_cast<size_t>(size.QuadPart);
+				if (my_size == 0)
+					return true;
+				my_mapping = CreateFileMappingA(
+					my_file, 0, copy ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, 0
+				);
+				if (my_mapping)
+					my_data = static_cast<char*>( MapViewOfFile(
+						my_mapping, copy ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0
+					) );
+				if (my_data == 0) {
+					close();
+					return false;
+				}
+				return true;
+#elif defined(GIL_MMAP)
+				const int fd = ::open(filename.c_str(), O_RDONLY);
+				if (fd < 0)
+					return false;
+				struct stat st;
+				if (fstat(fd, &st) != 0) {
+					::close(fd);
+					return false;
+				}
+				my_size = static_cast<size_t>(st.st_size);
+				if (my_size) {
+					void *p = mmap(
+						0, my_size,
+						copy ? PROT_READ | PROT_WRITE : PROT_READ,
+						copy ? MAP_PRIVATE : MAP_SHARED,
+						fd, 0
+					);
+					if (p == MAP_FAILED) {
+						::close(fd);
+						my_size = 0;
+						return false;
+					}
+					my_data = static_cast<char*>(p);
+				}
+				::close(fd);
+				return true;
+#else
+				(void)copy;
+				FILE *f = fopen(filename.c_str(), "rb");
+				if (f == NULL)
+					return false;
+				char chunk[65536];
+				size_t n;
+				while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+					my_buffer.insert(my_buffer.end(), chunk, chunk + n);
+				fclose(f);
+				my_size = my_buffer.size();
+				my_data = my_size ? &my_buffer[0] : 0;
+				return true;
+#endif
+			}
+
+			void close()
+			{
+#if defined(_WIN32)
+				if (my_data)
+					UnmapViewOfFile(my_data);
+				if (my_mapping)
+					CloseHandle(my_mapping);
+				if (my_file != INVALID_HANDLE_VALUE)
+					CloseHandle(my_file);
+				my_mapping = 0;
+				my_file = INVALID_HANDLE_VALUE;
+#elif defined(GIL_MMAP)
+				if (my_data)
+					munmap(my_data, my_size);
+#else
+				std::vector<char>().swap(my_buffer);
+#endif
+				my_data = 0;
+				my_size = 0;
+			}
+
+			char* data()
+			{
+				return my_data;
+			}
+
+			const char* data() const
+			{
+				return my_data;
+			}
+
+			size_t size() const
+			{
+				return my_size;
+			}
+
+		private:
+			MappedFile(const MappedFile&);
+			MappedFile& operator =(const MappedFile&);
+
+			char *my_data;
+			size_t my_size;
+#if defined(_WIN32)
+			HANDLE my_file;
+			HANDLE my_mapping;
+#elif !defined(GIL_MMAP)
+			std::vector<char> my_buffer;
+#endif
+	};
+
+	/* MappedImage:
+	 *   a read only image over the pixels of a PFM, PPM or PGM file mapped
+	 *   into memory. The pixel type must match the file: Float3 for PF,
+	 *   Float1 for Pf, Byte3 or Short3 for P6 and Byte1 or Short1 for P5
+	 *   depending on the maximal value.
+	 *
+	 *   Nothing is copied when the byte order of the file is the one of
+	 *   the machine. Otherwise the pixels are byte swapped once when the
+	 *   file is opened, on private copies of the pages. PFM stores the
+	 *   bottom row first, which the view turns around with a negative
+	 *   stride.
+	 *
+	 *   Rows follow the file header, whose length is arbitrary. When it
+	 *   leaves the samples at an address they cannot be read from, the
+	 *   pixels are copied once into memory of their own, and byte
+	 *   swapped there if they must be; the file is not kept mapped.
+	 *
+	 *     MappedImage<Float3> plate("plate.pfm");
+	 *     GaussianFilter<FloatImage3, float>(4, 4)(blurred, plate);
+	 */
+	template<typename T>
+	class MappedImage {
+		public:
+			typedef T value_type;
+			typedef const T& reference;
+			typedef const T& const_reference;
+			typedef const T* pointer;
+			typedef const T* const_pointer;
+			typedef std::ptrdiff_t difference_type;
+			typedef size_t size_type;
+
+			class const_iterator;
+			typedef const_iterator iterator;
+
+			typedef T ColorType;
+
+			MappedImage()
+				: my_origin(0), my_width(0), my_height(0), my_stride(0),
+				  my_swapped(false)
+			{
+				// empty
+			}
+
+			explicit MappedImage(const std::string& filename)
+				: my_origin(0), my_width(0), my_height(0), my_stride(0),
+				  my_swapped(false)
+			{
+				if (!open(filename))
+					throw IOError("cannot open " + filename);
+			}
+
+			// map filename, false if it cannot be opened. Throws
+			// InvalidFormat if it is not a PFM, PPM or PGM file with
+			// pixels of type T.
+			bool open(const std::string& filename)
+			{
+				close();
+				if (!my_file.open(filename))
+					return false;
+
+				const char *begin = my_file.data();
+				const char *p = begin;
+				const char *end = begin + my_file.size();
+
+				if (my_file.size() < 2 || p[0] != 'P')
+					throw InvalidFormat("not a PFM, PPM or PGM file");
+				const char magic = p[1];
+				p += 2;
+
+				std::string width, height, scale;
+				if (!field(p, end, width) || !field(p, end, height) ||
+					!field(p, end, scale) || p == end)
+					throw InvalidFormat("pnm header");
+				++p; // the white space ending the header
+
+				const bool is_float = (magic == 'F' || magic == 'f');
+				size_t channels, sample;
+				bool little_endian;
+				switch (magic) {
+					case 'F': channels = 3; break;
+					case 'f': channels = 1; break;
+					case '6': channels = 3; break;
+					case '5': channels = 1; break;
+					default:
+						throw InvalidFormat("not a PFM, PPM or PGM file");
+				}
+				if (is_float) {
+					const double s = strtod(scale.c_str(), 0);
+					if (s == 0)
+						throw InvalidFormat("pfm");
+					sample = sizeof(float);
+					little_endian = (s < 0);
+				} else {
+					const unsigned long max = strtoul(scale.c_str(), 0, 10);
+					if (max == 0 || max > 65535)
+						throw InvalidFormat("pnm maximal value");
+					sample = (max < 256) ? 1 : 2;
+					little_endian = false;
+				}
+
+				typedef typename ColorTrait<T>::BaseType BaseType;
+				if (ColorTrait<T>::channels() != channels ||
+					sizeof(T) != channels*sample ||
+					std::numeric_limits<BaseType>::is_integer == is_float)
+					throw InvalidFormat("pixel type does not match the file");
+
+				// the size is checked before it is multiplied out
+				const size_t w = dimension(width), h = dimension(height);
+				const size_t max = std::numeric_limits<size_t>::max();
+				if (h && w > max / h / sizeof(T))
+					throw InvalidFormat("pnm size too large");
+				const size_t offset = p - begin;
+				const size_t bytes = w * h * sizeof(T);
+				if (my_file.size() - offset < bytes)
+					throw EndOfFile("unexpected end-of-file");
+				my_width = w;
+				my_height = h;
+
+				my_swapped = sample > 1 &&
+					little_endian != ByteReverser<char>::is_little_endian();
+				const char *data = my_file.data() + offset;
+				const T *pixels = reinterpret_cast<const T*>(data);
+				if (reinterpret_cast<size_t>(data) % sizeof(BaseType) != 0) {
+					my_copy.resize(my_width * my_height);
+					if (bytes)
+						std::memcpy(&my_copy[0], data, bytes);
+					my_file.close();
+					if (my_swapped && bytes)
+						byte_swap(&my_copy[0], my_copy.size() * channels, sample);
+					pixels = my_copy.empty() ? 0 : &my_copy[0];
+				} else if (my_swapped) {
+					if (!my_file.open(filename, true))
+						throw IOError("cannot map " + filename);
+					byte_swap(
+						my_file.data() + offset,
+						my_width * my_height * channels, sample
+					);
+					pixels = reinterpret_cast<const T*>(my_file.data() + offset);
+				}
+
+				if (is_float && my_height) {
+					my_origin = pixels + (my_height - 1)*my_width;
+					my_stride = -static_cast<difference_type>(my_width);
+				} else {
+					my_origin = pixels;
+					my_stride = static_cast<difference_type>(my_width);
+				}
+				return true;
+			}
+
+			void close()
+			{
+				my_file.close();
+				std::vector<T>().swap(my_copy);
+				my_origin = 0;
+				my_width = my_height = 0;
+				my_stride = 0;
+				my_swapped = false;
+			}
+
+			size_type width() const
+			{
+				return my_width;
+			}
+
+			size_type height() const
+			{
+				return my_height;
+			}
+
+			size_type size() const
+			{
+				return my_width * my_height;
+			}
+
+			size_type channels() const
+			{
+				return ColorTrait<T>::channels();
+			}
+
+			// pixels between the starts of two rows, negative for PFM
+			difference_type stride() const
+			{
+				return my_stride;
+			}
+
+			// true if the pixels had to be byte swapped
+			bool swapped() const
+			{
+				return my_swapped;
+			}
+
+			// true if the pixels had to be copied out of the file to be
+			// aligned
+			bool copied() const
+			{
+				return !my_copy.empty();
+			}
+
+			const_pointer row(size_type y) const
+			{
+				return my_origin + static_cast<difference_type>(y)*my_stride;
+			}
+
+			const_reference operator ()(size_type x, size_type y) const
+			{
+				return row(y)[x];
+			}
+
+			// the pixels row by row, top to bottom
+			class const_iterator {
+				friend class MappedImage<T>;
+				public:
+					typedef std::forward_iterator_tag iterator_category;
+					typedef const T value_type;
+					typedef std::ptrdiff_t difference_type;
+					typedef const T* pointer;
+					typedef const T& reference;
+
+					const T& operator *() const
+					{
+						return (*my_image)(my_x, my_y);
+					}
+
+					const T* operator ->() const
+					{
+						return &(*my_image)(my_x, my_y);
+					}
+
+					const_iterator& operator ++()
+					{
+						if (++my_x == my_image->width()) {
+							my_x = 0;
+							++my_y;
+						}
+						return *this;
+					}
+
+					const_iterator operator ++(int)
+					{
+						const_iterator tmp = *this;
+						++*this;
+						return tmp;
+					}
+
+					bool operator ==(const const_iterator& rhs) const
+					{
+						return (my_image == rhs.my_image &&
+								my_x == rhs.my_x && my_y == rhs.my_y);
+					}
+
+					bool operator !=(const const_iterator& rhs) const
+					{
+						return !(*this == rhs);
+					}
+
+				private:
+					const_iterator(
+						const MappedImage<T>* image, size_type x, size_type y
+					): my_image(image), my_x(x), my_y(y)
+					{
+						// empty
+					}
+
+					const MappedImage<T> *my_image;
+					size_type my_x, my_y;
+			};
+
+			const_iterator begin() const
+			{
+				return const_iterator(this, 0, 0);
+			}
+
+			const_iterator end() const
+			{
+				return const_iterator(this, 0, my_height);
+			}
+
+		private:
+			MappedImage(const MappedImage&);
+			MappedImage& operator =(const MappedImage&);
+
+			// the next field of a header, skipping white space and comments
+			static bool field(const char*& p, const char* end, std::string& out)
+			{
+				for (;;) {
+					while (p != end && isspace(static_cast<unsigned char>(*p)))
+						++p;
+					if (p == end || *p != '#')
+						break;
+					while (p != end && *p != '\n')
+						++p;
+				}
+				const char *first = p;
+				while (p != end && !isspace(static_cast<unsigned char>(*p)))
+					++p;
+				out.assign(first, p);
+				return !out.empty();
+			}
+
+			// a width or height, decimal digits only
+			static size_t dimension(const std::string& field)
+			{
+				const size_t max = std::numeric_limits<size_t>::max();
+				size_t n = 0;
+				for (size_t i = 0; i < field.size(); ++i) {
+					const unsigned int d = static_cast<unsigned char>(field[i]) - '0';
+					if (d > 9 || n > (max - d) / 10)
+						throw InvalidFormat("pnm size");
+					n = 10*n + d;
+				}
+				return n;
+			}
+
+			MappedFile my_file;
+			std::vector<T> my_copy;		// the pixels, if the file's are
+										// not aligned
+			const T *my_origin;
+			size_t my_width;
+			size_t my_height;
+			difference_type my_stride;
+			bool my_swapped;
+	};
+
+	template<typename T>
+	struct RowTrait< MappedImage<T> > {
+		enum { Contiguous = true };
+	};
+
+}
+
+#endif // GIL_MAPPED_IMAGE_H
@@ -0,0 +1,400 @@
+#ifndef GIL_PARALLEL_H
+#define GIL_PARALLEL_H
+
+#include <cstddef>
+#include <algorithm>
+
+/* Threading support.
+ *
+ * The thread pool needs C++11 threads; other builds, or builds with
+ * GIL_NO_THREADS defined, run every parallel loop serially.
+ */
+
+#ifndef GIL_NO_THREADS
+	#if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900)
+		#define GIL_THREADS
+	#endif
+#endif // GIL_NO_THREADS
+
+#ifdef GIL_THREADS
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+namespace gil {
+
+	/* Execution:
+	 *   how a loop over rows is spread over threads.
+	 *
+	 *   SERIAL        runs the whole range on the calling thread.
+	 *   THREAD_POOL   hands out bands of grain rows to the pool threads
+	 *                 from a shared counter.
+	 *   WORK_STEALING gives each thread a contiguous run of bands; a thread
+	 *                 that runs out steals half of what another has left.
+	 *
+	 *   A thread count of 0 uses every hardware thread. A grain of 0 picks
+	 *   about four bands per thread. The loops handed to parallel_for give
+	 *   the same result whatever the bands are, so every policy matches
+	 *   SERIAL bit for bit.
+	 *
+	 *   Execution::global() is used when no policy is passed. Set it once
+	 *   at startup, for instance
+	 *
+	 *     Execution::global() = Execution(Execution::WORK_STEALING, 16);
+	 */
+	class Execution {
+		public:
+			enum Policy { SERIAL, THREAD_POOL, WORK_STEALING };
+
+			Execution(
+				Policy policy = THREAD_POOL, size_t threads = 0, size_t grain = 0
+			): my_policy(policy), my_threads(threads), my_grain(grain)
+			{
+				// empty
+			}
+
+			Policy policy() const
+			{
+				return my_policy;
+			}
+
+			size_t threads() const
+			{
+				return my_threads;
+			}
+
+			size_t grain() const
+			{
+				return my_grain;
+			}
+
+			// the number of threads a loop may use, 1 for SERIAL
+			size_t concurrency() const
+			{
+#ifdef GIL_THREADS
+				if (my_policy == SERIAL)
+					return 1;
+				if (my_threads)
+					return my_threads;
+				return std::max(1u, std::thread::hardware_concurrency());
+#else
+				return 1;
+#endif
+			}
+
+			// rows per band for a range of n rows, a multiple of align
+			size_t grain(size_t n, size_t align) const
+			{
+				size_t grain = my_grain;
+				if (grain == 0)
+					grain = (n + 4*concurrency() - 1) / (4*concurrency());
+				grain = std::max(grain, static_cast<size_t>(1));
+				return (grain + align - 1) / align * align;
+			}
+
+			static Execution& global()
+			{
+				static Execution execution;
+				return execution;
+			}
+
+		private:
+			Policy my_policy;
+			size_t my_threads;
+			size_t my_grain;
+	};
+
+#ifdef GIL_THREADS
+
+	/* ThreadPool:
+	 *   the process wide worker threads behind parallel_for. The pool
+	 *   grows to the largest thread count asked for and is joined at exit.
+	 */
+	class ThreadPool {
+		public:
+			static ThreadPool& instance()
+			{
+				static ThreadPool pool;
+				return pool;
+			}
+
+			// make sure at least n worker threads are running
+			void reserve(size_t n)
+			{
+				std::lock_guard<std::mutex> lock(my_mutex);
+				while (my_threads.size() < n)
+					my_threads.push_back( std::thread(&ThreadPool::run, this) );
+			}
+
+			void submit(const std::function<void ()>& task)
+			{
+				{
+					std::lock_guard<std::mutex> lock(my_mutex);
+					my_tasks.push_back(task);
+				}
+				my_ready.notify_one();
+			}
+
+			// true on the pool threads, nested loops run serially there
+			static bool& worker()
+			{
+				static thread_local bool worker = false;
+				return worker;
+			}
+
+			~ThreadPool()
+			{
+				{
+					std::lock_guard<std::mutex> lock(my_mutex);
+					my_stop = true;
+				}
+				my_ready.notify_all();
+				for (size_t i = 0; i < my_threads.size(); ++i)
+					my_threads[i].join();
+			}
+
+		private:
+			ThreadPool(): my_stop(false)
+			{
+				// empty
+			}
+
+			ThreadPool(const ThreadPool&);
+			ThreadPool& operator =(const ThreadPool&);
+
+			void run()
+			{
+				worker() = true;
+				for (;;) {
+					std::function<void ()> task;
+					{
+						std::unique_lock<std::mutex> lock(my_mutex);
+						while (!my_stop && my_tasks.empty())
+							my_ready.wait(lock);
+						if (my_tasks.empty())
+							return;
+						task = my_tasks.front();
+						my_tasks.pop_front();
+					}
+					task();
+				}
+			}
+
+			std::vector<std::thread> my_threads;
+			std::deque< std::function<void ()> > my_tasks;
+			std::mutex my_mutex;
+			std::condition_variable my_ready;
+			bool my_stop;
+	};
+
+	/* ParallelLoop:
+	 *   one call of parallel_for. The calling thread takes part as the
+	 *   first participant and waits for the others before returning; the
+	 *   first exception thrown by the body is rethrown there.
+	 */
+	template<class Body>
+	class ParallelLoop {
+		public:
+			ParallelLoop(
+				const Body& body, size_t begin, size_t end, size_t grain,
+				size_t threads, Execution::Policy policy
+			): my_body(body), my_begin(begin), my_end(end), my_grain(grain),
+			   my_bands((end - begin + grain - 1) / grain),
+			   my_threads(threads), my_policy(policy), my_next(0),
+			   my_failed(false), my_ranges(new Range[threads]),
+			   my_running(threads)
+			{
+				// split the bands evenly for work stealing
+				for (size_t i = 0; i < threads; ++i) {
+					my_ranges[i].begin = my_bands * i / threads;
+					my_ranges[i].end = my_bands * (i + 1) / threads;
+				}
+			}
+
+			void operator ()()
+			{
+				ThreadPool& pool = ThreadPool::instance();
+				pool.reserve(my_threads - 1);
+				for (size_t i = 1; i < my_threads; ++i)
+					pool.submit( std::bind(&ParallelLoop::participate, this, i) );
+				participate(0);
+
+				std::unique_lock<std::mutex> lock(my_mutex);
+				while (my_running)
+					my_done.wait(lock);
+				if (my_error)
+					std::rethrow_exception(my_error);
+			}
+
+		private:
+			struct Range {
+				std::mutex mutex;
+				size_t begin;
+				size_t end;
+			};
+
+			void participate(size_t id)
+			{
+				try {
+					size_t band;
+					while (!my_failed && next(id, band)) {
+						const size_t y0 = my_begin + band*my_grain;
+						my_body(y0, std::min(y0 + my_grain, my_end));
+					}
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(my_mutex);
+					if (!my_failed)
+						my_error = std::current_exception();
+					my_failed = true;
+				}
+
+				std::lock_guard<std::mutex> lock(my_mutex);
+				if (--my_running == 0)
+					my_done.notify_one();
+			}
+
+			bool next(size_t id, size_t& band)
+			{
+				if (my_policy == Execution::THREAD_POOL) {
+					band = my_next++;
+					return band < my_bands;
+				}
+
+				if (pop(my_ranges[id], band))
+					return true;
+
+				// steal the upper half of the first range with work left
+				for (size_t i = 1; i < my_threads; ++i) {
+					Range& victim = my_ranges[(id + i) % my_threads];
+					size_t begin, end;
+					{
+						std::lock_guard<std::mutex> lock(victim.mutex);
+						if (victim.begin == victim.end)
+							continue;
+						begin = victim.begin + (victim.end - victim.begin) / 2;
+						end = victim.end;
+						victim.end = begin;
+					}
+
+					Range& own = my_ranges[id];
+					std::lock_guard<std::mutex> lock(own.mutex);
+					own.begin = begin;
+					own.end = end;
+					band = own.begin++;
+					return true;
+				}
+				return false;
+			}
+
+			static bool pop(Range& range, size_t& band)
+			{
+				std::lock_guard<std::mutex> lock(range.mutex);
+				if (range.begin == range.end)
+					return false;
+				band = range.begin++;
+				return true;
+			}
+
+			const Body& my_body;
+			const size_t my_begin;
+			const size_t my_end;
+			const size_t my_grain;
+			const size_t my_bands;
+			const size_t my_threads;
+			const Execution::Policy my_policy;
+
+			std::atomic<size_t> my_next;
+			std::atomic<bool> my_failed;
+			std::unique_ptr<Range[]> my_ranges;
+
+			std::mutex my_mutex;
+			std::condition_variable my_done;
+			size_t my_running;
+			std::exception_ptr my_error;
+	};
+
+#endif // GIL_THREADS
+
+	// call body(y0, y1) over bands of [begin, end) that start at multiples
+	// of align from begin, on the threads given by exec.
+	template<class Body>
+	void parallel_for(
+		size_t begin, size_t end, const Body& body,
+		const Execution& exec = Execution::global(), size_t align = 1
+	)
+	{
+		if (begin >= end)
+			return;
+
+#ifdef GIL_THREADS
+		const size_t grain = exec.grain(end - begin, align);
+		const size_t bands = (end - begin + grain - 1) / grain;
+		const size_t threads = std::min(exec.concurrency(), bands);
+
+		if (threads > 1 && !ThreadPool::worker()) {
+			ParallelLoop<Body>(
+				body, begin, end, grain, threads, exec.policy()
+			)();
+			return;
+		}
+#else
+		(void)exec;
+		(void)align;
+#endif
+
+		body(begin, end);
+	}
+
+	/* Bands:
+	 *   binds an object and one of its (dst, src, y0, y1) methods into a
+	 *   body for parallel_for.
+	 */
+	template<class Object, class Dst, class Src>
+	class Bands {
+		public:
+			typedef
+				void (Object::*Method)(Dst&, const Src&, size_t, size_t) const;
+
+			Bands(const Object& object, Method method, Dst& dst, const Src& src)
+				: my_object(object), my_method(method), my_dst(dst), my_src(src)
+			{
+				// empty
+			}
+
+			void operator ()(size_t y0, size_t y1) const
+			{
+				(my_object.*my_method)(my_dst, my_src, y0, y1);
+			}
+
+		private:
+			const Object& my_object;
+			Method my_method;
+			Dst& my_dst;
+			const Src& my_src;
+	};
+
+	// run (object.*method)(dst, src, y0, y1) over bands of [begin, end)
+	template<class Object, class Dst, class Src>
+	void parallel_bands(
+		const Object& object,
+		void (Object::*method)(Dst&, const Src&, size_t, size_t) const,
+		Dst& dst, const Src& src, size_t begin, size_t end,
+		const Execution& exec, size_t align = 1
+	)
+	{
+		parallel_for(
+			begin, end, Bands<Object, Dst, Src>(object, method, dst, src),
+			exec, align
+		);
+	}
+
+}
+
+#endif // GIL_PARALLEL_H
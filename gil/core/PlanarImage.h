@@ -0,0 +1,450 @@
+#ifndef GIL_PLANAR_IMAGE_H
+#define GIL_PLANAR_IMAGE_H
+
+#include <cstddef>
+#include <algorithm>
+#include <cassert>
+#include <memory>
+
+#include "Color.h"
+#include "Converter.h"
+#include "Image.h"
+#include "ImageProxy.h"
+#include "Int2Type.h"
+#include "SliceImage.h"
+
+namespace gil {
+
+	/* PlanarImage:
+	 *   an image of Color<T, C> pixels that keeps every channel in a plane
+	 *   of its own. A plane is a plain aligned Image<T>, returned by
+	 *   plane(c) without copying, so per-channel work (luminance, a log
+	 *   encoding, a blur channel by channel) runs over contiguous rows of
+	 *   samples instead of gathering them from interleaved pixels:
+	 *
+	 *     PlanarImage<Float1, 3> plate, blurred(w, h);
+	 *     read(plate, "plate.pfm");
+	 *     for (size_t c = 0; c < 3; ++c)
+	 *         GaussianFilter<FloatImage1>(4, 4)(
+	 *             blurred.plane(c), plate.plane(c)
+	 *         );
+	 *
+	 *   A pixel reads as a Color<T, C> value and is written through a
+	 *   small reference object, img(x, y) = pixel or img(x, y)[c] = v.
+	 *   Rows are interleaved on the fly by store_row/load_row, so readers
+	 *   and writers, copy_rows (and so Image::operator=) and the dip
+	 *   filters take planar images as they are.
+	 */
+	template<
+		typename T, size_t C,
+		template<typename> class Allocator = std::allocator
+	>
+	class PlanarImage {
+		public:
+			class Reference;
+
+			typedef Color<T, C> value_type;
+			typedef Reference reference;
+			typedef const value_type const_reference;
+			typedef std::ptrdiff_t difference_type;
+			typedef std::size_t size_type;
+
+			typedef value_type ColorType;
+			typedef Image<T, Allocator> PlaneType;
+
+			enum { Channels = C };
+
+			PlanarImage()
+			{
+				// empty
+			}
+
+			PlanarImage(size_type w, size_type h)
+			{
+				resize(w, h);
+			}
+
+			// padded planes, see Image(w, h, border, pitch)
+			PlanarImage(
+				size_type w, size_type h, size_type border, size_type pitch = 0
+			)
+			{
+				for (size_type c = 0; c < C; ++c)
+					PlaneType(w, h, border, pitch).swap(my_planes[c]);
+			}
+
+			template<typename I>
+			PlanarImage(const I& img)
+			{
+				*this = img;
+			}
+
+			size_type width() const
+			{
+				return my_planes[0].width();
+			}
+
+			size_type height() const
+			{
+				return my_planes[0].height();
+			}
+
+			size_type size() const
+			{
+				return width() * height();
+			}
+
+			size_type channels() const
+			{
+				return C;
+			}
+
+			// channel c, an image of its own
+			PlaneType& plane(size_type c)
+			{
+				return my_planes[c];
+			}
+
+			const PlaneType& plane(size_type c) const
+			{
+				return my_planes[c];
+			}
+
+			void resize(size_type w, size_type h)
+			{
+				for (size_type c = 0; c < C; ++c)
+					my_planes[c].resize(w, h);
+			}
+
+			// deprecated, like Image::allocate
+			void allocate(size_type w, size_type h)
+			{
+				resize(w, h);
+			}
+
+			void fill(const value_type& pixel)
+			{
+				for (size_type c = 0; c < C; ++c)
+					my_planes[c].fill(pixel[c]);
+			}
+
+			const value_type operator ()(size_type x, size_type y) const
+			{
+				value_type pixel;
+				for (size_type c = 0; c < C; ++c)
+					pixel[c] = my_planes[c](x, y);
+				return pixel;
+			}
+
+			Reference operator ()(size_type x, size_type y)
+			{
+				return Reference(*this, x, y);
+			}
+
+			// interleave the n pixels of row y from x on into out
+			template<typename P>
+			void load(P* out, size_type x, size_type y, size_type n) const
+			{
+				load(out, x, y, n, Int2Type<ColorTrait<P>::Channels == C>());
+			}
+
+			// spread n interleaved pixels over the planes, row y from x on
+			template<typename P>
+			void store(size_type x, size_type y, const P* in, size_type n)
+			{
+				store(x, y, in, n, Int2Type<ColorTrait<P>::Channels == C>());
+			}
+
+			template<class Filter, class To, class From>
+			PlanarImage& operator =(
+				const ImageProxy<Filter, To, From>& image_proxy
+			)
+			{
+				return image_proxy(*this);
+			}
+
+			template<typename I>
+			PlanarImage& operator =(const I& img)
+			{
+				if (this != reinterpret_cast<const PlanarImage*>(&img)) {
+					resize(img.width(), img.height());
+					copy_rows(*this, img);
+				}
+				return *this;
+			}
+
+			template<typename I>
+			void replace(const I& img, size_type pos_x = 0, size_type pos_y = 0)
+			{
+				// FIXME use exception instead of assert.
+				assert( pos_x < this->width() );
+				assert( pos_y < this->height() );
+				assert( pos_x + img.width() <= this->width() );
+				assert( pos_y + img.height() <= this->height() );
+
+				copy_rows(*this, img, pos_x, pos_y);
+			}
+
+			void swap(PlanarImage& img)
+			{
+				for (size_type c = 0; c < C; ++c)
+					my_planes[c].swap(img.my_planes[c]);
+			}
+
+			// pixel (x, y) of a planar image, assignable like Color<T, C>&
+			class Reference {
+				friend class PlanarImage;
+				public:
+					operator value_type() const
+					{
+						const PlanarImage& image = my_image;
+						return image(my_x, my_y);
+					}
+
+					T& operator [](size_type c) const
+					{
+						return my_image.my_planes[c](my_x, my_y);
+					}
+
+					template<typename P>
+					Reference& operator =(const P& pixel)
+					{
+						// channels that pixel lacks are kept, as in Image
+						value_type v = *this;
+						v = pixel;
+						for (size_type c = 0; c < C; ++c)
+							(*this)[c] = v[c];
+						return *this;
+					}
+
+					Reference& operator =(const Reference& r)
+					{
+						const value_type pixel = r;
+						return *this = pixel;
+					}
+
+				private:
+					Reference(PlanarImage& image, size_type x, size_type y)
+						: my_image(image), my_x(x), my_y(y)
+					{
+						// empty
+					}
+
+					PlanarImage& my_image;
+					size_type my_x;
+					size_type my_y;
+			};
+
+		private:
+			// channel by channel, when P has C channels too
+			template<typename P>
+			void load(
+				P* out, size_type x, size_type y, size_type n, Int2Type<true>
+			) const
+			{
+				typedef typename ColorTrait<P>::BaseType BaseType;
+				for (size_type c = 0; c < C; ++c) {
+					const T *in = my_planes[c].row(y) + x;
+					for (size_type i = 0; i < n; ++i)
+						ColorTrait<P>::select_channel(out[i], c) =
+							static_cast<BaseType>(in[i]);
+				}
+			}
+
+			// pixel by pixel through assignment, like Image pixels
+			template<typename P>
+			void load(
+				P* out, size_type x, size_type y, size_type n, Int2Type<false>
+			) const
+			{
+				for (size_type i = 0; i < n; ++i) {
+					const value_type pixel = (*this)(x + i, y);
+					out[i] = pixel;
+				}
+			}
+
+			template<typename P>
+			void store(
+				size_type x, size_type y, const P* in, size_type n, Int2Type<true>
+			)
+			{
+				for (size_type c = 0; c < C; ++c) {
+					T *out = my_planes[c].row(y) + x;
+					for (size_type i = 0; i < n; ++i)
+						out[i] = static_cast<T>(
+							ColorTrait<P>::select_channel(in[i], c)
+						);
+				}
+			}
+
+			template<typename P>
+			void store(
+				size_type x, size_type y, const P* in, size_type n, Int2Type<false>
+			)
+			{
+				for (size_type i = 0; i < n; ++i)
+					(*this)(x + i, y) = in[i];
+			}
+
+			PlaneType my_planes[C];
+	};
+
+	template<typename T, size_t C, template<typename> class A>
+	inline void swap(PlanarImage<T, C, A>& a, PlanarImage<T, C, A>& b)
+	{
+		a.swap(b);
+	}
+
+	// channel c of a planar image is its plane, no view needed
+	template<typename T, size_t C, template<typename> class A>
+	inline Image<T, A>& slice_image(PlanarImage<T, C, A>& img, size_t c)
+	{
+		return img.plane(c);
+	}
+
+	// rows are interleaved a tile at a time on their way to a converter
+	template<
+		template<typename, typename> class Converter,
+		typename T, size_t C, template<typename> class A, typename From
+	>
+	inline void store_row(
+		PlanarImage<T, C, A>& image, size_t y, const From* from, size_t n
+	)
+	{
+		Color<T, C> tile[GIL_PIPELINE_TILE];
+		for (size_t x = 0; x < n; x += GIL_PIPELINE_TILE) {
+			const size_t m = std::min<size_t>(GIL_PIPELINE_TILE, n - x);
+			convert_row<Converter>(tile, from + x, m);
+			image.store(x, y, tile, m);
+		}
+	}
+
+	template<
+		template<typename, typename> class Converter,
+		typename To, typename T, size_t C, template<typename> class A
+	>
+	inline void load_row(
+		To* to, const PlanarImage<T, C, A>& image, size_t y, size_t n
+	)
+	{
+		Color<T, C> tile[GIL_PIPELINE_TILE];
+		for (size_t x = 0; x < n; x += GIL_PIPELINE_TILE) {
+			const size_t m = std::min<size_t>(GIL_PIPELINE_TILE, n - x);
+			image.load(tile, x, y, m);
+			convert_row<Converter>(to + x, tile, m);
+		}
+	}
+
+	// copies from and to planar images: an image with contiguous rows is
+	// read or written in place, any other a tile at a time
+	template<bool Contiguous>
+	struct PlanarCopy {
+		template<typename T, size_t C, template<typename> class A, class S>
+		static void copy(
+			PlanarImage<T, C, A>& dst, const S& src, size_t x, size_t y
+		)
+		{
+			typename S::value_type tile[GIL_PIPELINE_TILE];
+			for (size_t iy = 0; iy < src.height(); ++iy)
+				for (size_t ix = 0; ix < src.width(); ix += GIL_PIPELINE_TILE) {
+					const size_t n =
+						std::min<size_t>(GIL_PIPELINE_TILE, src.width() - ix);
+					read_span(src, tile, ix, iy, n);
+					dst.store(x + ix, y + iy, tile, n);
+				}
+		}
+
+		template<class D, typename T, size_t C, template<typename> class A>
+		static void copy(
+			D& dst, const PlanarImage<T, C, A>& src, size_t x, size_t y
+		)
+		{
+			Color<T, C> tile[GIL_PIPELINE_TILE];
+			for (size_t iy = 0; iy < src.height(); ++iy)
+				for (size_t ix = 0; ix < src.width(); ix += GIL_PIPELINE_TILE) {
+					const size_t n =
+						std::min<size_t>(GIL_PIPELINE_TILE, src.width() - ix);
+					src.load(tile, ix, iy, n);
+					for (size_t i = 0; i < n; ++i)
+						dst(x + ix + i, y + iy) = tile[i];
+				}
+		}
+	};
+
+	template<>
+	struct PlanarCopy<true> {
+		template<typename T, size_t C, template<typename> class A, class S>
+		static void copy(
+			PlanarImage<T, C, A>& dst, const S& src, size_t x, size_t y
+		)
+		{
+			if (src.width() == 0)
+				return;
+			for (size_t iy = 0; iy < src.height(); ++iy)
+				dst.store(x, y + iy, &src(0, iy), src.width());
+		}
+
+		template<class D, typename T, size_t C, template<typename> class A>
+		static void copy(
+			D& dst, const PlanarImage<T, C, A>& src, size_t x, size_t y
+		)
+		{
+			if (src.width() == 0)
+				return;
+			for (size_t iy = 0; iy < src.height(); ++iy)
+				src.load(&dst(x, y + iy), 0, iy, src.width());
+		}
+	};
+
+	// see copy_rows in Converter.h
+	template<typename T, size_t C, template<typename> class A, class S>
+	inline void copy_rows(
+		PlanarImage<T, C, A>& dst, const S& src, size_t x = 0, size_t y = 0
+	)
+	{
+		PlanarCopy<RowTrait<S>::Contiguous>::copy(dst, src, x, y);
+	}
+
+	template<class D, typename T, size_t C, template<typename> class A>
+	inline void copy_rows(
+		D& dst, const PlanarImage<T, C, A>& src, size_t x = 0, size_t y = 0
+	)
+	{
+		PlanarCopy<RowTrait<D>::Contiguous>::copy(dst, src, x, y);
+	}
+
+	// plane by plane
+	template<
+		typename T, size_t C, template<typename> class A,
+		typename F, template<typename> class B
+	>
+	inline void copy_rows(
+		PlanarImage<T, C, A>& dst, const PlanarImage<F, C, B>& src,
+		size_t x = 0, size_t y = 0
+	)
+	{
+		for (size_t c = 0; c < C; ++c)
+			copy_rows(dst.plane(c), src.plane(c), x, y);
+	}
+
+	template<typename T, size_t C, template<typename> class A, class I>
+	inline void copy_rows(
+		PlanarImage<T, C, A>& dst, const SliceImage<I>& src,
+		size_t x = 0, size_t y = 0
+	)
+	{
+		PlanarCopy<false>::copy(dst, src, x, y);
+	}
+
+	template<class I, typename T, size_t C, template<typename> class A>
+	inline void copy_rows(
+		SliceImage<I>& dst, const PlanarImage<T, C, A>& src,
+		size_t x = 0, size_t y = 0
+	)
+	{
+		PlanarCopy<false>::copy(dst, src, x, y);
+	}
+
+}
+
+#endif // GIL_PLANAR_IMAGE_H
@@ -0,0 +1,326 @@
+#ifndef GIL_POOL_H
+#define GIL_POOL_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <vector>
+
+#include "Parallel.h"
+#include "Image.h"
+
+namespace gil {
+
+	/* ImagePool:
+	 *   recycles the buffers of temporary images. A freed buffer is kept
+	 *   in the bucket of its size class and handed out again for the next
+	 *   request of that class, so a batch job filtering frames of the same
+	 *   size stops calling malloc, and faulting in fresh pages, after the
+	 *   first frame.
+	 *
+	 *   Size classes are 4 KiB at least and then four per power of two,
+	 *   which wastes at most a quarter of a buffer.
+	 *
+	 *   A Frame marks the end of a frame when it goes out of scope: the
+	 *   buckets that were not used during the frame are emptied, so the
+	 *   pool follows a change of resolution instead of growing.
+	 *
+	 *     for (size_t i = 0; i < frames.size(); ++i) {
+	 *         ImagePool::Frame frame;
+	 *         read(plate, frames[i]);
+	 *         GaussianFilter<FloatImage3>(2, 2)(blurred, plate);
+	 *         write(blurred, outputs[i]);
+	 *     }
+	 *
+	 *   Images draw from the pool through PoolAllocator. The library uses
+	 *   it for the temporaries it allocates itself; an Image<T, PoolAllocator>
+	 *   puts any other image there too. The pool is shared by all threads.
+	 */
+	class ImagePool {
+		public:
+			// byte counts are in whole size classes
+			struct Statistics {
+				size_t allocated;	// obtained from the system so far
+				size_t in_use;		// handed out and not freed yet
+				size_t peak;		// the most ever in use at once
+				size_t cached;		// freed and kept for reuse
+				size_t hits;		// requests served from a bucket
+				size_t misses;		// requests that had to allocate
+			};
+
+			class Frame {
+				public:
+					explicit Frame(ImagePool& pool = ImagePool::global())
+						: my_pool(pool)
+					{
+						// empty
+					}
+
+					~Frame()
+					{
+						my_pool.end_frame();
+					}
+
+				private:
+					Frame(const Frame&);
+					Frame& operator =(const Frame&);
+
+					ImagePool& my_pool;
+			};
+
+			ImagePool()
+			{
+				my_stats.allocated = my_stats.in_use = my_stats.peak = 0;
+				my_stats.cached = my_stats.hits = my_stats.misses = 0;
+			}
+
+			~ImagePool()
+			{
+				trim();
+			}
+
+			// the pool behind PoolAllocator. It is never destroyed, so
+			// static images may still free their buffers at exit.
+			static ImagePool& global()
+			{
+				static ImagePool *pool = new ImagePool;
+				return *pool;
+			}
+
+			void* allocate(size_t bytes)
+			{
+				const size_t size = size_class(bytes);
+				{
+					Lock lock(*this);
+					Bucket& bucket = my_buckets[size];
+					bucket.used = true;
+					my_stats.in_use += size;
+					if (my_stats.in_use > my_stats.peak)
+						my_stats.peak = my_stats.in_use;
+					if (!bucket.blocks.empty()) {
+						void *p = bucket.blocks.back();
+						bucket.blocks.pop_back();
+						my_stats.cached -= size;
+						++my_stats.hits;
+						return p;
+					}
+					++my_stats.misses;
+					my_stats.allocated += size;
+				}
+
+				void *p = std::malloc(size);
+				if (p == 0) {
+					Lock lock(*this);
+					my_stats.in_use -= size;
+					my_stats.allocated -= size;
+					throw std::bad_alloc();
+				}
+				return p;
+			}
+
+			// bytes must be what was passed to allocate()
+			void deallocate(void* p, size_t bytes)
+			{
+				if (p == 0)
+					return;
+				const size_t size = size_class(bytes);
+				Lock lock(*this);
+				my_buckets[size].blocks.push_back(p);
+				my_stats.in_use -= size;
+				my_stats.cached += size;
+			}
+
+			// free the buckets that were not used since the last call
+			void end_frame()
+			{
+				Lock lock(*this);
+				for (Buckets::iterator it = my_buckets.begin();
+						it != my_buckets.end(); ++it) {
+					if (!it->second.used)
+						release(it->first, it->second);
+					it->second.used = false;
+				}
+			}
+
+			// free every cached buffer
+			void trim()
+			{
+				Lock lock(*this);
+				for (Buckets::iterator it = my_buckets.begin();
+						it != my_buckets.end(); ++it)
+					release(it->first, it->second);
+			}
+
+			Statistics statistics() const
+			{
+				Lock lock(*this);
+				return my_stats;
+			}
+
+			// start counting hits, misses and the peak anew
+			void reset_statistics()
+			{
+				Lock lock(*this);
+				my_stats.peak = my_stats.in_use;
+				my_stats.hits = my_stats.misses = 0;
+			}
+
+			// the size of the buffers that serve a request of bytes
+			static size_t size_class(size_t bytes)
+			{
+				const size_t MIN = 4096;
+				if (bytes <= MIN)
+					return MIN;
+				size_t top = MIN;
+				while (top < bytes / 2)
+					top *= 2;
+				const size_t step = top / 4;
+				return (bytes + step - 1) / step * step;
+			}
+
+		private:
+			ImagePool(const ImagePool&);
+			ImagePool& operator =(const ImagePool&);
+
+			struct Bucket {
+				Bucket(): used(false)
+				{
+					// empty
+				}
+
+				std::vector<void*> blocks;
+				bool used;
+			};
+
+			typedef std::map<size_t, Bucket> Buckets;
+
+#ifdef GIL_THREADS
+			struct Lock {
+				Lock(const ImagePool& pool): my_lock(pool.my_mutex)
+				{
+					// empty
+				}
+
+				std::lock_guard<std::mutex> my_lock;
+			};
+#else
+			struct Lock {
+				Lock(const ImagePool&)
+				{
+					// empty
+				}
+			};
+#endif
+
+			void release(size_t size, Bucket& bucket)
+			{
+				for (size_t i = 0; i < bucket.blocks.size(); ++i)
+					std::free(bucket.blocks[i]);
+				my_stats.cached -= size * bucket.blocks.size();
+				std::vector<void*>().swap(bucket.blocks);
+			}
+
+			Buckets my_buckets;
+			Statistics my_stats;
+#ifdef GIL_THREADS
+			mutable std::mutex my_mutex;
+#endif
+	};
+
+	/* PoolAllocator:
+	 *   a standard allocator drawing from ImagePool::global(), for Image
+	 *   and std::vector.
+	 *
+	 *     typedef Image<Float3, PoolAllocator> TmpImage3;
+	 */
+	template<typename T>
+	class PoolAllocator {
+		public:
+			typedef T value_type;
+			typedef T* pointer;
+			typedef const T* const_pointer;
+			typedef T& reference;
+			typedef const T& const_reference;
+			typedef std::size_t size_type;
+			typedef std::ptrdiff_t difference_type;
+
+			template<typename U> struct rebind {
+				typedef PoolAllocator<U> other;
+			};
+
+			PoolAllocator()
+			{
+				// empty
+			}
+
+			template<typename U>
+			PoolAllocator(const PoolAllocator<U>&)
+			{
+				// empty
+			}
+
+			pointer address(reference x) const
+			{
+				return &x;
+			}
+
+			const_pointer address(const_reference x) const
+			{
+				return &x;
+			}
+
+			pointer allocate(size_type n, const void* = 0)
+			{
+				if (n > max_size())
+					throw std::bad_alloc();
+				return static_cast<pointer>(
+					ImagePool::global().allocate(n * sizeof(T))
+				);
+			}
+
+			void deallocate(pointer p, size_type n)
+			{
+				ImagePool::global().deallocate(p, n * sizeof(T));
+			}
+
+			size_type max_size() const
+			{
+				return static_cast<size_type>(-1) / sizeof(T);
+			}
+
+			void construct(pointer p, const T& value)
+			{
+				new (p) T(value);
+			}
+
+			void destroy(pointer p)
+			{
+				p->~T();
+			}
+	};
+
+	template<typename T, typename U>
+	inline bool operator ==(const PoolAllocator<T>&, const PoolAllocator<U>&)
+	{
+		return true;
+	}
+
+	template<typename T, typename U>
+	inline bool operator !=(const PoolAllocator<T>&, const PoolAllocator<U>&)
+	{
+		return false;
+	}
+
+	/* PooledImage:
+	 *   the type of a temporary image with the pixels of I, drawing from
+	 *   the pool.
+	 */
+	template<class I>
+	struct PooledImage {
+		typedef Image<typename I::value_type, PoolAllocator> type;
+	};
+
+}
+
+#endif // GIL_POOL_H
@@ -0,0 +1,480 @@
+#ifndef GIL_PROBE_H
+#define GIL_PROBE_H
+
+#include <cctype>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Exception.h"
+#include "FileFormat.h"
+#include "Codec.h"
+
+namespace gil {
+
+	/* ImageInfo:
+	 *   what probe() tells of a file without reading its pixels.
+	 *   width and height are those of the data window, which starts at
+	 *   (x, y); only EXR has one that does not start at 0.
+	 */
+	struct ImageInfo {
+		enum Sample {
+			UNSIGNED,		// integers of bits bits
+			FLOAT,			// IEEE floats of bits bits, 16 for half
+			RGBE			// Radiance, a byte per channel and a shared one
+		};
+
+		ImageInfo()
+			: format(FF_UNKNOWN), width(0), height(0), channels(0), bits(0),
+			  sample(UNSIGNED), x(0), y(0),
+			  tiled(false), tile_width(0), tile_height(0), levels(1)
+		{
+			// empty
+		}
+
+		FileFormat format;		// FF_UNKNOWN if the file cannot be told
+		size_t width;
+		size_t height;
+		size_t channels;		// as stored, palettes count as RGB
+		size_t bits;			// per channel
+		Sample sample;
+		int x;
+		int y;
+		std::string compression;	// "none", "rle", "deflate", "zip"...
+		bool tiled;
+		size_t tile_width;
+		size_t tile_height;
+		size_t levels;			// mipmap levels, of the larger side for
+								// ripmaps
+	};
+
+	namespace probe_detail {
+
+		inline void bytes(FILE* f, void* buf, size_t n)
+		{
+			if (fread(buf, 1, n, f) != n) {
+				if (feof(f))
+					throw EndOfFile("unexpected end-of-file");
+				throw IOError("unknown read error");
+			}
+		}
+
+		inline void skip(FILE* f, long n)
+		{
+			if (fseek(f, n, SEEK_CUR) != 0)
+				throw IOError("unknown fseek error");
+		}
+
+		inline unsigned int be16(const unsigned char* p)
+		{
+			return (p[0] << 8) | p[1];
+		}
+
+		inline unsigned int be32(const unsigned char* p)
+		{
+			return (static_cast<unsigned int>(p[0]) << 24) |
+				(p[1] << 16) | (p[2] << 8) | p[3];
+		}
+
+		inline unsigned int le16(const unsigned char* p)
+		{
+			return p[0] | (p[1] << 8);
+		}
+
+		inline unsigned int le32(const unsigned char* p)
+		{
+			return p[0] | (p[1] << 8) | (p[2] << 16) |
+				(static_cast<unsigned int>(p[3]) << 24);
+		}
+
+		// of a TIFF file, in its byte order
+		inline unsigned int tiff16(const unsigned char* p, bool big)
+		{
+			return big ? be16(p) : le16(p);
+		}
+
+		inline unsigned int tiff32(const unsigned char* p, bool big)
+		{
+			return big ? be32(p) : le32(p);
+		}
+
+		// the next number of a PNM header, past blanks and comments
+		inline size_t pnm_number(FILE* f)
+		{
+			int c = fgetc(f);
+			for (;;) {
+				while (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+					c = fgetc(f);
+				if (c != '#')
+					break;
+				while (c != '\n' && c != EOF)
+					c = fgetc(f);
+			}
+			if (c < '0' || c > '9') {
+				if (c == EOF)
+					throw EndOfFile("unexpected end-of-file");
+				throw InvalidFormat("invalid format");
+			}
+			size_t n = 0;
+			while (c >= '0' && c <= '9') {
+				n = 10*n + (c - '0');
+				c = fgetc(f);
+			}
+			return n;
+		}
+
+		inline void png(FILE* f, ImageInfo& info)
+		{
+			unsigned char h[8 + 8 + 13];
+			bytes(f, h, sizeof(h));
+			if (std::memcmp(h + 12, "IHDR", 4) != 0)
+				throw InvalidFormat("invalid format");
+			info.width = be32(h + 16);
+			info.height = be32(h + 20);
+			info.bits = h[24];
+			switch (h[25]) {
+				case 0: info.channels = 1; break;
+				case 2: info.channels = 3; break;
+				case 3: info.channels = 3; info.bits = 8; break;
+				case 4: info.channels = 2; break;
+				case 6: info.channels = 4; break;
+				default: throw InvalidFormat("invalid png color type");
+			}
+			info.compression = "deflate";
+		}
+
+		inline void jpeg(FILE* f, ImageInfo& info)
+		{
+			skip(f, 2);
+			for (;;) {
+				unsigned char m[2];
+				bytes(f, m, 1);
+				if (m[0] != 0xFF)
+					throw InvalidFormat("invalid jpeg marker");
+				do
+					bytes(f, m + 1, 1);
+				while (m[1] == 0xFF);
+				if (m[1] == 0x01 || (m[1] >= 0xD0 && m[1] <= 0xD7))
+					continue;
+				if (m[1] == 0xD9 || m[1] == 0xDA)
+					throw InvalidFormat("jpeg without frame header");
+
+				unsigned char length[2];
+				bytes(f, length, 2);
+				const bool sof = (m[1] >= 0xC0 && m[1] <= 0xCF &&
+					m[1] != 0xC4 && m[1] != 0xC8 && m[1] != 0xCC);
+				if (!sof) {
+					skip(f, static_cast<long>(be16(length)) - 2);
+					continue;
+				}
+
+				unsigned char h[6];
+				bytes(f, h, 6);
+				info.bits = h[0];
+				info.height = be16(h + 1);
+				info.width = be16(h + 3);
+				info.channels = h[5];
+				switch (m[1] & 3) {
+					case 2: info.compression = "progressive"; break;
+					case 3: info.compression = "lossless"; break;
+					default: info.compression = "jpeg"; break;
+				}
+				return;
+			}
+		}
+
+		inline void tiff(FILE* f, ImageInfo& info)
+		{
+			const long base = ftell(f);
+			unsigned char h[8];
+			bytes(f, h, 8);
+			const bool big = (h[0] == 'M');
+			if (fseek(f, base + tiff32(h + 4, big), SEEK_SET) != 0)
+				throw IOError("unknown fseek error");
+			unsigned char n[2];
+			bytes(f, n, 2);
+
+			info.bits = 1;
+			info.channels = 1;
+			info.compression = "none";
+			unsigned int bits_at = 0;		// offset of the bits per sample
+			unsigned int format_at = 0;		// and of the sample formats
+			for (size_t i = tiff16(n, big); i > 0; --i) {
+				unsigned char e[12];
+				bytes(f, e, 12);
+				const unsigned int type = tiff16(e + 2, big);
+				const unsigned int count = tiff32(e + 4, big);
+				const unsigned int value = (type == 3) ?
+					tiff16(e + 8, big) : tiff32(e + 8, big);
+				switch (tiff16(e, big)) {
+					case 256: info.width = value; break;
+					case 257: info.height = value; break;
+					case 258:
+						if (count > 2)
+							bits_at = tiff32(e + 8, big);
+						else
+							info.bits = value;
+						break;
+					case 259:
+						switch (value) {
+							case 1: info.compression = "none"; break;
+							case 5: info.compression = "lzw"; break;
+							case 6:
+							case 7: info.compression = "jpeg"; break;
+							case 8:
+							case 32946: info.compression = "deflate"; break;
+							case 32773: info.compression = "packbits"; break;
+							default: info.compression = "other"; break;
+						}
+						break;
+					case 277: info.channels = value; break;
+					case 322: info.tiled = true; info.tile_width = value; break;
+					case 323: info.tile_height = value; break;
+					case 339:
+						if (count > 2)
+							format_at = tiff32(e + 8, big);
+						else if (value == 3)
+							info.sample = ImageInfo::FLOAT;
+						break;
+				}
+			}
+			if (bits_at) {
+				if (fseek(f, base + bits_at, SEEK_SET) != 0)
+					throw IOError("unknown fseek error");
+				bytes(f, n, 2);
+				info.bits = tiff16(n, big);
+			}
+			if (format_at) {
+				if (fseek(f, base + format_at, SEEK_SET) != 0)
+					throw IOError("unknown fseek error");
+				bytes(f, n, 2);
+				if (tiff16(n, big) == 3)
+					info.sample = ImageInfo::FLOAT;
+			}
+		}
+
+		inline void bmp(FILE* f, ImageInfo& info)
+		{
+			unsigned char h[14 + 20];
+			bytes(f, h, 14 + 4);
+			const unsigned int size = le32(h + 14);
+			unsigned int bpp, compression = 0;
+			if (size == 12) {
+				bytes(f, h + 18, 8);
+				info.width = le16(h + 18);
+				info.height = le16(h + 20);
+				bpp = le16(h + 24);
+			} else {
+				bytes(f, h + 18, 16);
+				info.width = le32(h + 18);
+				const int height = static_cast<int>( le32(h + 22) );
+				info.height = height < 0 ? -height : height;
+				bpp = le16(h + 28);
+				compression = le32(h + 30);
+			}
+			info.bits = 8;
+			info.channels = (bpp == 32) ? 4 : 3;
+			switch (compression) {
+				case 0: info.compression = "none"; break;
+				case 1:
+				case 2: info.compression = "rle"; break;
+				case 3: info.compression = "bitfields"; break;
+				default: info.compression = "other"; break;
+			}
+		}
+
+		inline void targa(FILE* f, ImageInfo& info)
+		{
+			unsigned char h[18];
+			bytes(f, h, 18);
+			info.width = le16(h + 12);
+			info.height = le16(h + 14);
+			const unsigned int type = h[2] & 7;
+			if (type == 3) {
+				info.channels = 1;
+				info.bits = h[16];
+			} else {
+				info.channels = (h[16] == 32) ? 4 : 3;
+				info.bits = 8;
+			}
+			info.compression = (h[2] & 8) ? "rle" : "none";
+		}
+
+		inline void pnm(FILE* f, ImageInfo& info)
+		{
+			skip(f, 2);
+			info.width = pnm_number(f);
+			info.height = pnm_number(f);
+			info.bits = (pnm_number(f) < 256) ? 8 : 16;
+			info.channels = (info.format == FF_PGM) ? 1 : 3;
+			info.compression = "none";
+		}
+
+		inline void pfm(FILE* f, ImageInfo& info)
+		{
+			unsigned char magic[2];
+			bytes(f, magic, 2);
+			int width, height;
+			float scale;
+			if (fscanf(f, " %d %d %f", &width, &height, &scale) != 3 ||
+					width <= 0 || height <= 0)
+				throw InvalidFormat("invalid format");
+			info.width = width;
+			info.height = height;
+			info.channels = (magic[1] == 'F') ? 3 : 1;
+			info.bits = 32;
+			info.sample = ImageInfo::FLOAT;
+			info.compression = "none";
+		}
+
+		inline void hdr(FILE* f, ImageInfo& info)
+		{
+			hdr_read_header(f, info.width, info.height);
+			info.channels = 3;
+			info.bits = 8;
+			info.sample = ImageInfo::RGBE;
+
+			// the first scanline tells whether they are run length encoded
+			unsigned char rgbe[4];
+			info.compression = (fread(rgbe, 1, 4, f) == 4 &&
+				rgbe[0] == 2 && rgbe[1] == 2 && !(rgbe[2] & 0x80) &&
+				info.width >= 8 && info.width < 0x8000) ? "rle" : "none";
+		}
+
+		// the header of an EXR file, as the reader parses it
+		inline void exr(FILE* f, ImageInfo& info)
+		{
+			exr_detail::Header header;
+			exr_detail::read_header(f, header);
+
+			// UINT and FLOAT are 32 bits, HALF 16; float wins a tie
+			info.channels = header.channels.size();
+			info.bits = 0;
+			for (size_t i = 0; i < header.channels.size(); ++i) {
+				const ExrChannel::PixelType t = header.channels[i].type;
+				const size_t bits = (t == ExrChannel::HALF) ? 16 : 32;
+				if (bits > info.bits ||
+						(bits == info.bits && t == ExrChannel::FLOAT)) {
+					info.bits = bits;
+					info.sample = (t == ExrChannel::UINT) ?
+						ImageInfo::UNSIGNED : ImageInfo::FLOAT;
+				}
+			}
+
+			info.compression = exr_detail::compression_name(header.compression);
+			std::transform(
+				info.compression.begin(), info.compression.end(),
+				info.compression.begin(), ::tolower
+			);
+			info.x = header.min_x;
+			info.y = header.min_y;
+			info.width = header.width();
+			info.height = header.height();
+
+			// levels once the whole header is known, the data window may
+			// come after the tiles
+			info.tiled = header.tiled;
+			if (header.tiled) {
+				info.tile_width = header.tile_width;
+				info.tile_height = header.tile_height;
+				info.levels = static_cast<size_t>(
+					std::max(header.levels_x(), header.levels_y())
+				);
+			}
+		}
+
+		// raw floats after the width and height; channels by file size
+		inline void flt(FILE* f, ImageInfo& info)
+		{
+			const long start = ftell(f);
+			unsigned char h[8];
+			bytes(f, h, 8);
+			const size_t width = le32(h), height = le32(h + 4);
+			if (fseek(f, 0, SEEK_END) != 0)
+				throw IOError("unknown fseek error");
+			const long end = ftell(f);
+			if (width == 0 || height == 0 || end < start + 8)
+				throw InvalidFormat("invalid format");
+			const size_t size = static_cast<size_t>(end - start - 8);
+			info.width = width;
+			info.height = height;
+			info.channels = size / sizeof(float) / width / height;
+			if (width * height * info.channels * sizeof(float) != size)
+				throw InvalidFormat("invalid format");
+			info.bits = 32;
+			info.sample = ImageInfo::FLOAT;
+			info.compression = "none";
+		}
+
+		inline ImageInfo probe(FILE* f, FileFormat format)
+		{
+			ImageInfo info;
+			info.format = format;
+			switch (format) {
+				case FF_PNG: png(f, info); break;
+				case FF_JPEG: jpeg(f, info); break;
+				case FF_TIFF: tiff(f, info); break;
+				case FF_BMP: bmp(f, info); break;
+				case FF_TARGA: targa(f, info); break;
+				case FF_PGM:
+				case FF_PPM: pnm(f, info); break;
+				case FF_PFM: pfm(f, info); break;
+				case FF_HDR: hdr(f, info); break;
+				case FF_EXR: exr(f, info); break;
+				case FF_FLT: flt(f, info); break;
+				default: break;		// the format alone
+			}
+			return info;
+		}
+
+	} // namespace probe_detail
+
+	/* probe:
+	 *   the size, channels, sample type, compression and tiling of an
+	 *   image file, from its header alone: no pixel is read and no image
+	 *   allocated, so a whole archive can be scanned quickly.
+	 *
+	 *   The format is told by the magic number, or by the extension for
+	 *   formats without one (FLT, DPX, CRW); of DPX and CRW only the
+	 *   format is told. A file that cannot be opened or told gives
+	 *   format FF_UNKNOWN; a broken header throws as the readers do.
+	 */
+	inline ImageInfo probe(FILE* f)
+	{
+		return probe_detail::probe(f, Formater::get_format(f));
+	}
+
+	inline ImageInfo probe(const std::string& filename)
+	{
+		FILE* f = fopen(filename.c_str(), "rb");
+		if (f == NULL)
+			return ImageInfo();
+		FileFormat format = Formater::get_format(f);
+		if (format == FF_UNKNOWN)
+			format = Formater::get_format(filename);
+		try {
+			const ImageInfo info = probe_detail::probe(f, format);
+			fclose(f);
+			return info;
+		} catch (...) {
+			fclose(f);
+			throw;
+		}
+	}
+
+	// of a file held in memory
+	inline ImageInfo probe(const void* data, size_t size)
+	{
+		MemoryFile file;
+		FILE* f = file.open(data, size);
+		if (f == NULL)
+			return ImageInfo();
+		return probe(f);
+	}
+
+} // namespace gil
+
+#endif // GIL_PROBE_H
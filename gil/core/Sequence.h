@@ -0,0 +1,309 @@
+#ifndef GIL_SEQUENCE_H
+#define GIL_SEQUENCE_H
+
+#include <cstddef>
+#include <algorithm>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Exception.h"
+#include "Converter.h"
+#include "ImageIO.h"
+#include "Parallel.h"
+
+#ifdef GIL_THREADS
+#include <chrono>
+#endif
+
+namespace gil {
+
+	/* sequence_filename:
+	 *   the name of frame n of a numbered sequence: the %d, %4d or %04d
+	 *   of pattern replaced by n, as printf would. A pattern without one
+	 *   names every frame alike.
+	 */
+	inline std::string sequence_filename(const std::string& pattern, int n)
+	{
+		std::string::size_type pos = pattern.find('%');
+		while (pos != std::string::npos && pos + 1 < pattern.size() &&
+				pattern[pos + 1] == '%')
+			pos = pattern.find('%', pos + 2);
+		if (pos == std::string::npos)
+			return pattern;
+
+		std::string::size_type end = pos + 1;
+		const bool zeros = (end < pattern.size() && pattern[end] == '0');
+		size_t width = 0;
+		while (end < pattern.size() &&
+				pattern[end] >= '0' && pattern[end] <= '9')
+			width = 10*width + (pattern[end++] - '0');
+		if (end == pattern.size() || pattern[end] != 'd')
+			return pattern;
+
+		std::string digits;
+		unsigned long v = (n < 0) ? 0ul - static_cast<unsigned long>(n) : n;
+		do {
+			digits.insert(digits.begin(), static_cast<char>('0' + v % 10));
+			v /= 10;
+		} while (v);
+		const size_t sign = (n < 0) ? 1 : 0;
+		if (digits.size() + sign < width)
+			digits.insert(
+				digits.begin(), width - digits.size() - sign, zeros ? '0' : ' '
+			);
+		if (n < 0)
+			digits.insert(zeros ? digits.begin() : digits.begin() +
+				digits.find_first_not_of(' '), '-');
+		return pattern.substr(0, pos) + digits + pattern.substr(end + 1);
+	}
+
+	/* SequenceReader:
+	 *   reads the frames first to last of a numbered sequence, in order,
+	 *   while threads of its own decode the next ones ahead of time:
+	 *
+	 *     SequenceReader<FloatImage3> frames("plate.%04d.exr", 1001, 1100);
+	 *     FloatImage3 plate;
+	 *     while (frames.next(plate))
+	 *         process(plate, frames.frame());
+	 *
+	 *   At most depth frames are read ahead, into depth images that are
+	 *   recycled: next() swaps the decoded frame with the image passed,
+	 *   and that image is decoded into later, so frames of the same size
+	 *   do not allocate. Decoding threads are not the ones of
+	 *   parallel_for, so decoders that use it still run in parallel.
+	 *
+	 *   A frame that cannot be read throws from next(), in order. cancel()
+	 *   stops reading ahead and waits for the frames being decoded, and
+	 *   next() returns false from then on, also when it was waiting for
+	 *   a frame on another thread; the destructor cancels too.
+	 *
+	 *   statistics() tells how long next() waited for frames; a stall time
+	 *   much above zero asks for more depth or threads. Builds without
+	 *   threads read each frame in next().
+	 */
+	template<
+		class I,
+		template<typename, typename> class Converter = DefaultConverter
+	>
+	class SequenceReader {
+		public:
+			struct Statistics {
+				size_t frames;			// returned by next() so far
+				size_t stalls;			// frames next() had to wait for
+				double stall_seconds;	// time next() spent waiting
+				double read_seconds;	// time spent decoding, all threads
+			};
+
+			SequenceReader(
+				const std::string& pattern, int first, int last,
+				size_t depth = 4, size_t threads = 1
+			): my_pattern(pattern), my_last(last),
+			   my_next(first), my_frame(first - 1),
+			   my_depth(std::max<size_t>(depth, 1))
+#ifdef GIL_THREADS
+			   , my_scheduled(first), my_cancelled(false),
+			   my_buffers(my_depth)
+#endif
+			{
+				my_stats.frames = my_stats.stalls = 0;
+				my_stats.stall_seconds = my_stats.read_seconds = 0.0;
+#ifdef GIL_THREADS
+				for (size_t i = 0; i < my_depth; ++i)
+					my_free.push_back(i);
+				threads = std::max<size_t>(std::min(threads, my_depth), 1);
+				for (size_t i = 0; i < threads; ++i)
+					my_threads.push_back(
+						std::thread(&SequenceReader::run, this)
+					);
+#else
+				(void)threads;
+#endif
+			}
+
+			~SequenceReader()
+			{
+				cancel();
+			}
+
+			// the next frame into image, false after the last one
+			bool next(I& image)
+			{
+#ifdef GIL_THREADS
+				std::unique_lock<std::mutex> lock(my_mutex);
+				if (my_cancelled || my_next > my_last)
+					return false;
+				const int n = my_next++;
+				if (!ready(n)) {
+					const Clock::time_point start = Clock::now();
+					while (!my_cancelled && !ready(n))
+						my_ready.wait(lock);
+					if (!ready(n))
+						return false;
+					++my_stats.stalls;
+					my_stats.stall_seconds += seconds(start, Clock::now());
+				}
+
+				Slot slot = my_slots.front();
+				my_slots.erase(my_slots.begin());
+				if (slot.error) {
+					my_free.push_back(slot.buffer);
+					my_work.notify_one();
+					std::rethrow_exception(slot.error);
+				}
+				using std::swap;
+				swap(image, my_buffers[slot.buffer]);
+				my_free.push_back(slot.buffer);
+				my_frame = n;
+				++my_stats.frames;
+				lock.unlock();
+				my_work.notify_one();
+#else
+				if (my_next > my_last)
+					return false;
+				const int n = my_next++;
+				const std::clock_t start = std::clock();
+				read_frame(image, n);
+				my_frame = n;
+				const double t =
+					static_cast<double>(std::clock() - start) / CLOCKS_PER_SEC;
+				++my_stats.frames;
+				++my_stats.stalls;
+				my_stats.stall_seconds += t;
+				my_stats.read_seconds += t;
+#endif
+				return true;
+			}
+
+			// the number of the frame next() returned last, first - 1
+			// before the first one
+			int frame() const
+			{
+#ifdef GIL_THREADS
+				std::lock_guard<std::mutex> lock(my_mutex);
+#endif
+				return my_frame;
+			}
+
+			void cancel()
+			{
+#ifdef GIL_THREADS
+				{
+					std::lock_guard<std::mutex> lock(my_mutex);
+					my_cancelled = true;
+					my_next = my_last + 1;
+				}
+				my_work.notify_all();
+				my_ready.notify_all();
+				for (size_t i = 0; i < my_threads.size(); ++i)
+					my_threads[i].join();
+				my_threads.clear();
+#else
+				my_next = my_last + 1;
+#endif
+			}
+
+			Statistics statistics() const
+			{
+#ifdef GIL_THREADS
+				std::lock_guard<std::mutex> lock(my_mutex);
+#endif
+				return my_stats;
+			}
+
+		private:
+			SequenceReader(const SequenceReader&);
+			SequenceReader& operator =(const SequenceReader&);
+
+			void read_frame(I& image, int n)
+			{
+				const std::string filename = sequence_filename(my_pattern, n);
+				if (!read<Converter>(image, filename))
+					throw IOError("cannot read " + filename);
+			}
+
+			std::string my_pattern;
+			int my_last;
+			int my_next;	// the frame next() reads
+			int my_frame;	// the frame next() returned last
+			size_t my_depth;
+			Statistics my_stats;
+
+#ifdef GIL_THREADS
+			typedef std::chrono::steady_clock Clock;
+
+			// a frame read ahead, or being read, into my_buffers[buffer]
+			struct Slot {
+				int frame;
+				size_t buffer;
+				bool done;
+				std::exception_ptr error;
+			};
+
+			// frame n is decoded, with my_mutex held
+			bool ready(int n) const
+			{
+				return !my_slots.empty() && my_slots.front().frame == n &&
+					my_slots.front().done;
+			}
+
+			static double seconds(Clock::time_point a, Clock::time_point b)
+			{
+				return std::chrono::duration<double>(b - a).count();
+			}
+
+			// the decoding threads: take the next frame when a buffer is free
+			void run()
+			{
+				std::unique_lock<std::mutex> lock(my_mutex);
+				for (;;) {
+					while (!my_cancelled &&
+							(my_free.empty() || my_scheduled > my_last))
+						my_work.wait(lock);
+					if (my_cancelled)
+						return;
+
+					Slot slot;
+					slot.frame = my_scheduled++;
+					slot.buffer = my_free.back();
+					slot.done = false;
+					my_free.pop_back();
+					my_slots.push_back(slot);
+					lock.unlock();
+
+					const Clock::time_point start = Clock::now();
+					std::exception_ptr error;
+					try {
+						read_frame(my_buffers[slot.buffer], slot.frame);
+					} catch (...) {
+						error = std::current_exception();
+					}
+					const double t = seconds(start, Clock::now());
+
+					lock.lock();
+					my_stats.read_seconds += t;
+					for (size_t i = 0; i < my_slots.size(); ++i)
+						if (my_slots[i].frame == slot.frame) {
+							my_slots[i].done = true;
+							my_slots[i].error = error;
+						}
+					my_ready.notify_all();
+				}
+			}
+
+			int my_scheduled;		// the next frame to start reading
+			bool my_cancelled;
+			std::vector<I> my_buffers;
+			std::vector<size_t> my_free;
+			std::vector<Slot> my_slots;		// by frame, oldest first
+			std::vector<std::thread> my_threads;
+			mutable std::mutex my_mutex;
+			std::condition_variable my_work;	// a buffer was freed
+			std::condition_variable my_ready;	// a frame was decoded
+#endif
+	};
+
+}
+
+#endif // GIL_SEQUENCE_H
@@ -0,0 +1,37 @@
+#ifndef GIL_SIMD_H
+#define GIL_SIMD_H
+
+/* Instruction set selection for the vectorized code paths.
+ *
+ * The SIMD paths follow the compiler flags (-msse2, -mavx, -mfma, -mf16c,
+ * /arch:AVX ...). Define GIL_NO_SIMD to force the portable scalar code.
+ */
+
+#ifndef GIL_NO_SIMD
+	#if defined(__SSE2__) || defined(_M_X64) || \
+		(defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define GIL_SSE2
+	#endif
+
+	#if defined(__AVX__)
+		#define GIL_AVX
+	#endif
+
+	#if defined(__FMA__)
+		#define GIL_FMA
+	#endif
+
+	#if defined(__F16C__)
+		#define GIL_F16C
+	#endif
+#endif // GIL_NO_SIMD
+
+#ifdef GIL_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(GIL_AVX) || defined(GIL_F16C)
+#include <immintrin.h>
+#endif
+
+#endif // GIL_SIMD_H
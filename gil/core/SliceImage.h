@@ -6,6 +6,7 @@
 #include <stdexcept>
 
 #include "Color.h"
+#include "Converter.h"
 
 namespace gil {
 
@@ -67,6 +68,24 @@ namespace gil {
 					);
 			}
 
+			// the channel of pixel (0, y). Along a row it is found every
+			// step() values when the image has contiguous rows (see
+			// RowTrait).
+			value_type* row(size_type y)
+			{
+				return &(*this)(0, y);
+			}
+
+			const value_type* row(size_type y) const
+			{
+				return &(*this)(0, y);
+			}
+
+			static size_type step()
+			{
+				return ColorTrait<color_type>::Channels;
+			}
+
 			void fill(const_reference pixel)
 			{
 				std::fill(begin(), end(), pixel);
@@ -81,9 +100,7 @@ namespace gil {
 				assert( pos_x + img.width() <= this->width() );
 				assert( pos_y + img.height() <= this->height() );
 
-				for (size_type y(pos_y), iy(0); iy < img.height(); ++iy, ++y)
-					for (size_type x(pos_x), ix(0); ix < img.width(); ++ix, ++x)
-						(*this)(x, y) = img(ix, iy);
+				copy_rows(*this, img, pos_x, pos_y);
 			}
 
 			// iterator of SliceImage
@@ -191,6 +208,91 @@ namespace gil {
 			void operator =(const SliceImage<ImageType> &i);
 	};
 
+	// a channel of an image with contiguous rows is gathered and
+	// scattered row by row with a stride
+	template<bool Strided>
+	struct SliceCopy {
+		template<class D, class S>
+		static void copy(D& dst, const S& src, size_t x, size_t y)
+		{
+			RowCopy<false>::copy(dst, src, x, y);
+		}
+	};
+
+	template<>
+	struct SliceCopy<true> {
+		template<class D, class ImageType>
+		static void copy(
+			D& dst, const SliceImage<ImageType>& src, size_t x, size_t y
+		)
+		{
+			if (src.width() == 0)
+				return;
+			for (size_t iy = 0; iy < src.height(); ++iy)
+				copy_strided(
+					&dst(x, y + iy), 1,
+					src.row(iy), src.step(), src.width()
+				);
+		}
+
+		template<class ImageType, class S>
+		static void copy(
+			SliceImage<ImageType>& dst, const S& src, size_t x, size_t y
+		)
+		{
+			if (src.width() == 0)
+				return;
+			for (size_t iy = 0; iy < src.height(); ++iy)
+				copy_strided(
+					dst.row(y + iy) + x*dst.step(), dst.step(),
+					&src(0, iy), 1, src.width()
+				);
+		}
+
+		template<class A, class B>
+		static void copy(
+			SliceImage<A>& dst, const SliceImage<B>& src, size_t x, size_t y
+		)
+		{
+			if (src.width() == 0)
+				return;
+			for (size_t iy = 0; iy < src.height(); ++iy)
+				copy_strided(
+					dst.row(y + iy) + x*dst.step(), dst.step(),
+					src.row(iy), src.step(), src.width()
+				);
+		}
+	};
+
+	// see copy_rows in Converter.h
+	template<class D, class ImageType>
+	inline void copy_rows(
+		D& dst, const SliceImage<ImageType>& src, size_t x = 0, size_t y = 0
+	)
+	{
+		SliceCopy<RowTrait<D>::Contiguous && RowTrait<ImageType>::Contiguous>
+			::copy(dst, src, x, y);
+	}
+
+	template<class ImageType, class S>
+	inline void copy_rows(
+		SliceImage<ImageType>& dst, const S& src, size_t x = 0, size_t y = 0
+	)
+	{
+		SliceCopy<RowTrait<ImageType>::Contiguous && RowTrait<S>::Contiguous>
+			::copy(dst, src, x, y);
+	}
+
+	template<class A, class B>
+	inline void copy_rows(
+		SliceImage<A>& dst, const SliceImage<B>& src,
+		size_t x = 0, size_t y = 0
+	)
+	{
+		SliceCopy<RowTrait<A>::Contiguous && RowTrait<B>::Contiguous>
+			::copy(dst, src, x, y);
+	}
+
 	template <typename ImageType>
 	SliceImage<ImageType> slice_image(ImageType& img, size_t c)
 	{
@@ -2,8 +2,12 @@
 #define GIL_SUBIMAGE_H
 
 #include <algorithm>
+#include <cassert>
 #include <iterator>
 
+#include "Box.h"
+#include "Converter.h"
+
 namespace gil {
 	
 	template <typename I>
@@ -29,6 +33,14 @@ namespace gil {
 				// empty
 			}
 
+			SubImage(I& i, const Box& box)
+				: my_image(i),
+				  my_x_offset(box.x), my_y_offset(box.y),
+				  my_width(box.width), my_height(box.height)
+			{
+				// empty
+			}
+
 			~SubImage()
 			{
 				// empty
@@ -73,9 +85,7 @@ namespace gil {
 				assert( pos_x + img.width() <= this->width() );
 				assert( pos_y + img.height() <= this->height() );
 
-				for (size_type y(pos_y), iy(0); iy < img.height(); ++iy, ++y)
-					for (size_type x(pos_x), ix(0); ix < img.width(); ++ix, ++x)
-						(*this)(x, y) = img(ix, iy);
+				copy_rows(*this, img, pos_x, pos_y);
 			}
 
 			// iterator of subimage
@@ -186,6 +196,12 @@ namespace gil {
 	};
 
 
+	// a sub image has contiguous rows when its image has
+	template<typename I>
+	struct RowTrait< SubImage<I> > {
+		enum { Contiguous = RowTrait<I>::Contiguous };
+	};
+
 	template <typename I>
 	SubImage<I> sub_image(I& img, size_t x, size_t y, size_t w, size_t h)
 	{
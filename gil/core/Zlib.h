@@ -0,0 +1,24 @@
+#ifndef GIL_ZLIB_H
+#define GIL_ZLIB_H
+
+/* zlib support.
+ *
+ * The PNG writer and the EXR codec deflate and inflate by themselves
+ * with <zlib.h> when it is found. Define GIL_NO_ZLIB to do without: PNGs
+ * are then written through libpng in the library, and EXR files of ZIP
+ * and ZIPS compression are not written, nor decoded in-tree.
+ */
+
+#ifndef GIL_NO_ZLIB
+	#if defined(__has_include)
+		#if __has_include(<zlib.h>)
+			#define GIL_ZLIB
+		#endif
+	#endif
+#endif // GIL_NO_ZLIB
+
+#ifdef GIL_ZLIB
+#include <zlib.h>
+#endif
+
+#endif // GIL_ZLIB_H
@@ -38,19 +38,15 @@ namespace gil {
 			template <template<typename, typename> class Converter, typename I>
 			void read_pixels(I& image)
 			{
-				// typedef typename I::Converter Conv;
-				Converter<typename I::ColorType, Byte3> converter;
 				size_t w = image.width(), h = image.height();
 				std::vector<Byte3> buffer(w);
 				for(size_t y = 0; y < h; y++){
 					read_scanline(buffer);
 					// pixels in BMP file is stored upside down.
-					for(size_t x = 0; x < w; x++){
-						// change BGR to RGB
+					// change BGR to RGB
+					for(size_t x = 0; x < w; x++)
 						std::swap(buffer[x][0], buffer[x][2]);
-						image(x, h-y-1) = converter(buffer[x]);
-						//Conv::ext2int( image(x, h-y-1), buffer[x] );
-					}
+					store_row<Converter>(image, h-y-1, &buffer[0], w);
 				}
 			}
 
@@ -96,14 +92,10 @@ namespace gil {
 			>
 			void write_pixels(I& image)
 			{
-				//typedef typename I::Converter Conv;
-				Converter<T, typename I::ColorType> converter;
 				size_t w = image.width(), h = image.height();
 				std::vector<T> buffer(w);
 				for(size_t y = 0; y < h; y++){
-					for(size_t x = 0; x < w; x++)
-						buffer[x] = converter( image(x, h-y-1) );
-						//Conv::int2ext( buffer[x], image(x, h-y-1) );
+					load_row<Converter>(&buffer[0], image, h-y-1, w);
 
 					write_scanline(buffer);
 				}
@@ -24,11 +24,8 @@ namespace gil {
 				read((unsigned short(*)[4])row_pointers[0]);
 				image.allocate(my_width, my_height);
 
-				Converter<typename I::ColorType, Short4> converter;
 				for (size_t h = 0; h < my_height; ++h)
-					for (size_t w = 0; w < my_width; ++w)
-						image(w, h) = converter(row_pointers[h][w]);
-						//I::Converter::ext2int(image(w, h), row_pointers[h][w]);
+					store_row<Converter>(image, h, row_pointers[h], my_width);
 			}
 			template <typename I>
 			void operator ()(I& image, FILE* f)
@@ -1,20 +1,1681 @@
 #ifndef GIL_EXR_H
 #define GIL_EXR_H
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
+#include "../Box.h"
+#include "../Exception.h"
+#include "../Half.h"
 #include "../Image.h"
+#include "../PlanarImage.h"
+#include "../Parallel.h"
+#include "../Pool.h"
 #include "../Converter.h"
+#include "../Int2Type.h"
+#include "../Zlib.h"
 
 namespace gil {
 
 	//class C_IStream;
 	//class C_OStream;
 
+	/* ExrChannel:
+	 *   a channel of an EXR file as its header lists it. AOV layers are
+	 *   the prefixes of the names, "diffuse.R" or "N.X"; a name without a
+	 *   dot, "R" or "Z", belongs to the default layer.
+	 */
+	struct ExrChannel {
+		enum PixelType { UINT = 0, HALF = 1, FLOAT = 2 };	// as Imf::PixelType
+
+		ExrChannel()
+			: type(HALF), x_sampling(1), y_sampling(1), p_linear(false)
+		{
+			// empty
+		}
+
+		ExrChannel(const std::string& name, PixelType type)
+			: name(name), type(type), x_sampling(1), y_sampling(1),
+			  p_linear(false)
+		{
+			// empty
+		}
+
+		// the layer of the channel, "" for the default one
+		std::string layer() const
+		{
+			const std::string::size_type dot = name.rfind('.');
+			return (dot == std::string::npos) ? std::string() : name.substr(0, dot);
+		}
+
+		std::string name;
+		PixelType type;
+		int x_sampling;
+		int y_sampling;
+		bool p_linear;		// perceptually linear, B44 encodes its log
+	};
+
+	/* ExrSample:
+	 *   the channel type samples of type T are stored in. Halves, floats
+	 *   and unsigned ints are what EXR stores, and the codec reads and
+	 *   writes them in place; other samples go through floats.
+	 */
+	template<typename T>
+	struct ExrSample {
+		enum { Native = false };
+	};
+
+	template<>
+	struct ExrSample<Half1> {
+		enum { Native = true };
+		static ExrChannel::PixelType type() { return ExrChannel::HALF; }
+	};
+
+	template<>
+	struct ExrSample<Float1> {
+		enum { Native = true };
+		static ExrChannel::PixelType type() { return ExrChannel::FLOAT; }
+	};
+
+	template<>
+	struct ExrSample<unsigned int> {
+		enum { Native = true };
+		static ExrChannel::PixelType type() { return ExrChannel::UINT; }
+	};
+
+	/* ExrSlice:
+	 *   where the samples of one channel are in memory, like Imf::Slice.
+	 *   Sample (x, y) of the data window is at base + x*x_stride +
+	 *   y*y_stride, strides in bytes. A slice naming no channel of the
+	 *   file is filled with fill when read.
+	 */
+	struct ExrSlice {
+		ExrSlice()
+			: type(ExrChannel::HALF), base(NULL), x_stride(0), y_stride(0),
+			  fill(0.0)
+		{
+			// empty
+		}
+
+		std::string name;
+		ExrChannel::PixelType type;
+		char* base;
+		std::ptrdiff_t x_stride;
+		std::ptrdiff_t y_stride;
+		double fill;
+	};
+
+	/* ExrFrameBuffer:
+	 *   the slices a file is read into or written from. The channels of
+	 *   an image become slices over its own pixels, so they are decoded
+	 *   straight into it, and several images make up a file of layers:
+	 *
+	 *     HalfImage3 beauty;
+	 *     FloatImage1 depth;
+	 *     ...
+	 *     ExrFrameBuffer fb;
+	 *     fb.insert(beauty, exr_layer("", 3));       // R, G, B
+	 *     fb.insert(depth, std::vector<std::string>(1, "Z"));
+	 *     ExrWriter().write(f, w, h, fb);
+	 *
+	 *   The images must have the size of the data window and pixels of a
+	 *   type in ExrSample, and stay alive while the frame buffer is used.
+	 *   Channels of a file without a slice are skipped. Slices of
+	 *   channels the file lacks read as 0, or 1 for alpha ("A", "x.A").
+	 */
+	class ExrFrameBuffer {
+		public:
+			typedef std::vector<ExrSlice>::const_iterator const_iterator;
+
+			void insert(const ExrSlice& slice)
+			{
+				my_slices.push_back(slice);
+			}
+
+			// channel c of image is the slice names[c]
+			template<typename I>
+			void insert(const I& image, const std::vector<std::string>& names)
+			{
+				typedef typename ColorTrait<typename I::value_type>::BaseType T;
+				typedef typename I::value_type P;
+				check(names, ColorTrait<P>::channels());
+				if (image.width() == 0 || image.height() == 0)
+					return;
+
+				char *base = reinterpret_cast<char*>(
+					const_cast<P*>(&image(0, 0))
+				);
+				const std::ptrdiff_t y_stride = (image.height() > 1)
+					? reinterpret_cast<const char*>(&image(0, 1)) - base : 0;
+				for (size_t c = 0; c < names.size(); ++c) {
+					ExrSlice slice;
+					slice.name = names[c];
+					slice.type = ExrSample<T>::type();
+					slice.base = base + c*sizeof(T);
+					slice.x_stride = sizeof(P);
+					slice.y_stride = y_stride;
+					if (names[c] == "A" || (names[c].size() > 2 &&
+							names[c].compare(names[c].size() - 2, 2, ".A") == 0))
+						slice.fill = 1.0;
+					my_slices.push_back(slice);
+				}
+			}
+
+			// a channel per plane
+			template<typename T, size_t C, template<typename> class A>
+			void insert(
+				const PlanarImage<T, C, A>& image,
+				const std::vector<std::string>& names
+			)
+			{
+				check(names, C);
+				for (size_t c = 0; c < C; ++c)
+					insert(image.plane(c), std::vector<std::string>(1, names[c]));
+			}
+
+			size_t size() const
+			{
+				return my_slices.size();
+			}
+
+			const ExrSlice& operator [](size_t i) const
+			{
+				return my_slices[i];
+			}
+
+			const_iterator begin() const
+			{
+				return my_slices.begin();
+			}
+
+			const_iterator end() const
+			{
+				return my_slices.end();
+			}
+
+		private:
+			static void check(const std::vector<std::string>& names, size_t c)
+			{
+				if (names.size() != c)
+					throw std::invalid_argument("one channel name per channel");
+			}
+
+			std::vector<ExrSlice> my_slices;
+	};
+
+	/* exr_layer:
+	 *   the names of the c channels of a layer: "layer.R", "layer.G",
+	 *   "layer.B" and "layer.A", or "layer.Y" for one channel. The default
+	 *   layer "" gives R, G, B, A and Y.
+	 */
+	inline std::vector<std::string> exr_layer(const std::string& layer, size_t c)
+	{
+		static const char *const RGBA[] = { "R", "G", "B", "A" };
+		if (c == 0 || c > 4)
+			throw std::invalid_argument("exr_layer: 1 to 4 channels");
+		const std::string prefix = layer.empty() ? layer : layer + ".";
+		std::vector<std::string> names;
+		for (size_t i = 0; i < c; ++i)
+			names.push_back(prefix + ((c == 1) ? "Y" : RGBA[i]));
+		return names;
+	}
+
+	/* ExrCompression:
+	 *   how the line blocks of a file are compressed, as Imf::Compression.
+	 *   The codec below writes NONE, RLE, the lossy B44 and B44A and,
+	 *   with zlib, ZIPS, ZIP and the lossy PXR24 (see exr_writable).
+	 *   PIZ and DWA are listed for the files read through the library
+	 *   only: PIZ needs a Huffman coder and a wavelet transform, DWA a
+	 *   DCT and its quantization tables, each more code than the rest of
+	 *   the codec, for files the library reads anyway.
+	 */
+	enum ExrCompression {
+		EXR_NONE = 0, EXR_RLE, EXR_ZIPS, EXR_ZIP, EXR_PIZ, EXR_PXR24,
+		EXR_B44, EXR_B44A, EXR_DWAA, EXR_DWAB
+	};
+
+	// what files are written with unless told otherwise: ZIP, or RLE
+	// when built without zlib
+#ifdef GIL_ZLIB
+	const ExrCompression EXR_DEFAULT_COMPRESSION = EXR_ZIP;
+#else
+	const ExrCompression EXR_DEFAULT_COMPRESSION = EXR_RLE;
+#endif
+
+	// the scanlines a line block of each compression holds
+	inline size_t exr_block_lines(ExrCompression compression)
+	{
+		switch (compression) {
+			case EXR_ZIP:
+			case EXR_PXR24:
+				return 16;
+			case EXR_PIZ:
+			case EXR_B44:
+			case EXR_B44A:
+			case EXR_DWAA:
+				return 32;
+			case EXR_DWAB:
+				return 256;
+			default:
+				return 1;
+		}
+	}
+
+	/* exr_detail:
+	 *   the file format itself, for what the library's RGBA interface
+	 *   cannot do: single part scanline or tiled files of any channels,
+	 *   of any compression but PIZ and DWA. The layout follows the
+	 *   OpenEXR file specification; blocks are stored raw when
+	 *   compressing does not make them smaller, as OpenEXR does.
+	 */
+	namespace exr_detail {
+
+		inline unsigned int get16(const unsigned char* p)
+		{
+			return p[0] | (p[1] << 8);
+		}
+
+		inline unsigned int get32(const unsigned char* p)
+		{
+			return p[0] | (p[1] << 8) | (p[2] << 16) |
+				(static_cast<unsigned int>(p[3]) << 24);
+		}
+
+		inline unsigned long long get64(const unsigned char* p)
+		{
+			return get32(p) |
+				(static_cast<unsigned long long>( get32(p + 4) ) << 32);
+		}
+
+		inline void put16(unsigned char* p, unsigned int v)
+		{
+			p[0] = static_cast<unsigned char>(v);
+			p[1] = static_cast<unsigned char>(v >> 8);
+		}
+
+		inline void put32(unsigned char* p, unsigned int v)
+		{
+			put16(p, v & 0xffff);
+			put16(p + 2, v >> 16);
+		}
+
+		inline void put64(unsigned char* p, unsigned long long v)
+		{
+			put32(p, static_cast<unsigned int>(v));
+			put32(p + 4, static_cast<unsigned int>(v >> 32));
+		}
+
+		inline void append32(std::vector<unsigned char>& out, unsigned int v)
+		{
+			out.resize(out.size() + 4);
+			put32(&out[out.size() - 4], v);
+		}
+
+		inline void append(std::vector<unsigned char>& out, const std::string& s)
+		{
+			out.insert(out.end(), s.begin(), s.end());
+			out.push_back(0);
+		}
+
+		inline void bytes(FILE* f, void* buf, size_t n)
+		{
+			if (fread(buf, 1, n, f) != n) {
+				if (feof(f))
+					throw EndOfFile("unexpected end-of-file");
+				throw IOError("unknown read error");
+			}
+		}
+
+		inline void write_bytes(FILE* f, const void* buf, size_t n)
+		{
+			if (n && fwrite(buf, 1, n, f) != n)
+				throw IOError("exr: cannot write");
+		}
+
+		inline void seek(FILE* f, long pos)
+		{
+			if (fseek(f, pos, SEEK_SET) != 0)
+				throw IOError("unknown fseek error");
+		}
+
+		inline size_t sample_size(ExrChannel::PixelType type)
+		{
+			return (type == ExrChannel::HALF) ? 2 : 4;
+		}
+
+		inline int floor_div(int a, int b)
+		{
+			return (a >= 0) ? a / b : -((b - 1 - a) / b);
+		}
+
+		// the multiples of s in [a0, a1], where a channel sampled every
+		// s pixels has samples
+		inline size_t samples(int a0, int a1, int s)
+		{
+			if (a1 < a0)
+				return 0;
+			return static_cast<size_t>( floor_div(a1, s) - floor_div(a0 - 1, s) );
+		}
+
+		// the size of level l of a side of n pixels
+		inline size_t level_size(size_t n, int l, bool round_up)
+		{
+			size_t size = n >> l;
+			if (round_up && (size << l) < n)
+				++size;
+			return std::max<size_t>(size, 1);
+		}
+
+		// the levels down to one pixel of a side of n pixels
+		inline int level_count(size_t n, bool round_up)
+		{
+			int levels = 1;
+			bool odd = false;
+			for (; n > 1; n >>= 1, ++levels)
+				odd = odd || (n & 1);
+			return (round_up && odd) ? levels + 1 : levels;
+		}
+
+		// the samples of the largest data window read, 16 GiB of halves,
+		// whose sides must fit in an int too: hostile headers are refused
+		// before anything is allocated
+		const unsigned long long MAX_SAMPLES = 1ull << 33;
+
+		/* Header:
+		 *   what the codec needs of the header of a single part file. The
+		 *   data window is (min_x, min_y) to (max_x, max_y), inclusive.
+		 *   Tiled files have tiles of tile_width x tile_height pixels on
+		 *   every level, and a level keeps the top left corner of the
+		 *   data window.
+		 */
+		struct Header {
+			enum LevelMode { ONE_LEVEL = 0, MIPMAP = 1, RIPMAP = 2 };
+
+			Header()
+				: compression(EXR_NONE), min_x(0), min_y(0), max_x(-1), max_y(-1),
+				  tiled(false), tile_width(0), tile_height(0),
+				  level_mode(ONE_LEVEL), round_up(false)
+			{
+				// empty
+			}
+
+			// in 64 bits: a window of any two ints does not overflow
+			size_t width() const
+			{
+				return static_cast<size_t>(
+					static_cast<long long>(max_x) - min_x + 1
+				);
+			}
+
+			size_t height() const
+			{
+				return static_cast<size_t>(
+					static_cast<long long>(max_y) - min_y + 1
+				);
+			}
+
+			const ExrChannel* find(const std::string& name) const
+			{
+				for (size_t i = 0; i < channels.size(); ++i)
+					if (channels[i].name == name)
+						return &channels[i];
+				return NULL;
+			}
+
+			int levels_x() const
+			{
+				switch (level_mode) {
+					case MIPMAP:
+						return level_count(std::max(width(), height()), round_up);
+					case RIPMAP:
+						return level_count(width(), round_up);
+					default:
+						return 1;
+				}
+			}
+
+			int levels_y() const
+			{
+				return (level_mode == RIPMAP) ?
+					level_count(height(), round_up) : levels_x();
+			}
+
+			size_t level_width(int lx) const
+			{
+				return level_size(width(), lx, round_up);
+			}
+
+			size_t level_height(int ly) const
+			{
+				return level_size(height(), ly, round_up);
+			}
+
+			size_t tiles_x(int lx) const
+			{
+				return (level_width(lx) + tile_width - 1) / tile_width;
+			}
+
+			size_t tiles_y(int ly) const
+			{
+				return (level_height(ly) + tile_height - 1) / tile_height;
+			}
+
+			// the chunks of a file: line blocks, or the tiles of every
+			// level, mip levels one after the other, rip levels row by row
+			size_t chunks() const
+			{
+				if (!tiled) {
+					const size_t lines = exr_block_lines(compression);
+					return (height() + lines - 1) / lines;
+				}
+				return first_tile(level_mode == RIPMAP ? 0 : levels_x(), levels_y());
+			}
+
+			// the chunk of the first tile of level (lx, ly)
+			size_t first_tile(int lx, int ly) const
+			{
+				size_t n = 0;
+				if (level_mode == RIPMAP) {
+					for (int y = 0; y < ly; ++y)
+						for (int x = 0; x < levels_x(); ++x)
+							n += tiles_x(x) * tiles_y(y);
+					for (int x = 0; x < lx; ++x)
+						n += tiles_x(x) * tiles_y(ly);
+				} else {
+					for (int l = 0; l < lx; ++l)
+						n += tiles_x(l) * tiles_y(l);
+				}
+				return n;
+			}
+
+			std::vector<ExrChannel> channels;	// sorted by name
+			ExrCompression compression;
+			int min_x;
+			int min_y;
+			int max_x;
+			int max_y;
+			bool tiled;
+			size_t tile_width;
+			size_t tile_height;
+			LevelMode level_mode;
+			bool round_up;
+		};
+
+		inline bool by_name(const ExrChannel& a, const ExrChannel& b)
+		{
+			return a.name < b.name;
+		}
+
+		// a null terminated name, false for the empty one
+		inline bool read_name(FILE* f, std::string& name)
+		{
+			name.clear();
+			for (;;) {
+				const int c = fgetc(f);
+				if (c == EOF)
+					throw EndOfFile("unexpected end-of-file");
+				if (c == 0)
+					return !name.empty();
+				if (name.size() == 255)
+					throw InvalidFormat("exr: name too long");
+				name += static_cast<char>(c);
+			}
+		}
+
+		inline void parse_channels(
+			const unsigned char* v, size_t size, std::vector<ExrChannel>& channels
+		)
+		{
+			channels.clear();
+			size_t at = 0;
+			while (at < size && v[at]) {
+				const unsigned char* end = static_cast<const unsigned char*>(
+					std::memchr(v + at, 0, size - at)
+				);
+				const size_t length = end ? static_cast<size_t>(end - (v + at)) : size;
+				if (at + length + 17 > size)
+					throw InvalidFormat("exr: invalid channel list");
+				ExrChannel channel;
+				channel.name.assign(reinterpret_cast<const char*>(v + at), length);
+				at += length + 1;
+				const unsigned int type = get32(v + at);
+				if (type > ExrChannel::FLOAT)
+					throw InvalidFormat("exr: invalid channel type");
+				channel.type = static_cast<ExrChannel::PixelType>(type);
+				channel.p_linear = v[at + 4] != 0;
+				channel.x_sampling = static_cast<int>( get32(v + at + 8) );
+				channel.y_sampling = static_cast<int>( get32(v + at + 12) );
+				if (channel.x_sampling < 1 || channel.y_sampling < 1)
+					throw InvalidFormat("exr: invalid channel sampling");
+				channels.push_back(channel);
+				at += 16;
+			}
+		}
+
+		// the header after the magic number and version
+		inline void read_header(FILE* f, Header& header)
+		{
+			unsigned char h[8];
+			bytes(f, h, 8);
+			if (get32(h) != 20000630 || h[4] != 2)
+				throw InvalidFormat("exr: invalid magic number or version");
+			if (h[5] & 0x18)
+				throw InvalidFormat("exr: deep and multi-part files are not supported");
+			header.tiled = (h[5] & 0x02) != 0;
+
+			bool window = false;
+			std::string name, type;
+			std::vector<unsigned char> value;
+			while (read_name(f, name)) {
+				read_name(f, type);
+				unsigned char s[4];
+				bytes(f, s, 4);
+				const unsigned int size = get32(s);
+				if (name != "channels" && name != "compression" &&
+						name != "dataWindow" && name != "tiles") {
+					if (fseek(f, static_cast<long>(size), SEEK_CUR) != 0)
+						throw IOError("unknown fseek error");
+					continue;
+				}
+				if (size > (1u << 20))
+					throw InvalidFormat("exr: attribute too large");
+				value.resize(size + 1);
+				bytes(f, &value[0], size);
+				const unsigned char* v = &value[0];
+
+				if (name == "channels") {
+					parse_channels(v, size, header.channels);
+				} else if (name == "compression" && size >= 1) {
+					if (v[0] > EXR_DWAB)
+						throw InvalidFormat("exr: invalid compression");
+					header.compression = static_cast<ExrCompression>(v[0]);
+				} else if (name == "dataWindow" && size >= 16) {
+					header.min_x = static_cast<int>( get32(v) );
+					header.min_y = static_cast<int>( get32(v + 4) );
+					header.max_x = static_cast<int>( get32(v + 8) );
+					header.max_y = static_cast<int>( get32(v + 12) );
+					window = true;
+				} else if (name == "tiles" && size >= 9) {
+					header.tile_width = get32(v);
+					header.tile_height = get32(v + 4);
+					if ((v[8] & 0x0f) > Header::RIPMAP)
+						throw InvalidFormat("exr: invalid level mode");
+					header.level_mode = static_cast<Header::LevelMode>(v[8] & 0x0f);
+					header.round_up = (v[8] >> 4) == 1;
+				}
+			}
+			if (!window || header.max_x < header.min_x ||
+					header.max_y < header.min_y)
+				throw InvalidFormat("exr: invalid data window");
+			const long long width = static_cast<long long>(header.max_x) -
+				header.min_x + 1;
+			const long long height = static_cast<long long>(header.max_y) -
+				header.min_y + 1;
+			const long long channels = std::max<long long>(
+				static_cast<long long>(header.channels.size()), 1
+			);
+			if (width > 0x7fffffff || height > 0x7fffffff ||
+					static_cast<unsigned long long>(width) >
+					MAX_SAMPLES / height / channels)
+				throw InvalidFormat("exr: data window too large");
+			if (header.tiled && (header.tile_width == 0 ||
+					header.tile_height == 0 ||
+					header.tile_width > 0x7fffffff ||
+					header.tile_height > 0x7fffffff))
+				throw InvalidFormat("exr: invalid tile description");
+			for (size_t i = 0; header.tiled && i < header.channels.size(); ++i)
+				if (header.channels[i].x_sampling != 1 ||
+						header.channels[i].y_sampling != 1)
+					throw InvalidFormat("exr: subsampled channels in a tiled file");
+		}
+
+		inline void attribute(
+			std::vector<unsigned char>& out, const std::string& name,
+			const std::string& type, const unsigned char* value, size_t size
+		)
+		{
+			append(out, name);
+			append(out, type);
+			append32(out, static_cast<unsigned int>(size));
+			out.insert(out.end(), value, value + size);
+		}
+
+		// a scanline file, lines in increasing order
+		inline void write_header(FILE* f, const Header& header)
+		{
+			std::vector<unsigned char> out;
+			append32(out, 20000630);
+			append32(out, 2);
+
+			std::vector<unsigned char> list;
+			for (size_t i = 0; i < header.channels.size(); ++i) {
+				const ExrChannel& channel = header.channels[i];
+				if (channel.name.size() > 31)
+					out[5] |= 0x04;		// long names
+				append(list, channel.name);
+				append32(list, channel.type);
+				append32(list, channel.p_linear ? 1 : 0);	// and reserved
+				append32(list, channel.x_sampling);
+				append32(list, channel.y_sampling);
+			}
+			list.push_back(0);
+			attribute(out, "channels", "chlist", &list[0], list.size());
+
+			const unsigned char compression =
+				static_cast<unsigned char>(header.compression);
+			attribute(out, "compression", "compression", &compression, 1);
+
+			unsigned char box[16];
+			put32(box, header.min_x);
+			put32(box + 4, header.min_y);
+			put32(box + 8, header.max_x);
+			put32(box + 12, header.max_y);
+			attribute(out, "dataWindow", "box2i", box, 16);
+			attribute(out, "displayWindow", "box2i", box, 16);
+
+			const unsigned char increasing_y = 0;
+			attribute(out, "lineOrder", "lineOrder", &increasing_y, 1);
+
+			unsigned char number[8];
+			const float one = 1.0f, zero = 0.0f;
+			unsigned int bits;
+			std::memcpy(&bits, &one, 4);
+			put32(number, bits);
+			attribute(out, "pixelAspectRatio", "float", number, 4);
+			std::memcpy(&bits, &zero, 4);
+			put32(number, bits);
+			put32(number + 4, bits);
+			attribute(out, "screenWindowCenter", "v2f", number, 8);
+			std::memcpy(&bits, &one, 4);
+			put32(number, bits);
+			attribute(out, "screenWindowWidth", "float", number, 4);
+
+			out.push_back(0);
+			write_bytes(f, &out[0], out.size());
+		}
+
+		// the compressions the codec below handles
+		inline bool supported(ExrCompression compression)
+		{
+			switch (compression) {
+				case EXR_NONE:
+				case EXR_RLE:
+				case EXR_B44:
+				case EXR_B44A:
+					return true;
+#ifdef GIL_ZLIB
+				case EXR_ZIPS:
+				case EXR_ZIP:
+				case EXR_PXR24:
+					return true;
+#endif
+				default:
+					return false;
+			}
+		}
+
+		inline const char* compression_name(ExrCompression compression)
+		{
+			static const char *const NAMES[] = {
+				"NONE", "RLE", "ZIPS", "ZIP", "PIZ", "PXR24",
+				"B44", "B44A", "DWAA", "DWAB"
+			};
+			const size_t n = sizeof(NAMES) / sizeof(NAMES[0]);
+			return static_cast<size_t>(compression) < n ?
+				NAMES[compression] : "unknown";
+		}
+
+		// RLE and ZIP store the bytes of a block with the even ones first,
+		// and each byte as the difference to the previous one
+		inline void predict(
+			const unsigned char* in, size_t n, std::vector<unsigned char>& out
+		)
+		{
+			out.resize(n);
+			if (n == 0)
+				return;
+			unsigned char *t1 = &out[0], *t2 = &out[0] + (n + 1) / 2;
+			for (size_t i = 0; i < n; i += 2) {
+				*t1++ = in[i];
+				if (i + 1 < n)
+					*t2++ = in[i + 1];
+			}
+			int p = out[0];
+			for (size_t i = 1; i < n; ++i) {
+				const int d = int(out[i]) - p + (128 + 256);
+				p = out[i];
+				out[i] = static_cast<unsigned char>(d);
+			}
+		}
+
+		inline void unpredict(
+			std::vector<unsigned char>& in, unsigned char* out, size_t n
+		)
+		{
+			for (size_t i = 1; i < n; ++i)
+				in[i] = static_cast<unsigned char>(int(in[i - 1]) + int(in[i]) - 128);
+			const unsigned char *t1 = &in[0], *t2 = &in[0] + (n + 1) / 2;
+			for (size_t i = 0; i < n; i += 2) {
+				out[i] = *t1++;
+				if (i + 1 < n)
+					out[i + 1] = *t2++;
+			}
+		}
+
+		inline void rle_compress(
+			const std::vector<unsigned char>& in, std::vector<unsigned char>& out
+		)
+		{
+			const size_t MIN_RUN = 3, MAX_RUN = 127;
+			const size_t n = in.size();
+			out.clear();
+			size_t start = 0, end = 1;
+			while (start < n) {
+				while (end < n && in[start] == in[end] &&
+						end - start - 1 < MAX_RUN)
+					++end;
+				if (end - start >= MIN_RUN) {
+					out.push_back( static_cast<unsigned char>(end - start - 1) );
+					out.push_back(in[start]);
+					start = end;
+				} else {
+					while (end < n &&
+							(end + 1 >= n || in[end] != in[end + 1] ||
+							 end + 2 >= n || in[end + 1] != in[end + 2]) &&
+							end - start < MAX_RUN)
+						++end;
+					out.push_back( static_cast<unsigned char>(
+						-static_cast<int>(end - start)
+					) );
+					out.insert(out.end(), in.begin() + start, in.begin() + end);
+					start = end;
+				}
+				++end;
+			}
+		}
+
+		inline void rle_uncompress(
+			const unsigned char* in, size_t size, std::vector<unsigned char>& out
+		)
+		{
+			const size_t n = out.size();
+			size_t at = 0, o = 0;
+			while (at < size) {
+				const int count = static_cast<signed char>(in[at++]);
+				if (count < 0) {
+					const size_t m = static_cast<size_t>(-count);
+					if (at + m > size || o + m > n)
+						throw InvalidFormat("exr: invalid rle data");
+					std::memcpy(&out[o], in + at, m);
+					at += m;
+					o += m;
+				} else {
+					const size_t m = static_cast<size_t>(count) + 1;
+					if (at >= size || o + m > n)
+						throw InvalidFormat("exr: invalid rle data");
+					std::memset(&out[o], in[at++], m);
+					o += m;
+				}
+			}
+			if (o != n)
+				throw InvalidFormat("exr: invalid rle data");
+		}
+
+		/* Block:
+		 *   the pixels (x0, y0) to (x1, y1) of a line block or tile, in
+		 *   data window coordinates, and their bytes as stored.
+		 */
+		struct Block {
+			int x0;
+			int y0;
+			int x1;
+			int y1;
+			std::vector<unsigned char> data;
+		};
+
+#ifdef GIL_ZLIB
+		inline void zip_compress(
+			const unsigned char* in, size_t n, std::vector<unsigned char>& out
+		)
+		{
+			uLongf size = compressBound( static_cast<uLong>(n) );
+			out.resize(size);
+			if (::compress2(&out[0], &size, n ? in : NULL,
+					static_cast<uLong>(n), Z_DEFAULT_COMPRESSION) != Z_OK)
+				throw std::runtime_error("exr: deflate failed");
+			out.resize(size);
+		}
+
+		// exactly n bytes into out, InvalidFormat if not
+		inline void zip_uncompress(
+			const unsigned char* in, size_t size, unsigned char* out, size_t n
+		)
+		{
+			uLongf length = static_cast<uLongf>(n);
+			if (::uncompress(out, &length, in,
+					static_cast<uLong>(size)) != Z_OK || length != n)
+				throw InvalidFormat("exr: invalid zip data");
+		}
+#endif
+
+		// the bytes of each sample PXR24 keeps: floats lose their last
+		inline size_t pxr24_size(ExrChannel::PixelType type)
+		{
+			return (type == ExrChannel::FLOAT) ? 3 : sample_size(type);
+		}
+
+		// the top 24 bits of a float, rounded to nearest, as PXR24 keeps
+		// them. Values the rounding would overflow are cut instead, and
+		// NaNs keep their sign and a payload that is not zero.
+		inline unsigned int float24(unsigned int bits)
+		{
+			const unsigned int s = bits & 0x80000000u;
+			const unsigned int e = bits & 0x7f800000u;
+			const unsigned int m = bits & 0x007fffffu;
+			unsigned int i;
+			if (e == 0x7f800000u) {
+				i = (e >> 8) | (m >> 8);
+				if (m && !(m >> 8))
+					i |= 1;
+			} else {
+				i = ((e | m) + (m & 0x80)) >> 8;
+				if (i >= 0x7f8000)
+					i = (e | m) >> 8;
+			}
+			return (s >> 8) | i;
+		}
+
+		/* pxr24_compress, pxr24_uncompress:
+		 *   PXR24 stores every line of every channel of a block as the
+		 *   differences between its samples, floats cut to 24 bits (see
+		 *   float24), in planes of their bytes, the most significant first,
+		 *   and deflates the lot. Halves and unsigned ints are kept whole.
+		 */
+		inline void pxr24_compress(
+			const Header& header, const Block& b, const unsigned char* raw,
+			std::vector<unsigned char>& tmp
+		)
+		{
+			unsigned char *out = &tmp[0];
+			for (int y = b.y0; y <= b.y1; ++y)
+				for (size_t c = 0; c < header.channels.size(); ++c) {
+					const ExrChannel& channel = header.channels[c];
+					if (samples(y, y, channel.y_sampling) == 0)
+						continue;
+					const size_t n = samples(b.x0, b.x1, channel.x_sampling);
+					const size_t size = sample_size(channel.type);
+					const size_t planes = pxr24_size(channel.type);
+					unsigned int previous = 0;
+					for (size_t i = 0; i < n; ++i, raw += size) {
+						unsigned int v = (size == 2) ? get16(raw) : get32(raw);
+						if (channel.type == ExrChannel::FLOAT)
+							v = float24(v);
+						const unsigned int diff = v - previous;
+						previous = v;
+						for (size_t k = 0; k < planes; ++k)
+							out[k*n + i] = static_cast<unsigned char>(
+								diff >> (8 * (planes - 1 - k))
+							);
+					}
+					out += planes * n;
+				}
+			tmp.resize(out - &tmp[0]);
+		}
+
+		inline void pxr24_uncompress(
+			const Header& header, const Block& b,
+			const std::vector<unsigned char>& tmp, unsigned char* raw
+		)
+		{
+			const unsigned char *in = &tmp[0];
+			for (int y = b.y0; y <= b.y1; ++y)
+				for (size_t c = 0; c < header.channels.size(); ++c) {
+					const ExrChannel& channel = header.channels[c];
+					if (samples(y, y, channel.y_sampling) == 0)
+						continue;
+					const size_t n = samples(b.x0, b.x1, channel.x_sampling);
+					const size_t size = sample_size(channel.type);
+					const size_t planes = pxr24_size(channel.type);
+					const size_t low = (channel.type == ExrChannel::FLOAT) ? 8 : 0;
+					unsigned int v = 0;
+					for (size_t i = 0; i < n; ++i, raw += size) {
+						unsigned int diff = 0;
+						for (size_t k = 0; k < planes; ++k)
+							diff |= static_cast<unsigned int>(in[k*n + i]) <<
+								(8 * (planes - 1 - k) + low);
+						v += diff;
+						if (size == 2)
+							put16(raw, v & 0xffff);
+						else
+							put32(raw, v);
+					}
+					in += planes * n;
+				}
+		}
+
+		// the bytes PXR24 planes of a block take before deflating
+		inline size_t pxr24_block_size(const Header& header, const Block& b)
+		{
+			size_t size = 0;
+			for (size_t c = 0; c < header.channels.size(); ++c) {
+				const ExrChannel& channel = header.channels[c];
+				size += samples(b.x0, b.x1, channel.x_sampling) *
+					samples(b.y0, b.y1, channel.y_sampling) *
+					pxr24_size(channel.type);
+			}
+			return size;
+		}
+
+		/* B44Tables:
+		 *   the halves of perceptually linear channels go through B44 as
+		 *   8 log(h), and come back as exp(h / 8). Infinities, NaNs and,
+		 *   for the log, negative values give 0; exponents too large for
+		 *   a half give the largest one.
+		 */
+		struct B44Tables {
+			B44Tables(): exp(1 << 16), log(1 << 16)
+			{
+				for (size_t i = 0; i < exp.size(); ++i) {
+					const unsigned short bits = static_cast<unsigned short>(i);
+					const double h = Half::to_float(bits);
+					const bool finite = (bits & 0x7c00) != 0x7c00;
+					if (!finite)
+						exp[i] = 0;
+					else if (h >= 8 * std::log(65504.0))
+						exp[i] = 0x7bff;
+					else
+						exp[i] = Half::from_float(
+							static_cast<float>(std::exp(h / 8))
+						);
+					log[i] = (!finite || h < 0) ? 0 : Half::from_float(
+						static_cast<float>(8 * std::log(h))
+					);
+				}
+			}
+
+			std::vector<unsigned short> exp;
+			std::vector<unsigned short> log;
+		};
+
+		inline const B44Tables& b44_tables()
+		{
+			static const B44Tables tables;
+			return tables;
+		}
+
+		// x / 2^shift rounded to nearest, ties to even
+		inline int shift_and_round(int x, int shift)
+		{
+			x <<= 1;
+			const int a = (1 << shift) - 1;
+			shift += 1;
+			const int b = (x >> shift) & 1;
+			return (x + a + b) >> shift;
+		}
+
+		/* b44_pack, b44_unpack:
+		 *   a 4 x 4 block of halves, row by row, as 14 bytes: the first
+		 *   half and the differences of its neighbours, 6 bits each, with
+		 *   a common scale. Halves are compared as sign-magnitude numbers
+		 *   turned into ordered ones; infinities and NaNs become 0. With
+		 *   flat, blocks of one value take 3 bytes, the third 0xfc, which
+		 *   14 bytes never start with. exact keeps the largest value as it
+		 *   is.
+		 */
+		inline size_t b44_pack(
+			const unsigned short s[16], unsigned char b[14],
+			bool flat, bool exact
+		)
+		{
+			const int BIAS = 0x20;
+			unsigned short t[16];
+			for (size_t i = 0; i < 16; ++i) {
+				if ((s[i] & 0x7c00) == 0x7c00)
+					t[i] = 0x8000;
+				else if (s[i] & 0x8000)
+					t[i] = static_cast<unsigned short>(~s[i]);
+				else
+					t[i] = static_cast<unsigned short>(s[i] | 0x8000);
+			}
+			unsigned short t_max = 0;
+			for (size_t i = 0; i < 16; ++i)
+				t_max = std::max(t_max, t[i]);
+
+			int d[16], r[15], r_min, r_max;
+			int shift = -1;
+			do {
+				shift += 1;
+				for (size_t i = 0; i < 16; ++i)
+					d[i] = shift_and_round(t_max - t[i], shift);
+				r[ 0] = d[ 0] - d[ 4] + BIAS;
+				r[ 1] = d[ 4] - d[ 8] + BIAS;
+				r[ 2] = d[ 8] - d[12] + BIAS;
+				r[ 3] = d[ 0] - d[ 1] + BIAS;
+				r[ 4] = d[ 4] - d[ 5] + BIAS;
+				r[ 5] = d[ 8] - d[ 9] + BIAS;
+				r[ 6] = d[12] - d[13] + BIAS;
+				r[ 7] = d[ 1] - d[ 2] + BIAS;
+				r[ 8] = d[ 5] - d[ 6] + BIAS;
+				r[ 9] = d[ 9] - d[10] + BIAS;
+				r[10] = d[13] - d[14] + BIAS;
+				r[11] = d[ 2] - d[ 3] + BIAS;
+				r[12] = d[ 6] - d[ 7] + BIAS;
+				r[13] = d[10] - d[11] + BIAS;
+				r[14] = d[14] - d[15] + BIAS;
+				r_min = r_max = r[0];
+				for (size_t i = 1; i < 15; ++i) {
+					r_min = std::min(r_min, r[i]);
+					r_max = std::max(r_max, r[i]);
+				}
+			} while (r_min < 0 || r_max > 0x3f);
+
+			if (flat && r_min == BIAS && r_max == BIAS) {
+				b[0] = static_cast<unsigned char>(t[0] >> 8);
+				b[1] = static_cast<unsigned char>(t[0]);
+				b[2] = 0xfc;
+				return 3;
+			}
+			if (exact)
+				t[0] = static_cast<unsigned short>(t_max - (d[0] << shift));
+
+			b[ 0] = static_cast<unsigned char>(t[0] >> 8);
+			b[ 1] = static_cast<unsigned char>(t[0]);
+			b[ 2] = static_cast<unsigned char>((shift << 2) | (r[ 0] >> 4));
+			b[ 3] = static_cast<unsigned char>((r[ 0] << 4) | (r[ 1] >> 2));
+			b[ 4] = static_cast<unsigned char>((r[ 1] << 6) |  r[ 2]);
+			b[ 5] = static_cast<unsigned char>((r[ 3] << 2) | (r[ 4] >> 4));
+			b[ 6] = static_cast<unsigned char>((r[ 4] << 4) | (r[ 5] >> 2));
+			b[ 7] = static_cast<unsigned char>((r[ 5] << 6) |  r[ 6]);
+			b[ 8] = static_cast<unsigned char>((r[ 7] << 2) | (r[ 8] >> 4));
+			b[ 9] = static_cast<unsigned char>((r[ 8] << 4) | (r[ 9] >> 2));
+			b[10] = static_cast<unsigned char>((r[ 9] << 6) |  r[10]);
+			b[11] = static_cast<unsigned char>((r[11] << 2) | (r[12] >> 4));
+			b[12] = static_cast<unsigned char>((r[12] << 4) | (r[13] >> 2));
+			b[13] = static_cast<unsigned char>((r[13] << 6) |  r[14]);
+			return 14;
+		}
+
+		// the bytes of a block at b, up to end, into s; how many were read
+		inline size_t b44_unpack(
+			const unsigned char* b, const unsigned char* end,
+			unsigned short s[16]
+		)
+		{
+			if (end - b < 3)
+				throw InvalidFormat("exr: invalid b44 data");
+			size_t size = 3;
+			if (b[2] >= (13 << 2)) {
+				for (size_t i = 0; i < 16; ++i)
+					s[i] = static_cast<unsigned short>((b[0] << 8) | b[1]);
+			} else {
+				if (end - b < 14)
+					throw InvalidFormat("exr: invalid b44 data");
+				size = 14;
+				const unsigned int shift = b[2] >> 2;
+				const unsigned int bias = 0x20u << shift;
+				// the 6 bit differences, in the order b44_pack stores them
+				unsigned int r[15];
+				r[ 0] = ((b[ 2] << 4) | (b[ 3] >> 4)) & 0x3f;
+				r[ 1] = ((b[ 3] << 2) | (b[ 4] >> 6)) & 0x3f;
+				r[ 2] =   b[ 4]                       & 0x3f;
+				r[ 3] =   b[ 5] >> 2;
+				r[ 4] = ((b[ 5] << 4) | (b[ 6] >> 4)) & 0x3f;
+				r[ 5] = ((b[ 6] << 2) | (b[ 7] >> 6)) & 0x3f;
+				r[ 6] =   b[ 7]                       & 0x3f;
+				r[ 7] =   b[ 8] >> 2;
+				r[ 8] = ((b[ 8] << 4) | (b[ 9] >> 4)) & 0x3f;
+				r[ 9] = ((b[ 9] << 2) | (b[10] >> 6)) & 0x3f;
+				r[10] =   b[10]                       & 0x3f;
+				r[11] =   b[11] >> 2;
+				r[12] = ((b[11] << 4) | (b[12] >> 4)) & 0x3f;
+				r[13] = ((b[12] << 2) | (b[13] >> 6)) & 0x3f;
+				r[14] =   b[13]                       & 0x3f;
+				// the sample each difference is taken from, and to
+				static const unsigned char FROM[15] = {
+					0, 4, 8, 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14
+				};
+				static const unsigned char TO[15] = {
+					4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15
+				};
+				s[0] = static_cast<unsigned short>((b[0] << 8) | b[1]);
+				for (size_t i = 0; i < 15; ++i)
+					s[TO[i]] = static_cast<unsigned short>(
+						s[FROM[i]] + (r[i] << shift) - bias
+					);
+			}
+			for (size_t i = 0; i < 16; ++i)
+				s[i] = (s[i] & 0x8000) ?
+					static_cast<unsigned short>(s[i] & 0x7fff) :
+					static_cast<unsigned short>(~s[i]);
+			return size;
+		}
+
+		/* Plane:
+		 *   the samples of a channel in a block, all of its lines one
+		 *   after the other, for B44 to take 4 x 4 pixels at a time.
+		 */
+		struct Plane {
+			size_t offset;	// in the planes of a block
+			size_t nx;
+			size_t ny;
+		};
+
+		// the planes of a block, and their size in bytes
+		inline size_t planes(
+			const Header& header, const Block& b, std::vector<Plane>& out
+		)
+		{
+			out.resize(header.channels.size());
+			size_t size = 0;
+			for (size_t c = 0; c < header.channels.size(); ++c) {
+				const ExrChannel& channel = header.channels[c];
+				out[c].offset = size;
+				out[c].nx = samples(b.x0, b.x1, channel.x_sampling);
+				out[c].ny = samples(b.y0, b.y1, channel.y_sampling);
+				size += out[c].nx * out[c].ny * sample_size(channel.type);
+			}
+			return size;
+		}
+
+		// where each line of each channel of a block goes in its planes,
+		// in the order the lines are stored
+		inline void plane_lines(
+			const Header& header, const Block& b, const std::vector<Plane>& p,
+			std::vector<std::pair<size_t, size_t> >& lines
+		)
+		{
+			std::vector<size_t> row(p.size(), 0);
+			lines.clear();
+			for (int y = b.y0; y <= b.y1; ++y)
+				for (size_t c = 0; c < header.channels.size(); ++c) {
+					const ExrChannel& channel = header.channels[c];
+					if (samples(y, y, channel.y_sampling) == 0)
+						continue;
+					const size_t bytes = p[c].nx * sample_size(channel.type);
+					lines.push_back(
+						std::make_pair(p[c].offset + row[c]++ * bytes, bytes)
+					);
+				}
+		}
+
+		/* b44_compress, b44_uncompress:
+		 *   B44 and B44A store the channels of a block one after the
+		 *   other: half channels in 4 x 4 blocks of pixels (see b44_pack),
+		 *   the last column and row repeated to fill them, and the other
+		 *   channels as they are.
+		 */
+		inline void b44_compress(
+			const Header& header, const Block& b, const unsigned char* raw,
+			size_t n, bool flat, std::vector<unsigned char>& out
+		)
+		{
+			std::vector<Plane> p;
+			std::vector<unsigned char> apart( planes(header, b, p) );
+			std::vector<std::pair<size_t, size_t> > lines;
+			plane_lines(header, b, p, lines);
+			for (size_t i = 0; i < lines.size(); ++i) {
+				std::memcpy(&apart[lines[i].first], raw, lines[i].second);
+				raw += lines[i].second;
+			}
+
+			out.clear();
+			out.reserve(n);
+			std::vector<unsigned short> h;
+			for (size_t c = 0; c < header.channels.size(); ++c) {
+				const ExrChannel& channel = header.channels[c];
+				const unsigned char *plane = &apart[0] + p[c].offset;
+				const size_t nx = p[c].nx, ny = p[c].ny;
+				if (channel.type != ExrChannel::HALF) {
+					out.insert(out.end(), plane,
+						plane + nx * ny * sample_size(channel.type));
+					continue;
+				}
+				h.resize(nx * ny);
+				for (size_t i = 0; i < h.size(); ++i)
+					h[i] = static_cast<unsigned short>( get16(plane + 2*i) );
+				for (size_t y = 0; y < ny; y += 4)
+					for (size_t x = 0; x < nx; x += 4) {
+						unsigned short s[16];
+						for (size_t i = 0; i < 4; ++i)
+							for (size_t j = 0; j < 4; ++j)
+								s[4*i + j] = h[std::min(y + i, ny - 1) * nx +
+									std::min(x + j, nx - 1)];
+						if (channel.p_linear)
+							for (size_t i = 0; i < 16; ++i)
+								s[i] = b44_tables().log[s[i]];
+						unsigned char packed[14];
+						const size_t size =
+							b44_pack(s, packed, flat, !channel.p_linear);
+						out.insert(out.end(), packed, packed + size);
+					}
+			}
+		}
+
+		inline void b44_uncompress(
+			const Header& header, const Block& b,
+			const unsigned char* data, size_t size, unsigned char* raw
+		)
+		{
+			std::vector<Plane> p;
+			std::vector<unsigned char> apart( planes(header, b, p) );
+			const unsigned char *in = data, *end = data + size;
+			for (size_t c = 0; c < header.channels.size(); ++c) {
+				const ExrChannel& channel = header.channels[c];
+				unsigned char *plane = &apart[0] + p[c].offset;
+				const size_t nx = p[c].nx, ny = p[c].ny;
+				if (channel.type != ExrChannel::HALF) {
+					const size_t bytes = nx * ny * sample_size(channel.type);
+					if (static_cast<size_t>(end - in) < bytes)
+						throw InvalidFormat("exr: invalid b44 data");
+					std::memcpy(plane, in, bytes);
+					in += bytes;
+					continue;
+				}
+				for (size_t y = 0; y < ny; y += 4)
+					for (size_t x = 0; x < nx; x += 4) {
+						unsigned short s[16];
+						in += b44_unpack(in, end, s);
+						if (channel.p_linear)
+							for (size_t i = 0; i < 16; ++i)
+								s[i] = b44_tables().exp[s[i]];
+						for (size_t i = 0; i < 4 && y + i < ny; ++i)
+							for (size_t j = 0; j < 4 && x + j < nx; ++j)
+								put16(plane + 2*((y + i) * nx + x + j), s[4*i + j]);
+					}
+			}
+			if (in != end)
+				throw InvalidFormat("exr: invalid b44 data");
+			std::vector<std::pair<size_t, size_t> > lines;
+			plane_lines(header, b, p, lines);
+			for (size_t i = 0; i < lines.size(); ++i) {
+				std::memcpy(raw, &apart[lines[i].first], lines[i].second);
+				raw += lines[i].second;
+			}
+		}
+
+		// the n bytes of block b as stored, raw if compressing does not
+		// make them smaller
+		inline void compress(
+			const Header& header, const Block& b, const unsigned char* raw,
+			size_t n, std::vector<unsigned char>& out
+		)
+		{
+			const ExrCompression compression = header.compression;
+			std::vector<unsigned char> tmp;
+			if (compression == EXR_RLE) {
+				predict(raw, n, tmp);
+				rle_compress(tmp, out);
+#ifdef GIL_ZLIB
+			} else if (compression == EXR_ZIP || compression == EXR_ZIPS) {
+				predict(raw, n, tmp);
+				zip_compress(n ? &tmp[0] : NULL, n, out);
+			} else if (compression == EXR_PXR24) {
+				tmp.resize(n);
+				if (n)
+					pxr24_compress(header, b, raw, tmp);
+				zip_compress(tmp.empty() ? NULL : &tmp[0], tmp.size(), out);
+#endif
+			} else if (compression == EXR_B44 || compression == EXR_B44A) {
+				b44_compress(header, b, raw, n, compression == EXR_B44A, out);
+			} else {
+				out.clear();
+			}
+			if (compression == EXR_NONE || out.size() >= n)
+				out.assign(raw, raw + n);
+		}
+
+		// the n bytes of block b from its size stored ones
+		inline void uncompress(
+			const Header& header, const Block& b, const unsigned char* data,
+			size_t size, unsigned char* raw, size_t n
+		)
+		{
+			if (size == n) {
+				std::memcpy(raw, data, n);
+				return;
+			}
+			if (size > n)
+				throw InvalidFormat("exr: invalid block size");
+			const ExrCompression compression = header.compression;
+			if (compression == EXR_B44 || compression == EXR_B44A) {
+				b44_uncompress(header, b, data, size, raw);
+				return;
+			}
+			std::vector<unsigned char> tmp(n);
+			if (compression == EXR_RLE) {
+				rle_uncompress(data, size, tmp);
+#ifdef GIL_ZLIB
+			} else if (compression == EXR_ZIP || compression == EXR_ZIPS) {
+				zip_uncompress(data, size, &tmp[0], n);
+			} else if (compression == EXR_PXR24) {
+				tmp.resize( pxr24_block_size(header, b) );
+				zip_uncompress(data, size, &tmp[0], tmp.size());
+				pxr24_uncompress(header, b, tmp, raw);
+				return;
+#endif
+			} else {
+				throw InvalidFormat("exr: compression not supported");
+			}
+			unpredict(tmp, raw, n);
+		}
+
+		// a sample of a file or of memory as a float
+		inline float to_float(ExrChannel::PixelType type, unsigned int bits)
+		{
+			switch (type) {
+				case ExrChannel::HALF:
+					return Half::to_float( static_cast<unsigned short>(bits) );
+				case ExrChannel::FLOAT: {
+					float f;
+					std::memcpy(&f, &bits, 4);
+					return f;
+				}
+				default:
+					return static_cast<float>(bits);
+			}
+		}
+
+		// the bits of a sample of type from as a sample of type to
+		inline unsigned int convert(
+			ExrChannel::PixelType to, ExrChannel::PixelType from,
+			unsigned int bits
+		)
+		{
+			if (to == from)
+				return bits;
+			const float f = to_float(from, bits);
+			switch (to) {
+				case ExrChannel::HALF:
+					return Half::from_float(f);
+				case ExrChannel::FLOAT: {
+					unsigned int x;
+					std::memcpy(&x, &f, 4);
+					return x;
+				}
+				default:
+					// NaN gives 0
+					if (!(f > 0.0f))
+						return 0;
+					return (f >= 4294967295.0f) ?
+						4294967295u : static_cast<unsigned int>(f);
+			}
+		}
+
+		inline unsigned int load(ExrChannel::PixelType type, const char* p)
+		{
+			if (type == ExrChannel::HALF)
+				return *reinterpret_cast<const unsigned short*>(p);
+			return *reinterpret_cast<const unsigned int*>(p);
+		}
+
+		inline void store(ExrChannel::PixelType type, char* p, unsigned int bits)
+		{
+			if (type == ExrChannel::HALF)
+				*reinterpret_cast<unsigned short*>(p) =
+					static_cast<unsigned short>(bits);
+			else
+				*reinterpret_cast<unsigned int*>(p) = bits;
+		}
+
+		// n samples of type from, little endian at in, into a slice
+		inline void unpack(
+			ExrChannel::PixelType from, const unsigned char* in,
+			const ExrSlice& slice, char* out, size_t n
+		)
+		{
+			const size_t size = sample_size(from);
+			for (size_t i = 0; i < n; ++i, in += size, out += slice.x_stride) {
+				const unsigned int bits = (size == 2) ? get16(in) : get32(in);
+				store(slice.type, out, convert(slice.type, from, bits));
+			}
+		}
+
+		// n samples of a slice as samples of type to at out
+		inline void pack(
+			const ExrSlice& slice, const char* in,
+			ExrChannel::PixelType to, unsigned char* out, size_t n
+		)
+		{
+			const size_t size = sample_size(to);
+			for (size_t i = 0; i < n; ++i, in += slice.x_stride, out += size) {
+				const unsigned int bits =
+					convert(to, slice.type, load(slice.type, in));
+				if (size == 2)
+					put16(out, bits);
+				else
+					put32(out, bits);
+			}
+		}
+
+		// the fill value of a slice, n times
+		inline void fill(const ExrSlice& slice, char* out, size_t n)
+		{
+			const float value = static_cast<float>(slice.fill);
+			unsigned int bits;
+			std::memcpy(&bits, &value, 4);
+			bits = convert(slice.type, ExrChannel::FLOAT, bits);
+			for (size_t i = 0; i < n; ++i, out += slice.x_stride)
+				store(slice.type, out, bits);
+		}
+
+		// the bytes pixels (x0, y0) to (x1, y1) of the data window take
+		// when stored
+		inline size_t block_size(
+			const Header& header, int x0, int y0, int x1, int y1
+		)
+		{
+			size_t size = 0;
+			for (size_t c = 0; c < header.channels.size(); ++c) {
+				const ExrChannel& channel = header.channels[c];
+				size += samples(x0, x1, channel.x_sampling) *
+					samples(y0, y1, channel.y_sampling) *
+					sample_size(channel.type);
+			}
+			return size;
+		}
+
+		// the slices each channel of a header goes to, a region of the
+		// data window (inclusive) at their base
+		struct Targets {
+			std::vector< std::vector<const ExrSlice*> > slices;
+			int x0;
+			int y0;
+			int x1;
+			int y1;
+		};
+
+		// the decoded bytes of block b into the slices of t
+		inline void unpack_block(
+			const Header& header, const Block& b, const unsigned char* raw,
+			const Targets& t
+		)
+		{
+			for (int y = b.y0; y <= b.y1; ++y)
+				for (size_t c = 0; c < header.channels.size(); ++c) {
+					const ExrChannel& channel = header.channels[c];
+					if (samples(y, y, channel.y_sampling) == 0)
+						continue;
+					const size_t size = sample_size(channel.type);
+					const int x0 = std::max(b.x0, t.x0);
+					const int x1 = std::min(b.x1, t.x1);
+					if (y >= t.y0 && y <= t.y1 && x0 <= x1) {
+						// slices are only given channels sampled every pixel
+						const std::vector<const ExrSlice*>& slices = t.slices[c];
+						for (size_t i = 0; i < slices.size(); ++i) {
+							const ExrSlice& s = *slices[i];
+							unpack(
+								channel.type, raw + (x0 - b.x0) * size, s,
+								s.base + (x0 - t.x0) * s.x_stride +
+									(y - t.y0) * s.y_stride,
+								static_cast<size_t>(x1 - x0 + 1)
+							);
+						}
+					}
+					raw += samples(b.x0, b.x1, channel.x_sampling) * size;
+				}
+		}
+
+		// the rows of block b from sources, a slice per channel, with row
+		// y0 of the block at their base
+		inline void pack_block(
+			const Header& header, const Block& b,
+			const std::vector<const ExrSlice*>& sources, int y0,
+			unsigned char* raw
+		)
+		{
+			const size_t n = static_cast<size_t>(b.x1 - b.x0 + 1);
+			for (int y = b.y0; y <= b.y1; ++y)
+				for (size_t c = 0; c < header.channels.size(); ++c) {
+					const ExrSlice& s = *sources[c];
+					pack(
+						s, s.base + (y - y0) * s.y_stride,
+						header.channels[c].type, raw, n
+					);
+					raw += n * sample_size(header.channels[c].type);
+				}
+		}
+
+		// decompresses blocks [i0, i1) into the slices of t
+		class DecodeBlocks {
+			public:
+				DecodeBlocks(
+					const Header& header, const std::vector<Block>& blocks,
+					const Targets& t
+				): my_header(header), my_blocks(blocks), my_targets(t)
+				{
+					// empty
+				}
+
+				void operator ()(size_t i0, size_t i1) const
+				{
+					std::vector<unsigned char> raw;
+					for (size_t i = i0; i < i1; ++i) {
+						const Block& b = my_blocks[i];
+						raw.resize( block_size(my_header, b.x0, b.y0, b.x1, b.y1) );
+						if (raw.empty())
+							continue;
+						uncompress(
+							my_header, b,
+							b.data.empty() ? NULL : &b.data[0], b.data.size(),
+							&raw[0], raw.size()
+						);
+						unpack_block(my_header, b, &raw[0], my_targets);
+					}
+				}
+
+			private:
+				const Header& my_header;
+				const std::vector<Block>& my_blocks;
+				const Targets& my_targets;
+		};
+
+		// compresses blocks [i0, i1) from sources, see pack_block()
+		class EncodeBlocks {
+			public:
+				EncodeBlocks(
+					const Header& header, std::vector<Block>& blocks,
+					const std::vector<const ExrSlice*>& sources, int y0
+				): my_header(header), my_blocks(blocks), my_sources(sources),
+				   my_y0(y0)
+				{
+					// empty
+				}
+
+				void operator ()(size_t i0, size_t i1) const
+				{
+					std::vector<unsigned char> raw;
+					for (size_t i = i0; i < i1; ++i) {
+						Block& b = my_blocks[i];
+						raw.resize( block_size(my_header, b.x0, b.y0, b.x1, b.y1) );
+						b.data.clear();
+						if (raw.empty())
+							continue;
+						pack_block(my_header, b, my_sources, my_y0, &raw[0]);
+						compress(my_header, b, &raw[0], raw.size(), b.data);
+					}
+				}
+
+			private:
+				const Header& my_header;
+				std::vector<Block>& my_blocks;
+				const std::vector<const ExrSlice*>& my_sources;
+				int my_y0;
+		};
+
+	} // namespace exr_detail
+
+	// true if ExrReader::open() decodes files of the compression; the
+	// RGBA reads take any
+	inline bool exr_readable(ExrCompression compression)
+	{
+		return exr_detail::supported(compression);
+	}
+
+	// true if ExrWriter writes files of the compression; the others are
+	// rejected when the writer is made
+	inline bool exr_writable(ExrCompression compression)
+	{
+		return exr_detail::supported(compression);
+	}
+
+
+	// blocks read or written at a time, a few for every thread
+	inline size_t exr_batch_blocks(const Execution& exec)
+	{
+		return 4 * exec.concurrency();
+	}
+
+	// the float pixel samples of other types are exchanged in
+	template<size_t C>
+	struct ExrFloat {
+		typedef Color<Float1, C> Type;
+	};
+
+	template<>
+	struct ExrFloat<1> {
+		typedef Float1 Type;
+	};
+
+	// the RGBA pixels images of samples T are read and written through;
+	// images of halves keep them
+	template<typename T>
+	struct ExrRgba {
+		typedef Float4 Type;
+	};
+
+	template<>
+	struct ExrRgba<Half1> {
+		typedef Half4 Type;
+	};
+
+	/* ExrReader:
+	 *   tiles and line blocks are read from the file in order, a batch
+	 *   of a few for every thread of the execution (see Parallel.h), and
+	 *   decompressed in parallel. Files the codec below cannot decode,
+	 *   those of PIZ or DWA compression and luminance-chroma files, are
+	 *   read as RGBA through the library instead.
+	 *
+	 *   open() and the channel and region reads after it have no such
+	 *   fallback: they decode NONE, RLE, B44, B44A and, with zlib, ZIPS,
+	 *   ZIP and PXR24 files only, and open() throws InvalidFormat naming
+	 *   the compression of any other. exr_readable() tells beforehand.
+	 */
 	class DLLAPI ExrReader {
+		friend struct ExrReaderLayout;
 		public:
-			ExrReader() 
-				: my_istream(NULL), my_input_file(NULL)
+			explicit ExrReader(const Execution& exec = Execution::global())
+				: my_istream(NULL), my_input_file(NULL),
+				  my_min_x(0), my_min_y(0), my_file(NULL), my_start(0),
+				  my_width(0), my_height(0), my_tiled(false),
+				  my_levels_x(1), my_levels_y(1), my_level_x(0), my_level_y(0),
+				  my_exec(exec)
 			{
 				// empty
 			}
@@ -26,19 +1687,44 @@ namespace gil {
 			template <template<typename, typename> class Converter, typename I>
 			void operator ()(I& image, FILE* f)
 			{
-				//typedef typename I::Converter Conv;
-				Converter<typename I::ColorType, Color<Float1, 4> > converter;
-				size_t width, height;
-				init(f, width, height);
+				typedef typename ExrRgba<
+					typename ColorTrait<typename I::ColorType>::BaseType
+				>::Type Pixel;
+
+				const long start = ftell(f);
+				exr_detail::Header header;
+				exr_detail::read_header(f, header);
+				exr_detail::seek(f, start);
+				if (!exr_detail::supported(header.compression) ||
+						header.find("RY") || header.find("BY")) {
+					read_scanlines<Converter>(image, f);
+					return;
+				}
+
+				open(f);
+				std::vector<std::string> names = exr_layer("", 4);
+				if (find("R") == NULL && find("G") == NULL &&
+						find("B") == NULL && find("Y") != NULL)
+					names[0] = names[1] = names[2] = "Y";
+				const size_t width = my_width;
+				const size_t height = my_height;
 				image.allocate(width, height);
-				std::vector<Float4> buffer(width); // scanline buffer
-				for(size_t y = 0; y < height; y++){
-					read_scanline(buffer, static_cast<int>(y) );
-					for(size_t x = 0; x < width; x++)
-						image(x, y) = converter(buffer[x]);
-						//Conv::ext2int( image(x, y), buffer[x] );
+				const size_t lines = my_tiled ?
+					my_header.tile_height : exr_block_lines(my_header.compression);
+				const size_t band = lines * std::max<size_t>(
+					1, exr_batch_blocks(my_exec) /
+						(my_tiled ? my_header.tiles_x(0) : 1)
+				);
+				Image<Pixel, PoolAllocator> buffer(width, std::min(band, height));
+				ExrFrameBuffer fb;
+				fb.insert(buffer, names);
+				for(size_t y = 0; y < height; y += band){
+					const size_t n = std::min(band, height - y);
+					read(fb, Box(0, y, width, n));
+					for(size_t i = 0; i < n; i++)
+						store_row<Converter>(image, y + i, buffer.row(i), width);
 				}
-				cleanup();
+				close();
 			}
 			template <typename I>
 			void operator ()(I& image, FILE* f)
@@ -46,47 +1732,509 @@ namespace gil {
 				this->operator()<DefaultConverter, I>(image, f);
 			}
 
+			/* open, read, close:
+			 *   any channels of a file in their own types, instead of
+			 *   RGBA converted to floats. open() reads the header, which
+			 *   channels() lists, and read() decodes the channels named
+			 *   straight into the pixels of an image:
+			 *
+			 *     ExrReader exr;
+			 *     exr.open(f);
+			 *     HalfImage3 diffuse;
+			 *     FloatImage1 depth;
+			 *     exr.read(diffuse, exr_layer("diffuse", 3));
+			 *     exr.read(depth, std::vector<std::string>(1, "Z"));
+			 *     exr.close();
+			 *
+			 *   Images of halves, floats and unsigned ints, interleaved or
+			 *   planar, are read in place; others through floats and the
+			 *   converter.
+			 *
+			 *   Given a region of interest, only the tiles or line blocks
+			 *   overlapping it are decoded, and the image gets the size
+			 *   of the region:
+			 *
+			 *     exr.level(2, 2);                  // a quarter, if tiled
+			 *     exr.read(view, names, Box(x, y, w, h));
+			 *
+			 *   Coordinates are those of the image a full read gives: the
+			 *   top left pixel of the data window is (0, 0), wherever the
+			 *   window lies, and origin_x(), origin_y() tell where.
+			 */
+			void open(FILE* f)
+			{
+				close();
+				my_start = ftell(f);
+				exr_detail::Header header;
+				exr_detail::read_header(f, header);
+				if (!exr_readable(header.compression))
+					throw InvalidFormat(
+						std::string("exr: cannot open ") +
+						exr_detail::compression_name(header.compression) +
+						" compressed files, read them as RGBA instead"
+					);
+				my_header = header;
+				my_min_x = header.min_x;
+				my_min_y = header.min_y;
+				my_width = header.width();
+				my_height = header.height();
+				my_tiled = header.tiled;
+				my_levels_x = header.levels_x();
+				my_levels_y = header.levels_y();
+				my_level_x = my_level_y = 0;
+				read_offsets(f);
+				my_file = f;
+			}
+
+			void close()
+			{
+				my_file = NULL;
+				my_offsets.clear();
+			}
+
+			// the size of the data window at the current level
+			size_t width() const
+			{
+				return my_width;
+			}
+
+			size_t height() const
+			{
+				return my_height;
+			}
+
+			// the top left corner of the data window in the file
+			int origin_x() const
+			{
+				return my_min_x;
+			}
+
+			int origin_y() const
+			{
+				return my_min_y;
+			}
+
+			ExrCompression compression() const
+			{
+				return my_header.compression;
+			}
+
+			// true for tiled files, which may hold mip or rip levels
+			bool tiled() const
+			{
+				return my_tiled;
+			}
+
+			// 1 for a single level, equal counts for mip maps
+			int levels_x() const
+			{
+				return my_levels_x;
+			}
+
+			int levels_y() const
+			{
+				return my_levels_y;
+			}
+
+			// read level (lx, ly) from now on, (l, l) for a mip level.
+			// width() and height() become the size of that level.
+			void level(int lx, int ly)
+			{
+				if (lx < 0 || ly < 0 || lx >= my_levels_x || ly >= my_levels_y)
+					throw std::out_of_range("no such exr level");
+				select_level(lx, ly, my_width, my_height);
+			}
+
+			const std::vector<ExrChannel>& channels() const
+			{
+				return my_header.channels;
+			}
+
+			const ExrChannel* find(const std::string& name) const
+			{
+				return my_header.find(name);
+			}
+
+			// the layers of the file in the order of their first channel
+			std::vector<std::string> layers() const
+			{
+				std::vector<std::string> names;
+				for (size_t i = 0; i < channels().size(); ++i) {
+					const std::string layer = channels()[i].layer();
+					if (std::find(names.begin(), names.end(), layer) == names.end())
+						names.push_back(layer);
+				}
+				return names;
+			}
+
+			void read(const ExrFrameBuffer& fb)
+			{
+				read(fb, Box(0, 0, my_width, my_height));
+			}
+
+			// the slices of fb hold the region, its top left at their base
+			void read(const ExrFrameBuffer& fb, const Box& roi)
+			{
+				const Box box = roi.clip(my_width, my_height);
+				if (box.empty())
+					return;
+				read_region(
+					fb,
+					static_cast<int>(box.x), static_cast<int>(box.y),
+					static_cast<int>(box.x + box.width) - 1,
+					static_cast<int>(box.y + box.height) - 1
+				);
+			}
+
+			template <template<typename, typename> class Converter, typename I>
+			void read(
+				I& image, const std::vector<std::string>& names, const Box& roi
+			)
+			{
+				typedef typename ColorTrait<typename I::ColorType>::BaseType T;
+				const Box box = roi.clip(my_width, my_height);
+				image.allocate(box.width, box.height);
+				read<Converter>(
+					image, names, box, Int2Type<ExrSample<T>::Native>()
+				);
+			}
+
+			template <typename I>
+			void read(
+				I& image, const std::vector<std::string>& names, const Box& roi
+			)
+			{
+				read<DefaultConverter, I>(image, names, roi);
+			}
+
+			template <template<typename, typename> class Converter, typename I>
+			void read(I& image, const std::vector<std::string>& names)
+			{
+				read<Converter>(image, names, Box(0, 0, my_width, my_height));
+			}
+
+			template <typename I>
+			void read(I& image, const std::vector<std::string>& names)
+			{
+				read<DefaultConverter, I>(image, names);
+			}
+
+			// the channels an image of c channels is read from by default:
+			// R, G, B and A, or Y (R if there is no Y) for one channel
+			std::vector<std::string> rgba(size_t c) const
+			{
+				std::vector<std::string> names = exr_layer("", c);
+				if (c == 1 && find("Y") == NULL && find("R") != NULL)
+					names[0] = "R";
+				return names;
+			}
+
 		private:
+			template <template<typename, typename> class Converter, typename I>
+			void read(
+				I& image, const std::vector<std::string>& names,
+				const Box& box, Int2Type<true>
+			)
+			{
+				ExrFrameBuffer fb;
+				fb.insert(image, names);
+				read(fb, box);
+			}
+
+			template <template<typename, typename> class Converter, typename I>
+			void read(
+				I& image, const std::vector<std::string>& names,
+				const Box& box, Int2Type<false>
+			)
+			{
+				typedef typename ExrFloat<
+					ColorTrait<typename I::ColorType>::Channels
+				>::Type Pixel;
+				Image<Pixel, PoolAllocator> tmp(box.width, box.height);
+				ExrFrameBuffer fb;
+				fb.insert(tmp, names);
+				read(fb, box);
+				for (size_t y = 0; y < box.height; ++y)
+					store_row<Converter>(image, y, tmp.row(y), box.width);
+			}
+
+			// RGBA through the library, a scanline at a time
+			template <template<typename, typename> class Converter, typename I>
+			void read_scanlines(I& image, FILE* f)
+			{
+				size_t width, height;
+				init(f, width, height);
+				image.allocate(width, height);
+				std::vector<Float4> buffer(width); // scanline buffer
+				for(size_t y = 0; y < height; y++){
+					read_scanline(buffer, static_cast<int>(y) );
+					store_row<Converter>(image, y, &buffer[0], width);
+				}
+				cleanup();
+			}
+
+			// sets the origin
 			void init(FILE* f, size_t& w, size_t& h);
 			void read_scanline(std::vector<Float4>& buf, int y);
 			void cleanup() throw();
 
+			// the offset table after the header
+			void read_offsets(FILE* f)
+			{
+				const size_t count = my_header.chunks();
+				if (count > (1u << 28))
+					throw InvalidFormat("exr: too many chunks");
+				std::vector<unsigned char> table(8 * count);
+				if (count)
+					exr_detail::bytes(f, &table[0], table.size());
+				my_offsets.resize(count);
+				for (size_t i = 0; i < count; ++i) {
+					my_offsets[i] = exr_detail::get64(&table[8 * i]);
+					if (my_offsets[i] == 0 || my_offsets[i] > 0x7fffffffull)
+						throw InvalidFormat("exr: invalid offset table");
+				}
+			}
+
+			// the stored bytes of chunk i, whose header is head bytes
+			void read_chunk(
+				size_t i, size_t head, unsigned char* h, exr_detail::Block& b
+			)
+			{
+				exr_detail::seek(
+					my_file, my_start + static_cast<long>(my_offsets[i])
+				);
+				exr_detail::bytes(my_file, h, head);
+				const size_t size = exr_detail::get32(h + head - 4);
+				const size_t raw = exr_detail::block_size(
+					my_header, b.x0, b.y0, b.x1, b.y1
+				);
+				if (size > raw)
+					throw InvalidFormat("exr: invalid block size");
+				b.data.resize(size);
+				if (size)
+					exr_detail::bytes(my_file, &b.data[0], size);
+			}
+
+			// line block i of a scanline file
+			void read_block(size_t i, exr_detail::Block& b)
+			{
+				const int lines = static_cast<int>(
+					exr_block_lines(my_header.compression)
+				);
+				b.x0 = my_header.min_x;
+				b.x1 = my_header.max_x;
+				b.y0 = my_header.min_y + static_cast<int>(i) * lines;
+				b.y1 = std::min(b.y0 + lines - 1, my_header.max_y);
+				unsigned char h[8];
+				read_chunk(i, 8, h, b);
+				if (static_cast<int>( exr_detail::get32(h) ) != b.y0)
+					throw InvalidFormat("exr: invalid line block");
+			}
+
+			// tile (tx, ty) of the current level of a tiled file
+			void read_tile(size_t tx, size_t ty, exr_detail::Block& b)
+			{
+				const size_t tw = my_header.tile_width;
+				const size_t th = my_header.tile_height;
+				b.x0 = my_header.min_x + static_cast<int>(tx * tw);
+				b.y0 = my_header.min_y + static_cast<int>(ty * th);
+				b.x1 = my_header.min_x + static_cast<int>(
+					std::min((tx + 1) * tw, my_width) - 1
+				);
+				b.y1 = my_header.min_y + static_cast<int>(
+					std::min((ty + 1) * th, my_height) - 1
+				);
+				unsigned char h[20];
+				read_chunk(
+					my_header.first_tile(my_level_x, my_level_y) +
+						ty * my_header.tiles_x(my_level_x) + tx,
+					20, h, b
+				);
+				if (exr_detail::get32(h) != tx || exr_detail::get32(h + 4) != ty ||
+						static_cast<int>( exr_detail::get32(h + 8) ) != my_level_x ||
+						static_cast<int>( exr_detail::get32(h + 12) ) != my_level_y)
+					throw InvalidFormat("exr: invalid tile");
+			}
+
+			// the first n of blocks, in parallel
+			void decode(
+				const std::vector<exr_detail::Block>& blocks, size_t n,
+				const exr_detail::Targets& t
+			) const
+			{
+				parallel_for(
+					0, n, exr_detail::DecodeBlocks(my_header, blocks, t), my_exec
+				);
+			}
+
+			void select_level(int lx, int ly, size_t& w, size_t& h)
+			{
+				if (my_header.level_mode == exr_detail::Header::MIPMAP && lx != ly)
+					throw std::out_of_range("exr mip levels are (l, l)");
+				my_level_x = lx;
+				my_level_y = ly;
+				w = my_header.level_width(lx);
+				h = my_header.level_height(ly);
+			}
+
+			// pixels (x0, y0) to (x1, y1) of the data window at the current
+			// level into the slices of fb, (x0, y0) at their base. Only
+			// the tiles or line blocks overlapping the region are decoded,
+			// and no sample outside it is written.
+			void read_region(
+				const ExrFrameBuffer& fb, int x0, int y0, int x1, int y1
+			)
+			{
+				if (my_file == NULL)
+					throw std::logic_error("exr: no file open");
+				exr_detail::Targets t;
+				t.x0 = my_header.min_x + x0;
+				t.y0 = my_header.min_y + y0;
+				t.x1 = my_header.min_x + x1;
+				t.y1 = my_header.min_y + y1;
+				t.slices.resize(my_header.channels.size());
+				for (ExrFrameBuffer::const_iterator s = fb.begin(); s != fb.end(); ++s) {
+					const ExrChannel* channel = find(s->name);
+					if (channel == NULL) {
+						for (int y = y0; y <= y1; ++y)
+							exr_detail::fill(
+								*s, s->base + (y - y0) * s->y_stride,
+								static_cast<size_t>(x1 - x0 + 1)
+							);
+						continue;
+					}
+					if (channel->x_sampling != 1 || channel->y_sampling != 1)
+						throw std::invalid_argument(
+							"exr: subsampled channels cannot be read into slices"
+						);
+					t.slices[channel - &my_header.channels[0]].push_back(&*s);
+				}
+
+				std::vector<exr_detail::Block> blocks( exr_batch_blocks(my_exec) );
+				size_t n = 0;
+				if (my_tiled) {
+					const size_t tw = my_header.tile_width;
+					const size_t th = my_header.tile_height;
+					for (size_t ty = y0 / th; ty <= y1 / th; ++ty)
+						for (size_t tx = x0 / tw; tx <= x1 / tw; ++tx) {
+							read_tile(tx, ty, blocks[n]);
+							if (++n == blocks.size()) {
+								decode(blocks, n, t);
+								n = 0;
+							}
+						}
+				} else {
+					const size_t lines = exr_block_lines(my_header.compression);
+					for (size_t i = y0 / lines; i <= y1 / lines; ++i) {
+						read_block(i, blocks[n]);
+						if (++n == blocks.size()) {
+							decode(blocks, n, t);
+							n = 0;
+						}
+					}
+				}
+				decode(blocks, n, t);
+			}
+
+			/* The first four members are the whole of the library's
+			 * ExrReader. Its compiled init(), read_scanline() and
+			 * cleanup(), which the RGBA fallback and the destructor call,
+			 * find them by their offsets in the object: they must stay
+			 * first, in this order, and the class must not get a base or
+			 * virtual functions. test/exr_layout.cpp checks this through
+			 * ExrReaderLayout. The members after them are only used here.
+			 */
 			void* my_istream;	 // XXX actual type is C_IStream*
 			void* my_input_file; // XXX actual type is Imf::RgbaInputFile*
 			int my_min_x;
 			int my_min_y;
+			exr_detail::Header my_header;
+			std::vector<unsigned long long> my_offsets;
+			FILE* my_file;
+			long my_start;
+			size_t my_width;
+			size_t my_height;
+			bool my_tiled;
+			int my_levels_x;
+			int my_levels_y;
+			int my_level_x;
+			int my_level_y;
+			Execution my_exec;
 	};
 
+	/* ExrWriter:
+	 *   files are compressed with EXR_DEFAULT_COMPRESSION unless told
+	 *   otherwise,
+	 *
+	 *     ExrWriter writer(EXR_RLE);
+	 *     write(image, "beauty.exr", writer);
+	 *
+	 *   NONE, RLE, B44, B44A and, when built with zlib, ZIPS, ZIP and
+	 *   PXR24 are written; PIZ and DWA throw std::invalid_argument here
+	 *   rather than when the first file is written. PXR24 keeps 24 bits
+	 *   of floats, B44 and B44A 6 bits of the differences in every 4 x 4
+	 *   pixels of halves; B44A stores blocks of one value in 3 bytes.
+	 *
+	 *   Line blocks are compressed in parallel, a batch of them at a
+	 *   time, and written in order. Images are written as RGBA halves:
+	 *   Y for one channel, Y and A for two, R, G, B for three and R, G,
+	 *   B, A for four.
+	 */
 	class DLLAPI ExrWriter {
 		public:
-			ExrWriter() 
-				: my_ostream(NULL), my_output_file(NULL)
+			explicit ExrWriter(
+				ExrCompression compression = EXR_DEFAULT_COMPRESSION,
+				const Execution& exec = Execution::global()
+			): my_compression(checked(compression)), my_exec(exec),
+			   my_file(NULL), my_start(0), my_table(0)
 			{
 				// empty
 			}
 
-			~ExrWriter() 
+			ExrCompression compression() const
 			{
-				cleanup();
+				return my_compression;
+			}
+
+			void compression(ExrCompression compression)
+			{
+				my_compression = checked(compression);
 			}
 
 			template <template<typename, typename> class Converter, typename I>
 			void operator ()(const I& image, FILE* f)
 			{
-				//typedef typename I::Converter Conv;
-				Converter<Float4, typename I::ColorType> converter;
+				typedef typename ExrRgba<
+					typename ColorTrait<typename I::ColorType>::BaseType
+				>::Type Pixel;
+
 				size_t width = image.width();
 				size_t height = image.height();
+				const size_t c = image.channels();
 
-				init( f, width, height, image.channels() );
-				std::vector<Float4> buffer(width);
-				for(size_t y = 0; y < height; y++){
-					for(size_t x = 0; x < width; x++)
-						buffer[x] = converter( image(x, y) );
-						// Conv::int2ext( buffer[x], image(x, y) );
-					write_scanline( buffer, static_cast<int>(y) );
+				std::vector<std::string> names = exr_layer("", 4);
+				if (c < 3)
+					names[0] = "Y";
+				std::vector<ExrChannel> channels;
+				for (size_t i = 0; i < 4; ++i)
+					if ((c >= 3 && i < c) || (c < 3 && (i == 0 || (c == 2 && i == 3))))
+						channels.push_back( ExrChannel(names[i], ExrChannel::HALF) );
+				init(f, width, height, channels);
+
+				const size_t band = exr_block_lines(my_compression) *
+					exr_batch_blocks(my_exec);
+				Image<Pixel, PoolAllocator> buffer(width, std::min(band, height));
+				ExrFrameBuffer fb;
+				fb.insert(buffer, names);
+				for(size_t y = 0; y < height; y += band){
+					const size_t n = std::min(band, height - y);
+					for(size_t i = 0; i < n; i++)
+						load_row<Converter>(buffer.row(i), image, y + i, width);
+					write_pixels(
+						fb, static_cast<int>(y), static_cast<int>(y + n) - 1
+					);
 				}
-				cleanup();
+				finish();
 			}
 			template <typename I>
 			void operator ()(I& image, FILE* f)
@@ -94,13 +2242,186 @@ namespace gil {
 				this->operator()<DefaultConverter, I>(image, f);
 			}
 
+			/* write:
+			 *   the slices of fb as the channels of a w x h file, each in
+			 *   the type of its slice. To write images of halves, floats or
+			 *   unsigned ints with channels of their own names, in place:
+			 *
+			 *     ExrWriter().write(normals, f, names);
+			 *
+			 *   Other images are written as floats.
+			 */
+			void write(FILE* f, size_t w, size_t h, const ExrFrameBuffer& fb)
+			{
+				std::vector<ExrChannel> channels;
+				for (ExrFrameBuffer::const_iterator s = fb.begin(); s != fb.end(); ++s)
+					channels.push_back( ExrChannel(s->name, s->type) );
+				init(f, w, h, channels);
+				write_pixels(fb, 0, static_cast<int>(h) - 1);
+				finish();
+			}
+
+			template <template<typename, typename> class Converter, typename I>
+			void write(
+				const I& image, FILE* f, const std::vector<std::string>& names
+			)
+			{
+				typedef typename ColorTrait<typename I::ColorType>::BaseType T;
+				write<Converter>(
+					image, f, names, Int2Type<ExrSample<T>::Native>()
+				);
+			}
+
+			template <typename I>
+			void write(
+				const I& image, FILE* f, const std::vector<std::string>& names
+			)
+			{
+				write<DefaultConverter, I>(image, f, names);
+			}
+
 		private:
-			void init(FILE* f, size_t w, size_t h, size_t c);
-			void write_scanline(std::vector<Float4>& buf, int y);
-			void cleanup() throw();
+			template <template<typename, typename> class Converter, typename I>
+			void write(
+				const I& image, FILE* f, const std::vector<std::string>& names,
+				Int2Type<true>
+			)
+			{
+				ExrFrameBuffer fb;
+				fb.insert(image, names);
+				write(f, image.width(), image.height(), fb);
+			}
+
+			template <template<typename, typename> class Converter, typename I>
+			void write(
+				const I& image, FILE* f, const std::vector<std::string>& names,
+				Int2Type<false>
+			)
+			{
+				typedef typename ExrFloat<
+					ColorTrait<typename I::ColorType>::Channels
+				>::Type Pixel;
+				const size_t width = image.width();
+				const size_t height = image.height();
+				Image<Pixel, PoolAllocator> tmp(width, height);
+				for (size_t y = 0; y < height; ++y)
+					load_row<Converter>(tmp.row(y), image, y, width);
+				ExrFrameBuffer fb;
+				fb.insert(tmp, names);
+				write(f, width, height, fb);
+			}
+
+			// the header of a w x h file of channels, compressed with
+			// my_compression, and room for its offset table
+			void init(
+				FILE* f, size_t w, size_t h, std::vector<ExrChannel> channels
+			)
+			{
+				if (w == 0 || h == 0 || w > 0x7fffffff || h > 0x7fffffff)
+					throw std::invalid_argument("exr: invalid image size");
+				std::sort(channels.begin(), channels.end(), exr_detail::by_name);
+				for (size_t i = 1; i < channels.size(); ++i)
+					if (channels[i].name == channels[i - 1].name)
+						throw std::invalid_argument("exr: duplicate channel");
+
+				my_header = exr_detail::Header();
+				my_header.channels = channels;
+				my_header.compression = my_compression;
+				my_header.max_x = static_cast<int>(w) - 1;
+				my_header.max_y = static_cast<int>(h) - 1;
+				my_file = f;
+				my_start = ftell(f);
+				exr_detail::write_header(f, my_header);
+				my_table = ftell(f);
+				const size_t lines = exr_block_lines(my_compression);
+				my_offsets.assign((h + lines - 1) / lines, 0);
+				const std::vector<unsigned char> table(8 * my_offsets.size());
+				exr_detail::write_bytes(f, &table[0], table.size());
+			}
+
+			// rows y0 to y1 from the slices of fb, row y0 at their base.
+			// y0 starts a line block, and so does y1 + 1 unless y1 is the
+			// last row.
+			void write_pixels(const ExrFrameBuffer& fb, int y0, int y1)
+			{
+				std::vector<const ExrSlice*> sources;
+				for (size_t c = 0; c < my_header.channels.size(); ++c) {
+					ExrFrameBuffer::const_iterator s = fb.begin();
+					while (s != fb.end() && s->name != my_header.channels[c].name)
+						++s;
+					if (s == fb.end())
+						throw std::invalid_argument("exr: no slice for a channel");
+					sources.push_back(&*s);
+				}
+
+				const int lines = static_cast<int>(
+					exr_block_lines(my_compression)
+				);
+				std::vector<exr_detail::Block> blocks( exr_batch_blocks(my_exec) );
+				for (int y = y0; y <= y1; ) {
+					size_t n = 0;
+					for (; n < blocks.size() && y <= y1; ++n, y += lines) {
+						blocks[n].x0 = 0;
+						blocks[n].x1 = my_header.max_x;
+						blocks[n].y0 = y;
+						blocks[n].y1 = std::min(y + lines - 1, y1);
+					}
+					parallel_for(
+						0, n,
+						exr_detail::EncodeBlocks(my_header, blocks, sources, y0),
+						my_exec
+					);
+					for (size_t i = 0; i < n; ++i)
+						write_block(blocks[i]);
+				}
+			}
+
+			void write_block(const exr_detail::Block& b)
+			{
+				const long at = ftell(my_file);
+				if (at < 0)
+					throw IOError("exr: cannot tell the file position");
+				my_offsets[b.y0 / exr_block_lines(my_compression)] =
+					static_cast<unsigned long long>(at - my_start);
+				unsigned char h[8];
+				exr_detail::put32(h, static_cast<unsigned int>(b.y0));
+				exr_detail::put32(h + 4, static_cast<unsigned int>(b.data.size()));
+				exr_detail::write_bytes(my_file, h, 8);
+				if (!b.data.empty())
+					exr_detail::write_bytes(my_file, &b.data[0], b.data.size());
+			}
+
+			static ExrCompression checked(ExrCompression compression)
+			{
+				if (!exr_writable(compression))
+					throw std::invalid_argument(
+						std::string("exr: cannot write ") +
+						exr_detail::compression_name(compression) +
+						" compressed files"
+					);
+				return compression;
+			}
+
+			// the offset table, once every block is written
+			void finish()
+			{
+				std::vector<unsigned char> table(8 * my_offsets.size());
+				for (size_t i = 0; i < my_offsets.size(); ++i)
+					exr_detail::put64(&table[8 * i], my_offsets[i]);
+				exr_detail::seek(my_file, my_table);
+				exr_detail::write_bytes(my_file, &table[0], table.size());
+				if (fseek(my_file, 0, SEEK_END) != 0 || fflush(my_file) != 0)
+					throw IOError("exr: cannot write");
+				my_file = NULL;
+			}
 
-			void* my_ostream;	  // XXX actual type is C_IStream*
-			void* my_output_file; // XXX actual type is Imf::RgbaInputFile*
+			ExrCompression my_compression;
+			Execution my_exec;
+			exr_detail::Header my_header;
+			std::vector<unsigned long long> my_offsets;
+			FILE* my_file;
+			long my_start;
+			long my_table;
 	};
 
 } // namespace gil
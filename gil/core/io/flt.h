@@ -79,7 +79,6 @@ namespace gil {
 			void read(I &image, FILE *f)
 			{
 				std::vector<ColorType> row(image.width());
-				Converter<typename I::ColorType, ColorType> converter;
 				for (size_t h = 0; h < image.height(); ++h) {
 					if (fread(
 							(void*)&row[0], 
@@ -89,9 +88,7 @@ namespace gil {
 						) != 1) {
 						throw IOError("unknown read error");
 					}
-					for (size_t w = 0; w < image.width(); ++w)
-						image(w, h) = converter(row[w]);
-						//I::Converter::int2ext(row[w], image(w, h));
+					store_row<Converter>(image, h, &row[0], image.width());
 				}
 			}
 
@@ -132,12 +129,9 @@ namespace gil {
 			>
 			void write(const I& image, FILE *f) 
 			{
-				Converter<ColorType, typename I::ColorType> converter;
 				std::vector<ColorType> row(image.width());
 				for (size_t h = 0; h < image.height(); ++h) {
-					for (size_t w = 0; w < image.width(); ++w)
-						row[w] = converter( image(w, h) );
-						// I::Converter::int2ext(row[w], image(w, h));
+					load_row<Converter>(&row[0], image, h, image.width());
 					if (fwrite(
 							(void*)&row[0], 
 							sizeof(ColorType)*image.width(), 
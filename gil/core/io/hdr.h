@@ -2,61 +2,893 @@
 #define GIL_HDR_H
 
 #include <stdexcept>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <string>
 #include <vector>
 
+#include "../Exception.h"
 #include "../Color.h"
 #include "../Converter.h"
+#include "../Image.h"
+#include "../Int2Type.h"
+#include "../Parallel.h"
+#include "../Pool.h"
 
 // turn off the turnoff warnings
 #ifdef _MSC_VER
-#pragma warning(disable:4251) 
+#pragma warning(disable:4251)
 #endif
 
 namespace gil {
 
+	/* RGBE:
+	 *   the pixels of Radiance files, a byte of mantissa per channel and
+	 *   a shared exponent, kept in a Byte4. rgbe_to_float and
+	 *   float_to_rgbe are the conversions of Greg Ward's rgbe.c: a pixel
+	 *   decodes to (r, g, b) * 2^(e - 136), and encodes with the exponent
+	 *   of its largest channel. Negative channels and NaN encode as 0,
+	 *   values too large for the exponent as the largest one.
+	 */
+	inline Float3 rgbe_to_float(const Byte4& rgbe)
+	{
+		if (rgbe[3] == 0)
+			return Float3(0.0f, 0.0f, 0.0f);
+		const float f = static_cast<float>(std::ldexp(1.0, rgbe[3] - 136));
+		return Float3(rgbe[0]*f, rgbe[1]*f, rgbe[2]*f);
+	}
+
+	inline Byte4 float_to_rgbe(const Float3& rgb)
+	{
+		const float MAX = 1.7014117e38f;	// just under 2^127
+		float c[3];
+		for (size_t i = 0; i < 3; ++i) {
+			c[i] = (rgb[i] > 0.0f) ? rgb[i] : 0.0f;
+			c[i] = (c[i] < MAX) ? c[i] : MAX;
+		}
+		const float v = std::max(c[0], std::max(c[1], c[2]));
+
+		Byte4 rgbe;
+		if (v < 1e-32f) {
+			rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+			return rgbe;
+		}
+		int e;
+		const float scale = static_cast<float>(
+			std::frexp(v, &e) * 256.0 / v
+		);
+		for (size_t i = 0; i < 3; ++i)
+			rgbe[i] = static_cast<Byte1>(c[i] * scale);
+		rgbe[3] = static_cast<Byte1>(e + 128);
+		return rgbe;
+	}
+
+	/* RgbeConverter:
+	 *   a converter taking Byte4 pixels for RGBE. Images of raw RGBE pixels
+	 *   (see HdrReader::read_rgbe) decode with it when needed,
+	 *
+	 *     DefaultConvert<FloatImage3, RgbeConverter>()(radiance, probe);
+	 *
+	 *   and other pixels go through Float3 and DefaultConverter.
+	 */
+	template<typename To, typename From>
+	struct RgbeConverter;
+
+	template<typename Tt>
+	struct RgbeConverter<Tt, Byte4> {
+		typedef Tt To;
+		typedef Byte4 From;
+		const To operator()(const From& from) const
+		{
+			return DefaultConverter<To, Float3>()( rgbe_to_float(from) );
+		}
+	};
+
+	template<typename Tf>
+	struct RgbeConverter<Byte4, Tf> {
+		typedef Byte4 To;
+		typedef Tf From;
+		const To operator()(const From& from) const
+		{
+			return float_to_rgbe( DefaultConverter<Float3, From>()(from) );
+		}
+	};
+
+	template<>
+	struct RgbeConverter<Byte4, Byte4> {
+		typedef Byte4 To;
+		typedef Byte4 From;
+		const To operator()(const From& from) const
+		{
+			return from;
+		}
+	};
+
+	// RGBE -> Float3, four pixels at a time. The scale 2^(e - 136) is
+	// built from exponent bits in two halves, so that small exponents
+	// give the denormals ldexp gives.
+	template<>
+	struct RowConverter<RgbeConverter, Float3, Byte4> {
+		static void convert(Float3* to, const Byte4* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_SSE2
+			// each store spills over the red of the next pixel, which is
+			// written next; the last pixel is left to the scalar loop
+			float *out = reinterpret_cast<float*>(to);
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i bias = _mm_set1_epi32(136);
+			const __m128i one = _mm_set1_epi32(127);
+			for (; i + 4 < n; i += 4) {
+				const __m128i b = _mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(from + i)
+				);
+				const __m128i lo = _mm_unpacklo_epi8(b, zero);
+				const __m128i hi = _mm_unpackhi_epi8(b, zero);
+				__m128i p[4];
+				p[0] = _mm_unpacklo_epi16(lo, zero);
+				p[1] = _mm_unpackhi_epi16(lo, zero);
+				p[2] = _mm_unpacklo_epi16(hi, zero);
+				p[3] = _mm_unpackhi_epi16(hi, zero);
+				for (size_t k = 0; k < 4; ++k) {
+					const __m128i e = _mm_shuffle_epi32(p[k], 0xff);
+					const __m128i x = _mm_sub_epi32(e, bias);
+					const __m128i a = _mm_srai_epi32(x, 1);
+					const __m128i c = _mm_sub_epi32(x, a);
+					const __m128 fa = _mm_castsi128_ps(
+						_mm_slli_epi32(_mm_add_epi32(a, one), 23)
+					);
+					const __m128 fc = _mm_castsi128_ps(
+						_mm_slli_epi32(_mm_add_epi32(c, one), 23)
+					);
+					const __m128 nonzero = _mm_castsi128_ps(
+						_mm_cmpgt_epi32(e, zero)
+					);
+					_mm_storeu_ps(out + 3*(i + k), _mm_and_ps(
+						_mm_mul_ps(_mm_mul_ps(_mm_cvtepi32_ps(p[k]), fa), fc),
+						nonzero
+					));
+				}
+			}
+#endif
+			for (; i < n; ++i)
+				to[i] = rgbe_to_float(from[i]);
+		}
+	};
+
+	// Float3 -> RGBE, the exponent of frexp taken from the float bits
+	template<>
+	struct RowConverter<RgbeConverter, Byte4, Float3> {
+		static void convert(Byte4* to, const Float3* from, size_t n)
+		{
+			size_t i = 0;
+#ifdef GIL_SSE2
+			// each load takes the red of the next pixel, so the last
+			// pixel is left to the scalar loop
+			const float *in = reinterpret_cast<const float*>(from);
+			const __m128 zero = _mm_setzero_ps();
+			const __m128 max = _mm_set1_ps(1.7014117e38f);
+			const __m128 tiny = _mm_set1_ps(1e-32f);
+			const __m128i rgb = _mm_set_epi32(0, -1, -1, -1);
+			const __m128i ff = _mm_set1_epi32(0xff);
+			const __m128i top = _mm_set1_epi32(261);
+			const __m128i two = _mm_set1_epi32(2);
+			for (; i + 4 < n; i += 4) {
+				__m128i q[4];
+				for (size_t k = 0; k < 4; ++k) {
+					// max first, so that NaN becomes 0 as in float_to_rgbe
+					const __m128 c = _mm_min_ps(_mm_max_ps(
+						_mm_loadu_ps(in + 3*(i + k)), zero), max);
+					const __m128 v = _mm_max_ps(
+						_mm_shuffle_ps(c, c, 0x00),
+						_mm_max_ps(
+							_mm_shuffle_ps(c, c, 0x55),
+							_mm_shuffle_ps(c, c, 0xaa)
+						)
+					);
+					const __m128i e = _mm_and_si128(
+						_mm_srli_epi32(_mm_castps_si128(v), 23), ff
+					);
+					const __m128 scale = _mm_castsi128_ps(
+						_mm_slli_epi32(_mm_sub_epi32(top, e), 23)
+					);
+					const __m128i m = _mm_cvttps_epi32(_mm_mul_ps(c, scale));
+					const __m128i p = _mm_or_si128(
+						_mm_and_si128(m, rgb),
+						_mm_andnot_si128(rgb, _mm_add_epi32(e, two))
+					);
+					q[k] = _mm_andnot_si128(
+						_mm_castps_si128(_mm_cmplt_ps(v, tiny)), p
+					);
+				}
+				_mm_storeu_si128(
+					reinterpret_cast<__m128i*>(to + i),
+					_mm_packus_epi16(
+						_mm_packs_epi32(q[0], q[1]),
+						_mm_packs_epi32(q[2], q[3])
+					)
+				);
+			}
+#endif
+			for (; i < n; ++i)
+				to[i] = float_to_rgbe(from[i]);
+		}
+	};
+
+	/* hdr_decode_scanline:
+	 *   decodes the scanline of width pixels at in, up to end, into out
+	 *   and returns where the next scanline starts. Adaptive RLE lines
+	 *   are expanded a channel at a time into planes, with memset and
+	 *   memcpy, and the planes interleaved afterwards; planes holds 4 *
+	 *   width bytes of scratch. Flat and old style RLE lines are read as
+	 *   well. Throws EndOfFile or InvalidFormat.
+	 */
+	inline const unsigned char* hdr_decode_scanline(
+		const unsigned char* in, const unsigned char* end,
+		Byte4* out, size_t width, unsigned char* planes
+	)
+	{
+		if (width == 0)
+			return in;
+		if (end - in < 4)
+			throw EndOfFile("hdr: unexpected end-of-file");
+
+		if (width < 8 || width > 0x7fff || in[0] != 2 || in[1] != 2 ||
+			(in[2] & 0x80)) {
+			// flat pixels, where (1, 1, 1, n) repeats the last pixel
+			size_t x = 0;
+			int shift = 0;
+			while (x < width) {
+				if (end - in < 4)
+					throw EndOfFile("hdr: unexpected end-of-file");
+				if (in[0] == 1 && in[1] == 1 && in[2] == 1) {
+					if (x == 0)
+						throw InvalidFormat("hdr: run without a pixel");
+					const size_t count = static_cast<size_t>(in[3]) << shift;
+					if (count > width - x)
+						throw InvalidFormat("hdr: run past the scanline");
+					std::fill(out + x, out + x + count, out[x - 1]);
+					x += count;
+					shift += 8;
+				} else {
+					std::memcpy(&out[x++], in, 4);
+					shift = 0;
+				}
+				in += 4;
+			}
+			return in;
+		}
+
+		if ( ((static_cast<size_t>(in[2]) << 8) | in[3]) != width )
+			throw InvalidFormat("hdr: scanline width mismatch");
+		in += 4;
+
+		for (size_t c = 0; c < 4; ++c) {
+			unsigned char *plane = planes + c*width;
+			size_t x = 0;
+			while (x < width) {
+				if (in == end)
+					throw EndOfFile("hdr: unexpected end-of-file");
+				size_t count = *in++;
+				if (count > 128) {
+					count -= 128;
+					if (count > width - x)
+						throw InvalidFormat("hdr: run past the scanline");
+					if (in == end)
+						throw EndOfFile("hdr: unexpected end-of-file");
+					std::memset(plane + x, *in++, count);
+				} else {
+					if (count == 0 || count > width - x)
+						throw InvalidFormat("hdr: bad scanline data");
+					if (static_cast<size_t>(end - in) < count)
+						throw EndOfFile("hdr: unexpected end-of-file");
+					std::memcpy(plane + x, in, count);
+					in += count;
+				}
+				x += count;
+			}
+		}
+
+		const unsigned char *r = planes, *g = r + width;
+		const unsigned char *b = g + width, *e = b + width;
+		size_t x = 0;
+#ifdef GIL_SSE2
+		for (; x + 16 <= width; x += 16) {
+			const __m128i vr = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(r + x));
+			const __m128i vg = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(g + x));
+			const __m128i vb = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(b + x));
+			const __m128i ve = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(e + x));
+			const __m128i rg0 = _mm_unpacklo_epi8(vr, vg);
+			const __m128i rg1 = _mm_unpackhi_epi8(vr, vg);
+			const __m128i be0 = _mm_unpacklo_epi8(vb, ve);
+			const __m128i be1 = _mm_unpackhi_epi8(vb, ve);
+			__m128i *p = reinterpret_cast<__m128i*>(out + x);
+			_mm_storeu_si128(p, _mm_unpacklo_epi16(rg0, be0));
+			_mm_storeu_si128(p + 1, _mm_unpackhi_epi16(rg0, be0));
+			_mm_storeu_si128(p + 2, _mm_unpacklo_epi16(rg1, be1));
+			_mm_storeu_si128(p + 3, _mm_unpackhi_epi16(rg1, be1));
+		}
+#endif
+		for (; x < width; ++x) {
+			out[x][0] = r[x];
+			out[x][1] = g[x];
+			out[x][2] = b[x];
+			out[x][3] = e[x];
+		}
+		return in;
+	}
+
+	/* hdr_encode_scanline:
+	 *   appends the adaptive RLE encoding of a scanline to out, a channel
+	 *   at a time: runs of 4 bytes or more become runs, the rest literal
+	 *   chunks. Widths RLE cannot hold are written flat.
+	 */
+	inline void hdr_encode_scanline(
+		const Byte4* in, size_t width, std::vector<unsigned char>& out
+	)
+	{
+		if (width < 8 || width > 0x7fff) {
+			const unsigned char *p = reinterpret_cast<const unsigned char*>(in);
+			out.insert(out.end(), p, p + 4*width);
+			return;
+		}
+
+		const size_t MIN_RUN = 4;
+		out.push_back(2);
+		out.push_back(2);
+		out.push_back(static_cast<unsigned char>(width >> 8));
+		out.push_back(static_cast<unsigned char>(width & 0xff));
+
+		std::vector<unsigned char> plane(width);
+		for (size_t c = 0; c < 4; ++c) {
+			for (size_t x = 0; x < width; ++x)
+				plane[x] = in[x][c];
+
+			size_t x = 0;
+			while (x < width) {
+				// find the next run of MIN_RUN bytes or more
+				size_t run_start = x, run = 0;
+				while (run_start < width) {
+					run = 1;
+					while (run_start + run < width && run < 127 &&
+						plane[run_start + run] == plane[run_start])
+						++run;
+					if (run >= MIN_RUN)
+						break;
+					run_start += run;
+				}
+				if (run < MIN_RUN)
+					run_start = width;
+				// the bytes before it go literal, 128 at most a chunk
+				while (x < run_start) {
+					const size_t n = std::min<size_t>(128, run_start - x);
+					out.push_back(static_cast<unsigned char>(n));
+					out.insert(out.end(), &plane[x], &plane[x] + n);
+					x += n;
+				}
+				if (run_start < width) {
+					out.push_back(static_cast<unsigned char>(128 + run));
+					out.push_back(plane[run_start]);
+					x = run_start + run;
+				}
+			}
+		}
+	}
+
+	/* hdr_skip_scanline:
+	 *   where the scanline of width pixels at in ends, found by reading
+	 *   only the run counts. Throws like hdr_decode_scanline.
+	 */
+	inline const unsigned char* hdr_skip_scanline(
+		const unsigned char* in, const unsigned char* end, size_t width
+	)
+	{
+		if (width == 0)
+			return in;
+		if (end - in < 4)
+			throw EndOfFile("hdr: unexpected end-of-file");
+
+		if (width < 8 || width > 0x7fff || in[0] != 2 || in[1] != 2 ||
+			(in[2] & 0x80)) {
+			size_t x = 0;
+			int shift = 0;
+			while (x < width) {
+				if (end - in < 4)
+					throw EndOfFile("hdr: unexpected end-of-file");
+				if (in[0] == 1 && in[1] == 1 && in[2] == 1) {
+					const size_t count = static_cast<size_t>(in[3]) << shift;
+					if (x == 0 || count > width - x)
+						throw InvalidFormat("hdr: bad run");
+					x += count;
+					shift += 8;
+				} else {
+					++x;
+					shift = 0;
+				}
+				in += 4;
+			}
+			return in;
+		}
+
+		if ( ((static_cast<size_t>(in[2]) << 8) | in[3]) != width )
+			throw InvalidFormat("hdr: scanline width mismatch");
+		in += 4;
+		for (size_t c = 0; c < 4; ++c)
+			for (size_t x = 0; x < width; ) {
+				if (in == end)
+					throw EndOfFile("hdr: unexpected end-of-file");
+				size_t count = *in++;
+				const size_t bytes = (count > 128) ? 1 : count;
+				if (count > 128)
+					count -= 128;
+				if (count == 0 || count > width - x)
+					throw InvalidFormat("hdr: bad scanline data");
+				if (static_cast<size_t>(end - in) < bytes)
+					throw EndOfFile("hdr: unexpected end-of-file");
+				in += bytes;
+				x += count;
+			}
+		return in;
+	}
+
+	// a whole line of the header, however long, without its newline;
+	// false at end-of-file
+	inline bool hdr_read_line(FILE* f, std::string& line)
+	{
+		line.clear();
+		int c;
+		while ((c = getc(f)) != EOF && c != '\n')
+			line += static_cast<char>(c);
+		return c != EOF || !line.empty();
+	}
+
+	/* hdr_read_header, hdr_write_header:
+	 *   the header of a Radiance file, up to its first scanline: a
+	 *   "#?" line, lines of variables up to a blank one, and the
+	 *   resolution string. w and h are the sizes along X and Y.
+	 *   hdr_read_header() returns false unless scanlines run left to
+	 *   right from the top ("-Y h +X w"), the only layout the readers
+	 *   here decode.
+	 */
+	inline bool hdr_read_header(FILE* f, size_t& w, size_t& h)
+	{
+		std::string line;
+		if (!hdr_read_line(f, line))
+			throw EndOfFile("hdr: unexpected end-of-file");
+		if (line.compare(0, 2, "#?") != 0)
+			throw InvalidFormat("hdr: not a Radiance file");
+		do {
+			if (!hdr_read_line(f, line))
+				throw EndOfFile("hdr: unexpected end-of-file");
+			if (line.compare(0, 7, "FORMAT=") == 0 &&
+					line.compare(7, 15, "32-bit_rle_rgbe") != 0)
+				throw InvalidFormat("hdr: only RGBE pixels are supported");
+		} while (!line.empty() && line[0] != '\r');
+
+		char axis[2][3];
+		int size[2];
+		if (!hdr_read_line(f, line) ||
+				sscanf(line.c_str(), "%2s %d %2s %d",
+					axis[0], &size[0], axis[1], &size[1]) != 4 ||
+				size[0] <= 0 || size[1] <= 0)
+			throw InvalidFormat("hdr: invalid resolution string");
+		const int x = (axis[0][1] == 'X') ? 0 : 1;
+		w = size[x];
+		h = size[1 - x];
+		return std::strcmp(axis[0], "-Y") == 0 &&
+			std::strcmp(axis[1], "+X") == 0;
+	}
+
+	inline void hdr_write_header(FILE* f, size_t w, size_t h)
+	{
+		if (fprintf(f,
+				"#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y %lu +X %lu\n",
+				static_cast<unsigned long>(h),
+				static_cast<unsigned long>(w)) < 0)
+			throw IOError("hdr: cannot write header");
+	}
+
+	/* HdrIndex:
+	 *   where each scanline of a Radiance file starts, counted in bytes
+	 *   from the first one, so that scanlines can be decoded in any order
+	 *   and on any thread. build() finds them by skipping through the
+	 *   data, which is much faster than decoding it. An index may be kept
+	 *   in a sidecar file with save() and load(); it holds the native
+	 *   byte order and is meant as a local cache. It is keyed on the
+	 *   fingerprint() of the data, its size and a few blocks of it, which
+	 *   costs far less than the index does to build. A file rewritten
+	 *   with other pixels of the same size and the same blocks takes the
+	 *   index of the old one, which the reader finds stale when a
+	 *   scanline does not end where the index says (see HdrReader).
+	 */
+	class HdrIndex {
+		public:
+			HdrIndex(): my_width(0), my_size(0)
+			{
+				// empty
+			}
+
+			void build(
+				const unsigned char* data, size_t size,
+				size_t width, size_t height
+			)
+			{
+				my_offsets.resize(height + 1);
+				my_width = width;
+				my_size = size;
+				const unsigned char *p = data;
+				for (size_t y = 0; y < height; ++y) {
+					my_offsets[y] = p - data;
+					p = hdr_skip_scanline(p, data + size, width);
+				}
+				my_offsets[height] = p - data;
+			}
+
+			// of size bytes at data: the size, and SAMPLES blocks of
+			// SAMPLE_BYTES spread from the first byte to the last, or all
+			// of the data when it is not much larger
+			static unsigned long long fingerprint(
+				const unsigned char* data, size_t size
+			)
+			{
+				unsigned long long h = 0xcbf29ce484222325ull ^ size;
+				if (size <= SAMPLES * SAMPLE_BYTES)
+					return hash(h, data, size);
+				const size_t step = (size - SAMPLE_BYTES) / (SAMPLES - 1);
+				for (size_t i = 0; i < SAMPLES; ++i)
+					h = hash(h, data + i*step, SAMPLE_BYTES);
+				return h;
+			}
+
+			// for data of the given fingerprint, false if the file cannot
+			// be written
+			bool save(
+				const std::string& filename, unsigned long long key
+			) const
+			{
+				FILE *f = fopen(filename.c_str(), "wb");
+				if (f == NULL)
+					return false;
+				const unsigned long long head[5] = {
+					MAGIC, my_width, my_size, my_offsets.size(), key
+				};
+				std::vector<unsigned long long> offsets(
+					my_offsets.begin(), my_offsets.end()
+				);
+				bool ok = fwrite(head, sizeof(head), 1, f) == 1;
+				if (ok && !offsets.empty())
+					ok = fwrite(&offsets[0], sizeof(offsets[0]),
+						offsets.size(), f) == offsets.size();
+				return (fclose(f) == 0) && ok;
+			}
+
+			// false unless the file holds the index of size bytes of
+			// width x height scanlines of the given fingerprint
+			bool load(
+				const std::string& filename, unsigned long long key,
+				size_t size, size_t width, size_t height
+			)
+			{
+				FILE *f = fopen(filename.c_str(), "rb");
+				if (f == NULL)
+					return false;
+				unsigned long long head[5];
+				std::vector<unsigned long long> offsets(height + 1);
+				const bool ok =
+					fread(head, sizeof(head), 1, f) == 1 &&
+					head[0] == MAGIC && head[1] == width &&
+					head[2] == size && head[3] == height + 1 &&
+					head[4] == key &&
+					fread(&offsets[0], sizeof(offsets[0]),
+						offsets.size(), f) == offsets.size();
+				fclose(f);
+				if (!ok || offsets[0] != 0 || offsets[height] > size)
+					return false;
+				for (size_t y = 0; y < height; ++y)
+					if (offsets[y] > offsets[y + 1])
+						return false;
+				my_offsets.assign(offsets.begin(), offsets.end());
+				my_width = width;
+				my_size = size;
+				return true;
+			}
+
+			size_t height() const
+			{
+				return my_offsets.empty() ? 0 : my_offsets.size() - 1;
+			}
+
+			// scanline y is [begin(y), end(y))
+			size_t begin(size_t y) const
+			{
+				return my_offsets[y];
+			}
+
+			size_t end(size_t y) const
+			{
+				return my_offsets[y + 1];
+			}
+
+		private:
+			static const unsigned long long MAGIC = 0x3258444952444847ull;
+			static const size_t SAMPLES = 16;
+			static const size_t SAMPLE_BYTES = 4096;
+
+			// h and size bytes at data, 8 bytes a step
+			static unsigned long long hash(
+				unsigned long long h, const unsigned char* data, size_t size
+			)
+			{
+				const unsigned long long PRIME = 0x100000001b3ull;
+				size_t i = 0;
+				for (; i + 8 <= size; i += 8) {
+					unsigned long long w;
+					std::memcpy(&w, data + i, 8);
+					h = (h ^ w) * PRIME;
+					h ^= h >> 29;
+				}
+				for (; i < size; ++i)
+					h = (h ^ data[i]) * PRIME;
+				return h;
+			}
+
+			std::vector<size_t> my_offsets;
+			size_t my_width;
+			size_t my_size;
+	};
+
+	/* HdrReader:
+	 *   the header is parsed here (see hdr_read_header), and the pixels
+	 *   after it are read in one go. A pre-scan then indexes the
+	 *   scanlines (see HdrIndex), and they are decoded a band of rows at
+	 *   a time, in parallel with the threads of the execution, into a
+	 *   buffer. The rows of a band are then stored in order, top to
+	 *   bottom and from the calling thread, so that images filled row by
+	 *   row (StreamInput) can take them. Decoding a large file twice can
+	 *   skip the pre-scan with a sidecar index:
+	 *
+	 *     HdrReader reader;
+	 *     reader.index_file("latlong.hdr.idx");	// loaded, or built and saved
+	 *     read(image, "latlong.hdr", reader);
+	 *
+	 *   Every scanline must end where the index says the next starts. If
+	 *   one of a loaded index does not, the index is stale: it is built
+	 *   again, saved, and the band decoded again with it. The bands before
+	 *   were right, since their scanlines started where the ones before
+	 *   them ended.
+	 *
+	 *   read_rgbe() keeps the pixels as they are, RGBE in a Byte4 image,
+	 *   a quarter of the memory of floats, for RgbeConverter to decode
+	 *   later.
+	 */
 	class DLLAPI HdrReader {
 		public:
-			HdrReader() : my_file(NULL)
+			explicit HdrReader(const Execution& exec = Execution::global())
+				: my_key(0), my_loaded(false), my_file(NULL), my_exec(exec)
 			{
 				// empty
 			}
 
+			// the sidecar index of the next file read, that one only
+			void index_file(const std::string& filename)
+			{
+				my_index_file = filename;
+			}
+
+			const HdrIndex& index() const
+			{
+				return my_index;
+			}
+
 			template <template<typename, typename> class Converter, typename I>
 			void operator ()(I& image, FILE* f)
+			{
+				read_image<Converter, Float3, true>(image, f);
+			}
+			template <typename I>
+			void operator ()(I& image, FILE* f)
+			{
+				this->operator()<DefaultConverter, I>(image, f);
+			}
+
+			template <typename I>
+			void read_rgbe(I& image, FILE* f)
+			{
+				read_image<DefaultConverter, Byte4, false>(image, f);
+			}
+
+		private:
+			typedef Image<Float3, PoolAllocator> FloatBand;
+			typedef Image<Byte4, PoolAllocator> RgbeBand;
+
+			// rows decoded at a time, for every thread of the execution
+			static const size_t BAND_ROWS = 16;
+
+			// decodes rows [y0 + i0, y0 + i1) into rows [i0, i1) of a band,
+			// and converts them from RGBE if Decode. A scanline must end
+			// where the index says; InvalidFormat if not.
+			template<typename P, bool Decode>
+			class DecodeRows {
+				public:
+					DecodeRows(
+						Image<P, PoolAllocator>& band, size_t y0,
+						const unsigned char* data, const HdrIndex& index
+					): my_band(band), my_y0(y0), my_data(data),
+					   my_index(index)
+					{
+						// empty
+					}
+
+					void operator ()(size_t i0, size_t i1) const
+					{
+						const size_t width = my_band.width();
+						std::vector<Byte4> rgbe(Decode ? width : 0);
+						std::vector<unsigned char> planes(4*width);
+						for (size_t i = i0; i < i1; ++i) {
+							const size_t y = my_y0 + i;
+							const unsigned char *end = my_data + my_index.end(y);
+							Byte4 *out = scanline(i, rgbe, Int2Type<Decode>());
+							if (hdr_decode_scanline(
+									my_data + my_index.begin(y), end,
+									out, width, &planes[0]) != end)
+								throw InvalidFormat("hdr: scanline off its index");
+							store(i, out, Int2Type<Decode>());
+						}
+					}
+
+				private:
+					Byte4* scanline(
+						size_t, std::vector<Byte4>& rgbe, Int2Type<true>
+					) const
+					{
+						return &rgbe[0];
+					}
+
+					Byte4* scanline(
+						size_t i, std::vector<Byte4>&, Int2Type<false>
+					) const
+					{
+						return my_band.row(i);
+					}
+
+					void store(size_t i, const Byte4* rgbe, Int2Type<true>) const
+					{
+						convert_row<RgbeConverter>(
+							my_band.row(i), rgbe, my_band.width()
+						);
+					}
+
+					void store(size_t, const Byte4*, Int2Type<false>) const
+					{
+						// decoded in place
+					}
+
+					Image<P, PoolAllocator>& my_band;
+					size_t my_y0;
+					const unsigned char *my_data;
+					const HdrIndex& my_index;
+			};
+
+			template<
+				template<typename, typename> class Converter,
+				typename P, bool Decode, class I
+			>
+			void read_image(I& image, FILE* f)
 			{
 				size_t width, height;
 				init(f, width, height);
 				image.allocate(width, height);
-
-				// typedef typename I::Converter Conv;
-				Converter<typename I::ColorType, Color<Float1, 3> > converter;
-				std::vector<Float3> buffer(width);
-				for(size_t y = 0; y < height; y++){
-					read_scanline(buffer);
-					for(size_t x = 0; x < width; x++)
-						image(x, y) = converter(buffer[x]);
-						//Conv::ext2int( image(x, y), buffer[x] );
+				read_data();
+				prepare_index(width, height);
+				if (width && height) {
+					const size_t rows = std::min(
+						height, BAND_ROWS * my_exec.concurrency()
+					);
+					Image<P, PoolAllocator> band(width, rows);
+					for (size_t y = 0; y < height; y += rows) {
+						const size_t n = std::min(rows, height - y);
+						decode(
+							DecodeRows<P, Decode>(band, y, data(), my_index),
+							n, width, height
+						);
+						for (size_t i = 0; i < n; ++i)
+							store_row<Converter>(image, y + i, band.row(i), width);
+					}
 				}
-
 				finish();
 			}
-			template <typename I>
-			void operator ()(I& image, FILE* f)
+
+			void init(FILE* f, size_t& w, size_t& h)
 			{
-				this->operator()<DefaultConverter, I>(image, f);
+				if (!hdr_read_header(f, w, h))
+					throw InvalidFormat("hdr: unsupported orientation");
+				my_file = f;
 			}
 
-		private:
-			void init(FILE* f, size_t& w, size_t& h);
-			void finish();
-			void read_scanline(std::vector<Float3>& buf);
+			void finish()
+			{
+				my_file = NULL;
+				my_data.clear();
+				my_sidecar.clear();
+			}
 
-			void read_encoded();
-			void read_encoded_old(size_t pos = 0);
+			const unsigned char* data() const
+			{
+				return my_data.empty() ? NULL : &my_data[0];
+			}
 
-			std::vector<Byte4> my_enc_buffer;
+			// loads the sidecar index of the scanlines read, if there is
+			// one for them, and builds the index otherwise
+			void prepare_index(size_t width, size_t height)
+			{
+				my_sidecar.clear();
+				my_sidecar.swap(my_index_file);
+				my_loaded = false;
+				if (!my_sidecar.empty()) {
+					my_key = HdrIndex::fingerprint(data(), my_data.size());
+					my_loaded = my_index.load(
+						my_sidecar, my_key, my_data.size(), width, height
+					);
+				}
+				if (!my_loaded)
+					build_index(width, height);
+			}
+
+			void build_index(size_t width, size_t height)
+			{
+				my_loaded = false;
+				my_index.build(data(), my_data.size(), width, height);
+				if (!my_sidecar.empty())
+					my_index.save(my_sidecar, my_key);
+			}
+
+			// the n rows of a band with body, in parallel
+			template<class Body>
+			void decode(
+				const Body& body, size_t n, size_t width, size_t height
+			)
+			{
+				if (my_loaded) {
+					try {
+						parallel_for(0, n, body, my_exec);
+						return;
+					} catch (const InvalidFormat&) {
+						// a stale index, built again below
+					} catch (const EndOfFile&) {
+						// as well
+					}
+					build_index(width, height);
+				}
+				parallel_for(0, n, body, my_exec);
+			}
+
+			// the rest of the file, the scanlines
+			void read_data()
+			{
+				const size_t CHUNK = 1 << 16;
+				my_data.clear();
+				size_t n;
+				do {
+					const size_t size = my_data.size();
+					my_data.resize(size + CHUNK);
+					n = fread(&my_data[size], 1, CHUNK, my_file);
+					my_data.resize(size + n);
+				} while (n == CHUNK);
+			}
+
+			std::vector<unsigned char> my_data;
+			HdrIndex my_index;
+			std::string my_index_file;
+			std::string my_sidecar;		// of the file being read
+			unsigned long long my_key;	// HdrIndex::fingerprint()
+			bool my_loaded;				// my_index from my_sidecar
 			FILE* my_file;
+			Execution my_exec;
 	};
 
 
@@ -72,15 +904,15 @@ namespace gil {
 			{
 				size_t width = image.width(), height = image.height();
 				init(f, width, height);
+				my_enc_buffer.resize(width);
 
-				// typedef typename I::Converter Conv;
-				Converter<Float3, typename I::ColorType> converter;
 				std::vector<Float3> buffer(width);
-				for(size_t y = 0; y < height; y++){
-					for(size_t x = 0; x < width; x++)
-						buffer[x] = converter( image(x, y) );
-						//Conv::int2ext( buffer[x], image(x, y) );
-					write_scanline(buffer);
+				for(size_t y = 0; y < height && width; y++){
+					load_row<Converter>(&buffer[0], image, y, width);
+					convert_row<RgbeConverter>(
+						&my_enc_buffer[0], &buffer[0], width
+					);
+					write_encoded(width);
 				}
 
 				finish();
@@ -91,14 +923,49 @@ namespace gil {
 				this->operator()<DefaultConverter, I>(image, f);
 			}
 
+			// the pixels of image are RGBE already, see HdrReader::read_rgbe
+			template <typename I>
+			void write_rgbe(const I& image, FILE* f)
+			{
+				size_t width = image.width(), height = image.height();
+				init(f, width, height);
+				my_enc_buffer.resize(width);
+
+				for(size_t y = 0; y < height && width; y++){
+					load_row<DefaultConverter>(
+						&my_enc_buffer[0], image, y, width
+					);
+					write_encoded(width);
+				}
+
+				finish();
+			}
+
 		private:
-			void init(FILE* f, size_t w, size_t h);
-			void finish();
-			void write_scanline(const std::vector<Float3>& buf);
+			void init(FILE* f, size_t w, size_t h)
+			{
+				hdr_write_header(f, w, h);
+				my_file = f;
+			}
 
-			void write_encoded();
+			void finish()
+			{
+				if (fflush(my_file) != 0)
+					throw IOError("hdr: cannot write");
+				my_file = NULL;
+			}
+
+			void write_encoded(size_t width)
+			{
+				my_data.clear();
+				hdr_encode_scanline(&my_enc_buffer[0], width, my_data);
+				if (fwrite(&my_data[0], 1, my_data.size(), my_file) !=
+					my_data.size())
+					throw IOError("hdr: cannot write scanline");
+			}
 
 			std::vector<Byte4> my_enc_buffer;
+			std::vector<unsigned char> my_data;
 			FILE* my_file;
 	};
 
@@ -1,12 +1,15 @@
 #ifndef GIL_PFM_H
 #define GIL_PFM_H
 
+#include <algorithm>
+#include <climits>
 #include <cstdio>
 #include <stdexcept>
 #include <utility>
 #include <vector>
 
 #include "../Exception.h"
+#include "../Simd.h"
 #include "../Color.h"
 #include "../Converter.h"
 
@@ -53,6 +56,60 @@ namespace gil {
 		}
 	};
 
+	// reverse the bytes of n words of the given size in place. Words of
+	// 2 and 4 bytes are swapped 16 bytes at a time with SSE2.
+	inline void byte_swap(void* data, size_t n, size_t size)
+	{
+		unsigned char *p = static_cast<unsigned char*>(data);
+		size_t i = 0;
+#ifdef GIL_SSE2
+		if (size == 2 || size == 4) {
+			const size_t step = 16 / size;
+			for (; i + step <= n; i += step) {
+				__m128i *q = reinterpret_cast<__m128i*>(p + i*size);
+				__m128i v = _mm_loadu_si128(q);
+				v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+				if (size == 4)
+					v = _mm_shufflehi_epi16(
+						_mm_shufflelo_epi16(v, 0xB1), 0xB1
+					);
+				_mm_storeu_si128(q, v);
+			}
+		}
+#endif
+		for (; i < n; ++i)
+			std::reverse(p + i*size, p + (i + 1)*size);
+	}
+
+	// PFM stores the bottom row first. Images that must be visited top
+	// down (see OrderTrait) are read and written a block of rows at a time
+	// from the end of the data, with one seek per block, where f can be
+	// positioned; everything else streams the rows in file order.
+
+	// the offset of the pixel data at the position of f, or -1 if f cannot
+	// be positioned over all of its bytes
+	inline long pfm_data_offset(FILE* f, size_t bytes)
+	{
+		const long start = ftell(f);
+		if (start < 0 || bytes > static_cast<size_t>(LONG_MAX - start))
+			return -1;
+		return start;
+	}
+
+	// the rows of the given size in a block, about 64K
+	inline size_t pfm_block_rows(size_t bytes, size_t height)
+	{
+		return std::min(height, std::max<size_t>(1, 65536 / bytes));
+	}
+
+	// position f at row `row' of the file, counted from the first one
+	// stored, see pfm_data_offset
+	inline void pfm_seek(FILE* f, long start, size_t bytes, size_t row)
+	{
+		if (fseek(f, start + static_cast<long>(row * bytes), SEEK_SET))
+			throw IOError("seek error");
+	}
+
 	// because PfmReader is written in header completely,
 	// here we should not use DLLAPI
 	class PfmReader {
@@ -130,24 +187,40 @@ namespace gil {
 				const size_t width = image.width();
 				const size_t height = image.height();
 				std::vector<ColorType> row(width);
-				ByteReverser<ColorType, is_reverse> reverser;
-				Converter<typename I::ColorType, ColorType> converter;
-
-				for (size_t h = 0; h < height; ++h) {
-					if (fread(
-							(void*)&row[0], 
-							sizeof(ColorType)*width, 
-							1, 
-							f
-						) != 1) {
-						throw IOError("unknown read error");
-					}
-					for (size_t w = 0; w < width; ++w) {
-						reverser(row[w]);
-						image(w, height-h-1) = converter(row[w]);
-						//I::Converter::ext2int(image(w, image.height()-h-1), row[w]);
+				const size_t channels = ColorTrait<ColorType>::channels();
+				const size_t bytes = sizeof(ColorType)*width;
+				const long start = OrderTrait<I>::TopDown ?
+					pfm_data_offset(f, bytes*height) : -1;
+
+				if (start < 0) {
+					for (size_t h = 0; h < height; ++h) {
+						if (fread((void*)&row[0], bytes, 1, f) != 1)
+							throw IOError("unknown read error");
+						if (is_reverse)
+							byte_swap(&row[0], width*channels, sizeof(float));
+						store_row<Converter>(image, height-h-1, &row[0], width);
 					}
+					return;
 				}
+
+				// top down, the block of rows [y, y + n) of the image is the
+				// block [height - y - n, height - y) of the file, reversed
+				const size_t rows = pfm_block_rows(bytes, height);
+				std::vector<ColorType> block(rows*width);
+				for (size_t y = 0; y < height; y += rows) {
+					const size_t n = std::min(rows, height - y);
+					pfm_seek(f, start, bytes, height - y - n);
+					if (fread((void*)&block[0], bytes, n, f) != n)
+						throw IOError("unknown read error");
+					if (is_reverse)
+						byte_swap(&block[0], n*width*channels, sizeof(float));
+					for (size_t i = 0; i < n; ++i)
+						store_row<Converter>(
+							image, y + i, &block[(n-i-1)*width], width
+						);
+				}
+				// leave f after the pixels, like a sequential pass
+				pfm_seek(f, start, bytes, height);
 			}
 
 		private:
@@ -200,21 +273,34 @@ namespace gil {
 						f, "P%c\n%u %u\n%f\n", magic, (unsigned int)width, (unsigned int)height, scale
 					) < 0) test_and_throw(f);
 
-				Converter<ColorType, typename I::ColorType> converter;
-
-				for (size_t h = 0; h < height; ++h) {
-					for (size_t w = 0; w < width; ++w)
-						row[w] = converter( image(w, height-h-1) );
-					// I::Converter::int2ext(row[w], image(w, image.height()-h-1));
-					if (fwrite(
-								(void*)&row[0], 
-								sizeof(ColorType)*width, 
-								1, 
-								f
-							  ) != 1) {
-						throw IOError("unknown write error");
+				const size_t bytes = sizeof(ColorType)*width;
+				const long start = OrderTrait<I>::TopDown ?
+					pfm_data_offset(f, bytes*height) : -1;
+
+				if (start < 0) {
+					for (size_t h = 0; h < height; ++h) {
+						load_row<Converter>(&row[0], image, height-h-1, width);
+						if (fwrite((void*)&row[0], bytes, 1, f) != 1)
+							throw IOError("unknown write error");
 					}
+					return;
+				}
+
+				// top down, see PfmReader::read
+				const size_t rows = pfm_block_rows(bytes, height);
+				std::vector<ColorType> block(rows*width);
+				for (size_t y = 0; y < height; y += rows) {
+					const size_t n = std::min(rows, height - y);
+					for (size_t i = 0; i < n; ++i)
+						load_row<Converter>(
+							&block[(n-i-1)*width], image, y + i, width
+						);
+					pfm_seek(f, start, bytes, height - y - n);
+					if (fwrite((void*)&block[0], bytes, n, f) != n)
+						throw IOError("unknown write error");
 				}
+				// leave f after the pixels, like a sequential pass
+				pfm_seek(f, start, bytes, height);
 			}
 	};
 } // namespace gil
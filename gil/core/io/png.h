@@ -1,13 +1,19 @@
 #ifndef GIL_PNG_H
 #define GIL_PNG_H
 
+#include <algorithm>
+#include <cassert>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <vector>
 
 #include "../Exception.h"
 #include "../Color.h"
 #include "../Converter.h"
+#include "../Parallel.h"
+#include "../Zlib.h"
 
 namespace gil {
 	class DLLAPI PngReader {
@@ -74,7 +80,6 @@ namespace gil {
 			void read(I& image)
 			{
 				typedef typename Color<Type, Channel>::ColorType ColorType;
-				Converter<typename I::ColorType, ColorType> converter;
 				image.allocate(my_width, my_height);
 
 				std::vector<ColorType> row(my_width);
@@ -82,9 +87,7 @@ namespace gil {
 					assert(my_rowbytes == sizeof(Type)*Channel*my_width);
 					read_row((Type*)&(row[0]));
 
-					for (size_t w = 0; w < my_width; ++w)
-						image(w, h) = converter(row[w]);
-						// I::Converter::ext2int(image(w, h), row[w]);
+					store_row<Converter>(image, h, &row[0], my_width);
 				}
 			}
 		private:
@@ -103,11 +106,183 @@ namespace gil {
 			size_t my_interlace_type;
 	};
 
+	// the filter of each row; ADAPTIVE picks the one of smallest sum
+	// per row, as libpng does
+	enum PngFilter {
+		PNG_ROW_FILTER_NONE = 0, PNG_ROW_FILTER_SUB, PNG_ROW_FILTER_UP,
+		PNG_ROW_FILTER_AVERAGE, PNG_ROW_FILTER_PAETH, PNG_ROW_FILTER_ADAPTIVE
+	};
+
+	// the zlib strategies, in their order
+	enum PngStrategy {
+		PNG_STRATEGY_DEFAULT = 0, PNG_STRATEGY_FILTERED,
+		PNG_STRATEGY_HUFFMAN, PNG_STRATEGY_RLE
+	};
+
+	struct PngOptions {
+		// the least block_size, the window deflate primes a block with,
+		// and the most, which zlib's 32 bit lengths must hold
+		enum { MIN_BLOCK_SIZE = 32*1024, MAX_BLOCK_SIZE = 1024*1024*1024 };
+
+		PngOptions()
+			: level(6), filter(PNG_ROW_FILTER_ADAPTIVE),
+			  strategy(PNG_STRATEGY_DEFAULT), bit_depth(8),
+			  block_size(256*1024)
+		{
+			// empty
+		}
+
+		int level;				// zlib level, 0 to 9
+		PngFilter filter;
+		PngStrategy strategy;
+		size_t bit_depth;		// 8 or 16
+		size_t block_size;		// filtered bytes deflated by one task, at
+								// least MIN_BLOCK_SIZE and one filtered
+								// row, at most MAX_BLOCK_SIZE; 0 deflates
+								// the image as one block up to that
+	};
+
+	// filters row into out, 1 + rowbytes long: the filter type, then
+	// the bytes. prior is the row above, NULL for the first. ADAPTIVE
+	// tries each filter in scratch, 1 + rowbytes long too, which callers
+	// keep from row to row.
+	inline void png_filter_row(
+		const unsigned char* row, const unsigned char* prior,
+		size_t rowbytes, size_t bpp, PngFilter filter, unsigned char* out,
+		unsigned char* scratch
+	)
+	{
+		if (filter == PNG_ROW_FILTER_ADAPTIVE) {
+			unsigned long best = ~0ul;
+			for (int type = PNG_ROW_FILTER_NONE;
+					type <= PNG_ROW_FILTER_PAETH; ++type) {
+				png_filter_row(
+					row, prior, rowbytes, bpp,
+					static_cast<PngFilter>(type), scratch, NULL
+				);
+				unsigned long sum = 0;
+				for (size_t i = 1; i <= rowbytes && sum < best; ++i)
+					sum += (scratch[i] < 128) ? scratch[i] : 256 - scratch[i];
+				if (sum < best) {
+					best = sum;
+					std::memcpy(out, scratch, 1 + rowbytes);
+				}
+			}
+			return;
+		}
+
+		out[0] = static_cast<unsigned char>(filter);
+		++out;
+		for (size_t i = 0; i < rowbytes; ++i) {
+			const int a = (i >= bpp) ? row[i - bpp] : 0;
+			const int b = prior ? prior[i] : 0;
+			const int c = (prior && i >= bpp) ? prior[i - bpp] : 0;
+			int predictor = 0;
+			switch (filter) {
+				case PNG_ROW_FILTER_SUB: predictor = a; break;
+				case PNG_ROW_FILTER_UP: predictor = b; break;
+				case PNG_ROW_FILTER_AVERAGE: predictor = (a + b) / 2; break;
+				case PNG_ROW_FILTER_PAETH: {
+					const int p = a + b - c;
+					const int pa = std::abs(p - a);
+					const int pb = std::abs(p - b);
+					const int pc = std::abs(p - c);
+					predictor = (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+					break;
+				}
+				default: break;
+			}
+			out[i] = static_cast<unsigned char>(row[i] - predictor);
+		}
+	}
+
+	// the adler32 of two pieces of data from theirs, len2 the length of
+	// the second; zlib has it from 1.2.3 on only
+	inline unsigned long png_adler32_combine(
+		unsigned long adler1, unsigned long adler2, size_t len2
+	)
+	{
+		const unsigned long BASE = 65521;
+		const unsigned long rem = static_cast<unsigned long>(len2 % BASE);
+		unsigned long sum1 = adler1 & 0xffff;
+		unsigned long sum2 = (rem * sum1) % BASE;
+		sum1 += (adler2 & 0xffff) + BASE - 1;
+		sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) +
+			BASE - rem;
+		if (sum1 >= BASE) sum1 -= BASE;
+		if (sum1 >= BASE) sum1 -= BASE;
+		if (sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+		if (sum2 >= BASE) sum2 -= BASE;
+		return sum1 | (sum2 << 16);
+	}
+
+	// the bytes deflated by one task, of size filtered bytes in rows of
+	// rowbytes, for a block_size of PngOptions
+	inline size_t png_block_size(
+		size_t block_size, size_t rowbytes, size_t size
+	)
+	{
+		size_t block = size;
+		if (block_size)
+			block = std::min(block, std::max(block_size, std::max<size_t>(
+				PngOptions::MIN_BLOCK_SIZE, rowbytes + 1)));
+		return std::min<size_t>(block, PngOptions::MAX_BLOCK_SIZE);
+	}
+
+	/* PngWriter:
+	 *   writes 8 bit, or with PngOptions::bit_depth 16 bit, gray, RGB or
+	 *   RGBA PNGs. The rows are converted and filtered in parallel, then
+	 *   deflated in blocks of block_size bytes, each block on its own
+	 *   thread and primed with the 32K before it, as pigz does; blocks
+	 *   end on a sync flush and are stitched into one zlib stream, so the
+	 *   file is a standard PNG. The bytes written do not depend on the
+	 *   number of threads.
+	 *
+	 *   Built without zlib (see Zlib.h), PNGs are written through libpng
+	 *   in the library at its own settings, 8 bit; options other than
+	 *   the default level, filter, strategy and bit depth then throw
+	 *   std::invalid_argument.
+	 */
 	class DLLAPI PngWriter {
 		public:
+			explicit PngWriter(
+				const PngOptions& options = PngOptions(),
+				const Execution& exec = Execution::global()
+			): my_options(checked(options)), my_exec(exec)
+			{
+				// empty
+			}
+
+			const PngOptions& options() const
+			{
+				return my_options;
+			}
+
+			void options(const PngOptions& options)
+			{
+				my_options = checked(options);
+			}
+
 			template <template<typename, typename> class Converter, typename I>
 			void operator ()(const I& image, FILE* f)
 			{
+#ifdef GIL_ZLIB
+				if (my_options.bit_depth == 16) {
+					if (image.channels() >= 4)
+						encode<Converter, I, Short4>(image, f);
+					else if (image.channels() == 3)
+						encode<Converter, I, Short3>(image, f);
+					else
+						encode<Converter, I, Short1>(image, f);
+				} else {
+					if (image.channels() >= 4)
+						encode<Converter, I, Byte4>(image, f);
+					else if (image.channels() == 3)
+						encode<Converter, I, Byte3>(image, f);
+					else
+						encode<Converter, I, Byte1>(image, f);
+				}
+#else
 				init(f);
 				if (image.channels() >= 4)
 					write<Converter, I, Byte4>(image);
@@ -116,6 +291,7 @@ namespace gil {
 				else
 					write<Converter, I, Byte1>(image);
 				finish();
+#endif
 			}
 			template <typename I>
 			void operator ()(I& image, FILE* f)
@@ -123,6 +299,23 @@ namespace gil {
 				this->operator()<DefaultConverter, I>(image, f);
 			}
 		protected:
+			// options the writer can honour; block_size changes nothing
+			// in the file
+			static const PngOptions& checked(const PngOptions& options)
+			{
+#ifndef GIL_ZLIB
+				const PngOptions defaults;
+				if (options.level != defaults.level ||
+						options.filter != defaults.filter ||
+						options.strategy != defaults.strategy ||
+						options.bit_depth != defaults.bit_depth)
+					throw std::invalid_argument(
+						"png: options need zlib, libpng writes at its defaults"
+					);
+#endif
+				return options;
+			}
+
 			void init(FILE* f);
 			void write(unsigned char** row_pointers);
 			void finish();
@@ -137,8 +330,6 @@ namespace gil {
 				my_height = image.height();
 				my_channels = ColorTrait<ColorType>::channels();
 
-				Converter<ColorType, typename I::ColorType> converter;
-
 				std::vector<ColorType*> row_pointers(my_height);
 				std::vector<ColorType> row_data(my_height*my_width);
 				row_pointers[0] = &row_data[0];
@@ -146,12 +337,297 @@ namespace gil {
 					row_pointers[i] = row_pointers[i-1] + my_width;
 
 				for (size_t h = 0; h < my_height; ++h)
-					for (size_t w = 0; w < my_width; ++w)
-						row_pointers[h][w] = converter( image(w, h) );
-						//I::Converter::int2ext(row_pointers[h][w], image(w, h));
+					load_row<Converter>(row_pointers[h], image, h, my_width);
 
 				write((unsigned char**)&row_pointers[0]);
 			}
+
+#ifdef GIL_ZLIB
+		private:
+			// a deflated block and the checksums of its IDAT chunk
+			struct Block {
+				std::vector<unsigned char> data;
+				unsigned long adler;	// of the filtered bytes it holds
+				unsigned long crc;		// of "IDAT" and data
+			};
+
+			// converts rows [y0, y1) to bytes, samples big endian
+			template<
+				template<typename, typename> class Converter,
+				typename I, typename ColorType
+			>
+			class LoadRows {
+				public:
+					LoadRows(const I& image, unsigned char* raw, size_t rowbytes)
+						: my_image(image), my_raw(raw), my_rowbytes(rowbytes)
+					{
+						// empty
+					}
+
+					void operator ()(size_t y0, size_t y1) const
+					{
+						typedef typename ColorTrait<ColorType>::BaseType T;
+						const size_t width = my_image.width();
+						for (size_t y = y0; y < y1; ++y) {
+							unsigned char *row = my_raw + y*my_rowbytes;
+							load_row<Converter>(
+								reinterpret_cast<ColorType*>(row), my_image, y, width
+							);
+							if (sizeof(T) == 2)
+								for (size_t i = 0; i < my_rowbytes; i += 2) {
+									unsigned short v;
+									std::memcpy(&v, row + i, 2);
+									row[i] = static_cast<unsigned char>(v >> 8);
+									row[i + 1] = static_cast<unsigned char>(v);
+								}
+						}
+					}
+
+				private:
+					const I& my_image;
+					unsigned char *my_raw;
+					size_t my_rowbytes;
+			};
+
+			// filters rows [y0, y1)
+			class FilterRows {
+				public:
+					FilterRows(
+						const unsigned char* raw, unsigned char* filtered,
+						size_t rowbytes, size_t bpp, PngFilter filter
+					): my_raw(raw), my_filtered(filtered),
+					   my_rowbytes(rowbytes), my_bpp(bpp), my_filter(filter)
+					{
+						// empty
+					}
+
+					void operator ()(size_t y0, size_t y1) const
+					{
+						std::vector<unsigned char> scratch(
+							my_filter == PNG_ROW_FILTER_ADAPTIVE ? 1 + my_rowbytes : 0
+						);
+						for (size_t y = y0; y < y1; ++y)
+							png_filter_row(
+								my_raw + y*my_rowbytes,
+								y ? my_raw + (y - 1)*my_rowbytes : NULL,
+								my_rowbytes, my_bpp, my_filter,
+								my_filtered + y*(my_rowbytes + 1),
+								scratch.empty() ? NULL : &scratch[0]
+							);
+					}
+
+				private:
+					const unsigned char *my_raw;
+					unsigned char *my_filtered;
+					size_t my_rowbytes;
+					size_t my_bpp;
+					PngFilter my_filter;
+			};
+
+			// deflates blocks [b0, b1) of size bytes of data
+			class DeflateBlocks {
+				public:
+					DeflateBlocks(
+						const unsigned char* data, size_t size, size_t block,
+						const PngOptions& options, std::vector<Block>& blocks
+					): my_data(data), my_size(size), my_block(block),
+					   my_options(options), my_blocks(blocks)
+					{
+						// empty
+					}
+
+					void operator ()(size_t b0, size_t b1) const
+					{
+						for (size_t b = b0; b < b1; ++b)
+							deflate_block(b);
+					}
+
+				private:
+					void deflate_block(size_t b) const
+					{
+						const size_t begin = b * my_block;
+						const size_t length = std::min(my_block, my_size - begin);
+						const bool last = (begin + length == my_size);
+						const unsigned char *in = my_data + begin;
+						Block& block = my_blocks[b];
+
+						z_stream z;
+						std::memset(&z, 0, sizeof(z));
+						if (deflateInit2(
+								&z, my_options.level, Z_DEFLATED, -MAX_WBITS, 8,
+								static_cast<int>(my_options.strategy)) != Z_OK)
+							throw IOError("cannot initialize deflate");
+						if (begin) {
+							const size_t window = std::min<size_t>(begin, 32768);
+							deflateSetDictionary(
+								&z, const_cast<Bytef*>(in - window),
+								static_cast<uInt>(window)
+							);
+						}
+
+						block.data.resize(deflateBound(&z, static_cast<uLong>(length)) + 16);
+						z.next_in = const_cast<Bytef*>(in);
+						z.avail_in = static_cast<uInt>(length);
+						size_t out = 0;
+						for (;;) {
+							z.next_out = &block.data[out];
+							z.avail_out = static_cast<uInt>(block.data.size() - out);
+							const int ret = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+							if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+								deflateEnd(&z);
+								throw IOError("deflate error");
+							}
+							out = block.data.size() - z.avail_out;
+							if (last ? ret == Z_STREAM_END :
+									z.avail_in == 0 && z.avail_out != 0)
+								break;
+							block.data.resize(2 * block.data.size());
+						}
+						deflateEnd(&z);
+						block.data.resize(out);
+
+						block.adler = adler32(adler32(0, NULL, 0), in,
+							static_cast<uInt>(length));
+						block.crc = crc32(crc32(0, NULL, 0),
+							reinterpret_cast<const Bytef*>("IDAT"), 4);
+						if (out)
+							block.crc = crc32(block.crc, &block.data[0],
+								static_cast<uInt>(out));
+					}
+
+					const unsigned char *my_data;
+					size_t my_size;
+					size_t my_block;
+					const PngOptions& my_options;
+					std::vector<Block>& my_blocks;
+			};
+
+			template<
+				template<typename, typename> class Converter,
+				typename I, typename ColorType
+			>
+			void encode(const I& image, FILE* f)
+			{
+				typedef typename ColorTrait<ColorType>::BaseType T;
+				const size_t width = image.width();
+				const size_t height = image.height();
+				const size_t channels = ColorTrait<ColorType>::channels();
+				if (width == 0 || height == 0)
+					throw std::invalid_argument("cannot write an empty png");
+				if (my_options.level < 0 || my_options.level > 9)
+					throw std::invalid_argument("png level out of range");
+
+				const size_t bpp = channels * sizeof(T);
+				const size_t rowbytes = width * bpp;
+				std::vector<unsigned char> raw(height * rowbytes);
+				const LoadRows<Converter, I, ColorType> load(
+					image, &raw[0], rowbytes
+				);
+				// images without rows of their own, StreamOutput among them,
+				// give their rows in order only
+				if (RowTrait<I>::Contiguous)
+					parallel_for(0, height, load, my_exec);
+				else
+					load(0, height);
+
+				const size_t size = height * (rowbytes + 1);
+				std::vector<unsigned char> filtered(size);
+				parallel_for(
+					0, height,
+					FilterRows(&raw[0], &filtered[0], rowbytes, bpp, my_options.filter),
+					my_exec
+				);
+				std::vector<unsigned char>().swap(raw);
+
+				const size_t block =
+					png_block_size(my_options.block_size, rowbytes, size);
+				std::vector<Block> blocks( (size + block - 1) / block );
+				parallel_for(
+					0, blocks.size(),
+					DeflateBlocks(&filtered[0], size, block, my_options, blocks),
+					my_exec
+				);
+
+				static const unsigned char SIGNATURE[8] = {
+					0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+				};
+				if (fwrite(SIGNATURE, 8, 1, f) != 1)
+					throw IOError("unknown write error");
+
+				unsigned char ihdr[13];
+				put32(ihdr, width);
+				put32(ihdr + 4, height);
+				ihdr[8] = static_cast<unsigned char>(8 * sizeof(T));
+				ihdr[9] = (channels == 4) ? 6 : (channels == 3) ? 2 : 0;
+				ihdr[10] = ihdr[11] = ihdr[12] = 0;
+				write_chunk(f, "IHDR", ihdr, 13);
+
+				// zlib header, with the level as FLEVEL
+				const int level = my_options.level;
+				unsigned char header[2] = {
+					0x78, static_cast<unsigned char>(
+						(level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6
+					)
+				};
+				header[1] += 31 - (header[0] * 256 + header[1]) % 31;
+				write_chunk(f, "IDAT", header, 2);
+
+				unsigned long adler = adler32(0, NULL, 0);
+				for (size_t b = 0; b < blocks.size(); ++b) {
+					const size_t length = std::min(block, size - b*block);
+					adler = png_adler32_combine(adler, blocks[b].adler, length);
+					write_chunk(f, "IDAT", blocks[b].data, blocks[b].crc);
+					std::vector<unsigned char>().swap(blocks[b].data);
+				}
+
+				unsigned char trailer[4];
+				put32(trailer, adler);
+				write_chunk(f, "IDAT", trailer, 4);
+				write_chunk(f, "IEND", NULL, 0);
+			}
+
+			static void put32(unsigned char* p, unsigned long v)
+			{
+				p[0] = static_cast<unsigned char>(v >> 24);
+				p[1] = static_cast<unsigned char>(v >> 16);
+				p[2] = static_cast<unsigned char>(v >> 8);
+				p[3] = static_cast<unsigned char>(v);
+			}
+
+			static void write_chunk(
+				FILE* f, const char* type, const unsigned char* data, size_t size
+			)
+			{
+				unsigned long crc = crc32(crc32(0, NULL, 0),
+					reinterpret_cast<const Bytef*>(type), 4);
+				if (size)
+					crc = crc32(crc, data, static_cast<uInt>(size));
+				write_chunk(f, type, data, size, crc);
+			}
+
+			static void write_chunk(
+				FILE* f, const char* type,
+				const std::vector<unsigned char>& data, unsigned long crc
+			)
+			{
+				write_chunk(f, type, data.empty() ? NULL : &data[0], data.size(), crc);
+			}
+
+			static void write_chunk(
+				FILE* f, const char* type, const unsigned char* data,
+				size_t size, unsigned long crc
+			)
+			{
+				unsigned char length[4], check[4];
+				put32(length, size);
+				put32(check, crc);
+				if (fwrite(length, 4, 1, f) != 1 || fwrite(type, 4, 1, f) != 1 ||
+						(size && fwrite(data, size, 1, f) != 1) ||
+						fwrite(check, 4, 1, f) != 1)
+					throw IOError("unknown write error");
+			}
+#endif // GIL_ZLIB
+
 		private:
 			const static size_t BIT_DEPTH = 8;
 			void *my_png_ptr;
@@ -160,6 +636,8 @@ namespace gil {
 			size_t my_height;
 			size_t my_channels;
 			size_t my_bit_depth;
+			PngOptions my_options;
+			Execution my_exec;
 	};
 } // namespace gil
 
@@ -9,6 +9,7 @@
  */
 
 #include <cstdio>
+#include <cstring>
 #include <stdexcept>
 #include <vector>
 
@@ -27,8 +28,6 @@ namespace gil {
 				init(f);
 
 				image.allocate(my_width, my_height);
-				Converter<typename I::ColorType, ColorType> converter;
-
 				std::vector<ColorType> row(my_width);
 				for (size_t h = 0; h < my_height; ++h) {
 					if (fread((void*)&row[0], 
@@ -37,9 +36,7 @@ namespace gil {
 							throw EndOfFile("unexpected end-of-file");
 						throw IOError("unknown read error");
 					}
-					for (size_t w = 0; w < my_width; ++w)
-						image(w, h) = converter(row[w]);
-						//I::Converter::ext2int(image(w, h), row[w]);
+					store_row<Converter>(image, h, &row[0], my_width);
 				}
 			}
 			template <typename I>
@@ -111,11 +108,8 @@ namespace gil {
 					Magic, (int)image.width(), (int)image.height(), 255) < 0)
 					throw IOError("unknown write error");
 				std::vector<ColorType> row(image.width());
-				Converter<ColorType, typename I::ColorType> converter;
 				for (size_t h = 0; h < image.height(); ++h) {
-					for (size_t w = 0; w < image.width(); ++w)
-						row[w] = converter( image(w, h) );
-						//I::Converter::int2ext(row[w], image(w, h));
+					load_row<Converter>(&row[0], image, h, image.width());
 					if (fwrite((void*)&row[0], 
 								sizeof(ColorType)*image.width(), 1, f) != 1) {
 						throw IOError("unknown write error");
@@ -58,15 +58,11 @@ namespace gil {
 			>
 			void read_pixels(I& image)
 			{
-				//typedef typename I::Converter Conv;
-				Converter<typename I::ColorType, T> converter;
 				size_t w = image.width(), h = image.height();
 				std::vector<T> buffer(w);
 				for(size_t y = 0; y < h; y++){
 					read_scanline(buffer, static_cast<unsigned int>(y));
-					for(size_t x = 0; x < w; x++)
-						image(x, y) = converter(buffer[x]);
-						// Conv::ext2int( image(x, y), buffer[x] );
+					store_row<Converter>(image, y, &buffer[0], w);
 				}
 			}
 
@@ -127,14 +123,10 @@ namespace gil {
 			>
 			void write_pixels(I& image)
 			{
-				//typedef typename I::Converter Conv;
-				Converter<T, typename I::ColorType> converter;
 				size_t w = image.width(), h = image.height();
 				std::vector<T> buffer(w);
 				for(size_t y = 0; y < h; y++){
-					for(size_t x = 0; x < w; x++)
-						buffer[x] = converter( image(x, y) );
-						//Conv::int2ext( buffer[x], image(x, y) );
+					load_row<Converter>(&buffer[0], image, y, w);
 
 					write_scanline(buffer, static_cast<unsigned int>(y));
 				}
@@ -15,5 +15,6 @@
 #include "dip/ColorSpace.h"
 #include "dip/Convert.h"
 #include "dip/Pyramid.h"
+#include "dip/Stream.h"
 
 #endif
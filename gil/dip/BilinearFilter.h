@@ -17,33 +17,133 @@ namespace gil {
 			{
 				// empty
 			}
-		protected:
+
+			// point-wise stage interface, see StageTrait
 			template<class SrcImage>
-			void filter(DstImage& dst, const SrcImage& src) const
+			size_t width(const SrcImage&) const
+			{
+				return my_x;
+			}
+
+			template<class SrcImage>
+			size_t height(const SrcImage&) const
+			{
+				return my_y;
+			}
+
+			// interpolates like Image::lerp from two source rows, read a
+			// tile at a time or pixel by pixel when shrinking more than twice
+			template<class SrcImage>
+			void read(
+				typename DstImage::value_type* out, const SrcImage& src,
+				size_t x, size_t y, size_t n
+			) const
 			{
+				typedef typename SrcImage::value_type src_type;
+
 				const float ratio_x = src.width() / static_cast<float>(my_x);
-				const float ratio_y = src.height() / static_cast<float>(my_y);
-				dst.resize(my_x, my_y);
-				for (size_t y = 0; y < dst.height(); ++y) {
-					for (size_t x = 0; x < dst.width(); ++x) {
-						T _x = x*ratio_x;
-						T _y = y*ratio_y;
+				const T _y = source(y, my_y, src.height());
+				const int y0 = static_cast<int>(_y);
+				const double yf = _y - y0;
+
+				src_type r0[GIL_PIPELINE_TILE];
+				src_type r1[GIL_PIPELINE_TILE];
+				for (size_t i = 0; i < n; ) {
+					const size_t lo = static_cast<size_t>(
+						source(x + i, my_x, src.width())
+					);
+					size_t m = 1;
+					if (ratio_x <= 2)
+						while (i + m < n &&
+							static_cast<size_t>(
+								source(x + i + m, my_x, src.width())
+							) + 1 - lo < GIL_PIPELINE_TILE)
+							++m;
 
-						_x = std::min( _x, static_cast<T>( src.width()-1 ) );
-						_x = std::max( _x, static_cast<T>(0) );
+					const size_t hi = std::min(
+						static_cast<size_t>(
+							source(x + i + m - 1, my_x, src.width())
+						) + 1,
+						src.width() - 1
+					);
+					read_span(src, r0, lo, y0, hi - lo + 1);
+					if (yf != 0)
+						read_span(src, r1, lo, y0 + 1, hi - lo + 1);
 
-						_y = std::min( _y, static_cast<T>( src.height()-1 ) );
-						_y = std::max( _y, static_cast<T>(0) );
+					for (size_t k = 0; k < m; ++k, ++i) {
+						const T _x = source(x + i, my_x, src.width());
+						const int x0 = static_cast<int>(_x);
+						const double xf = _x - x0;
+						const size_t j = x0 - lo;
 
-						dst(x, y) = src.lerp(_x, _y);
+						if (xf == 0 && yf == 0)
+							out[i] = r0[j];
+						else if (xf == 0)
+							out[i] = mix( r0[j], r1[j], yf );
+						else if (yf == 0)
+							out[i] = mix( r0[j], r0[j+1], xf );
+						else
+							out[i] = mix(
+								mix( r0[j], r0[j+1], xf ),
+								mix( r1[j], r1[j+1], xf ),
+								yf );
 					}
 				}
 			}
+
+		protected:
+			template<class SrcImage>
+			void filter(DstImage& dst, const SrcImage& src) const
+			{
+				filter(dst, src, Execution::global());
+			}
+
+			template<class SrcImage>
+			void filter(
+				DstImage& dst, const SrcImage& src, const Execution& exec
+			) const
+			{
+				dst.resize(my_x, my_y);
+				parallel_bands(
+					*this, &BilinearFilter::template filter_rows<SrcImage>,
+					dst, src, 0, dst.height(), exec
+				);
+			}
+
+			// resample the rows [y0, y1) of dst, which is sized already
+			template<class SrcImage>
+			void filter_rows(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1
+			) const
+			{
+				for (size_t y = y0; y < y1; ++y) {
+					const T _y = source(y, my_y, src.height());
+					for (size_t x = 0; x < dst.width(); ++x)
+						dst(x, y) = src.lerp(source(x, my_x, src.width()), _y);
+				}
+			}
+
+			// the source position of x, in an axis scaled from size to
+			// target
+			static T source(size_t x, size_t target, size_t size)
+			{
+				const float ratio = size / static_cast<float>(target);
+				T _x = x*ratio;
+				_x = std::min( _x, static_cast<T>( size-1 ) );
+				_x = std::max( _x, static_cast<T>(0) );
+				return _x;
+			}
 		private:
 			size_t my_x;
 			size_t my_y;
 	};
 
+	template<class DstImage, typename T>
+	struct StageTrait< BilinearFilter<DstImage, T> > {
+		enum { Pointwise = true };
+		enum { Streaming = false };
+	};
+
 }
 
 #endif
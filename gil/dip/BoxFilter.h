@@ -1,6 +1,10 @@
 #ifndef GIL_BOX_FILTER_H
 #define GIL_BOX_FILTER_H
 
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
 #include "Kernel.h"
 #include "TwoPassFilter.h"
 
@@ -19,6 +23,165 @@ namespace gil {
 			}
 	};
 
+	/* BoxConvolution:
+	 *   box filtering by running sums, the cost per pixel does not depend
+	 *   on the box size. Like TwoPassFilter, each output is the mean of the
+	 *   taps that fall inside the image. The sums are kept in double so
+	 *   that wide boxes over HDR data do not drift.
+	 *
+	 *   The column sums restart every BLOCK rows. Bands of rows that begin
+	 *   on a block therefore come out exactly as a single pass would.
+	 */
+	template<class DstImage, class SrcImage>
+	class BoxConvolution {
+		public:
+			enum { Channels = ColorTrait<typename SrcImage::value_type>::Channels };
+
+			// rows between restarts of the column sums
+			static const size_t BLOCK = 256;
+
+			BoxConvolution(size_t xsize, size_t ysize)
+				: my_xlo(-static_cast<int>(xsize/2)),
+				  my_xhi(static_cast<int>(xsize) - 1 - static_cast<int>(xsize/2)),
+				  my_ylo(-static_cast<int>(ysize/2)),
+				  my_yhi(static_cast<int>(ysize) - 1 - static_cast<int>(ysize/2))
+			{
+				// empty
+			}
+
+			// compute the output rows [y0, y1), dst must be sized already.
+			// dst may be the same image as src.
+			void operator ()(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1
+			) const
+			{
+				if (y0 >= y1)
+					return;
+
+				const int height = static_cast<int>(src.height());
+				const size_t rowlen = src.width() * Channels;
+				const size_t ring = std::min(
+					static_cast<size_t>(my_yhi - my_ylo + 2), src.height()
+				);
+
+				std::vector<float> rows(ring * rowlen);
+				std::vector<float> line(rowlen);
+				std::vector<float> out(rowlen);
+				std::vector<double> sum(rowlen, 0.0);
+
+				const int begin = static_cast<int>(y0);
+				int first = std::max(begin + my_ylo, 0);
+				int last = std::min(begin + my_yhi, height - 1);
+				for (int k = first; k <= last; ++k)
+					produce(rows, ring, rowlen, src, k, line);
+
+				for (int y = begin; y < static_cast<int>(y1); ++y) {
+					if (y != begin) {
+						if (y + my_yhi < height) {
+							last = y + my_yhi;
+							produce(rows, ring, rowlen, src, last, line);
+							if (y % BLOCK)
+								add(sum, &rows[(last % ring) * rowlen], 1.0);
+						}
+						if (y + my_ylo - 1 >= 0) {
+							first = y + my_ylo;
+							if (y % BLOCK)
+								add(sum, &rows[((first-1) % ring) * rowlen], -1.0);
+						}
+					}
+
+					if (y == begin || y % BLOCK == 0) {
+						std::fill(sum.begin(), sum.end(), 0.0);
+						for (int k = first; k <= last; ++k)
+							add(sum, &rows[(k % ring) * rowlen], 1.0);
+					}
+
+					float *acc = FloatRows<DstImage>::row(dst, y);
+					if (acc == 0)
+						acc = &out[0];
+
+					const double scale = 1.0 / (last - first + 1);
+					for (size_t j = 0; j < rowlen; ++j)
+						acc[j] = static_cast<float>(sum[j] * scale);
+
+					if (acc == &out[0])
+						FloatRows<DstImage>::store(dst, y, acc);
+				}
+			}
+
+		private:
+			void produce(
+				std::vector<float>& rows, size_t ring, size_t rowlen,
+				const SrcImage& src, int y, std::vector<float>& line
+			) const
+			{
+				float *out = &rows[(y % ring) * rowlen];
+				filter_x(out, FloatRows<SrcImage>::get(src, y, &line[0]), src.width());
+			}
+
+			void filter_x(float* out, const float* in, size_t n) const
+			{
+				const int width = static_cast<int>(n);
+				double sum[Channels];
+				std::fill(sum, sum + Channels, 0.0);
+
+				int first = 0;
+				int last = std::min(my_xhi, width - 1);
+				for (int k = first; k <= last; ++k)
+					for (size_t c = 0; c < Channels; ++c)
+						sum[c] += in[k*Channels + c];
+
+				for (int x = 0; x < width; ++x) {
+					if (x != 0) {
+						if (x + my_xhi < width) {
+							last = x + my_xhi;
+							for (size_t c = 0; c < Channels; ++c)
+								sum[c] += in[last*Channels + c];
+						}
+						if (x + my_xlo - 1 >= 0) {
+							first = x + my_xlo;
+							for (size_t c = 0; c < Channels; ++c)
+								sum[c] -= in[(first-1)*Channels + c];
+						}
+					}
+
+					const double scale = 1.0 / (last - first + 1);
+					for (size_t c = 0; c < Channels; ++c)
+						*out++ = static_cast<float>(sum[c] * scale);
+				}
+			}
+
+			static void add(std::vector<double>& sum, const float* row, double sign)
+			{
+				for (size_t j = 0; j < sum.size(); ++j)
+					sum[j] += sign * row[j];
+			}
+
+			int my_xlo;
+			int my_xhi;
+			int my_ylo;
+			int my_yhi;
+	};
+
+	template<class DstImage, class SrcImage>
+	const size_t BoxConvolution<DstImage, SrcImage>::BLOCK;
+
+	// box kernels take the running-sum engine
+	template<typename T, class DstImage, class SrcImage>
+	void separable_convolve(
+		DstImage& dst, const SrcImage& src,
+		const BoxKernel<T>& xkernel, const BoxKernel<T>& ykernel,
+		const Execution& exec = Execution::global()
+	)
+	{
+		typedef BoxConvolution<DstImage, SrcImage> Engine;
+
+		dst.resize(src.width(), src.height());
+		convolve_bands(
+			Engine(xkernel.size(), ykernel.size()), dst, src, exec, Engine::BLOCK
+		);
+	}
+
 	template<class DstImage, typename T = TypeTrait<Byte1>::MathType>
 	class BoxFilter: 
 		public TwoPassFilter< DstImage, T, BoxKernel<T>, BoxKernel<T> > 
@@ -35,6 +198,112 @@ namespace gil {
 				// empty
 			}
 	};
+
+	/* BoxGaussianFilter:
+	 *   approximates a Gaussian blur by repeated box blurs, whose widths are
+	 *   chosen to match the requested sigma. Its cost does not depend on
+	 *   sigma, so it is meant for large sigmas. Three passes are accurate
+	 *   to a few percent.
+	 *
+	 * Reference:
+	 *   P. Kovesi, "Fast Almost-Gaussian Filtering", DICTA 2010.
+	 */
+	template<class DstImage, typename T = TypeTrait<Byte1>::MathType>
+	class BoxGaussianFilter: 
+		public Filter< BoxGaussianFilter<DstImage, T>, DstImage > 
+	{
+		friend class Filter< BoxGaussianFilter<DstImage, T>, DstImage >;
+
+		public:
+			BoxGaussianFilter(T sigmax, T sigmay, size_t passes = 3):
+				Filter< BoxGaussianFilter<DstImage, T>, DstImage >(*this),
+				my_xsizes( box_sizes(sigmax, passes) ),
+				my_ysizes( box_sizes(sigmay, passes) )
+			{
+				// empty
+			}
+
+			// widths of the boxes whose n-fold convolution has variance
+			// sigma^2, all odd so the boxes stay centred.
+			static std::vector<size_t> box_sizes(T sigma, size_t n)
+			{
+				std::vector<size_t> sizes(n, 1);
+				if (n == 0 || sigma <= 0)
+					return sizes;
+
+				const double s2 = 12.0 * sigma * sigma;
+				int wl = static_cast<int>( std::floor(std::sqrt(s2/n + 1)) );
+				if (wl % 2 == 0)
+					--wl;
+				const int wu = wl + 2;
+				const double m = 
+					(s2 - n*wl*wl - 4.0*n*wl - 3.0*n) / (-4.0*wl - 4.0);
+				const size_t lower = static_cast<size_t>( 
+					std::max(0.0, std::floor(m + 0.5)) );
+
+				for (size_t i = 0; i < n; ++i)
+					sizes[i] = static_cast<size_t>( i < lower ? wl : wu );
+				return sizes;
+			}
+
+			// rows read above and below an output row, see FilterStream
+			size_t radius() const
+			{
+				size_t radius = 0;
+				for (size_t i = 0; i < my_ysizes.size(); ++i)
+					radius += my_ysizes[i]/2;
+				return radius;
+			}
+
+		protected:
+			template<class SrcImage>
+			void filter(DstImage& dst, const SrcImage& src) const
+			{
+				filter(dst, src, Execution::global());
+			}
+
+			template<class SrcImage>
+			void filter(
+				DstImage& dst, const SrcImage& src, const Execution& exec
+			) const
+			{
+				typedef 
+					Image<
+						typename ColorTrait<
+							typename DstImage::value_type
+						>::ExtendedColor,
+						PoolAllocator
+					> TmpImage;
+
+				const size_t n = my_xsizes.size();
+				if (n == 0) {
+					dst = src;
+					return;
+				}
+				if (n == 1) {
+					BoxFilter<DstImage, T>(my_xsizes[0], my_ysizes[0])(
+						dst, src, exec
+					);
+					return;
+				}
+
+				TmpImage tmp;
+				BoxFilter<TmpImage, T>(my_xsizes[0], my_ysizes[0])(
+					tmp, src, exec
+				);
+				for (size_t i = 1; i + 1 < n; ++i)
+					BoxFilter<TmpImage, T>(my_xsizes[i], my_ysizes[i])(
+						tmp, tmp, exec
+					);
+				BoxFilter<DstImage, T>(my_xsizes[n-1], my_ysizes[n-1])(
+					dst, tmp, exec
+				);
+			}
+
+		private:
+			std::vector<size_t> my_xsizes;
+			std::vector<size_t> my_ysizes;
+	};
 }
 
 #endif
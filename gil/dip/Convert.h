@@ -1,8 +1,11 @@
 #ifndef GIL_CONVERT_H
 #define GIL_CONVERT_H
 
+#include <algorithm>
+
 #include "Filter.h"
 #include "../core/Converter.h"
+#include "../core/Int2Type.h"
 
 namespace gil {
 
@@ -17,30 +20,76 @@ namespace gil {
 				// empty
 			}
 
+			// point-wise, reads no rows around its output, see FilterStream
+			size_t radius() const
+			{
+				return 0;
+			}
+
 			template<class SrcImage>
-			inline void operator ()(DstImage& dst, const SrcImage& src) const
+			inline void operator ()(
+				DstImage& dst, const SrcImage& src,
+				const Execution& exec = Execution::global()
+			) const
 			{
 				dst.resize(src.width(), src.height());
-				Converter<
-					typename DstImage::value_type, 
-					typename SrcImage::value_type
-				> converter;
-				for (size_t y = 0; y < src.height(); ++y)
-					for (size_t x = 0; x < src.width(); ++x)
-						dst(x, y) = converter(src(x, y));
+				parallel_bands(
+					*this, &DefaultConvert::template convert_rows<SrcImage>,
+					dst, src, 0, src.height(), exec
+				);
 			}
 
+			// convert the rows [y0, y1), dst is sized already
+			template<class SrcImage>
+			void convert_rows(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1
+			) const
+			{
+				convert_rows(
+					dst, src, y0, y1,
+					Int2Type<RowTrait<SrcImage>::Contiguous>()
+				);
+			}
+
+			// fused with the proxy, no intermediate image
 			template<
 				class ProxyFilter, class ProxyDstImage, class ProxySrcImage
 			>
 			inline void operator ()(
 				DstImage& dst,
 				const ImageProxy<ProxyFilter, ProxyDstImage, ProxySrcImage>&
-				src_proxy
+				src_proxy,
+				const Execution& exec = Execution::global()
+			) const
+			{
+				(*this)(src_proxy).fuse(dst, exec);
+			}
+
+			// point-wise stage interface, see StageTrait
+			template<class SrcImage>
+			size_t width(const SrcImage& src) const
+			{
+				return src.width();
+			}
+
+			template<class SrcImage>
+			size_t height(const SrcImage& src) const
+			{
+				return src.height();
+			}
+
+			template<class SrcImage>
+			void read(
+				typename DstImage::value_type* out, const SrcImage& src,
+				size_t x, size_t y, size_t n
 			) const
 			{
-				ProxyDstImage tmp;
-				(*this)(dst, src_proxy(tmp));
+				typename SrcImage::value_type tile[GIL_PIPELINE_TILE];
+				for (size_t i = 0; i < n; i += GIL_PIPELINE_TILE) {
+					const size_t m = std::min<size_t>(GIL_PIPELINE_TILE, n - i);
+					read_span(src, tile, x + i, y, m);
+					convert_row<Converter>(out + i, tile, m);
+				}
 			}
 
 			template<class SrcImage>
@@ -60,6 +109,35 @@ namespace gil {
 					>
 					(*this, src);
 			}
+
+		private:
+			// whole rows at once with convert_row
+			template<class SrcImage>
+			void convert_rows(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1,
+				Int2Type<true>
+			) const
+			{
+				const size_t width = src.width();
+				for (size_t y = y0; y < y1; ++y)
+					if (width)
+						store_row<Converter>(dst, y, &src(0, y), width);
+			}
+
+			template<class SrcImage>
+			void convert_rows(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1,
+				Int2Type<false>
+			) const
+			{
+				Converter<
+					typename DstImage::value_type, 
+					typename SrcImage::value_type
+				> converter;
+				for (size_t y = y0; y < y1; ++y)
+					for (size_t x = 0; x < src.width(); ++x)
+						dst(x, y) = converter(src(x, y));
+			}
 	};
 
 	template<template<class> class Converter>
@@ -70,19 +148,40 @@ namespace gil {
 				// empty
 			}
 
+			// point-wise, reads no rows around its output, see FilterStream
+			size_t radius() const
+			{
+				return 0;
+			}
+
 			template<class I>
 			inline void operator ()(
 				Image<typename Converter<typename I::value_type>::To>& dst, 
-				const I& src
+				const I& src,
+				const Execution& exec = Execution::global()
 			) const
 			{
 				dst.resize(src.width(), src.height());
+				parallel_bands(
+					*this, &Convert::template convert_rows<I>,
+					dst, src, 0, src.height(), exec
+				);
+			}
+
+			// convert the rows [y0, y1), dst is sized already
+			template<class I>
+			void convert_rows(
+				Image<typename Converter<typename I::value_type>::To>& dst, 
+				const I& src, size_t y0, size_t y1
+			) const
+			{
 				Converter<typename I::value_type> converter;
-				for (size_t y = 0; y < src.height(); ++y)
+				for (size_t y = y0; y < y1; ++y)
 					for (size_t x = 0; x < src.width(); ++x)
 						dst(x, y) = converter(src(x, y));
 			}
 
+			// fused with the proxy, no intermediate image
 			template<
 				class ProxyFilter, class ProxyDstImage, class ProxySrcImage
 			>
@@ -91,11 +190,40 @@ namespace gil {
 					typename Converter<typename ProxyDstImage::value_type>::To
 				>& dst,
 				const ImageProxy<ProxyFilter, ProxyDstImage, ProxySrcImage>&
-				src_proxy
+				src_proxy,
+				const Execution& exec = Execution::global()
 			) const
 			{
-				ProxyDstImage tmp;
-				(*this)(dst, src_proxy(tmp));
+				(*this)(src_proxy).fuse(dst, exec);
+			}
+
+			// point-wise stage interface, see StageTrait
+			template<class I>
+			size_t width(const I& src) const
+			{
+				return src.width();
+			}
+
+			template<class I>
+			size_t height(const I& src) const
+			{
+				return src.height();
+			}
+
+			template<class I>
+			void read(
+				typename Converter<typename I::value_type>::To* out,
+				const I& src, size_t x, size_t y, size_t n
+			) const
+			{
+				Converter<typename I::value_type> converter;
+				typename I::value_type tile[GIL_PIPELINE_TILE];
+				for (size_t i = 0; i < n; i += GIL_PIPELINE_TILE) {
+					const size_t m = std::min<size_t>(GIL_PIPELINE_TILE, n - i);
+					read_span(src, tile, x + i, y, m);
+					for (size_t k = 0; k < m; ++k)
+						out[i + k] = converter(tile[k]);
+				}
 			}
 
 			template<class I>
@@ -121,6 +249,18 @@ namespace gil {
 		private:
 
 	};
+
+	template<class DstImage, template<class, class> class Converter>
+	struct StageTrait< DefaultConvert<DstImage, Converter> > {
+		enum { Pointwise = true };
+		enum { Streaming = false };
+	};
+
+	template<template<class> class Converter>
+	struct StageTrait< Convert<Converter> > {
+		enum { Pointwise = true };
+		enum { Streaming = false };
+	};
 }
 
 #endif
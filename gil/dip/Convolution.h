@@ -0,0 +1,550 @@
+#ifndef GIL_CONVOLUTION_H
+#define GIL_CONVOLUTION_H
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "../core/Simd.h"
+#include "../core/Image.h"
+#include "../core/Parallel.h"
+#include "../core/MappedImage.h"
+#include "../core/PlanarImage.h"
+#include "../core/Pool.h"
+
+namespace gil {
+
+	/* LineWeights:
+	 *   normalized weights of a LineKernel over a line of n samples.
+	 *
+	 *   Taps that fall outside the line are dropped and the remaining ones
+	 *   renormalized, which is the edge behaviour of TwoPassFilter. The
+	 *   weights are computed once, so the inner loops neither test bounds
+	 *   nor divide.
+	 */
+	class LineWeights {
+		public:
+			template<typename T, class Kernel>
+			static LineWeights create(const Kernel& kernel, size_t n)
+			{
+				LineWeights result;
+				result.init<T>(kernel, n);
+				return result;
+			}
+
+			LineWeights(): my_lo(0), my_hi(-1), my_begin(0), my_end(0)
+			{
+				// empty
+			}
+
+			// number of taps of the kernel
+			size_t taps() const
+			{
+				return static_cast<size_t>(my_hi - my_lo + 1);
+			}
+
+			// offset of the leftmost tap relative to the output sample
+			int lo() const { return my_lo; }
+			int hi() const { return my_hi; }
+
+			// samples in [interior_begin, interior_end) use all the taps
+			size_t interior_begin() const { return my_begin; }
+			size_t interior_end() const { return my_end; }
+
+			const float* interior() const
+			{
+				return &my_weights[0];
+			}
+
+			// first input sample that contributes to output p
+			size_t first(size_t p) const { return my_first[p]; }
+
+			// number of input samples that contribute to output p
+			size_t count(size_t p) const { return my_count[p]; }
+
+			const float* weights(size_t p) const
+			{
+				return &my_weights[ my_offset[p] ];
+			}
+
+		private:
+			template<typename T, class Kernel>
+			void init(const Kernel& kernel, size_t n)
+			{
+				const int r = static_cast<int>(kernel.size()/2);
+				my_lo = -r;
+				// an even sized kernel has one tap less on the right
+				my_hi = static_cast<int>(kernel.size()) - 1 - r;
+
+				const int in = static_cast<int>(n);
+				my_begin = static_cast<size_t>( std::min(-my_lo, in) );
+				my_end = static_cast<size_t>( std::max(in - my_hi, 0) );
+				if (my_end < my_begin)
+					my_end = my_begin;
+
+				my_first.resize(n);
+				my_count.resize(n);
+				my_offset.resize(n);
+				my_weights.clear();
+
+				append<T>(kernel, my_lo, my_hi);
+				for (int p = 0; p < in; ++p) {
+					const int lo = std::max(my_lo, -p);
+					const int hi = std::min(my_hi, in - 1 - p);
+					my_first[p] = static_cast<size_t>(p + lo);
+					my_count[p] = static_cast<size_t>(hi - lo + 1);
+					if (lo == my_lo && hi == my_hi) {
+						my_offset[p] = 0;
+					} else {
+						my_offset[p] = my_weights.size();
+						append<T>(kernel, lo, hi);
+					}
+				}
+			}
+
+			template<typename T, class Kernel>
+			void append(const Kernel& kernel, int lo, int hi)
+			{
+				T num = 0;
+				for (int i = lo; i <= hi; ++i)
+					num += kernel(i);
+				assert(num);
+				for (int i = lo; i <= hi; ++i)
+					my_weights.push_back( static_cast<float>(kernel(i) / num) );
+			}
+
+			int my_lo;
+			int my_hi;
+			size_t my_begin;
+			size_t my_end;
+			std::vector<size_t> my_first;
+			std::vector<size_t> my_count;
+			std::vector<size_t> my_offset;
+			std::vector<float> my_weights;
+	};
+
+	// out[j] = sum_i w[i] * in[j + i*step], for j in [0, n)
+	inline void convolve_line(
+		float* out, const float* in, size_t n,
+		const float* w, size_t taps, size_t step
+	)
+	{
+		size_t j = 0;
+#if defined(GIL_AVX)
+		for (; j + 8 <= n; j += 8) {
+			const float *p = in + j;
+			__m256 acc = _mm256_mul_ps(_mm256_set1_ps(w[0]), _mm256_loadu_ps(p));
+			for (size_t i = 1; i < taps; ++i) {
+				p += step;
+#if defined(GIL_FMA)
+				acc = _mm256_fmadd_ps(
+					_mm256_set1_ps(w[i]), _mm256_loadu_ps(p), acc);
+#else
+				acc = _mm256_add_ps(acc,
+					_mm256_mul_ps(_mm256_set1_ps(w[i]), _mm256_loadu_ps(p)));
+#endif
+			}
+			_mm256_storeu_ps(out + j, acc);
+		}
+#endif
+#if defined(GIL_SSE2)
+		for (; j + 4 <= n; j += 4) {
+			const float *p = in + j;
+			__m128 acc = _mm_mul_ps(_mm_set1_ps(w[0]), _mm_loadu_ps(p));
+			for (size_t i = 1; i < taps; ++i) {
+				p += step;
+				acc = _mm_add_ps(acc,
+					_mm_mul_ps(_mm_set1_ps(w[i]), _mm_loadu_ps(p)));
+			}
+			_mm_storeu_ps(out + j, acc);
+		}
+#endif
+		for (; j < n; ++j) {
+			const float *p = in + j;
+			float acc = w[0] * p[0];
+			for (size_t i = 1; i < taps; ++i) {
+				p += step;
+				acc += w[i] * p[0];
+			}
+			out[j] = acc;
+		}
+	}
+
+	// out[j] = w * in[j] (or += when accumulate is set), for j in [0, n)
+	inline void scale_line(
+		float* out, const float* in, size_t n, float w, bool accumulate
+	)
+	{
+		size_t j = 0;
+		if (!accumulate) {
+#if defined(GIL_AVX)
+			const __m256 w8 = _mm256_set1_ps(w);
+			for (; j + 8 <= n; j += 8)
+				_mm256_storeu_ps(out + j,
+					_mm256_mul_ps(w8, _mm256_loadu_ps(in + j)));
+#endif
+#if defined(GIL_SSE2)
+			const __m128 w4 = _mm_set1_ps(w);
+			for (; j + 4 <= n; j += 4)
+				_mm_storeu_ps(out + j, _mm_mul_ps(w4, _mm_loadu_ps(in + j)));
+#endif
+			for (; j < n; ++j)
+				out[j] = w * in[j];
+			return;
+		}
+
+#if defined(GIL_AVX)
+		const __m256 w8 = _mm256_set1_ps(w);
+		for (; j + 8 <= n; j += 8) {
+#if defined(GIL_FMA)
+			_mm256_storeu_ps(out + j, _mm256_fmadd_ps(
+				w8, _mm256_loadu_ps(in + j), _mm256_loadu_ps(out + j)));
+#else
+			_mm256_storeu_ps(out + j, _mm256_add_ps(_mm256_loadu_ps(out + j),
+				_mm256_mul_ps(w8, _mm256_loadu_ps(in + j))));
+#endif
+		}
+#endif
+#if defined(GIL_SSE2)
+		const __m128 w4 = _mm_set1_ps(w);
+		for (; j + 4 <= n; j += 4)
+			_mm_storeu_ps(out + j, _mm_add_ps(_mm_loadu_ps(out + j),
+				_mm_mul_ps(w4, _mm_loadu_ps(in + j))));
+#endif
+		for (; j < n; ++j)
+			out[j] += w * in[j];
+	}
+
+	/* FloatRows:
+	 *   row access to images as interleaved floats. Images whose channels
+	 *   are floats are read and written in place through row(), the rest
+	 *   return NULL there and are staged through load() and store().
+	 */
+	template<class I>
+	struct FloatRows {
+		typedef typename I::value_type value_type;
+		typedef typename ColorTrait<value_type>::BaseType base_type;
+		enum { Channels = ColorTrait<value_type>::Channels };
+
+		static float* row(I&, size_t) { return 0; }
+		static const float* row(const I&, size_t) { return 0; }
+
+		static void load(const I& img, size_t y, float* out)
+		{
+			for (size_t x = 0; x < img.width(); ++x) {
+				const value_type& pixel = img(x, y);
+				for (size_t c = 0; c < Channels; ++c)
+					*out++ = static_cast<float>(
+						ColorTrait<value_type>::select_channel(pixel, c)
+					);
+			}
+		}
+
+		static void store(I& img, size_t y, const float* in)
+		{
+			for (size_t x = 0; x < img.width(); ++x) {
+				value_type& pixel = img(x, y);
+				for (size_t c = 0; c < Channels; ++c)
+					ColorTrait<value_type>::select_channel(pixel, c) =
+						static_cast<base_type>(*in++);
+			}
+		}
+
+		// row y as floats, either in place or loaded into buf
+		static const float* get(const I& img, size_t y, float* buf)
+		{
+			const float *p = FloatRows<I>::row(img, y);
+			if (p)
+				return p;
+			FloatRows<I>::load(img, y, buf);
+			return buf;
+		}
+	};
+
+	template<class I>
+	struct FloatImageRows {
+		static float* row(I& img, size_t y)
+		{
+			return reinterpret_cast<float*>(img.row(y));
+		}
+		static const float* row(const I& img, size_t y)
+		{
+			return reinterpret_cast<const float*>(img.row(y));
+		}
+		static void load(const I& img, size_t y, float* out)
+		{
+			std::copy(row(img, y), row(img, y) + img.width()*img.channels(), out);
+		}
+		static void store(I& img, size_t y, const float* in)
+		{
+			std::copy(in, in + img.width()*img.channels(), row(img, y));
+		}
+		static const float* get(const I& img, size_t y, float*)
+		{
+			return row(img, y);
+		}
+	};
+
+	template<template<typename> class A>
+	struct FloatRows< Image<Float1, A> >
+		: FloatImageRows< Image<Float1, A> > {};
+
+	template<size_t C, template<typename> class A>
+	struct FloatRows< Image<Color<Float1, C>, A> >
+		: FloatImageRows< Image<Color<Float1, C>, A> > {};
+
+	// mapped float files are read in place, whatever their stride
+	template<>
+	struct FloatRows< MappedImage<Float1> >
+		: FloatImageRows< MappedImage<Float1> > {};
+
+	template<size_t C>
+	struct FloatRows< MappedImage< Color<Float1, C> > >
+		: FloatImageRows< MappedImage< Color<Float1, C> > > {};
+
+	// planar rows are interleaved into the float rows of the engine
+	template<typename T, size_t C, template<typename> class A>
+	struct FloatRows< PlanarImage<T, C, A> > {
+		typedef PlanarImage<T, C, A> I;
+
+		static float* row(I&, size_t) { return 0; }
+		static const float* row(const I&, size_t) { return 0; }
+
+		static void load(const I& img, size_t y, float* out)
+		{
+			const size_t width = img.width();
+			for (size_t c = 0; c < C; ++c)
+				copy_strided(out + c, C, img.plane(c).row(y), 1, width);
+		}
+
+		static void store(I& img, size_t y, const float* in)
+		{
+			const size_t width = img.width();
+			for (size_t c = 0; c < C; ++c)
+				copy_strided(img.plane(c).row(y), 1, in + c, C, width);
+		}
+
+		static const float* get(const I& img, size_t y, float* buf)
+		{
+			load(img, y, buf);
+			return buf;
+		}
+	};
+
+	// a proxy is computed a tile at a time as its rows are read
+	template<class Filter, class DstImage, class SrcImage>
+	struct FloatRows< ImageProxy<Filter, DstImage, SrcImage> > {
+		typedef ImageProxy<Filter, DstImage, SrcImage> I;
+		typedef typename I::value_type value_type;
+		enum { Channels = ColorTrait<value_type>::Channels };
+
+		static const float* row(const I&, size_t) { return 0; }
+
+		static void load(const I& img, size_t y, float* out)
+		{
+			value_type tile[GIL_PIPELINE_TILE];
+			for (size_t x = 0; x < img.width(); x += GIL_PIPELINE_TILE) {
+				const size_t n =
+					std::min<size_t>(GIL_PIPELINE_TILE, img.width() - x);
+				img.read(tile, x, y, n);
+				for (size_t i = 0; i < n; ++i)
+					for (size_t c = 0; c < Channels; ++c)
+						*out++ = static_cast<float>(
+							ColorTrait<value_type>::select_channel(tile[i], c)
+						);
+			}
+		}
+
+		static const float* get(const I& img, size_t y, float* buf)
+		{
+			load(img, y, buf);
+			return buf;
+		}
+	};
+
+	/* SeparableConvolution:
+	 *   the engine behind TwoPassFilter. Rows are converted to interleaved
+	 *   floats, filtered along x (branch-free interior, precomputed borders)
+	 *   into a ring of rows, then filtered along y one output row at a time
+	 *   by accumulating whole rows, so every access is sequential.
+	 */
+	template<class DstImage, class SrcImage>
+	class SeparableConvolution {
+		public:
+			typedef typename SrcImage::value_type src_type;
+			typedef typename DstImage::value_type dst_type;
+			typedef typename ColorTrait<src_type>::BaseType src_base;
+			typedef typename ColorTrait<dst_type>::BaseType dst_base;
+
+			enum { Channels = ColorTrait<src_type>::Channels };
+
+			// row buffers of a band come from the pool
+			typedef std::vector< float, PoolAllocator<float> > Buffer;
+
+			// the engine works on numeric channels only
+			enum {
+				Supported =
+					std::numeric_limits<src_base>::is_specialized &&
+					std::numeric_limits<dst_base>::is_specialized &&
+					static_cast<int>(ColorTrait<dst_type>::Channels) ==
+						static_cast<int>(Channels)
+			};
+
+			// floats per strip of the y pass, keeps the accumulator in L1
+			static const size_t STRIP = 2048;
+
+			SeparableConvolution(const LineWeights& xw, const LineWeights& yw)
+				: my_xw(xw), my_yw(yw)
+			{
+				// empty
+			}
+
+			// compute the output rows [y0, y1), dst must be sized already.
+			// dst may be the same image as src.
+			void operator ()(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1
+			) const
+			{
+				if (y0 >= y1)
+					return;
+
+				const size_t width = src.width();
+				const size_t rowlen = width * Channels;
+				const size_t ring = std::min(my_yw.taps(), src.height());
+
+				Buffer rows(ring * rowlen);
+				Buffer line(rowlen);
+				Buffer out(rowlen);
+
+				size_t next = my_yw.first(y0);
+				for (size_t y = y0; y < y1; ++y) {
+					const size_t first = my_yw.first(y);
+					const size_t count = my_yw.count(y);
+
+					for (; next < first + count; ++next)
+						filter_x(&rows[(next % ring) * rowlen], src, next, line);
+
+					float *acc = FloatRows<DstImage>::row(dst, y);
+					if (acc == 0)
+						acc = &out[0];
+
+					const float *w = my_yw.weights(y);
+					for (size_t j = 0; j < rowlen; j += STRIP) {
+						const size_t n = std::min(STRIP, rowlen - j);
+						for (size_t i = 0; i < count; ++i) {
+							const float *in =
+								&rows[((first + i) % ring) * rowlen] + j;
+							scale_line(acc + j, in, n, w[i], i != 0);
+						}
+					}
+
+					if (acc == &out[0])
+						FloatRows<DstImage>::store(dst, y, acc);
+				}
+			}
+
+		private:
+			void filter_x(
+				float* out, const SrcImage& src, size_t y, Buffer& line
+			) const
+			{
+				const float *in = FloatRows<SrcImage>::get(src, y, &line[0]);
+
+				const size_t width = src.width();
+				const size_t begin = my_xw.interior_begin();
+				const size_t end = my_xw.interior_end();
+
+				if (begin < end) {
+					convolve_line(
+						out + begin*Channels,
+						in + my_xw.first(begin)*Channels,
+						(end - begin)*Channels,
+						my_xw.interior(),
+						my_xw.taps(),
+						Channels
+					);
+				}
+
+				for (size_t x = 0; x < width; ++x) {
+					if (x == begin && begin < end)
+						x = end;
+					if (x >= width)
+						break;
+
+					const float *w = my_xw.weights(x);
+					const float *p = in + my_xw.first(x)*Channels;
+					for (size_t c = 0; c < Channels; ++c) {
+						float acc = 0;
+						for (size_t i = 0; i < my_xw.count(x); ++i)
+							acc += w[i] * p[i*Channels + c];
+						out[x*Channels + c] = acc;
+					}
+				}
+			}
+
+			const LineWeights& my_xw;
+			const LineWeights& my_yw;
+	};
+
+	template<class DstImage, class SrcImage>
+	const size_t SeparableConvolution<DstImage, SrcImage>::STRIP;
+
+	// run engine(dst, src, y0, y1) over bands of rows starting at multiples
+	// of align.
+	template<class Engine, class DstImage, class SrcImage>
+	void convolve_bands(
+		const Engine& engine, DstImage& dst, const SrcImage& src,
+		const Execution& exec, size_t align = 1
+	)
+	{
+		parallel_bands(
+			engine, &Engine::operator (), dst, src, 0, src.height(), exec, align
+		);
+	}
+
+	// A band reads rows around it that another band may already have
+	// written when dst is src, so that case filters a copy of src.
+	template<class Engine, class I>
+	void convolve_bands(
+		const Engine& engine, I& dst, const I& src,
+		const Execution& exec, size_t align = 1
+	)
+	{
+		if (exec.concurrency() > 1 && &dst == &src) {
+			const I copy(src);
+			parallel_bands(
+				engine, &Engine::operator (),
+				dst, copy, 0, copy.height(), exec, align
+			);
+			return;
+		}
+
+		parallel_bands(
+			engine, &Engine::operator (), dst, src, 0, src.height(), exec, align
+		);
+	}
+
+	// convolve src with xkernel along x and ykernel along y into dst.
+	// this is the generic engine, kernels with a faster algorithm provide
+	// an overload (see BoxFilter.h).
+	template<typename T, class DstImage, class SrcImage, class XKernel, class YKernel>
+	void separable_convolve(
+		DstImage& dst, const SrcImage& src,
+		const XKernel& xkernel, const YKernel& ykernel,
+		const Execution& exec = Execution::global()
+	)
+	{
+		typedef SeparableConvolution<DstImage, SrcImage> Engine;
+
+		const LineWeights xw = LineWeights::create<T>(xkernel, src.width());
+		const LineWeights yw = LineWeights::create<T>(ykernel, src.height());
+
+		dst.resize(src.width(), src.height());
+		convolve_bands(Engine(xw, yw), dst, src, exec);
+	}
+
+}
+
+#endif
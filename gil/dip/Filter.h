@@ -4,6 +4,7 @@
 #include <cstddef>
 
 #include "../gil.h"
+#include "../core/Int2Type.h"
 
 namespace gil {
 
@@ -15,12 +16,24 @@ namespace gil {
 				// empty
 			}
 
+			// filters written before execution policies only have this
+			// filter(dst, src); the ones here forward it to the global
+			// execution
 			template<class SrcImage>
 			inline void operator ()(DstImage& dst, const SrcImage& src) const
 			{
 				my_real_filter.filter(dst, src);
 			}
 
+			// filter with the given execution policy instead of the global one
+			template<class SrcImage>
+			inline void operator ()(
+				DstImage& dst, const SrcImage& src, const Execution& exec
+			) const
+			{
+				my_real_filter.filter(dst, src, exec);
+			}
+
 			template<
 				class ProxyFilter, class ProxyDstImage, class ProxySrcImage
 			>
@@ -30,8 +43,30 @@ namespace gil {
 				src_proxy
 			) const
 			{
-				ProxyDstImage tmp;
-				(*this)(dst, src_proxy(tmp));
+				typedef StageTrait<RealFilter> Stage;
+				filter_proxy(
+					dst, src_proxy,
+					Int2Type<(Stage::Pointwise || Stage::Streaming) ? 1 : 0>()
+				);
+			}
+
+			// point-wise filters fuse with the proxy, streaming filters read
+			// it row by row, the others get it materialized.
+			template<
+				class ProxyFilter, class ProxyDstImage, class ProxySrcImage
+			>
+			inline void operator ()(
+				DstImage& dst,
+				const ImageProxy<ProxyFilter, ProxyDstImage, ProxySrcImage>&
+				src_proxy,
+				const Execution& exec
+			) const
+			{
+				typedef StageTrait<RealFilter> Stage;
+				filter_proxy(
+					dst, src_proxy, exec,
+					Int2Type<Stage::Pointwise ? 2 : Stage::Streaming ? 1 : 0>()
+				);
 			}
 
 			template<class SrcImage>
@@ -46,6 +81,52 @@ namespace gil {
 		protected:
 
 		private:
+			// point-wise and streaming filters take the global execution
+			template<class Proxy>
+			void filter_proxy(
+				DstImage& dst, const Proxy& src_proxy, Int2Type<1>
+			) const
+			{
+				(*this)(dst, src_proxy, Execution::global());
+			}
+
+			template<class Proxy>
+			void filter_proxy(
+				DstImage& dst, const Proxy& src_proxy, Int2Type<0>
+			) const
+			{
+				my_real_filter.filter(dst, materialize(src_proxy));
+			}
+
+			template<class Proxy>
+			void filter_proxy(
+				DstImage& dst, const Proxy& src_proxy, const Execution& exec,
+				Int2Type<2>
+			) const
+			{
+				ImageProxy<RealFilter, DstImage, Proxy>(
+					my_real_filter, src_proxy
+				).fuse(dst, exec);
+			}
+
+			template<class Proxy>
+			void filter_proxy(
+				DstImage& dst, const Proxy& src_proxy, const Execution& exec,
+				Int2Type<1>
+			) const
+			{
+				my_real_filter.filter(dst, prepare(src_proxy), exec);
+			}
+
+			template<class Proxy>
+			void filter_proxy(
+				DstImage& dst, const Proxy& src_proxy, const Execution& exec,
+				Int2Type<0>
+			) const
+			{
+				my_real_filter.filter(dst, materialize(src_proxy), exec);
+			}
+
 			RealFilter& my_real_filter;	
 	};
 
@@ -2,9 +2,17 @@
 #define GIL_GAUSSIAN_FILTER_H
 
 #include <cmath>
+#include <algorithm>
 
 #include "Kernel.h"
 #include "TwoPassFilter.h"
+#include "RecursiveGaussian.h"
+
+// sigmas from this value up are filtered recursively instead of by the
+// 6*sigma+1 tap FIR kernel.
+#ifndef GIL_RECURSIVE_GAUSSIAN_SIGMA
+#define GIL_RECURSIVE_GAUSSIAN_SIGMA 10
+#endif
 
 namespace gil {
 
@@ -12,15 +20,52 @@ namespace gil {
 	class GaussianKernel: public LineKernel<T> {
 		public:
 			GaussianKernel<T>(T sigma): 
-				LineKernel<T>( 2*static_cast<size_t>(3*sigma) + 1 )
+				LineKernel<T>( 2*static_cast<size_t>(3*sigma) + 1 ),
+				my_sigma(sigma)
 			{
 				for (int i = - static_cast<int>(this->my_radius); 
 						i <= static_cast<int>(this->my_radius); ++i) {
 					(*this)(i) = std::exp( -(i*i) / (2*sigma*sigma) );
 				}
 			}
+
+			T sigma() const
+			{
+				return my_sigma;
+			}
+
+		private:
+			T my_sigma;
 	};
 
+	// large Gaussian kernels take the recursive engine
+	template<typename T, class DstImage, class SrcImage>
+	void separable_convolve(
+		DstImage& dst, const SrcImage& src,
+		const GaussianKernel<T>& xkernel, const GaussianKernel<T>& ykernel,
+		const Execution& exec = Execution::global()
+	)
+	{
+		const T sigma_max = std::max(xkernel.sigma(), ykernel.sigma());
+		const T sigma_min = std::min(xkernel.sigma(), ykernel.sigma());
+
+		// the recursive coefficients only hold from sigma 0.5 up
+		if (sigma_max >= GIL_RECURSIVE_GAUSSIAN_SIGMA && sigma_min >= 0.5) {
+			RecursiveGaussian<DstImage, SrcImage>(
+				xkernel.sigma(), ykernel.sigma()
+			)(dst, src, exec);
+			return;
+		}
+
+		typedef SeparableConvolution<DstImage, SrcImage> Engine;
+
+		const LineWeights xw = LineWeights::create<T>(xkernel, src.width());
+		const LineWeights yw = LineWeights::create<T>(ykernel, src.height());
+
+		dst.resize(src.width(), src.height());
+		convolve_bands(Engine(xw, yw), dst, src, exec);
+	}
+
 	template<class DstImage, typename T = typename TypeTrait<Byte1>::MathType >
 	class GaussianFilter: 
 		public 
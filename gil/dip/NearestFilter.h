@@ -17,35 +17,103 @@ namespace gil {
 			{
 				// empty
 			}
-		protected:
+
+			// point-wise stage interface, see StageTrait
 			template<class SrcImage>
-			void filter(DstImage& dst, const SrcImage& src) const
+			size_t width(const SrcImage&) const
 			{
+				return my_x;
+			}
+
+			template<class SrcImage>
+			size_t height(const SrcImage&) const
+			{
+				return my_y;
+			}
+
+			// reads the source a tile at a time, or pixel by pixel when
+			// shrinking more than twice
+			template<class SrcImage>
+			void read(
+				typename DstImage::value_type* out, const SrcImage& src,
+				size_t x, size_t y, size_t n
+			) const
+			{
+				typedef typename SrcImage::value_type src_type;
+
 				const float ratio_x = src.width() / static_cast<float>(my_x);
-				const float ratio_y = src.height() / static_cast<float>(my_y);
-				dst.resize(my_x, my_y);
-				for (size_t y = 0; y < dst.height(); ++y) {
-					for (size_t x = 0; x < dst.width(); ++x) {
-						int _x = static_cast<int>( x*ratio_x + 0.5 );
-						int _y = static_cast<int>( y*ratio_y + 0.5 );
+				const size_t sy = source(y, my_y, src.height());
+
+				src_type tile[GIL_PIPELINE_TILE];
+				for (size_t i = 0; i < n; ) {
+					const size_t lo = source(x + i, my_x, src.width());
+					size_t m = 1;
+					if (ratio_x <= 2)
+						while (i + m < n && 
+							source(x + i + m, my_x, src.width()) - lo <
+							GIL_PIPELINE_TILE)
+							++m;
+
+					const size_t hi = source(x + i + m - 1, my_x, src.width());
+					read_span(src, tile, lo, sy, hi - lo + 1);
+					for (size_t k = 0; k < m; ++k, ++i)
+						out[i] = tile[source(x + i, my_x, src.width()) - lo];
+				}
+			}
 
-						_x = std::min( _x, static_cast<int>(src.width())-1 );
-						_x = std::max( _x, 0 );
+		protected:
+			template<class SrcImage>
+			void filter(DstImage& dst, const SrcImage& src) const
+			{
+				filter(dst, src, Execution::global());
+			}
 
-						_y = std::min( _y, static_cast<int>(src.height())-1 );
-						_y = std::max( _y, 0 );
+			template<class SrcImage>
+			void filter(
+				DstImage& dst, const SrcImage& src, const Execution& exec
+			) const
+			{
+				dst.resize(my_x, my_y);
+				parallel_bands(
+					*this, &NearestFilter::template filter_rows<SrcImage>,
+					dst, src, 0, dst.height(), exec
+				);
+			}
 
-						dst(x, y) = src(
-							static_cast<size_t>(_x), static_cast<size_t>(_y)
-						);
-					}
+			// resample the rows [y0, y1) of dst, which is sized already
+			template<class SrcImage>
+			void filter_rows(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1
+			) const
+			{
+				for (size_t y = y0; y < y1; ++y) {
+					const size_t sy = source(y, my_y, src.height());
+					for (size_t x = 0; x < dst.width(); ++x)
+						dst(x, y) = src(source(x, my_x, src.width()), sy);
 				}
 			}
+
+			// the source pixel nearest to x, in an axis scaled from size
+			// to target
+			static size_t source(size_t x, size_t target, size_t size)
+			{
+				const float ratio = size / static_cast<float>(target);
+				int _x = static_cast<int>( x*ratio + 0.5 );
+				_x = std::min( _x, static_cast<int>(size)-1 );
+				_x = std::max( _x, 0 );
+				return static_cast<size_t>(_x);
+			}
 		private:
 			size_t my_x;
 			size_t my_y;
 	};
 
+	template<class DstImage>
+	struct StageTrait< NearestFilter<DstImage> > {
+		enum { Pointwise = true };
+		enum { Streaming = false };
+	};
+
 }
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef GIL_NULL_FILTER_H
 #define GIL_NULL_FILTER_H
 
+#include <algorithm>
 #include "Filter.h"
 
 namespace gil {
@@ -13,14 +14,61 @@ namespace gil {
 			{
 				// empty
 			}
+
+			// point-wise, reads no rows around its output, see FilterStream
+			size_t radius() const
+			{
+				return 0;
+			}
+
+			// point-wise stage interface, see StageTrait
+			template<class SrcImage>
+			size_t width(const SrcImage& src) const
+			{
+				return src.width();
+			}
+
+			template<class SrcImage>
+			size_t height(const SrcImage& src) const
+			{
+				return src.height();
+			}
+
+			template<class SrcImage>
+			void read(
+				typename DstImage::value_type* out, const SrcImage& src,
+				size_t x, size_t y, size_t n
+			) const
+			{
+				typename SrcImage::value_type tile[GIL_PIPELINE_TILE];
+				for (size_t i = 0; i < n; i += GIL_PIPELINE_TILE) {
+					const size_t m = std::min<size_t>(GIL_PIPELINE_TILE, n - i);
+					read_span(src, tile, x + i, y, m);
+					std::copy(tile, tile + m, out + i);
+				}
+			}
 		protected:
 			template<class SrcImage>
 			void filter(DstImage& dst, const SrcImage& src) const
+			{
+				filter(dst, src, Execution::global());
+			}
+
+			template<class SrcImage>
+			void filter(
+				DstImage& dst, const SrcImage& src, const Execution&
+			) const
 			{
 				dst = src;
 			}
 	};
 
+	template<class DstImage>
+	struct StageTrait< NullFilter<DstImage> > {
+		enum { Pointwise = true };
+		enum { Streaming = false };
+	};
+
 }
 
 #endif
@@ -23,25 +23,49 @@ namespace gil {
 				// empty
 			}
 
+			// rows read above and below an output row, see FilterStream
+			size_t radius() const
+			{
+				return my_kernel.sizey()/2;
+			}
+
 		protected:
 
 			template<class SrcImage>
-			void filter(DstImage& dst, const SrcImage& src) 
+			void filter(DstImage& dst, const SrcImage& src) const
+			{
+				filter(dst, src, Execution::global());
+			}
+
+			template<class SrcImage>
+			void filter(
+				DstImage& dst, const SrcImage& src, const Execution& exec
+			) const
+			{
+				dst.resize(src.width(), src.height());
+				parallel_bands(
+					*this, &OnePassFilter::template filter_rows<SrcImage>,
+					dst, src, 0, dst.height(), exec
+				);
+			}
+
+			// filter the rows [y0, y1) of dst, which is sized already
+			template<class SrcImage>
+			void filter_rows(
+				DstImage& dst, const SrcImage& src, size_t y0, size_t y1
+			) const
 			{
 				typedef 
 					typename ColorTrait< 
 						typename SrcImage::value_type 
 					>::ExtendedColor sum_type;
 
-
-				dst.resize(src.width(), src.height());
-
 				const int width = static_cast<int>(src.width());
 				const int height = static_cast<int>(src.height());
 				const int rx = my_kernel.sizex()/2;
 				const int ry = my_kernel.sizey()/2;
 
-				for (size_t y = 0; y < dst.height(); ++y) {
+				for (size_t y = y0; y < y1; ++y) {
 					for (size_t x = 0; x < dst.width(); ++x) {
 						sum_type sum(0);
 						T num = 0;
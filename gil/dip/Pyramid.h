@@ -5,7 +5,9 @@
 #include <string>
 #include <stdexcept>
 #include <cmath>
+#include <utility>
 
+#include "../core/Pool.h"
 #include "NearestFilter.h"
 #include "GaussianFilter.h"
 
@@ -30,28 +32,34 @@ namespace gil {
 				reset(image);
 			}
 
+			// the levels of the previous image are overwritten in place, so
+			// resetting with images of the same size does not allocate
+			// them. Each level is blurred into a pooled image (see
+			// ImagePool), so from the second reset on neither that nor
+			// the temporaries of the filters allocate, whatever Image is.
 			void reset(const Image &image)
 			{
-				size_t width = image.width();
-				size_t height = image.height();
-
-				my_pyramids.clear();
-				my_pyramids.push_back(image);
+				my_pyramids.resize( my_levels(image) );
+				my_pyramids[0] = image;
+				my_build();
+			}
 
-				while (width > 1 && height > 1) {
-					width = (width+1) / 2;
-					height = (height+1) / 2;
-					const Image &img = my_pyramids[ my_pyramids.size()-1 ];
+#ifdef GIL_MOVE
+			// level 0 takes the pixels of image instead of copying them
+			Pyramid(Image&& image)
+			{
+				reset(std::move(image));
+			}
 
-					my_pyramids.push_back(
-						Scaler(width, height)(
-							GaussianFilter<Image>(1., 1.)(img)
-						)
-					);
-				}
+			void reset(Image&& image)
+			{
+				my_pyramids.resize( my_levels(image) );
+				my_pyramids[0] = std::move(image);
+				my_build();
 			}
+#endif
 
-			const Image operator ()(T layer) const
+			Image operator ()(T layer) const
 			{
 				Image tmp;
 				(*this)(tmp, layer);
@@ -114,6 +122,32 @@ namespace gil {
 			}
 
 		protected:
+			static size_t my_levels(const Image& image)
+			{
+				size_t levels = 1;
+				for (size_t w = image.width(), h = image.height();
+						w > 1 && h > 1; ++levels) {
+					w = (w+1) / 2;
+					h = (h+1) / 2;
+				}
+				return levels;
+			}
+
+			// fill the levels above the first, each one blurred and scaled
+			// down from the one below
+			void my_build()
+			{
+				size_t width = my_pyramids[0].width();
+				size_t height = my_pyramids[0].height();
+				for (size_t i = 1; i < my_pyramids.size(); ++i) {
+					width = (width+1) / 2;
+					height = (height+1) / 2;
+
+					GaussianFilter<Blurred>(1., 1.)(my_blurred, my_pyramids[i-1]);
+					Scaler(width, height)(my_pyramids[i], my_blurred);
+				}
+			}
+
 			void my_check_layer(T layer) const
 			{
 				if (layer < 0 || layer >= my_pyramids.size())
@@ -171,7 +205,10 @@ namespace gil {
 			}
 
 		private:
+			typedef typename PooledImage<Image>::type Blurred;
+
 			std::vector<Image> my_pyramids;
+			Blurred my_blurred;	// the level being scaled down
 	};
 
 }
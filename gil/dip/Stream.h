@@ -0,0 +1,550 @@
+#ifndef GIL_STREAM_H
+#define GIL_STREAM_H
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../core/ImageIO.h"
+#include "Filter.h"
+
+#ifdef GIL_THREADS
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#endif
+
+namespace gil {
+
+	/* Streaming:
+	 *   filters a file into another a band of rows at a time, so that the
+	 *   memory used depends on the image width and the filter radius but
+	 *   not on the image height.
+	 *
+	 *   Rows travel through stages, each of which gets
+	 *
+	 *     begin(width, height)  before the first row,
+	 *     push(row)             once per row, top to bottom,
+	 *     end()                 after the last row.
+	 *
+	 *   StreamInput is the image handed to a reader, FilterStream applies
+	 *   a filter and StreamOutput is the image handed to a writer.
+	 *
+	 *   Readers and writers that visit rows bottom up (BMP) or need the
+	 *   whole image at once (the PNG writer) still work, but hold a full
+	 *   frame. The Radiance reader reads all of its compressed scanlines
+	 *   before it decodes any, so memory grows with the file size there,
+	 *   though only to the size of the file and not of the pixels.
+	 */
+
+	/* StreamInput:
+	 *   an image that a reader fills row by row. Every finished row is
+	 *   pushed to the next stage; only the current row is kept. A reader
+	 *   that does not start at row 0 gets a full frame instead, which is
+	 *   pushed by finish().
+	 */
+	template<class Image, class Sink>
+	class StreamInput {
+		public:
+			typedef typename Image::value_type value_type;
+			typedef value_type ColorType;
+
+			StreamInput(Sink& sink)
+				: my_sink(sink), my_width(0), my_height(0), my_y(0),
+				  my_started(false), my_framed(false)
+			{
+				// empty
+			}
+
+			void allocate(size_t w, size_t h)
+			{
+				resize(w, h);
+			}
+
+			void resize(size_t w, size_t h)
+			{
+				my_width = w;
+				my_height = h;
+				my_row.resize(w);
+				my_sink.begin(w, h);
+			}
+
+			size_t width() const
+			{
+				return my_width;
+			}
+
+			size_t height() const
+			{
+				return my_height;
+			}
+
+			size_t channels() const
+			{
+				return ColorTrait<value_type>::channels();
+			}
+
+			value_type& operator ()(size_t x, size_t y)
+			{
+				if (my_framed)
+					return my_frame(x, y);
+				if (!my_started) {
+					my_started = true;
+					if (y != 0) {
+						my_framed = true;
+						my_frame.resize(my_width, my_height);
+						return my_frame(x, y);
+					}
+				} else if (y != my_y) {
+					if (y != my_y + 1)
+						throw std::runtime_error("rows out of order");
+					my_sink.push(&my_row[0]);
+					my_y = y;
+				}
+				return my_row[x];
+			}
+
+			// push what is left, call when the reader returns
+			void finish()
+			{
+				if (my_framed) {
+					for (size_t y = 0; y < my_height; ++y)
+						my_sink.push(my_frame.row(y));
+				} else if (my_started) {
+					my_sink.push(&my_row[0]);
+				}
+				my_sink.end();
+			}
+
+		private:
+			Sink& my_sink;
+			size_t my_width;
+			size_t my_height;
+			size_t my_y;
+			bool my_started;
+			bool my_framed;
+			std::vector<value_type> my_row;
+			Image my_frame;
+	};
+
+	template<class Image, class Sink>
+	struct OrderTrait< StreamInput<Image, Sink> > {
+		enum { TopDown = true };
+	};
+
+	/* FilterStream:
+	 *   applies a filter to bands of rows. The filter must give the rows it
+	 *   reads above and below an output row through radius(); each band is
+	 *   filtered with that many rows of context, so the output matches
+	 *   filtering the whole image. Filters with an unbounded support (the
+	 *   recursive Gaussian) agree to their accuracy.
+	 *
+	 *   band is the number of output rows per band, 0 picks four times
+	 *   the radius and at least 32.
+	 */
+	template<class Image, class Filter, class Sink>
+	class FilterStream {
+		public:
+			typedef typename Image::value_type value_type;
+
+			FilterStream(
+				const Filter& filter, Sink& sink, size_t band = 0,
+				const Execution& exec = Execution::global()
+			): my_filter(filter), my_sink(sink), my_band(band), my_exec(exec),
+			   my_width(0), my_height(0)
+			{
+				// empty
+			}
+
+			void begin(size_t width, size_t height)
+			{
+				my_width = width;
+				my_height = height;
+				my_radius = my_filter.radius();
+				my_rows = my_band ? my_band : std::max<size_t>(4*my_radius, 32);
+				my_y0 = 0;
+				my_lo = my_hi = my_received = 0;
+				my_sink.begin(width, height);
+				if (height)
+					start_band();
+			}
+
+			void push(const value_type* row)
+			{
+				std::copy(row, row + my_width, my_window.row(my_received - my_lo));
+				++my_received;
+				// the last bands may have all their rows already
+				while (my_y0 < my_height && my_received == my_hi)
+					filter_band();
+			}
+
+			void end()
+			{
+				my_sink.end();
+			}
+
+		private:
+			// size the window for the next band, keeping the rows it shares
+			// with the previous one
+			void start_band()
+			{
+				const size_t y1 = std::min(my_y0 + my_rows, my_height);
+				const size_t lo = my_y0 > my_radius ? my_y0 - my_radius : 0;
+				const size_t hi = std::min(y1 + my_radius, my_height);
+
+				my_spare.resize(my_width, hi - lo);
+				for (size_t y = lo; y < my_received; ++y)
+					std::copy(
+						my_window.row(y - my_lo),
+						my_window.row(y - my_lo) + my_width,
+						my_spare.row(y - lo)
+					);
+				my_window.swap(my_spare);
+
+				my_lo = lo;
+				my_hi = hi;
+			}
+
+			void filter_band()
+			{
+				const size_t y1 = std::min(my_y0 + my_rows, my_height);
+				my_filter(my_out, my_window, my_exec);
+				for (size_t y = my_y0; y < y1; ++y)
+					my_sink.push(my_out.row(y - my_lo));
+
+				my_y0 = y1;
+				if (my_y0 < my_height)
+					start_band();
+			}
+
+			const Filter& my_filter;
+			Sink& my_sink;
+			size_t my_band;
+			Execution my_exec;
+
+			size_t my_width;
+			size_t my_height;
+			size_t my_radius;
+			size_t my_rows;
+
+			size_t my_y0;		// first output row of the band
+			size_t my_lo;		// input rows [my_lo, my_hi) are in the window
+			size_t my_hi;
+			size_t my_received;	// input rows pushed so far
+
+			Image my_window;
+			Image my_spare;
+			Image my_out;
+	};
+
+	/* FilterChain:
+	 *   two filters applied one after the other, as one filter whose radius
+	 *   is the sum of theirs.
+	 */
+	template<class Image, class First, class Second>
+	class FilterChain {
+		public:
+			FilterChain(const First& first, const Second& second)
+				: my_first(first), my_second(second)
+			{
+				// empty
+			}
+
+			size_t radius() const
+			{
+				return my_first.radius() + my_second.radius();
+			}
+
+			void operator ()(
+				Image& dst, const Image& src, const Execution& exec
+			) const
+			{
+				Image tmp;
+				my_first(tmp, src, exec);
+				my_second(dst, tmp, exec);
+			}
+
+		private:
+			const First& my_first;
+			const Second& my_second;
+	};
+
+	template<class Image, class First, class Second>
+	inline FilterChain<Image, First, Second>
+	chain(const First& first, const Second& second)
+	{
+		return FilterChain<Image, First, Second>(first, second);
+	}
+
+	/* StreamOutput:
+	 *   the last stage, an image that a writer reads row by row. The writer
+	 *   runs on its own thread from begin() on and takes the rows from a
+	 *   queue of at most QUEUE rows. A writer that does not start at row 0
+	 *   gets the full frame.
+	 *
+	 *   Without threads the rows are kept until the input ends and written
+	 *   then.
+	 *
+	 *   Once the writer has stopped, push() throws Stopped, for stream() to
+	 *   catch. discard() removes what a failed writer left of the file.
+	 */
+	template<class Image>
+	class StreamOutput {
+		public:
+			typedef typename Image::value_type value_type;
+			typedef value_type ColorType;
+
+			// rows waiting for the writer
+			static const size_t QUEUE = 16;
+
+			// thrown by push() once the writer has stopped
+			struct Stopped {};
+
+			StreamOutput(const std::string& filename)
+				: my_filename(filename), my_width(0), my_height(0),
+				  my_y(0), my_started(false), my_framed(false),
+				  my_taken(false), my_pushed(0), my_done(false),
+				  my_failed(false), my_written(false)
+			{
+				FILE* f = std::fopen(filename.c_str(), "rb");
+				my_existed = f != NULL;
+				if (f != NULL)
+					std::fclose(f);
+			}
+
+			~StreamOutput()
+			{
+				abort();
+			}
+
+			// RowSink interface
+			void begin(size_t width, size_t height)
+			{
+				my_width = width;
+				my_height = height;
+#ifdef GIL_THREADS
+				my_thread = std::thread(&StreamOutput::run, this);
+#else
+				my_frame.resize(width, height);
+#endif
+			}
+
+			void push(const value_type* row)
+			{
+#ifdef GIL_THREADS
+				std::unique_lock<std::mutex> lock(my_mutex);
+				while (!my_failed && my_queue.size() >= QUEUE)
+					my_changed.wait(lock);
+				if (my_failed)
+					throw Stopped();
+				my_queue.push_back( std::vector<value_type>(row, row + my_width) );
+				my_changed.notify_all();
+#else
+				std::copy(row, row + my_width, my_frame.row(my_pushed));
+				++my_pushed;
+#endif
+			}
+
+			void end()
+			{
+#ifdef GIL_THREADS
+				std::lock_guard<std::mutex> lock(my_mutex);
+				my_done = true;
+				my_changed.notify_all();
+#endif
+			}
+
+			// wait for the writer, true if the file was written
+			bool wait()
+			{
+#ifdef GIL_THREADS
+				if (my_thread.joinable())
+					my_thread.join();
+				if (my_error)
+					std::rethrow_exception(my_error);
+#else
+				my_framed = true;
+				my_written = write(*this, my_filename);
+#endif
+				return my_written;
+			}
+
+			// after the writer has stopped without writing the file, remove
+			// it if the writer made it or began to overwrite it
+			void discard()
+			{
+				if (!my_existed || my_taken)
+					std::remove(my_filename.c_str());
+			}
+
+			// stop the writer after a read error
+			void abort()
+			{
+#ifdef GIL_THREADS
+				{
+					std::lock_guard<std::mutex> lock(my_mutex);
+					my_failed = true;
+					my_changed.notify_all();
+				}
+				if (my_thread.joinable())
+					my_thread.join();
+#endif
+			}
+
+			// image interface for the writer
+			size_t width() const
+			{
+				return my_width;
+			}
+
+			size_t height() const
+			{
+				return my_height;
+			}
+
+			size_t channels() const
+			{
+				return ColorTrait<value_type>::channels();
+			}
+
+			const value_type& operator ()(size_t x, size_t y) const
+			{
+				my_taken = true;
+				if (my_framed)
+					return my_frame(x, y);
+				if (!my_started) {
+					my_started = true;
+					if (y != 0) {
+						my_framed = true;
+						my_frame.resize(my_width, my_height);
+						for (size_t i = 0; i < my_height; ++i)
+							pop(my_frame.row(i));
+						return my_frame(x, y);
+					}
+					my_row.resize(my_width);
+					pop(&my_row[0]);
+				} else if (y != my_y) {
+					if (y != my_y + 1)
+						throw std::runtime_error("rows out of order");
+					pop(&my_row[0]);
+					my_y = y;
+				}
+				return my_row[x];
+			}
+
+		private:
+#ifdef GIL_THREADS
+			void run()
+			{
+				try {
+					my_written = write(*this, my_filename);
+				} catch (...) {
+					my_error = std::current_exception();
+				}
+				std::lock_guard<std::mutex> lock(my_mutex);
+				my_failed = true;
+				my_changed.notify_all();
+			}
+#endif
+
+			// the next row from the pipeline
+			void pop(value_type* out) const
+			{
+#ifdef GIL_THREADS
+				std::unique_lock<std::mutex> lock(my_mutex);
+				while (!my_failed && !my_done && my_queue.empty())
+					my_changed.wait(lock);
+				if (my_queue.empty())
+					throw std::runtime_error("stream input ended");
+				std::copy(my_queue.front().begin(), my_queue.front().end(), out);
+				my_queue.pop_front();
+				my_changed.notify_all();
+#else
+				(void)out;
+#endif
+			}
+
+			std::string my_filename;
+			bool my_existed;
+			size_t my_width;
+			size_t my_height;
+
+			// writer side
+			mutable size_t my_y;
+			mutable bool my_started;
+			mutable bool my_framed;
+			mutable bool my_taken;	// the writer read a pixel
+			mutable std::vector<value_type> my_row;
+			mutable Image my_frame;
+			size_t my_pushed;
+
+			// shared
+			mutable std::deque< std::vector<value_type> > my_queue;
+			bool my_done;
+			bool my_failed;
+			bool my_written;
+#ifdef GIL_THREADS
+			std::thread my_thread;
+			mutable std::mutex my_mutex;
+			mutable std::condition_variable my_changed;
+			std::exception_ptr my_error;
+#endif
+	};
+
+	template<class Image>
+	const size_t StreamOutput<Image>::QUEUE;
+
+	template<class Image>
+	struct OrderTrait< StreamOutput<Image> > {
+		enum { TopDown = true };
+	};
+
+	// filter the image file `in' into `out' a band of rows at a time, see
+	// FilterStream. Returns false if a file cannot be opened or has an
+	// unknown format, whether the writer finds out before the reader is
+	// done or after; an exception of the reader or the writer is thrown
+	// on. Either way no partial `out' is left behind.
+	template<class Image, class Filter>
+	bool stream(
+		const std::string& in, const std::string& out, const Filter& filter,
+		size_t band = 0, const Execution& exec = Execution::global()
+	)
+	{
+		typedef StreamOutput<Image> Output;
+		typedef FilterStream<Image, Filter, Output> Stage;
+
+		Output output(out);
+		Stage stage(filter, output, band, exec);
+		StreamInput<Image, Stage> input(stage);
+
+		bool written = false;
+		try {
+			try {
+				if (read(input, in)) {
+					input.finish();
+					written = output.wait();
+				}
+			} catch (const typename Output::Stopped&) {
+				// the writer stopped first, its result is the one to give
+				written = output.wait();
+			}
+		} catch (...) {
+			output.abort();
+			output.discard();
+			throw;
+		}
+		if (!written) {
+			output.abort();
+			output.discard();
+		}
+		return written;
+	}
+
+}
+
+#endif
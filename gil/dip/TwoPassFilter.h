@@ -3,6 +3,8 @@
 
 #include <cstddef>
 #include "Filter.h"
+#include "../core/Int2Type.h"
+#include "Convolution.h"
 
 namespace gil {
 
@@ -71,24 +73,86 @@ namespace gil {
 				// empty
 			}
 
+			// rows read above and below an output row, see FilterStream
+			size_t radius() const
+			{
+				return my_ykernel.size()/2;
+			}
+
 		protected:
 
 			template<class SrcImage>
 			void filter(DstImage& dst, const SrcImage& src) const
 			{
-				DstImage tmp(src.width(), src.height());
-				filter<XSelector>(tmp, src, my_xkernel);
+				filter(dst, src, Execution::global());
+			}
+
+			template<class SrcImage>
+			void filter(
+				DstImage& dst, const SrcImage& src, const Execution& exec
+			) const
+			{
+				typedef SeparableConvolution<DstImage, SrcImage> Engine;
+				filter(dst, src, exec, Int2Type<Engine::Supported>());
+			}
+
+			// numeric pixels go through the SIMD convolution engine
+			template<class SrcImage>
+			void filter(
+				DstImage& dst, const SrcImage& src, const Execution& exec,
+				Int2Type<true>
+			) const
+			{
+				separable_convolve<T>(dst, src, my_xkernel, my_ykernel, exec);
+			}
+
+			// anything else takes the generic per-tap path
+			template<class SrcImage>
+			void filter(
+				DstImage& dst, const SrcImage& src, const Execution& exec,
+				Int2Type<false>
+			) const
+			{
+				typedef typename PooledImage<DstImage>::type TmpImage;
+
+				TmpImage tmp(src.width(), src.height());
+				parallel_bands(
+					*this, &TwoPassFilter::template filter_x<TmpImage, SrcImage>,
+					tmp, src, 0, tmp.height(), exec
+				);
 
 				dst.resize(tmp.width(), tmp.height());
-				filter<YSelector>(dst, tmp, my_ykernel);
+				parallel_bands(
+					*this, &TwoPassFilter::template filter_y<DstImage, TmpImage>,
+					dst, tmp, 0, dst.height(), exec
+				);
+			}
+
+			template<class I, class SrcImage>
+			void filter_x(
+				I& dst, const SrcImage& src, size_t y0, size_t y1
+			) const
+			{
+				filter<XSelector>(dst, src, my_xkernel, y0, y1);
 			}
 
-			template< class Selector, class SrcImage, class Kernel >
+			template<class I, class SrcImage>
+			void filter_y(
+				I& dst, const SrcImage& src, size_t y0, size_t y1
+			) const
+			{
+				filter<YSelector>(dst, src, my_ykernel, y0, y1);
+			}
+
+			// one pass over the rows [y0, y1) of dst
+			template< class Selector, class I, class SrcImage, class Kernel >
 			void 
 			filter(
-				DstImage& dst, 
+				I& dst, 
 				const SrcImage& src, 
-				const Kernel &kernel
+				const Kernel &kernel,
+				size_t y0,
+				size_t y1
 			) const
 			{
 				typedef 
@@ -98,7 +162,7 @@ namespace gil {
 
 				const int r = kernel.size()/2;
 
-				for (size_t y = 0; y < dst.height(); ++y) {
+				for (size_t y = y0; y < y1; ++y) {
 					for (size_t x = 0; x < dst.width(); ++x) {
 
 						sum_type sum(0);
@@ -134,6 +198,13 @@ namespace gil {
 			YKernel my_ykernel;
 	};
 
+	// the engines read their source a row at a time
+	template<class DstImage, typename T, class XKernel, class YKernel>
+	struct StageTrait< TwoPassFilter<DstImage, T, XKernel, YKernel> > {
+		enum { Pointwise = false };
+		enum { Streaming = true };
+	};
+
 }
 
 #endif
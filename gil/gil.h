@@ -9,7 +9,15 @@
 #include "core/Image.h"
 #include "core/SubImage.h"
 #include "core/SliceImage.h"
+#include "core/PlanarImage.h"
 #include "core/ImageIO.h"
 #include "core/Formatter.h"
+#include "core/Codec.h"
+#include "core/Probe.h"
+#include "core/Parallel.h"
+#include "core/MappedImage.h"
+#include "core/Pool.h"
+#include "core/Sequence.h"
+#include "core/Batch.h"
 
 #endif
@@ -0,0 +1,173 @@
+/* batch_convert:
+ *   BatchConvert over PFM files, some of which fail: missing, truncated,
+ *   refused by the transform, or with a destination that cannot be
+ *   written. Every other job must write its own frame, transformed,
+ *   to its own destination, whatever the threads of the stages; the
+ *   failures must be reported once each, in the order of the jobs.
+ *
+ *   A batch of hundreds of corrupt files must fail them all and leave
+ *   no file open.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "gil/core/Batch.h"
+#include "codec_stubs.h"
+#include "scratch.h"
+
+using namespace gil;
+
+namespace {
+
+	const float REFUSED = 13.0f;	// frames the transform throws on
+
+	// doubles every pixel, refuses frames starting with REFUSED
+	struct Double {
+		void operator ()(FloatImage3& image) const
+		{
+			if (image(0, 0)[0] == REFUSED)
+				throw std::runtime_error("refused");
+			for (size_t y = 0; y < image.height(); ++y)
+				for (size_t x = 0; x < image.width(); ++x)
+					for (size_t c = 0; c < 3; ++c)
+						image(x, y)[c] *= 2.0f;
+		}
+	};
+
+	typedef BatchConvert<FloatImage3, DefaultConverter, Double> Batch;
+
+	FloatImage3 frame(size_t i)
+	{
+		FloatImage3 image(7 + i % 3, 5);
+		for (size_t y = 0; y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				image(x, y) = Float3(float(i), float(x), float(y));
+		return image;
+	}
+
+	std::string name(const char* prefix, size_t i)
+	{
+		char buf[32];
+		std::sprintf(buf, "%s%03lu.pfm", prefix, (unsigned long)i);
+		return buf;
+	}
+
+	int next_descriptor()
+	{
+		const int fd = dup(0);
+		close(fd);
+		return fd;
+	}
+
+	enum Kind { GOOD, MISSING, TRUNCATED, REFUSED_FRAME, UNWRITABLE };
+
+	Kind kind(size_t i)
+	{
+		switch (i % 7) {
+			case 2: return MISSING;
+			case 3: return TRUNCATED;
+			case 5: return UNWRITABLE;
+			default: return i == REFUSED ? REFUSED_FRAME : GOOD;
+		}
+	}
+
+	bool check(Scratch& scratch, const Batch::Stages& stages, const char* run)
+	{
+		const size_t JOBS = 40;
+		Batch batch(stages);
+		std::vector<std::string> dst(JOBS);
+		for (size_t i = 0; i < JOBS; ++i) {
+			const std::string src = scratch.file(name(run, i));
+			dst[i] = scratch.file(name((std::string(run) + "out").c_str(), i));
+			if (kind(i) != MISSING)
+				write<PfmWriter>(frame(i), src);
+			if (kind(i) == TRUNCATED) {
+				const std::string bytes = Scratch::bytes(src);
+				scratch.file(name(run, i), bytes.substr(0, bytes.size() / 2));
+			}
+			batch.add(src, kind(i) == UNWRITABLE ?
+				scratch.file("none") + "/" + name("out", i) : dst[i]);
+		}
+		const Batch::Report report = batch.run();
+
+		bool ok = batch.jobs().empty();
+		size_t failed = 0, f = 0;
+		for (size_t i = 0; i < JOBS; ++i) {
+			if (kind(i) != GOOD) {
+				++failed;
+				const bool listed = f < report.failures.size() &&
+					report.failures[f].job == i &&
+					!report.failures[f].message.empty();
+				if (!listed)
+					std::printf("job %lu: failure not listed in order\n",
+						(unsigned long)i);
+				ok = ok && listed;
+				++f;
+				continue;
+			}
+			FloatImage3 out, expected = frame(i);
+			Double()(expected);
+			bool same = read<PfmReader>(out, dst[i]) &&
+				out.width() == expected.width() &&
+				out.height() == expected.height();
+			for (size_t y = 0; same && y < out.height(); ++y)
+				for (size_t x = 0; x < out.width(); ++x)
+					for (size_t c = 0; c < 3; ++c)
+						same = same && out(x, y)[c] == expected(x, y)[c];
+			if (!same)
+				std::printf("job %lu: wrong output\n", (unsigned long)i);
+			ok = ok && same;
+		}
+		ok = ok && report.files == JOBS - failed && report.failed == failed &&
+			report.failures.size() == failed && report.bytes_read > 0 &&
+			report.bytes_written > 0;
+		std::printf("%s: %lu converted, %lu failed, %s\n", run,
+			(unsigned long)report.files, (unsigned long)report.failed,
+			ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	// many corrupt inputs, none of which may stay open
+	bool check_corrupt(Scratch& scratch)
+	{
+		const size_t JOBS = 300;
+		const std::string bad = scratch.file("bad.pfm", "PF\n8 8\n-1.0\n0123");
+		const int before = next_descriptor();
+		Batch batch;
+		for (size_t i = 0; i < JOBS; ++i)
+			batch.add(bad, scratch.file(name("bad", i)));
+		const Batch::Report report = batch.run();
+		const int after = next_descriptor();
+		const bool ok = report.files == 0 && report.failed == JOBS &&
+			before == after;
+		std::printf("%lu corrupt files: %lu failed, descriptor %d before, %d after\n",
+			(unsigned long)JOBS, (unsigned long)report.failed, before, after);
+		return ok;
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	Batch::Stages serial;
+	serial.read_threads = serial.transform_threads = serial.write_threads = 1;
+	serial.read_depth = serial.write_depth = 1;
+	Batch::Stages wide;
+	wide.read_threads = 4;
+	wide.transform_threads = 3;
+	wide.write_threads = 4;
+
+	bool ok = check(scratch, serial, "a");
+	ok = check(scratch, Batch::Stages(), "b") && ok;
+	ok = check(scratch, wide, "c") && ok;
+	ok = check_corrupt(scratch) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,233 @@
+/* box_filter:
+ *   the running-sum box engine (BoxConvolution) against the per-tap
+ *   engine (SeparableConvolution with a LineKernel of ones) and a double
+ *   precision box mean over the taps inside the image. Boxes of odd and
+ *   even sizes, wider than the image too, over images taller than
+ *   BoxConvolution::BLOCK.
+ *
+ *   Both round differently, so they are not bit for bit the same. The
+ *   running sums are exact in double: on HDR floats each output must be
+ *   within FLT_EPSILON of the exact mean, whatever the size, and no
+ *   further from it than the per-tap engine. Byte images, whose sums
+ *   are integers, must get the exact mean truncated, as BoxFilter
+ *   stores it.
+ *
+ *   BoxGaussianFilter must blur an impulse to the variance of its boxes,
+ *   and that must be sigma^2 up to the rounding of the box count.
+ *
+ *     make test
+ */
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "gil/core/Image.h"
+#include "gil/dip/BoxFilter.h"
+
+using namespace gil;
+
+namespace {
+
+	const size_t SIZES[] = { 1, 2, 3, 4, 5, 8, 31, 101, 256, 700 };
+
+	// the sums of src over rectangles, from a table of prefix sums
+	template<class I>
+	class Rectangles {
+		public:
+			explicit Rectangles(const I& src)
+				: my_width(src.width() + 1), my_channels(src.channels()),
+				  my_sums(my_width * (src.height() + 1) * my_channels, 0.0)
+			{
+				typedef typename I::value_type P;
+				for (size_t y = 0; y < src.height(); ++y)
+					for (size_t x = 0; x < src.width(); ++x)
+						for (size_t c = 0; c < my_channels; ++c)
+							at(x + 1, y + 1, c) = at(x + 1, y, c) +
+								at(x, y + 1, c) - at(x, y, c) +
+								ColorTrait<P>::select_channel(src(x, y), c);
+			}
+
+			// the mean of pixels [x0, x1] x [y0, y1], clipped to the image
+			double mean(int x0, int y0, int x1, int y1, size_t c) const
+			{
+				x0 = std::max(x0, 0);
+				y0 = std::max(y0, 0);
+				x1 = std::min(x1, static_cast<int>(my_width) - 2);
+				y1 = std::min(y1, static_cast<int>(
+					my_sums.size() / my_channels / my_width) - 2);
+				const double sum = at(x1 + 1, y1 + 1, c) - at(x0, y1 + 1, c) -
+					at(x1 + 1, y0, c) + at(x0, y0, c);
+				return sum / ((x1 - x0 + 1.0) * (y1 - y0 + 1.0));
+			}
+
+		private:
+			double& at(size_t x, size_t y, size_t c)
+			{
+				return my_sums[(y * my_width + x) * my_channels + c];
+			}
+
+			double at(size_t x, size_t y, size_t c) const
+			{
+				return my_sums[(y * my_width + x) * my_channels + c];
+			}
+
+			size_t my_width;
+			size_t my_channels;
+			std::vector<double> my_sums;
+	};
+
+	// a positive HDR scene, some pixels a thousand times the rest
+	FloatImage3 scene(size_t w, size_t h)
+	{
+		FloatImage3 image(w, h);
+		unsigned int seed = 12345;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				for (size_t c = 0; c < 3; ++c) {
+					seed = seed * 1103515245u + 12345u;
+					const float v = float((seed >> 8) & 0xffff) / 65536.0f + 0.01f;
+					image(x, y)[c] = v * ((x * y) % 97 == 0 ? 1e6f : 1e3f);
+				}
+		return image;
+	}
+
+	ByteImage3 bytes(size_t w, size_t h)
+	{
+		ByteImage3 image(w, h);
+		unsigned int seed = 54321;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				for (size_t c = 0; c < 3; ++c) {
+					seed = seed * 1103515245u + 12345u;
+					image(x, y)[c] = static_cast<Byte1>(seed >> 24);
+				}
+		return image;
+	}
+
+	// the largest error of dst relative to the exact box mean of size k
+	double error(const FloatImage3& dst, const Rectangles<FloatImage3>& exact,
+		size_t k)
+	{
+		const int lo = -static_cast<int>(k / 2);
+		const int hi = static_cast<int>(k) - 1 - static_cast<int>(k / 2);
+		double worst = 0.0;
+		for (size_t y = 0; y < dst.height(); ++y)
+			for (size_t x = 0; x < dst.width(); ++x)
+				for (size_t c = 0; c < 3; ++c) {
+					const int ix = static_cast<int>(x), iy = static_cast<int>(y);
+					const double m = exact.mean(ix + lo, iy + lo, ix + hi, iy + hi, c);
+					worst = std::max(worst, std::fabs(dst(x, y)[c] - m) / m);
+				}
+		return worst;
+	}
+
+	bool check_floats()
+	{
+		const FloatImage3 src = scene(301, 600);
+		const Rectangles<FloatImage3> exact(src);
+		const Execution serial(Execution::SERIAL);
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); ++i) {
+			const size_t k = SIZES[i];
+			LineKernel<float> ones(k);
+			ones.fill(1);
+			FloatImage3 running, per_tap;
+			separable_convolve<float>(running, src,
+				BoxKernel<float>(k), BoxKernel<float>(k), serial);
+			separable_convolve<float>(per_tap, src, ones, ones, serial);
+			const double r = error(running, exact, k);
+			const double p = error(per_tap, exact, k);
+			const bool good = r <= FLT_EPSILON && r <= p;
+			std::printf("box %3lu: running sums %.3g, per tap %.3g of the mean: %s\n",
+				(unsigned long)k, r, p, good ? "ok" : "FAILED");
+			ok = ok && good;
+		}
+		return ok;
+	}
+
+	bool check_bytes()
+	{
+		const ByteImage3 src = bytes(123, 517);
+		const Rectangles<ByteImage3> exact(src);
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); ++i) {
+			const size_t kx = SIZES[i], ky = SIZES[(i + 3) % 10];
+			const int xlo = -static_cast<int>(kx / 2), ylo = -static_cast<int>(ky / 2);
+			const int xhi = static_cast<int>(kx) - 1 + xlo;
+			const int yhi = static_cast<int>(ky) - 1 + ylo;
+			ByteImage3 dst;
+			BoxFilter<ByteImage3>(kx, ky)(dst, src, Execution(Execution::SERIAL));
+			size_t wrong = 0;
+			for (size_t y = 0; y < src.height(); ++y)
+				for (size_t x = 0; x < src.width(); ++x)
+					for (size_t c = 0; c < 3; ++c) {
+						const int ix = static_cast<int>(x), iy = static_cast<int>(y);
+						const double m = exact.mean(
+							ix + xlo, iy + ylo, ix + xhi, iy + yhi, c);
+						wrong += dst(x, y)[c] != static_cast<Byte1>(m);
+					}
+			std::printf("bytes, box %lu x %lu: %lu wrong\n",
+				(unsigned long)kx, (unsigned long)ky, (unsigned long)wrong);
+			ok = ok && wrong == 0;
+		}
+		return ok;
+	}
+
+	// the variance of an impulse blurred with sigma, along x
+	double blurred_variance(float sigma)
+	{
+		const size_t N = 1201;
+		FloatImage1 impulse(N, 1), dst;
+		impulse.fill(0.0f);
+		impulse(N / 2, 0) = 1.0f;
+		BoxGaussianFilter<FloatImage1, float>(sigma, 0.0f)(
+			dst, impulse, Execution(Execution::SERIAL));
+		double sum = 0.0, moment = 0.0;
+		for (size_t x = 0; x < N; ++x) {
+			const double d = double(x) - double(N / 2);
+			sum += dst(x, 0);
+			moment += d * d * dst(x, 0);
+		}
+		return moment / sum;
+	}
+
+	bool check_gaussian()
+	{
+		const float sigmas[] = { 1.0f, 2.5f, 7.0f, 20.0f, 60.0f };
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(sigmas) / sizeof(sigmas[0]); ++i) {
+			const float sigma = sigmas[i];
+			const std::vector<size_t> sizes =
+				BoxGaussianFilter<FloatImage1, float>::box_sizes(sigma, 3);
+			double boxes = 0.0;
+			for (size_t j = 0; j < sizes.size(); ++j)
+				boxes += (double(sizes[j]) * sizes[j] - 1.0) / 12.0;
+			const double blurred = blurred_variance(sigma);
+			// a box one step wider or narrower changes the variance by
+			// (w + 1) / 3
+			const double step = (sizes[0] + 1.0) / 3.0;
+			const double s2 = double(sigma) * sigma;
+			const bool good = std::fabs(blurred - boxes) <= 1e-3 * boxes &&
+				std::fabs(boxes - s2) <= step / 2 + 1e-9;
+			std::printf("sigma %g: boxes %lu %lu %lu, variance %.4g blurred, "
+				"%.4g of the boxes, %.4g wanted: %s\n", sigma,
+				(unsigned long)sizes[0], (unsigned long)sizes[1],
+				(unsigned long)sizes[2], blurred, boxes, s2,
+				good ? "ok" : "FAILED");
+			ok = ok && good;
+		}
+		return ok;
+	}
+
+} // namespace
+
+int main()
+{
+	bool ok = check_floats();
+	ok = check_bytes() && ok;
+	ok = check_gaussian() && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+/* codec_stubs.h:
+ *   the entry points of the codecs compiled into the prebuilt library,
+ *   for the tests that go through read() and write() and so instantiate
+ *   every codec of the registries. The tests do not link the library;
+ *   these throw IOError, as a file the library cannot decode would.
+ *   Include it once, in the test's own source.
+ */
+#ifndef GIL_TEST_CODEC_STUBS_H
+#define GIL_TEST_CODEC_STUBS_H
+
+#include <string>
+#include <vector>
+
+#include "gil/core/ImageIO.h"
+
+namespace gil {
+
+	namespace test_detail {
+
+		inline void not_linked()
+		{
+			throw IOError("codec of the prebuilt library, not linked");
+		}
+
+	} // namespace test_detail
+
+	void BmpReader::init(FILE*, size_t&, size_t&) { test_detail::not_linked(); }
+	void BmpReader::read_scanline(std::vector<Byte3>&) { test_detail::not_linked(); }
+	void BmpWriter::init(FILE*, size_t, size_t, size_t) { test_detail::not_linked(); }
+	void BmpWriter::write_scanline(std::vector<Byte1>&) { test_detail::not_linked(); }
+	void BmpWriter::write_scanline(std::vector<Byte3>&) { test_detail::not_linked(); }
+
+	void JpegReader::init(FILE*, size_t&, size_t&, size_t&) { test_detail::not_linked(); }
+	void JpegReader::finish() { test_detail::not_linked(); }
+	void JpegReader::read_scanline(std::vector<Byte1>&) { test_detail::not_linked(); }
+	void JpegReader::read_scanline(std::vector<Byte3>&) { test_detail::not_linked(); }
+	void JpegReader::cleanup() throw() {}
+	void JpegWriter::init(FILE*, size_t, size_t, size_t) { test_detail::not_linked(); }
+	void JpegWriter::write_scanline(std::vector<Byte1>&) { test_detail::not_linked(); }
+	void JpegWriter::write_scanline(std::vector<Byte3>&) { test_detail::not_linked(); }
+	void JpegWriter::finish() { test_detail::not_linked(); }
+	void JpegWriter::cleanup() throw() {}
+
+	void PngReader::init(FILE*) { test_detail::not_linked(); }
+	void PngReader::finish() { test_detail::not_linked(); }
+	void PngReader::read_row(unsigned char*) { test_detail::not_linked(); }
+	void PngReader::read_row(unsigned short*) { test_detail::not_linked(); }
+
+	void TiffReader::init(const std::string&, size_t&, size_t&, size_t&) { test_detail::not_linked(); }
+	void TiffReader::finish() { test_detail::not_linked(); }
+	void TiffReader::read_scanline(std::vector<Byte1>&, unsigned int) { test_detail::not_linked(); }
+	void TiffReader::read_scanline(std::vector<Byte3>&, unsigned int) { test_detail::not_linked(); }
+	void TiffReader::read_scanline(std::vector<Byte4>&, unsigned int) { test_detail::not_linked(); }
+	void TiffWriter::init(const std::string&, size_t, size_t, size_t) { test_detail::not_linked(); }
+	void TiffWriter::write_scanline(std::vector<Byte1>&, unsigned int) { test_detail::not_linked(); }
+	void TiffWriter::write_scanline(std::vector<Byte3>&, unsigned int) { test_detail::not_linked(); }
+	void TiffWriter::write_scanline(std::vector<Byte4>&, unsigned int) { test_detail::not_linked(); }
+	void TiffWriter::finish() { test_detail::not_linked(); }
+
+	void ExrReader::init(FILE*, size_t&, size_t&) { test_detail::not_linked(); }
+	void ExrReader::read_scanline(std::vector<Float4>&, int) { test_detail::not_linked(); }
+	void ExrReader::cleanup() throw() {}
+
+} // namespace gil
+
+#endif // GIL_TEST_CODEC_STUBS_H
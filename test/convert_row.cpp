@@ -0,0 +1,163 @@
+/* convert_row:
+ *   the row converters of DefaultConverter against the converter itself,
+ *   called once per pixel, bit for bit: Byte3/Byte4 <-> Float3/Float4,
+ *   Short3 <-> Float3, Float3 <-> Float4 and Float3 -> Half3. Rows of
+ *   every length to 40 from every offset into the source, so that the
+ *   SIMD loops and the scalar tails both run, and whole long rows. The
+ *   floats include NaNs, infinities, denormals, negative zero, values
+ *   out of range and values next to the steps of the integer types. No
+ *   converter may write past the n pixels it is given.
+ *
+ *   Built without SSE2 (or with GIL_NO_SIMD) the rows are converted by
+ *   the scalar loops only.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "gil/core/Color.h"
+#include "gil/core/Converter.h"
+#include "gil/core/Half.h"
+
+using namespace gil;
+
+namespace {
+
+	unsigned int seed = 12345;
+
+	unsigned int next_random()
+	{
+		seed = seed * 1103515245u + 12345u;
+		return seed >> 8;
+	}
+
+	unsigned int bits_of(float f)
+	{
+		unsigned int x;
+		std::memcpy(&x, &f, sizeof(x));
+		return x;
+	}
+
+	float float_of(unsigned int x)
+	{
+		float f;
+		std::memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+
+	// floats next to the steps of bytes and shorts, special ones, and
+	// random ones of every exponent
+	std::vector<float> channels()
+	{
+		std::vector<float> all;
+		for (int i = -2; i <= 257; ++i) {
+			const float v = float(i) / 255.0f;
+			all.push_back(v);
+			all.push_back(float_of(bits_of(v) - 1));
+			all.push_back(float_of(bits_of(v) + 1));
+		}
+		for (int i = 0; i < 300; ++i) {
+			const float v = float(next_random() % 65540) / 65535.0f;
+			all.push_back(v);
+			all.push_back(float_of(bits_of(v) + 1));
+		}
+		for (unsigned int e = 0; e < 256; ++e)
+			for (unsigned int s = 0; s < 2; ++s)
+				all.push_back(float_of((s << 31) | (e << 23) |
+					(next_random() & 0x7fffff)));
+		all.push_back(std::numeric_limits<float>::infinity());
+		all.push_back(-std::numeric_limits<float>::infinity());
+		all.push_back(std::numeric_limits<float>::quiet_NaN());
+		all.push_back(-std::numeric_limits<float>::quiet_NaN());
+		all.push_back(float_of(0x7fc12345));
+		all.push_back(float_of(0xffc00001));
+		all.push_back(std::numeric_limits<float>::max());
+		all.push_back(-std::numeric_limits<float>::max());
+		all.push_back(std::numeric_limits<float>::denorm_min());
+		all.push_back(std::numeric_limits<float>::min());
+		all.push_back(0.0f);
+		all.push_back(-0.0f);
+		all.push_back(1.0f);
+		all.push_back(65535.0f);
+		all.push_back(2147483648.0f);
+		all.push_back(-2147483904.0f);
+		return all;
+	}
+
+	// pixels of the channels, each channel in turn at every position
+	template<typename P, typename T>
+	std::vector<P> pixels(const std::vector<T>& c)
+	{
+		const size_t C = sizeof(P) / sizeof(T);
+		std::vector<P> all(c.size() + 64);
+		for (size_t i = 0; i < all.size(); ++i)
+			for (size_t k = 0; k < C; ++k)
+				reinterpret_cast<T*>(&all[i])[k] =
+					c[(i + k * (c.size() / C + 1)) % c.size()];
+		return all;
+	}
+
+	// convert_row on rows of every length and offset, and on the whole
+	// of in, against DefaultConverter<To, From> pixel by pixel
+	template<typename To, typename From>
+	bool check(const char* what, const std::vector<From>& in)
+	{
+		DefaultConverter<To, From> converter;
+		std::vector<To> expected(in.size());
+		for (size_t i = 0; i < in.size(); ++i)
+			expected[i] = converter(in[i]);
+
+		std::vector<unsigned char> sentinel(sizeof(To), 0xa5);
+		std::vector<To> out(in.size() + 1);
+		size_t wrong = 0, spilled = 0;
+		for (size_t offset = 0; offset < 8; ++offset)
+			for (size_t n = 0; n <= 40; ++n) {
+				std::memset(static_cast<void*>(&out[0]), 0xa5,
+					out.size() * sizeof(To));
+				convert_row(&out[0], &in[offset], n);
+				for (size_t i = 0; i < n; ++i)
+					wrong += std::memcmp(&out[i], &expected[offset + i],
+						sizeof(To)) != 0;
+				spilled += std::memcmp(&out[n], &sentinel[0], sizeof(To)) != 0;
+			}
+
+		std::memset(static_cast<void*>(&out[0]), 0xa5,
+			out.size() * sizeof(To));
+		convert_row(&out[0], &in[0], in.size());
+		for (size_t i = 0; i < in.size(); ++i)
+			wrong += std::memcmp(&out[i], &expected[i], sizeof(To)) != 0;
+		spilled += std::memcmp(&out[in.size()], &sentinel[0], sizeof(To)) != 0;
+
+		const bool ok = wrong == 0 && spilled == 0;
+		std::printf("%-16s %lu pixels wrong, %lu rows written past: %s\n", what,
+			(unsigned long)wrong, (unsigned long)spilled, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+} // namespace
+
+int main()
+{
+	const std::vector<float> floats = channels();
+	std::vector<Byte1> bytes(256);
+	for (size_t i = 0; i < bytes.size(); ++i)
+		bytes[i] = static_cast<Byte1>(i);
+	std::vector<Short1> shorts(65536);
+	for (size_t i = 0; i < shorts.size(); ++i)
+		shorts[i] = static_cast<Short1>(i);
+
+	bool ok = check<Float3>("Byte3 -> Float3", pixels<Byte3>(bytes));
+	ok = check<Float4>("Byte4 -> Float4", pixels<Byte4>(bytes)) && ok;
+	ok = check<Byte3>("Float3 -> Byte3", pixels<Float3>(floats)) && ok;
+	ok = check<Byte4>("Float4 -> Byte4", pixels<Float4>(floats)) && ok;
+	ok = check<Float3>("Short3 -> Float3", pixels<Short3>(shorts)) && ok;
+	ok = check<Short3>("Float3 -> Short3", pixels<Float3>(floats)) && ok;
+	ok = check<Float4>("Float3 -> Float4", pixels<Float3>(floats)) && ok;
+	ok = check<Float3>("Float4 -> Float3", pixels<Float4>(floats)) && ok;
+	ok = check<Half3>("Float3 -> Half3", pixels<Float3>(floats)) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,285 @@
+/* copy_rows:
+ *   copy_rows, and so Image::operator=, Image::replace, SubImage::replace
+ *   and SliceImage::replace, against assigning one pixel at a time.
+ *   Plain and padded images, of the same pixel type and of another,
+ *   crops, crops of crops and channels, as source and destination, at
+ *   offsets all over the destination, and images of zero width. Nothing
+ *   outside the block assigned may change.
+ *
+ *   Crops of the same image that overlap within rows, or with the
+ *   destination above the source, must copy what the source held
+ *   before the copy.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <vector>
+
+#include "gil/core/Image.h"
+#include "gil/core/SliceImage.h"
+#include "gil/core/SubImage.h"
+
+using namespace gil;
+
+namespace {
+
+	// pixels kept apart from the images under test, assigned one by one
+	template<typename P>
+	class Pixels {
+		public:
+			template<class I>
+			explicit Pixels(const I& image)
+				: my_width(image.width()), my_height(image.height())
+			{
+				for (size_t y = 0; y < my_height; ++y)
+					for (size_t x = 0; x < my_width; ++x)
+						my_pixels.push_back(image(x, y));
+			}
+
+			// assign src to the block at (x, y)
+			template<class I>
+			void assign(const I& src, size_t x, size_t y)
+			{
+				const Pixels<P> from(src);
+				for (size_t iy = 0; iy < src.height(); ++iy)
+					for (size_t ix = 0; ix < src.width(); ++ix)
+						(*this)(x + ix, y + iy) = from(ix, iy);
+			}
+
+			template<class I>
+			bool same(const I& image) const
+			{
+				// images resized to no pixels are 0 x 0
+				if (image.width() * image.height() == 0)
+					return my_width * my_height == 0;
+				if (image.width() != my_width || image.height() != my_height)
+					return false;
+				for (size_t y = 0; y < my_height; ++y)
+					for (size_t x = 0; x < my_width; ++x)
+						if (!equal((*this)(x, y), image(x, y)))
+							return false;
+				return true;
+			}
+
+			P& operator ()(size_t x, size_t y)
+			{
+				return my_pixels[y * my_width + x];
+			}
+
+			const P& operator ()(size_t x, size_t y) const
+			{
+				return my_pixels[y * my_width + x];
+			}
+
+		private:
+			template<typename T, size_t C>
+			static bool equal(const Color<T, C>& a, const Color<T, C>& b)
+			{
+				for (size_t c = 0; c < C; ++c)
+					if (a[c] != b[c])
+						return false;
+				return true;
+			}
+
+			template<typename T>
+			static bool equal(T a, T b)
+			{
+				return a == b;
+			}
+
+			size_t my_width;
+			size_t my_height;
+			std::vector<P> my_pixels;
+	};
+
+	unsigned int seed = 12345;
+
+	template<class I>
+	void noise(I& image)
+	{
+		typedef typename I::value_type P;
+		for (size_t y = 0; y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				for (size_t c = 0; c < ColorTrait<P>::Channels; ++c) {
+					seed = seed * 1103515245u + 12345u;
+					ColorTrait<P>::select_channel(image(x, y), c) =
+						typename ColorTrait<P>::BaseType(seed >> 20);
+				}
+	}
+
+	bool report(const char* what, size_t wrong, size_t count)
+	{
+		std::printf("%s: %lu of %lu copies wrong\n", what,
+			(unsigned long)wrong, (unsigned long)count);
+		return wrong == 0;
+	}
+
+	const size_t WIDTHS[] = { 0, 1, 3, 16, 37 };
+	const size_t N = sizeof(WIDTHS) / sizeof(WIDTHS[0]);
+
+	// Image::operator= from plain, padded and converted images and crops
+	bool check_assign()
+	{
+		size_t wrong = 0, count = 0;
+		for (size_t i = 0; i < N; ++i) {
+			const size_t w = WIDTHS[i], h = 7;
+			FloatImage3 plain(w, h), padded(w, h, 2, w + 5);
+			noise(plain);
+			noise(padded);
+
+			FloatImage3 a, b(3, 3, 1), c(w, h, 4);
+			a = plain;
+			b = padded;
+			c = plain;
+			wrong += !Pixels<Float3>(plain).same(a);
+			wrong += !Pixels<Float3>(padded).same(b);
+			wrong += !Pixels<Float3>(plain).same(c);
+
+			Image<Short1> shorts(w, h);
+			noise(shorts);
+			FloatImage1 floats;
+			floats = shorts;
+			Pixels<Float1> expected(floats);
+			for (size_t y = 0; y < h; ++y)
+				for (size_t x = 0; x < w; ++x)
+					expected(x, y) = shorts(x, y);
+			wrong += !expected.same(floats);
+			count += 4;
+
+			// crops, and crops of crops, of the padded image
+			if (w < 3)
+				continue;
+			SubImage<FloatImage3> crop(padded, 1, 2, w - 2, 4);
+			SubImage< SubImage<FloatImage3> > inner(crop, 1, 1, w - 3, 2);
+			FloatImage3 d, e(1, 1, 3);
+			d = crop;
+			e = inner;
+			wrong += !Pixels<Float3>(crop).same(d);
+			wrong += !Pixels<Float3>(inner).same(e);
+			count += 2;
+		}
+		return report("Image::operator=", wrong, count);
+	}
+
+	// replace() at every offset the source fits
+	template<class D, class S>
+	void replace_everywhere(D& dst, const S& src, size_t& wrong, size_t& count)
+	{
+		typedef typename D::value_type P;
+		if (src.width() == 0 || src.height() == 0)
+			return;
+		for (size_t y = 0; y + src.height() <= dst.height(); ++y)
+			for (size_t x = 0; x + src.width() <= dst.width(); ++x) {
+				noise(dst);
+				Pixels<P> expected(dst);
+				expected.assign(src, x, y);
+				dst.replace(src, x, y);
+				wrong += !expected.same(dst);
+				++count;
+			}
+	}
+
+	bool check_replace()
+	{
+		size_t wrong = 0, count = 0;
+		for (size_t i = 0; i < N; ++i) {
+			const size_t w = WIDTHS[i];
+			FloatImage3 src(w, 3), padded(w + 2, 9, 1, w + 7), plain(w + 5, 4);
+			noise(src);
+			replace_everywhere(padded, src, wrong, count);
+			replace_everywhere(plain, src, wrong, count);
+
+			FloatImage3 big(w + 9, 11, 2);
+			SubImage<FloatImage3> crop(big, 2, 1, w + 4, 8);
+			replace_everywhere(crop, src, wrong, count);
+			SubImage<FloatImage3> from(padded, 1, 2, w, 5);
+			replace_everywhere(big, from, wrong, count);
+
+			// nothing of big outside the block may change
+			Pixels<Float3> before(big);
+			FloatImage3 zeros(w, 2);
+			zeros.fill(Float3(0, 0, 0));
+			if (w)
+				crop.replace(zeros, 1, 3);
+			before.assign(zeros, 3, 4);
+			wrong += !before.same(big);
+			++count;
+		}
+		return report("replace", wrong, count);
+	}
+
+	// views of the same image
+	bool check_overlap()
+	{
+		size_t wrong = 0, count = 0;
+		const int shifts[][2] = {
+			{ 1, 0 }, { -1, 0 }, { 5, 0 }, { -7, 0 },
+			{ 0, -1 }, { 3, -2 }, { -3, -1 }
+		};
+		for (size_t i = 0; i < sizeof(shifts) / sizeof(shifts[0]); ++i) {
+			FloatImage3 image(40, 20, 1);
+			noise(image);
+			const int dx = shifts[i][0], dy = shifts[i][1];
+			const size_t sx = dx < 0 ? 8 : 0, sy = dy < 0 ? 3 : 0;
+			SubImage<FloatImage3> src(image, sx, sy, 30, 15);
+			SubImage<FloatImage3> dst(image, sx + dx, sy + dy, 30, 15);
+			Pixels<Float3> expected(image);
+			expected.assign(src, sx + dx, sy + dy);
+			dst.replace(src);
+			wrong += !expected.same(image);
+			++count;
+		}
+		return report("overlapping crops", wrong, count);
+	}
+
+	// channels to images, images to channels, channels to channels
+	bool check_slices()
+	{
+		size_t wrong = 0, count = 0;
+		for (size_t i = 0; i < N; ++i) {
+			const size_t w = WIDTHS[i];
+			FloatImage4 rgba(w, 6, 2, w + 3);
+			FloatImage3 rgb(w + 4, 8);
+			noise(rgba);
+			noise(rgb);
+			for (size_t c = 0; c < 4; ++c) {
+				SliceImage<FloatImage4> channel(rgba, c);
+				FloatImage1 gray;
+				gray = channel;
+				wrong += !Pixels<Float1>(channel).same(gray);
+				++count;
+
+				FloatImage1 values(w, 3);
+				noise(values);
+				replace_everywhere(channel, values, wrong, count);
+
+				SliceImage<FloatImage3> target(rgb, c % 3);
+				replace_everywhere(target, channel, wrong, count);
+
+				// the other channels are left alone
+				noise(rgb);
+				Pixels<Float3> before(rgb);
+				if (w) {
+					target.replace(values, 2, 1);
+					for (size_t y = 0; y < values.height(); ++y)
+						for (size_t x = 0; x < w; ++x)
+							before(x + 2, y + 1)[c % 3] = values(x, y);
+				}
+				wrong += !before.same(rgb);
+				++count;
+			}
+		}
+		return report("channels", wrong, count);
+	}
+
+} // namespace
+
+int main()
+{
+	bool ok = check_assign();
+	ok = check_replace() && ok;
+	ok = check_overlap() && ok;
+	ok = check_slices() && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
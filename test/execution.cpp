@@ -0,0 +1,203 @@
+/* execution:
+ *   the filters of gil/dip under every execution policy. Each filter must
+ *   give the same bits as SERIAL with a thread pool and with work
+ *   stealing, at several thread counts and grains, on an image taller
+ *   than the row blocks of the separable engines: box, Gaussian (both
+ *   FIR and recursive), iterated box, a one-pass kernel, nearest,
+ *   bilinear and the converters, and the box filtering its own source.
+ *
+ *   parallel_for must run each index once under every policy, and
+ *   rethrow the exception of a band to the caller.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "gil/core/Image.h"
+#include "gil/dip/BilinearFilter.h"
+#include "gil/dip/BoxFilter.h"
+#include "gil/dip/ColorSpace.h"
+#include "gil/dip/Convert.h"
+#include "gil/dip/GaussianFilter.h"
+#include "gil/dip/NearestFilter.h"
+#include "gil/dip/OnePassFilter.h"
+
+using namespace gil;
+
+namespace {
+
+	FloatImage3 scene(size_t w, size_t h)
+	{
+		FloatImage3 image(w, h);
+		unsigned int seed = 12345;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				for (size_t c = 0; c < 3; ++c) {
+					seed = seed * 1103515245u + 12345u;
+					image(x, y)[c] = float(seed >> 8) / 65536.0f *
+						(((x / 16 + y / 16) % 2) ? 1.0f : 0.01f);
+				}
+		return image;
+	}
+
+	// a 5 x 5 tent, through OnePassFilter
+	template<class DstImage>
+	class Tent: public OnePassFilter<DstImage, float, SquareKernel<float> > {
+		typedef OnePassFilter<DstImage, float, SquareKernel<float> > RealFilter;
+		friend class Filter<RealFilter, DstImage>;
+
+		public:
+			Tent(): RealFilter(*this, 5, 5)
+			{
+				for (int y = -2; y <= 2; ++y)
+					for (int x = -2; x <= 2; ++x)
+						this->my_kernel(x, y) =
+							float((3 - std::abs(x)) * (3 - std::abs(y)));
+			}
+	};
+
+	// the policies compared with SERIAL
+	std::vector<Execution> executions()
+	{
+		const size_t threads[] = { 2, 3, 4, 7 };
+		const size_t grains[] = { 0, 1, 3, 50 };
+		std::vector<Execution> all;
+		for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t)
+			for (size_t g = 0; g < sizeof(grains) / sizeof(grains[0]); ++g) {
+				all.push_back(Execution(
+					Execution::THREAD_POOL, threads[t], grains[g]));
+				all.push_back(Execution(
+					Execution::WORK_STEALING, threads[t], grains[g]));
+			}
+		return all;
+	}
+
+	template<class I>
+	bool same(const I& a, const I& b)
+	{
+		typedef typename I::value_type P;
+		if (a.width() != b.width() || a.height() != b.height())
+			return false;
+		for (size_t y = 0; y < a.height(); ++y)
+			for (size_t x = 0; x < a.width(); ++x)
+				if (std::memcmp(&a(x, y), &b(x, y), sizeof(P)) != 0)
+					return false;
+		return true;
+	}
+
+	// filter into images of I under SERIAL and every other policy
+	template<class I, class F, class S>
+	bool check(const char* what, const F& filter, const S& src)
+	{
+		I serial;
+		filter(serial, src, Execution(Execution::SERIAL));
+		const std::vector<Execution> all = executions();
+		size_t differ = 0;
+		for (size_t i = 0; i < all.size(); ++i) {
+			I out;
+			filter(out, src, all[i]);
+			differ += !same(serial, out);
+		}
+		std::printf("%s: %lu of %lu policies differ from serial\n", what,
+			(unsigned long)differ, (unsigned long)all.size());
+		return differ == 0;
+	}
+
+	// a box filtering its source in place
+	bool check_in_place(const FloatImage3& src)
+	{
+		FloatImage3 serial(src);
+		BoxFilter<FloatImage3>(9, 41)(serial, serial, Execution(Execution::SERIAL));
+		const std::vector<Execution> all = executions();
+		size_t differ = 0;
+		for (size_t i = 0; i < all.size(); ++i) {
+			FloatImage3 out(src);
+			BoxFilter<FloatImage3>(9, 41)(out, out, all[i]);
+			differ += !same(serial, out);
+		}
+		std::printf("box in place: %lu of %lu policies differ from serial\n",
+			(unsigned long)differ, (unsigned long)all.size());
+		return differ == 0;
+	}
+
+	// marks each index of [i0, i1), throws at THROW_AT if asked
+	struct Mark {
+		static const size_t THROW_AT = 777;
+
+		Mark(std::vector<int>& marks, bool fail): marks(marks), fail(fail) {}
+
+		void operator ()(size_t i0, size_t i1) const
+		{
+			for (size_t i = i0; i < i1; ++i) {
+				if (fail && i == THROW_AT)
+					throw std::runtime_error("band failed");
+				++marks[i];
+			}
+		}
+
+		std::vector<int>& marks;
+		bool fail;
+	};
+
+	bool check_loops()
+	{
+		std::vector<Execution> all = executions();
+		all.push_back(Execution(Execution::SERIAL));
+		bool ok = true;
+		for (size_t i = 0; i < all.size(); ++i) {
+			std::vector<int> marks(1001, 0);
+			parallel_for(0, marks.size(), Mark(marks, false), all[i]);
+			for (size_t j = 0; j < marks.size(); ++j)
+				ok = ok && marks[j] == 1;
+
+			bool thrown = false;
+			try {
+				parallel_for(0, marks.size(), Mark(marks, true), all[i]);
+			} catch (const std::runtime_error&) {
+				thrown = true;
+			}
+			ok = ok && thrown;
+		}
+		std::printf("parallel_for, each index once, exceptions rethrown: %s\n",
+			ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+} // namespace
+
+int main()
+{
+	const FloatImage3 src = scene(201, 611);
+	bool ok = check<FloatImage3>("box 31 x 17",
+		BoxFilter<FloatImage3>(31, 17), src);
+	ok = check<FloatImage3>("box 4 x 600",
+		BoxFilter<FloatImage3>(4, 600), src) && ok;
+	ok = check<FloatImage3>("gaussian 1.5, FIR",
+		GaussianFilter<FloatImage3>(1.5f, 1.5f), src) && ok;
+	ok = check<FloatImage3>("gaussian 12, recursive",
+		GaussianFilter<FloatImage3>(12.0f, 12.0f), src) && ok;
+	ok = check<FloatImage3>("iterated box 15",
+		BoxGaussianFilter<FloatImage3>(15.0f, 15.0f), src) && ok;
+	ok = check<FloatImage3>("one pass, tent",
+		Tent<FloatImage3>(), src) && ok;
+	ok = check<FloatImage3>("nearest, down",
+		NearestFilter<FloatImage3>(67, 250), src) && ok;
+	ok = check<FloatImage3>("nearest, up",
+		NearestFilter<FloatImage3>(450, 900), src) && ok;
+	ok = check<FloatImage3>("bilinear, down",
+		BilinearFilter<FloatImage3>(67, 250), src) && ok;
+	ok = check<FloatImage3>("bilinear, up",
+		BilinearFilter<FloatImage3>(450, 900), src) && ok;
+	ok = check<ByteImage3>("DefaultConvert to bytes",
+		DefaultConvert<ByteImage3>(), src) && ok;
+	ok = check<FloatImage1>("Convert to gray",
+		Convert<RgbToGray>(), src) && ok;
+	ok = check_in_place(src) && ok;
+	ok = check_loops() && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,689 @@
+/* exr_codec:
+ *   The in-tree EXR codec. Frames of half RGB, a float Z and an unsigned
+ *   int id channel must round-trip through ExrWriter and ExrReader,
+ *   sample for sample, in every lossless compression it writes, the same
+ *   bytes at 1 and 4 threads. PXR24 must keep the top 24 bits of floats,
+ *   B44 and B44A halves within a sixteenth of the range of the 4 x 4
+ *   pixels around them, and the rest whole. B44A must store flat blocks
+ *   exactly and in fewer bytes than B44; perceptually linear channels
+ *   must come back close. Regions of interest must read the pixels a full
+ *   read gives there, clipped to the data window, and decode no block
+ *   outside them: a corrupt block elsewhere must not be noticed.
+ *
+ *   Tiled files, which the writer does not make, are assembled here
+ *   from exr_detail: one level, mip and rip maps rounded down and up,
+ *   tiles not dividing the levels, data windows off the origin. Every
+ *   level must read whole and by region.
+ *
+ *   PIZ and DWA files must be refused by ExrWriter, and by open(),
+ *   naming the compression; so must ZIP and ZIPS without zlib.
+ *   RGB floats must read back through the RGBA path as halves.
+ *
+ *     make test
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gil/core/io/exr.h"
+#include "codec_stubs.h"
+#include "scratch.h"
+
+using namespace gil;
+using exr_detail::Header;
+
+namespace {
+
+	typedef Image<unsigned int> UintImage1;
+
+	const ExrCompression WRITTEN[] = {
+		EXR_NONE, EXR_RLE, EXR_ZIPS, EXR_ZIP, EXR_PXR24, EXR_B44, EXR_B44A
+	};
+	const ExrCompression REFUSED[] = { EXR_PIZ, EXR_DWAA, EXR_DWAB };
+
+	// the channels of a frame, and their types
+	const char *const NAMES[] = { "R", "G", "B", "Z", "id" };
+	const ExrChannel::PixelType TYPES[] = {
+		ExrChannel::HALF, ExrChannel::HALF, ExrChannel::HALF,
+		ExrChannel::FLOAT, ExrChannel::UINT
+	};
+	const size_t CHANNELS = 5;
+
+	bool report(const char* what, bool ok)
+	{
+		std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	// the bits of sample (x, y) of channel c on level (lx, ly): smooth on
+	// the left, for the compressions to find runs, noise on the right
+	unsigned int value(size_t c, int lx, int ly, size_t x, size_t y, size_t w)
+	{
+		unsigned int h = static_cast<unsigned int>(
+			x * 73856093u ^ y * 19349663u ^ c * 83492791u ^
+			static_cast<unsigned int>(lx * 7 + ly * 131)
+		);
+		h = h * 2654435761u;
+		switch (TYPES[c]) {
+			case ExrChannel::HALF:
+				return Half::from_float(x < w / 2 ?
+					float(y % 8 + c + lx) / 4 : float(h >> 20) / 64 - 8);
+			case ExrChannel::FLOAT: {
+				const float f = x < w / 2 ?
+					float(y + ly) : float(h >> 8) / 1024 - float(x);
+				unsigned int bits;
+				std::memcpy(&bits, &f, 4);
+				return bits;
+			}
+			default:
+				return x < w / 2 ? static_cast<unsigned int>(y) : h;
+		}
+	}
+
+	// halves as unsigned numbers in the order of their values, as B44
+	// compares them
+	int ordered(unsigned int bits)
+	{
+		return static_cast<int>((bits & 0x8000) ? ~bits & 0xffff : bits | 0x8000);
+	}
+
+	// true if the bits read for sample (x, y) of channel c are those
+	// written, as far as the compression keeps them
+	bool kept(unsigned int bits, size_t c, int lx, int ly, size_t x,
+		size_t y, size_t w, ExrCompression compression)
+	{
+		const unsigned int v = value(c, lx, ly, x, y, w);
+		// whole in blocks that compressing did not make smaller
+		if (compression == EXR_PXR24 && TYPES[c] == ExrChannel::FLOAT)
+			return bits == exr_detail::float24(v) << 8 || bits == v;
+		if ((compression != EXR_B44 && compression != EXR_B44A) ||
+				TYPES[c] != ExrChannel::HALF)
+			return bits == v;
+
+		// the range of every 4 x 4 block the sample may be in
+		int t_min = 0xffff, t_max = 0;
+		for (size_t j = (y < 3) ? 0 : y - 3; j <= y + 3; ++j)
+			for (size_t i = (x < 3) ? 0 : x - 3; i <= x + 3; ++i) {
+				const int t = ordered( value(c, lx, ly, i, j, w) );
+				t_min = std::min(t_min, t);
+				t_max = std::max(t_max, t);
+			}
+		return std::abs(ordered(bits) - ordered(v)) <= (t_max - t_min) / 16 + 1;
+	}
+
+	// the channels of a w x h level, as images of their own types
+	struct Frame {
+		Frame(size_t w, size_t h)
+			: rgb(w, h), z(w, h), id(w, h)
+		{
+			// empty
+		}
+
+		void fill(int lx, int ly)
+		{
+			for (size_t y = 0; y < rgb.height(); ++y)
+				for (size_t x = 0; x < rgb.width(); ++x) {
+					const size_t w = rgb.width();
+					for (size_t c = 0; c < 3; ++c)
+						rgb(x, y)[c] = Half::from_bits(static_cast<unsigned short>(
+							value(c, lx, ly, x, y, w)));
+					const unsigned int bits = value(3, lx, ly, x, y, w);
+					std::memcpy(&z(x, y), &bits, 4);
+					id(x, y) = value(4, lx, ly, x, y, w);
+				}
+		}
+
+		ExrFrameBuffer frame_buffer() const
+		{
+			ExrFrameBuffer fb;
+			fb.insert(rgb, exr_layer("", 3));
+			fb.insert(z, std::vector<std::string>(1, "Z"));
+			fb.insert(id, std::vector<std::string>(1, "id"));
+			return fb;
+		}
+
+		// the channels of a file read into the images, roi if given
+		void read(ExrReader& exr, const Box* roi = NULL)
+		{
+			const Box box = roi ? *roi : Box(0, 0, exr.width(), exr.height());
+			exr.read(rgb, exr_layer("", 3), box);
+			exr.read(z, std::vector<std::string>(1, "Z"), box);
+			exr.read(id, std::vector<std::string>(1, "id"), box);
+		}
+
+		HalfImage3 rgb;
+		FloatImage1 z;
+		UintImage1 id;
+	};
+
+	// true if frame holds the samples of level (lx, ly) of a level w
+	// pixels wide, in the box given, as compression keeps them
+	bool holds(const Frame& frame, int lx, int ly, size_t w, const Box& box,
+		ExrCompression compression)
+	{
+		if (frame.rgb.width() != box.width || frame.rgb.height() != box.height ||
+				frame.z.width() != box.width || frame.id.height() != box.height)
+			return false;
+		for (size_t y = 0; y < box.height; ++y)
+			for (size_t x = 0; x < box.width; ++x) {
+				const size_t fx = box.x + x, fy = box.y + y;
+				for (size_t c = 0; c < 3; ++c)
+					if (!kept(frame.rgb(x, y)[c].bits(), c, lx, ly, fx, fy, w,
+							compression))
+						return false;
+				unsigned int bits;
+				std::memcpy(&bits, &frame.z(x, y), 4);
+				if (!kept(bits, 3, lx, ly, fx, fy, w, compression) ||
+						!kept(frame.id(x, y), 4, lx, ly, fx, fy, w, compression))
+					return false;
+			}
+		return true;
+	}
+
+	std::string write_frame(
+		Scratch& scratch, const char* name, ExrCompression compression,
+		const Frame& frame, size_t threads
+	)
+	{
+		const std::string path = scratch.file(name);
+		FILE* f = std::fopen(path.c_str(), "wb");
+		ExrWriter(compression, Execution(Execution::THREAD_POOL, threads))
+			.write(f, frame.rgb.width(), frame.rgb.height(),
+				frame.frame_buffer());
+		std::fclose(f);
+		return Scratch::bytes(path);
+	}
+
+	std::string write_scanlines(
+		Scratch& scratch, const char* name, ExrCompression compression,
+		size_t w, size_t h, size_t threads
+	)
+	{
+		Frame frame(w, h);
+		frame.fill(0, 0);
+		return write_frame(scratch, name, compression, frame, threads);
+	}
+
+	// the regions of interest of a w x h level
+	std::vector<Box> regions(size_t w, size_t h)
+	{
+		std::vector<Box> boxes;
+		boxes.push_back(Box(0, 0, w, h));
+		boxes.push_back(Box(0, 0, 1, 1));
+		boxes.push_back(Box(w / 3, h / 4, w / 2 + 1, h / 2 + 1));
+		boxes.push_back(Box(w - 1, h - 1, 1, 1));
+		boxes.push_back(Box(w / 2, 15, 5, 18));		// across line blocks
+		boxes.push_back(Box(w - 3, h - 2, 100, 100));	// clipped
+		return boxes;
+	}
+
+	// every region of level (lx, ly) of the file open in exr
+	bool check_regions(ExrReader& exr, int lx, int ly)
+	{
+		bool ok = true;
+		const std::vector<Box> boxes = regions(exr.width(), exr.height());
+		for (size_t i = 0; i < boxes.size(); ++i) {
+			Frame frame(0, 0);
+			frame.read(exr, &boxes[i]);
+			ok = holds(frame, lx, ly, exr.width(),
+				boxes[i].clip(exr.width(), exr.height()), exr.compression()) && ok;
+		}
+		return ok;
+	}
+
+	bool check_scanlines(Scratch& scratch)
+	{
+		const size_t W = 97, H = 75;
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(WRITTEN) / sizeof(WRITTEN[0]); ++i) {
+			const ExrCompression compression = WRITTEN[i];
+			const char* name = exr_detail::compression_name(compression);
+			if (!exr_writable(compression)) {
+				std::printf("%s: not written without zlib\n", name);
+				continue;
+			}
+			const std::string one = write_scanlines(
+				scratch, "lines.exr", compression, W, H, 1);
+			const std::string four = write_scanlines(
+				scratch, "lines4.exr", compression, W, H, 4);
+			const std::string path = scratch.file("lines.exr", one);
+
+			bool same = one == four;
+			FILE* f = std::fopen(path.c_str(), "rb");
+			try {
+				ExrReader exr(Execution(Execution::THREAD_POOL, 4));
+				exr.open(f);
+				Frame frame(0, 0);
+				frame.read(exr);
+				same = same && exr.compression() == compression &&
+					!exr.tiled() && exr.channels().size() == CHANNELS &&
+					holds(frame, 0, 0, W, Box(0, 0, W, H), compression) &&
+					check_regions(exr, 0, 0);
+				exr.close();
+			} catch (const std::exception& e) {
+				std::printf("%s: %s\n", name, e.what());
+				same = false;
+			}
+			std::fclose(f);
+			std::printf("%s, %lu bytes: %s\n", name, (unsigned long)one.size(),
+				same ? "ok" : "FAILED");
+			ok = ok && same;
+		}
+		return report("scanline files written and read", ok);
+	}
+
+	// the chunk header of line block or tile i, at its offset
+	size_t chunk(const std::string& file, size_t header, size_t i)
+	{
+		const unsigned char* p =
+			reinterpret_cast<const unsigned char*>(file.data()) + header + 8 * i;
+		return static_cast<size_t>(exr_detail::get64(p));
+	}
+
+	// the size of the header, up to the offset table
+	size_t header_size(const std::string& path)
+	{
+		FILE* f = std::fopen(path.c_str(), "rb");
+		Header header;
+		exr_detail::read_header(f, header);
+		const long at = std::ftell(f);
+		std::fclose(f);
+		return static_cast<size_t>(at);
+	}
+
+	// a region away from a broken block must read; the whole file not
+	bool check_untouched(Scratch& scratch, const std::string& file,
+		size_t broken, const Box& away)
+	{
+		std::string bytes = file;
+		const std::string path = scratch.file("broken.exr", bytes);
+		bytes[chunk(bytes, header_size(path), broken)] ^= 0x55;
+		scratch.file("broken.exr", bytes);
+
+		FILE* f = std::fopen(path.c_str(), "rb");
+		bool away_read = true, whole_read = true;
+		ExrReader exr;
+		exr.open(f);
+		try {
+			Frame frame(0, 0);
+			frame.read(exr, &away);
+		} catch (const InvalidFormat&) {
+			away_read = false;
+		}
+		try {
+			Frame frame(0, 0);
+			frame.read(exr);
+		} catch (const InvalidFormat&) {
+			whole_read = false;
+		}
+		std::fclose(f);
+		return away_read && !whole_read;
+	}
+
+	/* a tiled file of the channels of a frame, every level filled by
+	 * Frame::fill. The scanline header of the writer is made tiled:
+	 * its flag set and a tiles attribute added.
+	 */
+	std::string write_tiles(
+		Scratch& scratch, ExrCompression compression, Header::LevelMode mode,
+		bool round_up, size_t tw, size_t th, int min_x, int min_y,
+		size_t w, size_t h
+	)
+	{
+		Header header;
+		for (size_t c = 0; c < CHANNELS; ++c)
+			header.channels.push_back(ExrChannel(NAMES[c], TYPES[c]));
+		std::sort(header.channels.begin(), header.channels.end(),
+			exr_detail::by_name);
+		header.compression = compression;
+		header.min_x = min_x;
+		header.min_y = min_y;
+		header.max_x = min_x + static_cast<int>(w) - 1;
+		header.max_y = min_y + static_cast<int>(h) - 1;
+
+		const std::string path = scratch.file("header.exr");
+		FILE* f = std::fopen(path.c_str(), "wb");
+		exr_detail::write_header(f, header);
+		std::fclose(f);
+		const std::string scanline = Scratch::bytes(path);
+		std::vector<unsigned char> out(scanline.begin(), scanline.end() - 1);
+		out[5] |= 0x02;
+		unsigned char tiles[9];
+		exr_detail::put32(tiles, static_cast<unsigned int>(tw));
+		exr_detail::put32(tiles + 4, static_cast<unsigned int>(th));
+		tiles[8] = static_cast<unsigned char>(mode | (round_up ? 0x10 : 0));
+		exr_detail::attribute(out, "tiles", "tiledesc", tiles, 9);
+		out.push_back(0);
+
+		header.tiled = true;
+		header.tile_width = tw;
+		header.tile_height = th;
+		header.level_mode = mode;
+		header.round_up = round_up;
+		const size_t table = out.size();
+		out.resize(table + 8 * header.chunks());
+
+		for (int ly = 0; ly < header.levels_y(); ++ly)
+			for (int lx = 0; lx < header.levels_x(); ++lx) {
+				if (mode != Header::RIPMAP && lx != ly)
+					continue;
+				const size_t lw = header.level_width(lx);
+				const size_t lh = header.level_height(ly);
+				Frame frame(lw, lh);
+				frame.fill(lx, ly);
+				const ExrFrameBuffer fb = frame.frame_buffer();
+				std::vector<const ExrSlice*> sources;
+				for (size_t c = 0; c < header.channels.size(); ++c)
+					for (size_t s = 0; s < fb.size(); ++s)
+						if (fb[s].name == header.channels[c].name)
+							sources.push_back(&fb[s]);
+
+				for (size_t ty = 0; ty < header.tiles_y(ly); ++ty)
+					for (size_t tx = 0; tx < header.tiles_x(lx); ++tx) {
+						exr_detail::Block b;
+						b.x0 = static_cast<int>(tx * tw);
+						b.y0 = static_cast<int>(ty * th);
+						b.x1 = static_cast<int>(std::min((tx + 1) * tw, lw)) - 1;
+						b.y1 = static_cast<int>(std::min((ty + 1) * th, lh)) - 1;
+						std::vector<unsigned char> raw(exr_detail::block_size(
+							header, b.x0, b.y0, b.x1, b.y1));
+						// rows of the frame from b.x0: the sources moved
+						// there
+						std::vector<ExrSlice> moved(sources.size());
+						std::vector<const ExrSlice*> at(sources.size());
+						for (size_t c = 0; c < sources.size(); ++c) {
+							moved[c] = *sources[c];
+							moved[c].base += b.x0 * moved[c].x_stride;
+							at[c] = &moved[c];
+						}
+						exr_detail::pack_block(header, b, at, 0, &raw[0]);
+						exr_detail::compress(header, b, &raw[0], raw.size(),
+							b.data);
+
+						const size_t i = header.first_tile(lx, ly) +
+							ty * header.tiles_x(lx) + tx;
+						exr_detail::put64(&out[table + 8 * i], out.size());
+						exr_detail::append32(out, static_cast<unsigned int>(tx));
+						exr_detail::append32(out, static_cast<unsigned int>(ty));
+						exr_detail::append32(out, static_cast<unsigned int>(lx));
+						exr_detail::append32(out, static_cast<unsigned int>(ly));
+						exr_detail::append32(out,
+							static_cast<unsigned int>(b.data.size()));
+						out.insert(out.end(), b.data.begin(), b.data.end());
+					}
+			}
+		return std::string(out.begin(), out.end());
+	}
+
+	bool check_tiled(Scratch& scratch, const char* what,
+		ExrCompression compression, Header::LevelMode mode, bool round_up,
+		size_t tw, size_t th, int min_x, int min_y, size_t w, size_t h)
+	{
+		const std::string file = write_tiles(scratch, compression, mode,
+			round_up, tw, th, min_x, min_y, w, h);
+		const std::string path = scratch.file("tiled.exr", file);
+		FILE* f = std::fopen(path.c_str(), "rb");
+		bool ok = true;
+		int levels = 0;
+		try {
+			ExrReader exr(Execution(Execution::THREAD_POOL, 4));
+			exr.open(f);
+			ok = exr.tiled() && exr.origin_x() == min_x &&
+				exr.origin_y() == min_y && exr.width() == w && exr.height() == h;
+			for (int ly = 0; ly < exr.levels_y(); ++ly)
+				for (int lx = 0; lx < exr.levels_x(); ++lx) {
+					if (mode != Header::RIPMAP && lx != ly) {
+						bool refused = false;
+						try {
+							exr.level(lx, ly);
+						} catch (const std::out_of_range&) {
+							refused = true;
+						}
+						ok = ok && refused;
+						continue;
+					}
+					exr.level(lx, ly);
+					Frame frame(0, 0);
+					frame.read(exr);
+					ok = ok && holds(frame, lx, ly, exr.width(),
+						Box(0, 0, exr.width(), exr.height()), compression) &&
+						check_regions(exr, lx, ly);
+					++levels;
+				}
+			exr.close();
+		} catch (const std::exception& e) {
+			std::printf("%s: %s\n", what, e.what());
+			ok = false;
+		}
+		std::fclose(f);
+
+		// the last tile of level 0 broken, the first one read
+		const size_t tiles = ((w + tw - 1) / tw) * ((h + th - 1) / th);
+		ok = ok && (tiles < 2 ||
+			check_untouched(scratch, file, tiles - 1, Box(0, 0, tw, th)));
+		std::printf("%s, %d levels: %s\n", what, levels, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	bool check_tiles(Scratch& scratch)
+	{
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(WRITTEN) / sizeof(WRITTEN[0]); ++i) {
+			const ExrCompression c = WRITTEN[i];
+			if (!exr_readable(c))
+				continue;
+			std::printf("%s\n", exr_detail::compression_name(c));
+			ok = check_tiled(scratch, "one level", c, Header::ONE_LEVEL,
+				false, 16, 16, 0, 0, 70, 45) && ok;
+			ok = check_tiled(scratch, "one level off the origin", c,
+				Header::ONE_LEVEL, false, 32, 8, -7, 13, 61, 40) && ok;
+			ok = check_tiled(scratch, "mip map", c, Header::MIPMAP,
+				false, 16, 16, 3, -2, 77, 50) && ok;
+			ok = check_tiled(scratch, "mip map rounded up", c, Header::MIPMAP,
+				true, 8, 12, 0, 0, 77, 50) && ok;
+			ok = check_tiled(scratch, "rip map", c, Header::RIPMAP,
+				false, 16, 8, -5, 5, 66, 41) && ok;
+			ok = check_tiled(scratch, "rip map rounded up", c, Header::RIPMAP,
+				true, 10, 10, 0, 0, 33, 65) && ok;
+		}
+		return report("tiled files read", ok);
+	}
+
+	// the line blocks after the first, broken, with a region in the first
+	bool check_blocks(Scratch& scratch)
+	{
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(WRITTEN) / sizeof(WRITTEN[0]); ++i) {
+			const ExrCompression c = WRITTEN[i];
+			if (!exr_writable(c))
+				continue;
+			const size_t lines = exr_block_lines(c);
+			const std::string file = write_scanlines(
+				scratch, "blocks.exr", c, 40, 64, 1);
+			const size_t last = 64 / lines - 1;
+			ok = check_untouched(scratch, file, last,
+				Box(3, 0, 30, lines)) && ok;
+		}
+		return report("regions decode only their line blocks", ok);
+	}
+
+	bool check_refused(Scratch& scratch)
+	{
+		const std::string good = write_scanlines(
+			scratch, "refused.exr", EXR_NONE, 20, 20, 1);
+		const std::string key("compression\0compression\0", 24);
+		const size_t at = good.find(key) + key.size() + 4;
+
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(REFUSED) / sizeof(REFUSED[0]); ++i) {
+			const ExrCompression c = REFUSED[i];
+			const std::string name = exr_detail::compression_name(c);
+			bool made = false, changed = false;
+			try {
+				ExrWriter writer(c);
+				made = true;
+			} catch (const std::invalid_argument&) {
+				// refused
+			}
+			ExrWriter writer(EXR_NONE);
+			try {
+				writer.compression(c);
+			} catch (const std::invalid_argument& e) {
+				changed = std::string(e.what()).find(name) == std::string::npos;
+			}
+			changed = changed || writer.compression() != EXR_NONE;
+
+			std::string bytes = good;
+			bytes[at] = static_cast<char>(c);
+			const std::string path = scratch.file("refused.exr", bytes);
+			FILE* f = std::fopen(path.c_str(), "rb");
+			bool opened = true;
+			try {
+				ExrReader exr;
+				exr.open(f);
+			} catch (const InvalidFormat& e) {
+				opened = std::string(e.what()).find(name) == std::string::npos;
+			}
+			std::fclose(f);
+
+			const bool refused = !made && !changed && !opened &&
+				!exr_writable(c) && !exr_readable(c);
+			std::printf("%s: %s\n", name.c_str(),
+				refused ? "refused" : "not refused");
+			ok = ok && refused;
+		}
+#ifndef GIL_ZLIB
+		bool zip = false;
+		try {
+			ExrWriter writer(EXR_ZIP);
+		} catch (const std::invalid_argument&) {
+			zip = true;
+		}
+		ok = ok && zip;
+#endif
+		return report("other compressions refused", ok);
+	}
+
+	// a frame of one value per channel: B44A stores its blocks in 3
+	// bytes where B44 takes 14, and both exactly
+	bool check_flat(Scratch& scratch)
+	{
+		Frame frame(64, 64);
+		for (size_t y = 0; y < 64; ++y)
+			for (size_t x = 0; x < 64; ++x) {
+				frame.rgb(x, y) = Half3(Half(1.5f), Half(-0.25f), Half(3000.0f));
+				frame.z(x, y) = 7.0f;
+				frame.id(x, y) = 42;
+			}
+		bool ok = true;
+		size_t sizes[2];
+		const ExrCompression b44[] = { EXR_B44, EXR_B44A };
+		for (size_t i = 0; i < 2; ++i) {
+			const std::string file =
+				write_frame(scratch, "flat.exr", b44[i], frame, 1);
+			sizes[i] = file.size();
+			FILE* f = std::fopen(scratch.file("flat.exr").c_str(), "rb");
+			ExrReader exr;
+			exr.open(f);
+			Frame read(0, 0);
+			read.read(exr);
+			std::fclose(f);
+			for (size_t y = 0; ok && y < 64; ++y)
+				for (size_t x = 0; x < 64; ++x)
+					for (size_t c = 0; c < 3; ++c)
+						ok = ok && read.rgb(x, y)[c].bits() ==
+							frame.rgb(x, y)[c].bits();
+		}
+		return report("flat blocks, B44A smaller", ok && sizes[1] < sizes[0]);
+	}
+
+	// a perceptually linear channel: the flag kept by the header, and
+	// its halves through B44 within 1%, a flat block and a ramp
+	bool check_p_linear(Scratch& scratch)
+	{
+		Header header;
+		header.channels.push_back(ExrChannel("Y", ExrChannel::HALF));
+		header.channels.back().p_linear = true;
+		header.compression = EXR_B44;
+		header.max_x = 7;
+		header.max_y = 3;
+		const std::string path = scratch.file("linear.exr");
+		FILE* f = std::fopen(path.c_str(), "wb");
+		exr_detail::write_header(f, header);
+		std::fclose(f);
+		Header read;
+		f = std::fopen(path.c_str(), "rb");
+		exr_detail::read_header(f, read);
+		std::fclose(f);
+		bool ok = read.channels.size() == 1 && read.channels[0].p_linear;
+
+		exr_detail::Block b;
+		b.x0 = b.y0 = 0;
+		b.x1 = 7;
+		b.y1 = 3;
+		std::vector<float> values;
+		std::vector<unsigned char> raw;
+		for (size_t y = 0; y < 4; ++y)
+			for (size_t x = 0; x < 8; ++x) {
+				values.push_back(x < 4 ? 3.0f : 2.0f + float(x + 4 * y) / 80);
+				raw.push_back(0);
+				raw.push_back(0);
+				exr_detail::put16(&raw[raw.size() - 2],
+					Half::from_float(values.back()));
+			}
+		exr_detail::compress(header, b, &raw[0], raw.size(), b.data);
+		std::vector<unsigned char> out(raw.size());
+		exr_detail::uncompress(header, b, &b.data[0], b.data.size(),
+			&out[0], out.size());
+		ok = ok && b.data.size() < raw.size();
+		for (size_t i = 0; i < values.size(); ++i) {
+			const float v = Half::to_float(static_cast<unsigned short>(
+				exr_detail::get16(&out[2 * i])));
+			ok = ok && std::fabs(v - values[i]) < values[i] / 100;
+		}
+		return report("perceptually linear halves", ok);
+	}
+
+	// floats through the RGBA path come back rounded to halves
+	bool check_rgba(Scratch& scratch)
+	{
+		FloatImage3 image(50, 33);
+		for (size_t y = 0; y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				image(x, y) = Float3(float(x) / 3, float(y) * 1000.1f, -float(x * y));
+		const std::string path = scratch.file("rgba.exr");
+		FILE* f = std::fopen(path.c_str(), "wb");
+		ExrWriter()(image, f);
+		std::fclose(f);
+
+		FloatImage3 out;
+		f = std::fopen(path.c_str(), "rb");
+		ExrReader()(out, f);
+		std::fclose(f);
+		bool ok = out.width() == image.width() && out.height() == image.height();
+		for (size_t y = 0; ok && y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				for (size_t c = 0; c < 3; ++c)
+					ok = ok && out(x, y)[c] == float(Half(image(x, y)[c]));
+		return report("rgb floats through halves", ok);
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	bool ok = check_scanlines(scratch);
+	ok = check_blocks(scratch) && ok;
+	ok = check_tiles(scratch) && ok;
+	ok = check_flat(scratch) && ok;
+	ok = check_p_linear(scratch) && ok;
+	ok = check_refused(scratch) && ok;
+	ok = check_rgba(scratch) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
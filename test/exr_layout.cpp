@@ -0,0 +1,57 @@
+/* exr_layout:
+ *   ExrReader keeps the members of the library's class first, in the
+ *   order the library's compiled init(), read_scanline() and cleanup()
+ *   expect them: two pointers, then the two ints of the data window
+ *   origin. A reader made by the constructor must leave the pointers
+ *   NULL, which cleanup() tests before it frees anything.
+ *
+ *     make test
+ */
+#include <cstddef>
+#include <cstdio>
+#include <new>
+
+#include "gil/core/io/exr.h"
+
+namespace gil {
+
+	// the friend of ExrReader that sees its members
+	struct ExrReaderLayout {
+		static bool check()
+		{
+			// not destroyed: ~ExrReader calls cleanup() in the library,
+			// which the tests do not link
+			void* storage = ::operator new(sizeof(ExrReader));
+			const ExrReader* reader = new (storage) ExrReader();
+			const char* base = reinterpret_cast<const char*>(reader);
+			const std::ptrdiff_t offsets[] = {
+				reinterpret_cast<const char*>(&reader->my_istream) - base,
+				reinterpret_cast<const char*>(&reader->my_input_file) - base,
+				reinterpret_cast<const char*>(&reader->my_min_x) - base,
+				reinterpret_cast<const char*>(&reader->my_min_y) - base
+			};
+			const std::ptrdiff_t expected[] = {
+				0,
+				sizeof(void*),
+				2 * sizeof(void*),
+				2 * sizeof(void*) + sizeof(int)
+			};
+			bool ok = reader->my_istream == NULL && reader->my_input_file == NULL;
+			for (size_t i = 0; i < 4; ++i) {
+				std::printf("member %lu at %ld, expected %ld\n", (unsigned long)i,
+					(long)offsets[i], (long)expected[i]);
+				ok = ok && offsets[i] == expected[i];
+			}
+			::operator delete(storage);
+			return ok;
+		}
+	};
+
+} // namespace gil
+
+int main()
+{
+	const bool ok = gil::ExrReaderLayout::check();
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+/* gaussian_accuracy:
+ *   the recursive Gaussian (RecursiveGaussian) against the FIR path
+ *   (SeparableConvolution with a GaussianKernel) on a synthetic HDR
+ *   image whose values span more than 1e5: a dim gradient, mid-level
+ *   texture and a few bright sources. Both are measured against a double
+ *   precision FIR of radius 6 sigma, which stands in for the exact
+ *   Gaussian.
+ *
+ *   Errors are per pixel, relative to the exact value, or to FLOOR times
+ *   the brightest exact value where that is larger: the recursion is
+ *   accurate to about 1e-4 of the peak along each axis, and its ripple
+ *   is all there is further out. The FIR kernel stops at 3 sigma and
+ *   misses the tails of the bright sources altogether, an error of
+ *   nearly 1 in the pixels around them.
+ *
+ *   The bound on the recursive path comes from its kernel: with D the
+ *   largest difference between a tap of the 2D recursive kernel
+ *   (the response to an impulse, normalized to a sum of 1) and of the
+ *   Gaussian, no pixel of a channel can be further from the exact
+ *   value than D times the sum of that channel over the image. D is
+ *   under 1e-3 of the peak tap of the Gaussian.
+ *
+ *   For the sigmas GaussianFilter filters recursively, the test fails
+ *   if a pixel of the recursive path is outside that bound, or if the
+ *   path is further from the exact Gaussian than the FIR path is.
+ *   GaussianFilter must give the FIR result just below
+ *   GIL_RECURSIVE_GAUSSIAN_SIGMA and the recursive one from there up.
+ *
+ *     make test
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "gil/core/Image.h"
+#include "gil/dip/GaussianFilter.h"
+
+using namespace gil;
+
+namespace {
+
+	const double FLOOR = 2e-4;
+
+	// a deterministic HDR scene of w x h pixels, values 1e-2 to 5e4
+	FloatImage3 scene(size_t w, size_t h)
+	{
+		FloatImage3 image(w, h);
+		unsigned int seed = 12345;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x) {
+				seed = seed * 1103515245u + 12345u;
+				const float noise =
+					static_cast<float>((seed >> 16) & 0x7fff) / 32768.0f;
+				const float base = 0.01f + 0.05f * x / w;
+				const float texture = ((x / 8 + y / 8) % 2) ? 2.0f * noise : 0.0f;
+				image(x, y) = Float3(base + texture, base, base + 0.5f * texture);
+			}
+
+		// sources of various sizes, one touching a border
+		const size_t spots[][3] = {
+			{ w / 4, h / 3, 1 }, { w / 2, h / 2, 4 }, { 3 * w / 4, h / 5, 2 },
+			{ w - 2, h - 3, 3 }, { 0, h / 2, 1 }
+		};
+		for (size_t s = 0; s < sizeof(spots) / sizeof(spots[0]); ++s)
+			for (size_t dy = 0; dy < spots[s][2]; ++dy)
+				for (size_t dx = 0; dx < spots[s][2]; ++dx) {
+					const size_t x = std::min(spots[s][0] + dx, w - 1);
+					const size_t y = std::min(spots[s][1] + dy, h - 1);
+					image(x, y) = Float3(5e4f, 2e4f, 1e4f * (s + 1));
+				}
+		return image;
+	}
+
+	// one axis of a double precision Gaussian of radius 6 sigma, zero
+	// outside and renormalized at the borders, like both engines
+	void reference_line(
+		double* out, const double* in, size_t n, size_t stride, double sigma
+	)
+	{
+		const int radius = static_cast<int>(std::ceil(6 * sigma));
+		std::vector<double> taps(2 * radius + 1);
+		for (int i = -radius; i <= radius; ++i)
+			taps[i + radius] = std::exp(-(i * i) / (2 * sigma * sigma));
+		for (size_t p = 0; p < n; ++p) {
+			double sum = 0.0, weight = 0.0;
+			for (int i = -radius; i <= radius; ++i) {
+				const long q = static_cast<long>(p) + i;
+				if (q < 0 || q >= static_cast<long>(n))
+					continue;
+				sum += taps[i + radius] * in[q * stride];
+				weight += taps[i + radius];
+			}
+			out[p * stride] = sum / weight;
+		}
+	}
+
+	std::vector<double> reference(const FloatImage3& src, double sigma)
+	{
+		const size_t w = src.width(), h = src.height();
+		std::vector<double> a(w * h * 3), b(w * h * 3);
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				for (size_t c = 0; c < 3; ++c)
+					a[(y * w + x) * 3 + c] = src(x, y)[c];
+		for (size_t y = 0; y < h; ++y)
+			for (size_t c = 0; c < 3; ++c)
+				reference_line(&b[y * w * 3 + c], &a[y * w * 3 + c], w, 3, sigma);
+		for (size_t x = 0; x < w; ++x)
+			for (size_t c = 0; c < 3; ++c)
+				reference_line(&a[x * 3 + c], &b[x * 3 + c], h, w * 3, sigma);
+		return a;
+	}
+
+	FloatImage3 fir(const FloatImage3& src, float sigma)
+	{
+		const GaussianKernel<float> kernel(sigma);
+		const LineWeights xw = LineWeights::create<float>(kernel, src.width());
+		const LineWeights yw = LineWeights::create<float>(kernel, src.height());
+		FloatImage3 dst(src.width(), src.height());
+		convolve_bands(
+			SeparableConvolution<FloatImage3, FloatImage3>(xw, yw), dst, src,
+			Execution::global()
+		);
+		return dst;
+	}
+
+	FloatImage3 recursive(const FloatImage3& src, float sigma)
+	{
+		FloatImage3 dst;
+		RecursiveGaussian<FloatImage3, FloatImage3>(sigma, sigma)(dst, src);
+		return dst;
+	}
+
+	// the largest difference between a tap of the 2D kernel of the
+	// recursive filter and of the Gaussian, both of sum 1
+	double kernel_error(double sigma)
+	{
+		const size_t n = 2 * static_cast<size_t>(std::ceil(12 * sigma)) + 1;
+		std::vector<double> impulse(n), h(n), g(n);
+		std::vector<double> work(RecursiveGaussianLine::work_size(n, 1));
+		impulse[n / 2] = 1.0;
+		const RecursiveGaussianLine line(sigma);
+		line(&h[0], &impulse[0], n, 1, &work[0]);
+
+		double hsum = 0.0, gsum = 0.0;
+		for (size_t i = 0; i < n; ++i) {
+			const double d = static_cast<double>(i) - static_cast<double>(n / 2);
+			g[i] = std::exp(-d * d / (2 * sigma * sigma));
+			hsum += h[i];
+			gsum += g[i];
+		}
+		double e = 0.0;
+		for (size_t i = 0; i < n; ++i)
+			for (size_t j = 0; j < n; ++j)
+				e = std::max(e, std::fabs(
+					h[i] * h[j] / (hsum * hsum) - g[i] * g[j] / (gsum * gsum)
+				));
+		return e;
+	}
+
+	// the largest difference per pixel over its bound, D times the sum of
+	// its channel in src, see kernel_error
+	double bounded(
+		const FloatImage3& a, const std::vector<double>& b,
+		const FloatImage3& src, double sigma
+	)
+	{
+		const double d = kernel_error(sigma);
+		double sum[3] = { 0.0, 0.0, 0.0 };
+		for (size_t y = 0; y < src.height(); ++y)
+			for (size_t x = 0; x < src.width(); ++x)
+				for (size_t c = 0; c < 3; ++c)
+					sum[c] += std::fabs(src(x, y)[c]);
+
+		double e = 0.0;
+		for (size_t y = 0; y < a.height(); ++y)
+			for (size_t x = 0; x < a.width(); ++x)
+				for (size_t c = 0; c < 3; ++c) {
+					const double v = b[(y * a.width() + x) * 3 + c];
+					e = std::max(e, std::fabs(a(x, y)[c] - v) / (d * sum[c]));
+				}
+		return e;
+	}
+
+	// the largest difference per pixel, relative to the value of b or
+	// FLOOR times the largest value of b, whichever is larger
+	double error(const FloatImage3& a, const std::vector<double>& b)
+	{
+		double peak = 0.0;
+		for (size_t i = 0; i < b.size(); ++i)
+			peak = std::max(peak, std::fabs(b[i]));
+		const double least = FLOOR * peak;
+
+		double e = 0.0;
+		for (size_t y = 0; y < a.height(); ++y)
+			for (size_t x = 0; x < a.width(); ++x)
+				for (size_t c = 0; c < 3; ++c) {
+					const double v = b[(y * a.width() + x) * 3 + c];
+					const double d = std::fabs(a(x, y)[c] - v);
+					e = std::max(e, d / std::max(std::fabs(v), least));
+				}
+		return e;
+	}
+
+	// true if a and b hold the same pixels
+	bool same(const FloatImage3& a, const FloatImage3& b)
+	{
+		if (a.width() != b.width() || a.height() != b.height())
+			return false;
+		for (size_t y = 0; y < a.height(); ++y)
+			for (size_t x = 0; x < a.width(); ++x)
+				for (size_t c = 0; c < 3; ++c)
+					if (a(x, y)[c] != b(x, y)[c])
+						return false;
+		return true;
+	}
+
+	// GaussianFilter gives the FIR result below the threshold and the
+	// recursive one from it up
+	bool check_switch(const FloatImage3& src)
+	{
+		const float threshold = GIL_RECURSIVE_GAUSSIAN_SIGMA;
+		const float sigmas[] = { threshold - 0.5f, threshold, threshold + 0.5f };
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(sigmas) / sizeof(sigmas[0]); ++i) {
+			FloatImage3 dst;
+			GaussianFilter<FloatImage3, float>(sigmas[i], sigmas[i])(dst, src);
+			const bool recursive_path = sigmas[i] >= threshold;
+			const bool match = recursive_path ?
+				same(dst, recursive(src, sigmas[i])) :
+				same(dst, fir(src, sigmas[i]));
+			std::printf("GaussianFilter sigma %g: %s path %s\n", sigmas[i],
+				recursive_path ? "recursive" : "FIR", match ? "ok" : "FAILED");
+			ok = ok && match;
+		}
+		return ok;
+	}
+
+} // namespace
+
+int main()
+{
+	const FloatImage3 src = scene(320, 240);
+	float lo = 1e30f, hi = 0.0f;
+	for (size_t y = 0; y < src.height(); ++y)
+		for (size_t x = 0; x < src.width(); ++x)
+			for (size_t c = 0; c < 3; ++c) {
+				lo = std::min(lo, src(x, y)[c]);
+				hi = std::max(hi, src(x, y)[c]);
+			}
+	std::printf("dynamic range %.3g\n", hi / lo);
+	std::printf("%6s %14s %14s %14s\n",
+		"sigma", "recursive-ref", "fir-ref", "of bound");
+
+	const float sigmas[] = { 2, 5, 10, 20, 40 };
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(sigmas) / sizeof(sigmas[0]); ++i) {
+		const std::vector<double> ref = reference(src, sigmas[i]);
+		const FloatImage3 a = recursive(src, sigmas[i]);
+		const double ar = error(a, ref);
+		const double br = error(fir(src, sigmas[i]), ref);
+		const double of = bounded(a, ref, src, sigmas[i]);
+		const bool used = sigmas[i] >= GIL_RECURSIVE_GAUSSIAN_SIGMA;
+		std::printf("%6g %14.3g %14.3g %14.3g%s\n", sigmas[i], ar, br, of,
+			used ? "" : "  (FIR in GaussianFilter)");
+		if (used)
+			ok = ok && of <= 1.0 && ar <= br;
+	}
+	ok = check_switch(src) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,201 @@
+/* half:
+ *   Half against F16C, exhaustively: each of the 65536 halves must widen
+ *   to the float _cvtsh_ss gives, and each of the 2^32 floats, NaNs,
+ *   infinities and denormals among them, must round to the half
+ *   _cvtss_sh gives, bit for bit. The row converters, which use F16C
+ *   themselves when it is enabled, must agree with Half on rows of
+ *   every length. Built without F16C, or run on a CPU without it, only
+ *   the row converters against Half are checked.
+ *
+ *   Every member of std::numeric_limits<Half> must describe binary16.
+ *
+ *     make test
+ */
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "gil/core/Converter.h"
+#include "gil/core/Half.h"
+#include "gil/core/Parallel.h"
+#include "gil/core/Simd.h"
+
+using namespace gil;
+
+namespace {
+
+	unsigned int bits_of(float f)
+	{
+		unsigned int x;
+		std::memcpy(&x, &f, sizeof(x));
+		return x;
+	}
+
+	float float_of(unsigned int x)
+	{
+		float f;
+		std::memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+
+	bool report(const char* what, bool ok)
+	{
+		std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	bool check_limits()
+	{
+		typedef std::numeric_limits<Half> L;
+		const float min = L::min(), max = L::max();
+		bool ok = L::is_specialized && L::is_signed && !L::is_integer &&
+			!L::is_exact && L::has_infinity && L::has_quiet_NaN &&
+			L::has_signaling_NaN && L::has_denorm == std::denorm_present &&
+			!L::has_denorm_loss && L::round_style == std::round_to_nearest &&
+			L::is_iec559 && L::is_bounded && !L::is_modulo && !L::traps &&
+			!L::tinyness_before && L::radix == 2 && L::digits == 11;
+
+		// the decimal digits, from the binary ones
+		ok = ok && L::digits10 ==
+			static_cast<int>(std::floor((L::digits - 1) * std::log10(2.0)));
+		ok = ok && L::max_digits10 ==
+			static_cast<int>(std::ceil(1 + L::digits * std::log10(2.0)));
+
+		// the values, and the exponents that bound them
+		ok = ok && min == std::ldexp(1.0f, L::min_exponent - 1);
+		ok = ok && max == 65504.0f && float(L::lowest()) == -max;
+		ok = ok && max < std::ldexp(1.0f, L::max_exponent) &&
+			Half(std::ldexp(1.0f, L::max_exponent)).bits() == 0x7c00;
+		ok = ok && std::pow(10.0, L::min_exponent10) >= min &&
+			std::pow(10.0, L::min_exponent10 - 1) < min;
+		ok = ok && std::pow(10.0, L::max_exponent10) <= max &&
+			std::pow(10.0, L::max_exponent10 + 1) > max;
+		ok = ok && float(L::epsilon()) == std::ldexp(1.0f, 1 - L::digits) &&
+			float(L::round_error()) == 0.5f;
+		ok = ok && float(L::denorm_min()) == std::ldexp(1.0f, -24) &&
+			Half(float(L::denorm_min()) / 2).bits() == 0;
+
+		// special values
+		ok = ok && float(L::infinity()) == std::numeric_limits<float>::infinity();
+		const Half q = L::quiet_NaN(), s = L::signaling_NaN();
+		ok = ok && q.bits() == 0x7e00 && s.bits() != q.bits();
+		ok = ok && (s.bits() & 0x7c00) == 0x7c00 && (s.bits() & 0x3ff) != 0 &&
+			(s.bits() & 0x200) == 0;
+		ok = ok && float(q) != float(q) && float(s) != float(s);
+
+		// ties go to even
+		const float eps = L::epsilon();
+		ok = ok && Half(1 + eps / 2).bits() == Half(1.0f).bits() &&
+			float(Half(1 + 3 * eps / 2)) == 1 + 2 * eps;
+		return report("numeric_limits<Half>", ok);
+	}
+
+	// the row converters against Half, on rows of every length to 40
+	bool check_rows()
+	{
+		std::vector<Half1> halves(65536);
+		for (size_t i = 0; i < halves.size(); ++i)
+			halves[i] = Half::from_bits(static_cast<unsigned short>(i));
+		std::vector<Float1> floats(halves.size());
+		bool ok = true;
+		for (size_t n = 0; n <= 40; ++n) {
+			convert_row(&floats[0], &halves[0], n);
+			for (size_t i = 0; i < n; ++i)
+				ok = ok && bits_of(floats[i]) == bits_of(Half::to_float(halves[i].bits()));
+		}
+		convert_row(&floats[0], &halves[0], halves.size());
+		for (size_t i = 0; i < halves.size(); ++i)
+			ok = ok && bits_of(floats[i]) == bits_of(Half::to_float(halves[i].bits()));
+
+		// floats around every half, and specials
+		std::vector<Float1> in;
+		for (unsigned int h = 0; h < 0x10000; h += 7) {
+			const unsigned int x = bits_of(Half::to_float(static_cast<unsigned short>(h)));
+			in.push_back(float_of(x));
+			in.push_back(float_of(x + 0x1000));		// a tie, for normals
+			in.push_back(float_of(x + 0x1001));
+		}
+		in.push_back(std::numeric_limits<float>::infinity());
+		in.push_back(-std::numeric_limits<float>::infinity());
+		in.push_back(std::numeric_limits<float>::quiet_NaN());
+		in.push_back(float_of(0x7f800001));			// signaling
+		in.push_back(float_of(0xffc12345));
+		in.push_back(std::numeric_limits<float>::max());
+		in.push_back(std::numeric_limits<float>::denorm_min());
+		std::vector<Half1> out(in.size());
+		for (size_t n = 0; n <= 40; ++n) {
+			convert_row(&out[0], &in[in.size() - n], n);
+			for (size_t i = 0; i < n; ++i)
+				ok = ok && out[i].bits() == Half::from_float(in[in.size() - n + i]);
+		}
+		convert_row(&out[0], &in[0], in.size());
+		for (size_t i = 0; i < in.size(); ++i)
+			ok = ok && out[i].bits() == Half::from_float(in[i]);
+		return report("row converters against Half", ok);
+	}
+
+#ifdef GIL_F16C
+	bool check_halves()
+	{
+		size_t wrong = 0;
+		for (unsigned int h = 0; h < 0x10000; ++h) {
+			const float f = Half::to_float(static_cast<unsigned short>(h));
+			wrong += bits_of(f) != bits_of(_cvtsh_ss(static_cast<unsigned short>(h)));
+		}
+		std::printf("65536 halves to float, %lu differ from F16C\n",
+			(unsigned long)wrong);
+		return report("half to float", wrong == 0);
+	}
+
+	// the floats whose top 16 bits are in [hi0, hi1)
+	struct RoundFloats {
+		explicit RoundFloats(std::vector<size_t>& wrong): wrong(wrong) {}
+
+		void operator ()(size_t hi0, size_t hi1) const
+		{
+			for (size_t hi = hi0; hi < hi1; ++hi) {
+				size_t n = 0;
+				for (unsigned int lo = 0; lo < 0x10000; ++lo) {
+					const float f = float_of(static_cast<unsigned int>(hi << 16) | lo);
+					n += Half::from_float(f) != _cvtss_sh(f, 0);
+				}
+				wrong[hi] = n;
+			}
+		}
+
+		std::vector<size_t>& wrong;
+	};
+
+	bool check_floats()
+	{
+		std::vector<size_t> wrong(0x10000);
+		parallel_for(0, wrong.size(), RoundFloats(wrong));
+		size_t n = 0;
+		for (size_t i = 0; i < wrong.size(); ++i)
+			n += wrong[i];
+		std::printf("2^32 floats to half, %lu differ from F16C\n", (unsigned long)n);
+		return report("float to half", n == 0);
+	}
+#endif
+
+} // namespace
+
+int main()
+{
+	bool ok = check_limits();
+	ok = check_rows() && ok;
+#ifdef GIL_F16C
+	if (__builtin_cpu_supports("f16c")) {
+		ok = check_halves() && ok;
+		ok = check_floats() && ok;
+	} else {
+		std::printf("no F16C on this CPU, not checked against it\n");
+	}
+#else
+	std::printf("built without F16C, not checked against it\n");
+#endif
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,303 @@
+/* hdr_codec:
+ *   The Radiance codec. Every scanline hdr_encode_scanline writes must
+ *   decode to the pixels encoded, and be skipped to the same end, for
+ *   widths flat and RLE, and pixels of runs of every length. HdrWriter
+ *   and HdrReader must round-trip RGBE images, and float images to
+ *   float_to_rgbe and back.
+ *
+ *   The SSE2 row converters must agree with rgbe_to_float and
+ *   float_to_rgbe, bit for bit: on every RGBE pixel, and on floats of
+ *   every exponent, negative, denormal, infinite and NaN among them.
+ *
+ *   Header lines of any length must be read whole, at lengths about the
+ *   512 bytes a line buffer would hold as well.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "gil/core/Image.h"
+#include "gil/core/io/hdr.h"
+#include "scratch.h"
+
+using namespace gil;
+
+namespace {
+
+	unsigned int seed = 12345;
+
+	unsigned int next_random()
+	{
+		seed = seed * 1103515245u + 12345u;
+		return seed >> 8;
+	}
+
+	unsigned int bits_of(float f)
+	{
+		unsigned int x;
+		std::memcpy(&x, &f, sizeof(x));
+		return x;
+	}
+
+	float float_of(unsigned int x)
+	{
+		float f;
+		std::memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+
+	bool report(const char* what, bool ok)
+	{
+		std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	// runs of length 1, 2, ... up to longest, then noise
+	std::vector<Byte4> scanline(size_t width, size_t longest)
+	{
+		std::vector<Byte4> line(width);
+		size_t x = 0;
+		for (size_t run = 1; x < width && run <= longest; ++run) {
+			const Byte4 p = Byte4(Byte1(next_random()), Byte1(next_random()),
+				Byte1(next_random()), Byte1(next_random()));
+			for (size_t i = 0; i < run && x < width; ++i)
+				line[x++] = p;
+		}
+		for (; x < width; ++x)
+			line[x] = Byte4(Byte1(next_random()), Byte1(next_random()),
+				Byte1(next_random()), Byte1(next_random()));
+		return line;
+	}
+
+	bool round_trip(const std::vector<Byte4>& line)
+	{
+		const size_t width = line.size();
+		std::vector<unsigned char> encoded;
+		hdr_encode_scanline(width ? &line[0] : NULL, width, encoded);
+		// a scanline after it, which the decoder must not read
+		encoded.insert(encoded.end(), 64, 0x81);
+
+		const unsigned char *begin = encoded.empty() ? NULL : &encoded[0];
+		const unsigned char *end = begin + encoded.size();
+		std::vector<Byte4> decoded(width + 1);
+		std::vector<unsigned char> planes(4 * width + 1);
+		const unsigned char *stop = hdr_decode_scanline(
+			begin, end, &decoded[0], width, &planes[0]);
+		bool ok = stop == end - 64 && hdr_skip_scanline(begin, end, width) == stop;
+		for (size_t x = 0; ok && x < width; ++x)
+			ok = std::memcmp(&decoded[x], &line[x], 4) == 0;
+		return ok;
+	}
+
+	bool check_scanlines()
+	{
+		const size_t widths[] = {
+			0, 1, 7, 8, 9, 15, 16, 17, 31, 127, 128, 129, 255, 256, 300,
+			1000, 4096, 0x7fff, 0x8000
+		};
+		const size_t longest[] = { 0, 1, 3, 4, 5, 127, 128, 129, 300, 0x8000 };
+		bool ok = true;
+		for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w)
+			for (size_t l = 0; l < sizeof(longest) / sizeof(longest[0]); ++l) {
+				const bool same = round_trip(scanline(widths[w], longest[l]));
+				if (!same)
+					std::printf("width %lu, runs to %lu: decoded wrong\n",
+						(unsigned long)widths[w], (unsigned long)longest[l]);
+				ok = ok && same;
+			}
+
+		// flat, as a single pixel repeated
+		ok = ok && round_trip(std::vector<Byte4>(5000, Byte4(1, 2, 3, 128)));
+		return report("scanlines encoded and decoded", ok);
+	}
+
+	ByteImage4 rgbe_frame(size_t w, size_t h)
+	{
+		ByteImage4 image(w, h);
+		for (size_t y = 0; y < h; ++y) {
+			const std::vector<Byte4> line = scanline(w, y % 40);
+			for (size_t x = 0; x < w; ++x)
+				image(x, y) = line[x];
+		}
+		return image;
+	}
+
+	bool check_files(Scratch& scratch)
+	{
+		const std::string name = scratch.file("frame.hdr");
+		const ByteImage4 rgbe = rgbe_frame(333, 77);
+
+		FILE* f = std::fopen(name.c_str(), "wb");
+		HdrWriter().write_rgbe(rgbe, f);
+		std::fclose(f);
+		ByteImage4 read_back;
+		f = std::fopen(name.c_str(), "rb");
+		HdrReader().read_rgbe(read_back, f);
+		std::fclose(f);
+		bool ok = read_back.width() == rgbe.width() &&
+			read_back.height() == rgbe.height();
+		for (size_t y = 0; ok && y < rgbe.height(); ++y)
+			for (size_t x = 0; x < rgbe.width(); ++x)
+				ok = ok && std::memcmp(&read_back(x, y), &rgbe(x, y), 4) == 0;
+		ok = report("rgbe written and read", ok);
+
+		// floats, which must come back as RGBE of them decodes
+		FloatImage3 image(200, 31);
+		for (size_t y = 0; y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				image(x, y) = Float3(x < 100 ? 0.5f : float(next_random()) / 1024,
+					float(y) / 8, float(x * y));
+		f = std::fopen(name.c_str(), "wb");
+		HdrWriter()(image, f);
+		std::fclose(f);
+		FloatImage3 floats;
+		f = std::fopen(name.c_str(), "rb");
+		HdrReader()(floats, f);
+		std::fclose(f);
+		bool same = floats.width() == image.width() &&
+			floats.height() == image.height();
+		for (size_t y = 0; same && y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x) {
+				const Float3 expected = rgbe_to_float(float_to_rgbe(image(x, y)));
+				for (size_t c = 0; c < 3; ++c)
+					same = same && floats(x, y)[c] == expected[c];
+			}
+		return report("floats written and read", same) && ok;
+	}
+
+	bool check_to_float()
+	{
+		// every pixel, the mantissas cycled through the exponents
+		std::vector<Byte4> in;
+		for (unsigned int e = 0; e < 256; ++e)
+			for (unsigned int m = 0; m < 256; ++m)
+				in.push_back(Byte4(Byte1(m), Byte1(255 - m), Byte1(m * 7), Byte1(e)));
+		std::vector<Float3> out(in.size());
+		bool ok = true;
+		for (size_t n = 0; n <= 20; ++n) {
+			convert_row<RgbeConverter>(&out[0], &in[in.size() - n], n);
+			for (size_t i = 0; i < n; ++i) {
+				const Float3 f = rgbe_to_float(in[in.size() - n + i]);
+				for (size_t c = 0; c < 3; ++c)
+					ok = ok && bits_of(out[i][c]) == bits_of(f[c]);
+			}
+		}
+		convert_row<RgbeConverter>(&out[0], &in[0], in.size());
+		for (size_t i = 0; i < in.size(); ++i) {
+			const Float3 f = rgbe_to_float(in[i]);
+			for (size_t c = 0; c < 3; ++c)
+				ok = ok && bits_of(out[i][c]) == bits_of(f[c]);
+		}
+		return report("rgbe to float, rows against rgbe_to_float", ok);
+	}
+
+	bool check_to_rgbe()
+	{
+		// floats of every exponent and sign, and specials
+		std::vector<float> channels;
+		for (unsigned int e = 0; e < 256; ++e)
+			for (unsigned int i = 0; i < 24; ++i)
+				channels.push_back(float_of((i % 2 << 31) | (e << 23) |
+					(next_random() & 0x7fffff)));
+		channels.push_back(std::numeric_limits<float>::infinity());
+		channels.push_back(-std::numeric_limits<float>::infinity());
+		channels.push_back(std::numeric_limits<float>::quiet_NaN());
+		channels.push_back(float_of(0xffc12345));
+		channels.push_back(std::numeric_limits<float>::max());
+		channels.push_back(std::numeric_limits<float>::denorm_min());
+		channels.push_back(1.7014117e38f);
+		channels.push_back(1e-32f);
+		channels.push_back(0.0f);
+		channels.push_back(-0.0f);
+
+		// each as every channel, next to others of every kind
+		std::vector<Float3> in;
+		for (size_t i = 0; i < channels.size(); ++i)
+			for (size_t c = 0; c < 3; ++c) {
+				Float3 p(channels[next_random() % channels.size()],
+					channels[next_random() % channels.size()],
+					channels[next_random() % channels.size()]);
+				p[c] = channels[i];
+				in.push_back(p);
+				p[(c + 1) % 3] = 0.0f;
+				in.push_back(p);
+			}
+
+		std::vector<Byte4> out(in.size());
+		bool ok = true;
+		for (size_t n = 0; n <= 20; ++n) {
+			convert_row<RgbeConverter>(&out[0], &in[in.size() - n], n);
+			for (size_t i = 0; i < n; ++i) {
+				const Byte4 b = float_to_rgbe(in[in.size() - n + i]);
+				ok = ok && std::memcmp(&out[i], &b, 4) == 0;
+			}
+		}
+		convert_row<RgbeConverter>(&out[0], &in[0], in.size());
+		size_t wrong = 0;
+		for (size_t i = 0; i < in.size(); ++i) {
+			const Byte4 b = float_to_rgbe(in[i]);
+			wrong += std::memcmp(&out[i], &b, 4) != 0;
+		}
+		std::printf("%lu pixels to rgbe, %lu differ from float_to_rgbe\n",
+			(unsigned long)in.size(), (unsigned long)wrong);
+		return report("float to rgbe, rows against float_to_rgbe",
+			ok && wrong == 0);
+	}
+
+	// a file whose header has a comment and a variable of length bytes
+	bool check_long_line(Scratch& scratch, size_t length)
+	{
+		const ByteImage4 rgbe = rgbe_frame(40, 3);
+		std::string header = "#?RADIANCE\n# " + std::string(length, 'c') + "\n";
+		header += "EXPOSURE=" + std::string(length, '1') + "\n";
+		header += "FORMAT=32-bit_rle_rgbe\n\n-Y 3 +X 40\n";
+		std::vector<unsigned char> data;
+		for (size_t y = 0; y < rgbe.height(); ++y)
+			hdr_encode_scanline(&rgbe(0, y), rgbe.width(), data);
+		const std::string name = scratch.file("long.hdr",
+			header + std::string(data.begin(), data.end()));
+
+		FILE* f = std::fopen(name.c_str(), "rb");
+		ByteImage4 image;
+		bool ok = true;
+		try {
+			HdrReader().read_rgbe(image, f);
+		} catch (const std::exception& e) {
+			std::printf("line of %lu: %s\n", (unsigned long)length, e.what());
+			ok = false;
+		}
+		std::fclose(f);
+		ok = ok && image.width() == rgbe.width() &&
+			image.height() == rgbe.height();
+		for (size_t y = 0; ok && y < rgbe.height(); ++y)
+			for (size_t x = 0; x < rgbe.width(); ++x)
+				ok = ok && std::memcmp(&image(x, y), &rgbe(x, y), 4) == 0;
+		return ok;
+	}
+
+	bool check_long_lines(Scratch& scratch)
+	{
+		const size_t lengths[] = { 0, 500, 507, 508, 509, 510, 511, 1020, 100000 };
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+			ok = check_long_line(scratch, lengths[i]) && ok;
+		return report("long header lines", ok);
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	bool ok = check_scanlines();
+	ok = check_files(scratch) && ok;
+	ok = check_to_float() && ok;
+	ok = check_to_rgbe() && ok;
+	ok = check_long_lines(scratch) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+/* hdr_index:
+ *   HdrReader with a sidecar index. Two files of the same size and the
+ *   same number of scanlines, whose scanlines start at other offsets,
+ *   are written in turn under one name: the sidecar of the first must
+ *   not be taken for the second. A sidecar forged with the fingerprint of
+ *   the second file and the offsets of the first must be found stale
+ *   and built again rather than throw. The sidecar is for the next
+ *   read only: a later read without one must leave it alone.
+ *
+ *   The fingerprint samples large files only. Two tall files that differ
+ *   in two scanlines swapped between the samples share it, so the second
+ *   takes the sidecar of the first, and must find it stale at those
+ *   scanlines, far below the first band of rows decoded, and still
+ *   decode right.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <string>
+
+#include "gil/core/Image.h"
+#include "gil/core/io/hdr.h"
+#include "scratch.h"
+
+using namespace gil;
+
+namespace {
+
+	const size_t WIDTH = 64;
+
+	// a flat scanline and a noisy one, in the order given
+	ByteImage4 frame(bool flat_first)
+	{
+		ByteImage4 image(WIDTH, 2);
+		unsigned int seed = 12345;
+		for (size_t x = 0; x < WIDTH; ++x) {
+			image(x, flat_first ? 0 : 1) = Byte4(40, 80, 120, 130);
+			Byte4 noise;
+			for (size_t c = 0; c < 4; ++c) {
+				seed = seed * 1103515245u + 12345u;
+				noise[c] = static_cast<Byte1>(seed >> 16);
+			}
+			noise[3] = static_cast<Byte1>(120 + noise[3] % 16);
+			image(x, flat_first ? 1 : 0) = noise;
+		}
+		return image;
+	}
+
+	// flat and noisy scanlines in turn, rows swap and swap + 1 swapped
+	ByteImage4 tall_frame(size_t swap)
+	{
+		const size_t HEIGHT = 3000;
+		ByteImage4 image(WIDTH, HEIGHT);
+		for (size_t y = 0; y < HEIGHT; ++y) {
+			const size_t row = (y == swap) ? y + 1 : (y == swap + 1) ? swap : y;
+			unsigned int seed = static_cast<unsigned int>(y);
+			for (size_t x = 0; x < WIDTH; ++x) {
+				Byte4 p(40, 80, 120, 130);
+				for (size_t c = 0; c < 4 && y % 2; ++c) {
+					seed = seed * 1103515245u + 12345u;
+					p[c] = static_cast<Byte1>(seed >> 16);
+				}
+				if (y % 2)
+					p[3] = static_cast<Byte1>(120 + p[3] % 16);
+				image(x, row) = p;
+			}
+		}
+		return image;
+	}
+
+	bool save(const ByteImage4& image, const std::string& name)
+	{
+		FILE* f = std::fopen(name.c_str(), "wb");
+		if (f == NULL)
+			return false;
+		HdrWriter().write_rgbe(image, f);
+		return std::fclose(f) == 0;
+	}
+
+	// reads name with reader, false if it throws or the pixels differ
+	bool load(HdrReader& reader, const std::string& name,
+		const ByteImage4& expected)
+	{
+		FILE* f = std::fopen(name.c_str(), "rb");
+		if (f == NULL)
+			return false;
+		ByteImage4 image;
+		bool ok = true;
+		try {
+			reader.read_rgbe(image, f);
+		} catch (const std::exception& e) {
+			std::printf("read threw: %s\n", e.what());
+			ok = false;
+		}
+		std::fclose(f);
+		ok = ok && image.width() == expected.width() &&
+			image.height() == expected.height();
+		for (size_t y = 0; ok && y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				for (size_t c = 0; c < 4; ++c)
+					ok = ok && image(x, y)[c] == expected(x, y)[c];
+		return ok;
+	}
+
+	// the scanlines of a file, after its header
+	std::string scanlines(const std::string& name)
+	{
+		FILE* f = std::fopen(name.c_str(), "rb");
+		size_t w, h;
+		hdr_read_header(f, w, h);
+		const long header = std::ftell(f);
+		std::fclose(f);
+		return Scratch::bytes(name).substr(header);
+	}
+
+	const unsigned char* bytes(const std::string& s)
+	{
+		return reinterpret_cast<const unsigned char*>(s.data());
+	}
+
+	bool report(const char* what, bool ok)
+	{
+		std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	const std::string name = scratch.file("frame.hdr");
+	const std::string sidecar = scratch.file("frame.hdr.idx");
+	const ByteImage4 a = frame(true), b = frame(false);
+
+	bool ok = save(a, name);
+	const std::string data_a = scanlines(name);
+	HdrReader reader;
+	reader.index_file(sidecar);
+	ok = report("first file, sidecar built", ok && load(reader, name, a) &&
+		Scratch::exists(sidecar)) && ok;
+
+	// same size, same height, other scanline offsets
+	ok = save(b, name) && ok;
+	const std::string data_b = scanlines(name);
+	ok = report("second file of the same size",
+		data_a.size() == data_b.size() && data_a != data_b) && ok;
+	reader.index_file(sidecar);
+	ok = report("second file, sidecar of the first",
+		load(reader, name, b)) && ok;
+
+	// the fingerprint of the second file, the offsets of the first
+	HdrIndex forged;
+	forged.build(bytes(data_a), data_a.size(), WIDTH, 2);
+	ok = forged.save(sidecar,
+		HdrIndex::fingerprint(bytes(data_b), data_b.size())) && ok;
+	const std::string stale = Scratch::bytes(sidecar);
+	reader.index_file(sidecar);
+	ok = report("forged sidecar, rebuilt", load(reader, name, b) &&
+		Scratch::bytes(sidecar) != stale) && ok;
+
+	// and the sidecar kept, of the right offsets, is loaded as it is
+	const std::string kept = Scratch::bytes(sidecar);
+	reader.index_file(sidecar);
+	ok = report("sidecar reused", load(reader, name, b) &&
+		Scratch::bytes(sidecar) == kept) && ok;
+
+	// a read without index_file() leaves the sidecar alone
+	std::remove(sidecar.c_str());
+	ok = report("sidecar for one read only",
+		load(reader, name, b) && !Scratch::exists(sidecar)) && ok;
+
+	// tall files of one fingerprint, the second stale at rows swapped
+	const ByteImage4 c = tall_frame(size_t(-2));
+	ok = save(c, name) && ok;
+	const std::string data_c = scanlines(name);
+	const unsigned long long key =
+		HdrIndex::fingerprint(bytes(data_c), data_c.size());
+	ByteImage4 d;
+	std::string data_d;
+	for (size_t swap = 2001; swap < 2999 && data_d.empty(); swap += 2) {
+		d = tall_frame(swap);
+		ok = save(d, name) && ok;
+		data_d = scanlines(name);
+		if (HdrIndex::fingerprint(bytes(data_d), data_d.size()) != key)
+			data_d.clear();
+	}
+	ok = report("tall files of one fingerprint",
+		!data_d.empty() && data_c != data_d) && ok;
+	HdrIndex old;
+	old.build(bytes(data_c), data_c.size(), WIDTH, c.height());
+	ok = old.save(sidecar, key) && ok;
+	const std::string old_sidecar = Scratch::bytes(sidecar);
+	reader.index_file(sidecar);
+	ok = report("stale far down, rebuilt", load(reader, name, d) &&
+		Scratch::bytes(sidecar) != old_sidecar) && ok;
+
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
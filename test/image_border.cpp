@@ -0,0 +1,79 @@
+/* image_border:
+ *   the guard pixels of padded images. Every guard pixel of the border
+ *   rows and columns is overwritten, after which the interior must still
+ *   hold its pixels, for various widths, borders and pitches. Rows must
+ *   start on Image::ALIGNMENT.
+ *
+ *     make test
+ */
+#include <cstddef>
+#include <cstdio>
+
+#include "gil/core/Image.h"
+
+using namespace gil;
+
+namespace {
+
+	typedef Image<Float4> Image4;
+
+	Float4 interior(size_t x, size_t y)
+	{
+		return Float4(float(x), float(y), float(x + y), 1.0f);
+	}
+
+	bool same(const Float4& a, const Float4& b)
+	{
+		for (size_t c = 0; c < 4; ++c)
+			if (a[c] != b[c])
+				return false;
+		return true;
+	}
+
+	bool check(size_t w, size_t h, size_t border, size_t pitch)
+	{
+		Image4 image(w, h, border, pitch);
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				image(x, y) = interior(x, y);
+
+		const std::ptrdiff_t b = border;
+		const std::ptrdiff_t right = w + border;
+		const Float4 guard(-9.0f, -9.0f, -9.0f, -9.0f);
+		for (std::ptrdiff_t y = -b; y < static_cast<std::ptrdiff_t>(h) + b; ++y) {
+			Float4* row = image.row(0) + y * static_cast<std::ptrdiff_t>(image.stride());
+			const bool inside = y >= 0 && y < static_cast<std::ptrdiff_t>(h);
+			for (std::ptrdiff_t x = -b; x < right; ++x)
+				if (!inside || x < 0 || x >= static_cast<std::ptrdiff_t>(w))
+					row[x] = guard;
+		}
+
+		bool ok = image.stride() >= w + 2 * border && image.stride() >= pitch;
+		for (size_t y = 0; y < h; ++y) {
+			const std::size_t address = reinterpret_cast<std::size_t>(image.row(y));
+			ok = ok && address % Image4::ALIGNMENT == 0;
+			for (size_t x = 0; x < w; ++x)
+				ok = ok && same(image(x, y), interior(x, y));
+		}
+		if (!ok)
+			std::printf("FAILED: %lu x %lu, border %lu, pitch %lu, stride %lu\n",
+				(unsigned long)w, (unsigned long)h, (unsigned long)border,
+				(unsigned long)pitch, (unsigned long)image.stride());
+		return ok;
+	}
+
+} // namespace
+
+int main()
+{
+	const size_t widths[] = { 1, 3, 15, 16, 17, 64 };
+	const size_t borders[] = { 0, 1, 2, 5 };
+	const size_t pitches[] = { 0, 16, 100 };
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); ++i)
+		for (size_t j = 0; j < sizeof(borders) / sizeof(borders[0]); ++j)
+			for (size_t k = 0; k < sizeof(pitches) / sizeof(pitches[0]); ++k)
+				ok = check(widths[i], 4, borders[j], pitches[k]) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
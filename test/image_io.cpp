@@ -0,0 +1,120 @@
+/* image_io:
+ *   read() and write() by filename close their file whatever the codec
+ *   does. A corrupt file read many times over, through the registry
+ *   and through a reader given by type, must throw every time and leave
+ *   no file open: the lowest free descriptor is the same before and
+ *   after. A write whose data cannot be flushed, to /dev/full, must
+ *   return false rather than true.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <string>
+
+#include <unistd.h>
+
+#include "gil/core/ImageIO.h"
+#include "codec_stubs.h"
+#include "scratch.h"
+
+using namespace gil;
+
+namespace {
+
+	// the descriptor the next file opened gets
+	int next_descriptor()
+	{
+		const int fd = dup(0);
+		close(fd);
+		return fd;
+	}
+
+	// a Radiance header of 16 x 4 pixels, and half a scanline
+	std::string corrupt_hdr()
+	{
+		std::string bytes =
+			"#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 4 +X 16\n";
+		bytes += std::string("\x02\x02\x00\x10\x90\x01", 6);
+		return bytes;
+	}
+
+	template<class Read>
+	bool throws_every_time(const Read& read_file, const char* what)
+	{
+		const int before = next_descriptor();
+		size_t thrown = 0;
+		const size_t TIMES = 200;
+		for (size_t i = 0; i < TIMES; ++i)
+			try {
+				read_file();
+			} catch (const std::exception&) {
+				++thrown;
+			}
+		const int after = next_descriptor();
+		std::printf("%s: %lu of %lu reads threw, descriptor %d before, %d after\n",
+			what, (unsigned long)thrown, (unsigned long)TIMES, before, after);
+		return thrown == TIMES && before == after;
+	}
+
+	struct ReadRegistry {
+		explicit ReadRegistry(const std::string& name): name(name) {}
+		void operator ()() const
+		{
+			FloatImage3 image;
+			read(image, name);
+		}
+		std::string name;
+	};
+
+	struct ReadHdr {
+		explicit ReadHdr(const std::string& name): name(name) {}
+		void operator ()() const
+		{
+			FloatImage3 image;
+			read<HdrReader>(image, name);
+		}
+		std::string name;
+	};
+
+	bool check_reads(Scratch& scratch)
+	{
+		const std::string name = scratch.file("corrupt.hdr", corrupt_hdr());
+		bool ok = throws_every_time(ReadRegistry(name), "read(image, name)");
+		ok = throws_every_time(ReadHdr(name), "read<HdrReader>(image, name)") && ok;
+		return ok;
+	}
+
+	bool check_writes(Scratch& scratch)
+	{
+		if (!Scratch::exists("/dev/full")) {
+			std::printf("no /dev/full, write failures not checked\n");
+			return true;
+		}
+		// the registry picks the writer by extension
+		const std::string name = scratch.file("full.pfm");
+		if (symlink("/dev/full", name.c_str()) != 0) {
+			std::printf("FAILED: cannot link %s\n", name.c_str());
+			return false;
+		}
+		const FloatImage3 image(4, 4);
+		const bool by_registry = write(image, name);
+		const bool by_type = write<PfmWriter>(image, std::string("/dev/full"));
+		std::printf("write to /dev/full: registry %s, PfmWriter %s\n",
+			by_registry ? "true" : "false", by_type ? "true" : "false");
+
+		// and a write that can be flushed still succeeds
+		const bool written = write(image, scratch.file("fine.pfm"));
+		std::printf("write to a file: %s\n", written ? "true" : "false");
+		return !by_registry && !by_type && written;
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	bool ok = check_reads(scratch);
+	ok = check_writes(scratch) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
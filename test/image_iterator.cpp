@@ -0,0 +1,111 @@
+/* image_iterator:
+ *   Image::iterator is a random access iterator over the pixels row by
+ *   row, packed or padded. Every step and jump must land on the pixel
+ *   a pointer into a packed copy would, std::sort and std::reverse must
+ *   work on the pixels and leave the guard pixels of padded images
+ *   alone, and iterators must convert to const_iterators.
+ *
+ *     make test
+ */
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+
+#include "gil/core/Image.h"
+
+using namespace gil;
+
+namespace {
+
+	typedef Image<float> FloatImage;
+
+	// a compile time check of the iterator category
+	template<typename T>
+	bool random_access(std::random_access_iterator_tag)
+	{
+		return true;
+	}
+
+	// pixel i of the image, counted row by row
+	float value(size_t i)
+	{
+		return static_cast<float>((i * 7919) % 1009);
+	}
+
+	bool check(size_t w, size_t h, size_t border, size_t pitch)
+	{
+		FloatImage image(w, h, border, pitch);
+		const size_t n = w * h;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				image(x, y) = value(y * w + x);
+		const float guard = -1.0f;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = w; x < image.stride() - border; ++x)
+				image.row(y)[x] = guard;
+
+		bool ok = random_access<float>(
+			std::iterator_traits<FloatImage::iterator>::iterator_category()
+		);
+		const FloatImage::iterator begin = image.begin(), end = image.end();
+		ok = ok && end - begin == static_cast<std::ptrdiff_t>(n);
+		ok = ok && static_cast<size_t>(std::distance(begin, end)) == n;
+
+		// forward and backward steps, jumps and indexing
+		FloatImage::iterator it = begin;
+		for (size_t i = 0; i < n; ++i, ++it) {
+			ok = ok && *it == value(i) && begin[i] == value(i);
+			ok = ok && *(begin + i) == value(i) && *(end - (n - i)) == value(i);
+			ok = ok && it - begin == static_cast<std::ptrdiff_t>(i);
+			ok = ok && begin + i == it && (i == 0 || begin < it) && it < end;
+		}
+		ok = ok && it == end;
+		for (size_t i = n; i > 0; --i)
+			ok = ok && *--it == value(i - 1);
+		ok = ok && it == begin;
+		for (size_t step = 1; step < n; step += 3) {
+			it = begin;
+			for (size_t i = 0; i + step < n; i += step) {
+				ok = ok && *it == value(i);
+				it += step;
+			}
+		}
+
+		// iterator to const_iterator, and comparisons between them
+		const FloatImage& view = image;
+		FloatImage::const_iterator c = begin;
+		ok = ok && c == view.begin() && view.end() == end && c != end;
+
+		// algorithms that need random access
+		std::sort(image.begin(), image.end());
+		ok = ok && std::adjacent_find(
+			view.begin(), view.end(), std::greater<float>()) == view.end();
+		std::reverse(image.begin(), image.end());
+		ok = ok && std::adjacent_find(
+			view.begin(), view.end(), std::less<float>()) == view.end();
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = w; x < image.stride() - border; ++x)
+				ok = ok && image.row(y)[x] == guard;
+
+		if (!ok)
+			std::printf("FAILED: %lu x %lu, border %lu, pitch %lu\n",
+				(unsigned long)w, (unsigned long)h, (unsigned long)border,
+				(unsigned long)pitch);
+		return ok;
+	}
+
+} // namespace
+
+int main()
+{
+	bool ok = true;
+	ok = check(16, 5, 0, 0) && ok;		// packed
+	ok = check(17, 5, 0, 0) && ok;
+	ok = check(17, 5, 0, 32) && ok;	// padded rows
+	ok = check(3, 7, 2, 0) && ok;
+	ok = check(1, 9, 1, 0) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
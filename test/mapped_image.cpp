@@ -0,0 +1,190 @@
+/* mapped_image:
+ *   MappedImage over PFM files. A file PfmWriter wrote must map to the
+ *   pixels written, top row first. Malformed headers must throw
+ *   InvalidFormat: a bad magic number, sizes that are negative, not
+ *   numbers, or so large that width x height x the pixel size
+ *   overflows, a zero scale, a pixel type of the wrong channels.
+ *   Truncated pixel data must throw EndOfFile. PfmReader must throw on
+ *   the same files, but read the one MappedImage refuses for its type.
+ *
+ *   Headers of any length leave the samples at any address: floats and
+ *   shorts after headers of odd lengths, in either byte order, must
+ *   come out of a copy of their own, aligned and with the values
+ *   written; those after a header of the right length must not.
+ *
+ *     make test
+ */
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "gil/core/Image.h"
+#include "gil/core/MappedImage.h"
+#include "scratch.h"
+
+using namespace gil;
+
+namespace {
+
+	FloatImage3 frame()
+	{
+		FloatImage3 image(13, 7);
+		for (size_t y = 0; y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				image(x, y) = Float3(float(x), float(y), float(x * y) / 8);
+		return image;
+	}
+
+	bool check_good(Scratch& scratch)
+	{
+		const FloatImage3 image = frame();
+		const std::string name = scratch.file("good.pfm");
+		FILE* f = std::fopen(name.c_str(), "wb");
+		bool ok = f != NULL;
+		if (ok) {
+			PfmWriter()(image, f);
+			ok = std::fclose(f) == 0;
+		}
+		MappedImage<Float3> mapped(name);
+		ok = ok && mapped.width() == image.width() &&
+			mapped.height() == image.height();
+		for (size_t y = 0; ok && y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				for (size_t c = 0; c < 3; ++c)
+					ok = ok && mapped(x, y)[c] == image(x, y)[c];
+		std::printf("written and mapped: %s\n", ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	enum Expected { INVALID, TRUNCATED, WRONG_TYPE };
+
+	// MappedImage<T> and PfmReader must both throw on the bytes given,
+	// or only MappedImage<T> for WRONG_TYPE
+	template<typename T>
+	bool check_bad(Scratch& scratch, const char* what,
+		const std::string& bytes, Expected expected)
+	{
+		const std::string name = scratch.file("bad.pfm", bytes);
+		const char* mapped = "no exception";
+		try {
+			MappedImage<T> image(name);
+		} catch (const InvalidFormat&) {
+			mapped = "InvalidFormat";
+		} catch (const EndOfFile&) {
+			mapped = "EndOfFile";
+		} catch (const std::exception&) {
+			mapped = "other exception";
+		}
+		const std::string want =
+			expected == TRUNCATED ? "EndOfFile" : "InvalidFormat";
+
+		bool thrown = false;
+		FILE* f = std::fopen(name.c_str(), "rb");
+		try {
+			FloatImage3 image;
+			PfmReader()(image, f);
+		} catch (const std::exception&) {
+			thrown = true;
+		}
+		std::fclose(f);
+
+		const bool ok = want == mapped && thrown == (expected != WRONG_TYPE);
+		std::printf("%-32s MappedImage %s, PfmReader %s: %s\n", what, mapped,
+			thrown ? "threw" : "did not throw", ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	// the bytes of v, in the byte order given
+	template<typename S>
+	std::string sample(S v, bool little_endian)
+	{
+		std::string bytes(reinterpret_cast<const char*>(&v), sizeof(S));
+		unsigned short one = 1;
+		const bool native_little = *reinterpret_cast<unsigned char*>(&one) == 1;
+		if (native_little != little_endian)
+			std::reverse(bytes.begin(), bytes.end());
+		return bytes;
+	}
+
+	// a file of header and w x h pixels of the channels given, sample
+	// (x, y, c) holding x + 10 y + 100 c, rows in file order
+	template<typename T>
+	bool check_aligned(Scratch& scratch, const char* what,
+		const std::string& header, size_t w, size_t h, bool little_endian,
+		bool copied)
+	{
+		typedef typename ColorTrait<T>::BaseType S;
+		const size_t channels = ColorTrait<T>::channels();
+		std::string bytes = header;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				for (size_t c = 0; c < channels; ++c)
+					bytes += sample(static_cast<S>(x + 10*y + 100*c),
+						little_endian);
+		const std::string name = scratch.file("aligned.pfm", bytes);
+		MappedImage<T> mapped(name);
+		const bool pfm = header[1] == 'F' || header[1] == 'f';
+		bool ok = mapped.width() == w && mapped.height() == h &&
+			mapped.copied() == copied &&
+			reinterpret_cast<size_t>(&mapped(0, 0)) % sizeof(S) == 0;
+		for (size_t y = 0; ok && y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				for (size_t c = 0; c < channels; ++c) {
+					const size_t row = pfm ? h - 1 - y : y;
+					ok = ok && ColorTrait<T>::select_channel(mapped(x, y), c) ==
+						static_cast<S>(x + 10*row + 100*c);
+				}
+		std::printf("%-32s %s: %s\n", what,
+			mapped.copied() ? "copied" : "mapped", ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	std::string pixels(size_t n)
+	{
+		return std::string(n * sizeof(float), '\0');
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	bool ok = check_good(scratch);
+
+	ok = check_bad<Float3>(scratch, "bad magic",
+		"PX\n2 2\n-1.0\n" + pixels(12), INVALID) && ok;
+	ok = check_bad<Float3>(scratch, "negative width",
+		"PF\n-3 4\n-1.0\n" + pixels(36), INVALID) && ok;
+	ok = check_bad<Float3>(scratch, "width not a number",
+		"PF\nabc 4\n-1.0\n" + pixels(36), INVALID) && ok;
+	ok = check_bad<Float3>(scratch, "width past size_t",
+		"PF\n99999999999999999999999 1\n-1.0\n" + pixels(12), INVALID) && ok;
+	ok = check_bad<Float3>(scratch, "width x height overflows",
+		"PF\n4294967296 4294967296\n-1.0\n" + pixels(12), INVALID) && ok;
+	ok = check_bad<Float3>(scratch, "x pixel size overflows",
+		"PF\n4611686018427387904 4\n-1.0\n" + pixels(12), INVALID) && ok;
+	ok = check_bad<Float3>(scratch, "zero scale",
+		"PF\n2 2\n0\n" + pixels(12), INVALID) && ok;
+	ok = check_bad<Float3>(scratch, "header cut short",
+		"PF\n2 2\n-1.0", INVALID) && ok;
+	ok = check_bad<Float1>(scratch, "one channel for PF",
+		"PF\n2 2\n-1.0\n" + pixels(12), WRONG_TYPE) && ok;
+	ok = check_bad<Float3>(scratch, "pixels cut short",
+		"PF\n4 4\n-1.0\n" + pixels(4 * 4 * 3 - 1), TRUNCATED) && ok;
+	ok = check_bad<Float1>(scratch, "gray pixels cut short",
+		"Pf\n8 3\n1.0\n" + pixels(8 * 2), TRUNCATED) && ok;
+
+	ok = check_aligned<Float3>(scratch, "floats after 11 bytes",
+		"PF\n13 7\n-1\n", 13, 7, true, true) && ok;
+	ok = check_aligned<Float3>(scratch, "big endian floats after 10 bytes",
+		"PF\n13 7\n1\n", 13, 7, false, true) && ok;
+	ok = check_aligned<Float1>(scratch, "floats after 12 bytes",
+		"Pf\n13 7\n-1.\n", 13, 7, true, false) && ok;
+	ok = check_aligned<Short3>(scratch, "shorts after 15 bytes",
+		"P6\n 13 7\n65535\n", 13, 7, false, true) && ok;
+	ok = check_aligned<Short1>(scratch, "shorts after 14 bytes",
+		"P5\n13 7\n65535\n", 13, 7, false, false) && ok;
+
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+/* pipeline:
+ *   chains of ImageProxy stages against the same stages evaluated one
+ *   by one into images. Point-wise chains are fused and computed a tile
+ *   at a time, streaming filters read them row by row, other filters get
+ *   them materialized; all must give the bits of the staged filters, on
+ *   images narrower, as wide as and wider than GIL_PIPELINE_TILE, with
+ *   the global execution and with a thread pool, into images whose rows
+ *   are contiguous and into planar ones, whose are not.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "gil/core/Image.h"
+#include "gil/core/PlanarImage.h"
+#include "gil/dip/BilinearFilter.h"
+#include "gil/dip/BoxFilter.h"
+#include "gil/dip/ColorSpace.h"
+#include "gil/dip/Convert.h"
+#include "gil/dip/GaussianFilter.h"
+#include "gil/dip/NearestFilter.h"
+#include "gil/dip/OnePassFilter.h"
+
+using namespace gil;
+
+namespace {
+
+	FloatImage3 scene(size_t w, size_t h)
+	{
+		FloatImage3 image(w, h);
+		unsigned int seed = 12345;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				for (size_t c = 0; c < 3; ++c) {
+					seed = seed * 1103515245u + 12345u;
+					image(x, y)[c] = float(seed >> 8) / 65536.0f / 256.0f *
+						(((x / 16 + y / 16) % 2) ? 1.0f : 0.1f);
+				}
+		return image;
+	}
+
+	// a 5 x 5 tent, through OnePassFilter, which is neither point-wise
+	// nor streaming
+	template<class DstImage>
+	class Tent: public OnePassFilter<DstImage, float, SquareKernel<float> > {
+		typedef OnePassFilter<DstImage, float, SquareKernel<float> > RealFilter;
+		friend class Filter<RealFilter, DstImage>;
+
+		public:
+			Tent(): RealFilter(*this, 5, 5)
+			{
+				for (int y = -2; y <= 2; ++y)
+					for (int x = -2; x <= 2; ++x)
+						this->my_kernel(x, y) =
+							float((3 - std::abs(x)) * (3 - std::abs(y)));
+			}
+	};
+
+	template<class A, class B>
+	bool same(const A& a, const B& b)
+	{
+		typedef typename A::value_type P;
+		if (a.width() != b.width() || a.height() != b.height())
+			return false;
+		for (size_t y = 0; y < a.height(); ++y)
+			for (size_t x = 0; x < a.width(); ++x) {
+				const P p = a(x, y), q = b(x, y);
+				if (std::memcmp(&p, &q, sizeof(P)) != 0)
+					return false;
+			}
+		return true;
+	}
+
+	bool report(const char* what, size_t width, bool global, bool pool)
+	{
+		std::printf("%s, %lu wide: %s\n", what, (unsigned long)width,
+			global && pool ? "ok" : "FAILED");
+		return global && pool;
+	}
+
+	// RGB -> XYZ -> RGB -> bytes, three point-wise stages
+	bool check_converts(const FloatImage3& src, const Execution& pool)
+	{
+		FloatImage3 xyz, rgb;
+		ByteImage3 staged;
+		Convert<RgbToXyz>()(xyz, src);
+		Convert<XyzToRgb>()(rgb, xyz);
+		DefaultConvert<ByteImage3>()(staged, rgb);
+
+		ByteImage3 global, pooled;
+		DefaultConvert<ByteImage3>()(global,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)));
+		DefaultConvert<ByteImage3>()(pooled,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)), pool);
+		return report("xyz and back to bytes", src.width(),
+			same(staged, global), same(staged, pooled));
+	}
+
+	// resampling stages, which read their source in spans of other sizes
+	bool check_resampling(const FloatImage3& src, const Execution& pool)
+	{
+		const size_t w = src.width(), h = src.height();
+		bool ok = true;
+
+		FloatImage3 up;
+		FloatImage1 staged, global, pooled;
+		NearestFilter<FloatImage3>(2 * w + 1, h + 3)(up, src);
+		Convert<RgbToGray>()(staged, up);
+		Convert<RgbToGray>()(global,
+			NearestFilter<FloatImage3>(2 * w + 1, h + 3)(src));
+		Convert<RgbToGray>()(pooled,
+			NearestFilter<FloatImage3>(2 * w + 1, h + 3)(src), pool);
+		ok = report("nearest up, gray", w,
+			same(staged, global), same(staged, pooled)) && ok;
+
+		FloatImage3 down;
+		ByteImage3 bytes, bytes_global, bytes_pooled;
+		BilinearFilter<FloatImage3>(w / 3 + 1, h / 2)(down, src);
+		DefaultConvert<ByteImage3>()(bytes, down);
+		DefaultConvert<ByteImage3>()(bytes_global,
+			BilinearFilter<FloatImage3>(w / 3 + 1, h / 2)(src));
+		DefaultConvert<ByteImage3>()(bytes_pooled,
+			BilinearFilter<FloatImage3>(w / 3 + 1, h / 2)(src), pool);
+		ok = report("bilinear down, bytes", w,
+			same(bytes, bytes_global), same(bytes, bytes_pooled)) && ok;
+
+		// nearest down then bilinear up, both on a converted source
+		FloatImage3 xyz, near, lerp, lerp_global, lerp_pooled;
+		Convert<RgbToXyz>()(xyz, src);
+		NearestFilter<FloatImage3>(w / 5 + 1, h / 4 + 1)(near, xyz);
+		BilinearFilter<FloatImage3>(3 * w, 2 * h)(lerp, near);
+		BilinearFilter<FloatImage3>(3 * w, 2 * h)(lerp_global,
+			NearestFilter<FloatImage3>(w / 5 + 1, h / 4 + 1)(
+				Convert<RgbToXyz>()(src)));
+		BilinearFilter<FloatImage3>(3 * w, 2 * h)(lerp_pooled,
+			NearestFilter<FloatImage3>(w / 5 + 1, h / 4 + 1)(
+				Convert<RgbToXyz>()(src)), pool);
+		return report("xyz, nearest down, bilinear up", w,
+			same(lerp, lerp_global), same(lerp, lerp_pooled)) && ok;
+	}
+
+	// a streaming filter and a materializing one at the end of a chain
+	bool check_filters(const FloatImage3& src, const Execution& pool)
+	{
+		const size_t w = src.width();
+		FloatImage3 xyz, rgb;
+		Convert<RgbToXyz>()(xyz, src);
+		Convert<XyzToRgb>()(rgb, xyz);
+		bool ok = true;
+
+		FloatImage3 box, box_global, box_pooled;
+		BoxFilter<FloatImage3>(9, 5)(box, rgb);
+		BoxFilter<FloatImage3>(9, 5)(box_global,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)));
+		BoxFilter<FloatImage3>(9, 5)(box_pooled,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)), pool);
+		ok = report("xyz and back, box", w,
+			same(box, box_global), same(box, box_pooled)) && ok;
+
+		FloatImage3 blur, blur_global, blur_pooled;
+		GaussianFilter<FloatImage3>(12.0f, 12.0f)(blur, rgb);
+		GaussianFilter<FloatImage3>(12.0f, 12.0f)(blur_global,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)));
+		GaussianFilter<FloatImage3>(12.0f, 12.0f)(blur_pooled,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)), pool);
+		ok = report("xyz and back, recursive gaussian", w,
+			same(blur, blur_global), same(blur, blur_pooled)) && ok;
+
+		FloatImage3 tent, tent_global, tent_pooled;
+		Tent<FloatImage3>()(tent, rgb);
+		Tent<FloatImage3>()(tent_global,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)));
+		Tent<FloatImage3>()(tent_pooled,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)), pool);
+		return report("xyz and back, one pass tent", w,
+			same(tent, tent_global), same(tent, tent_pooled)) && ok;
+	}
+
+	// a planar destination, filled a tile at a time pixel by pixel
+	bool check_planar(const FloatImage3& src, const Execution& pool)
+	{
+		typedef PlanarImage<float, 3> Planar;
+		FloatImage3 xyz, staged;
+		Convert<RgbToXyz>()(xyz, src);
+		Convert<XyzToRgb>()(staged, xyz);
+
+		Planar global, pooled;
+		DefaultConvert<Planar>()(global,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)));
+		DefaultConvert<Planar>()(pooled,
+			Convert<XyzToRgb>()(Convert<RgbToXyz>()(src)), pool);
+		return report("xyz and back into planes", src.width(),
+			same(staged, global), same(staged, pooled));
+	}
+
+} // namespace
+
+int main()
+{
+	const Execution pool(Execution::THREAD_POOL, 3, 1);
+	const size_t widths[] = {
+		1, 37, GIL_PIPELINE_TILE - 1, GIL_PIPELINE_TILE,
+		GIL_PIPELINE_TILE + 1, 3 * GIL_PIPELINE_TILE + 89
+	};
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); ++i) {
+		const FloatImage3 src = scene(widths[i], 67);
+		ok = check_converts(src, pool) && ok;
+		ok = check_resampling(src, pool) && ok;
+		ok = check_filters(src, pool) && ok;
+		ok = check_planar(src, pool) && ok;
+	}
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
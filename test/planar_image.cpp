@@ -0,0 +1,235 @@
+/* planar_image:
+ *   PlanarImage against interleaved images of the same pixels. Copies
+ *   both ways, from crops, between pixel types and channel counts, into
+ *   padded planes and at offsets, must give what the same copies give
+ *   between interleaved images, on rows narrower and wider than a tile.
+ *
+ *   The box, Gaussian (FIR and recursive) and iterated box filters must
+ *   give the same bits with planar sources and destinations as with
+ *   interleaved ones, serially and with a thread pool.
+ *
+ *   Pixels written through a Reference must keep the channels the value
+ *   lacks, planes must be what slice_image returns, and a PFM written
+ *   from planes must read back into planes and into an interleaved image.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "gil/core/Image.h"
+#include "gil/core/PlanarImage.h"
+#include "gil/core/SubImage.h"
+#include "gil/core/io/pfm.h"
+#include "gil/dip/BoxFilter.h"
+#include "gil/dip/GaussianFilter.h"
+#include "scratch.h"
+
+using namespace gil;
+
+namespace {
+
+	typedef PlanarImage<float, 3> Planar3;
+	typedef PlanarImage<float, 4> Planar4;
+	typedef PlanarImage<Byte1, 3> BytePlanar3;
+
+	FloatImage3 scene(size_t w, size_t h)
+	{
+		FloatImage3 image(w, h);
+		unsigned int seed = 12345;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				for (size_t c = 0; c < 3; ++c) {
+					seed = seed * 1103515245u + 12345u;
+					image(x, y)[c] = float(seed >> 8) / 65536.0f *
+						(((x / 16 + y / 16) % 2) ? 1.0f : 0.01f);
+				}
+		return image;
+	}
+
+	// the same pixels, bit for bit
+	template<class A, class B>
+	bool same(const A& a, const B& b)
+	{
+		typedef typename A::value_type P;
+		if (a.width() != b.width() || a.height() != b.height())
+			return false;
+		for (size_t y = 0; y < a.height(); ++y)
+			for (size_t x = 0; x < a.width(); ++x) {
+				const P p = a(x, y), q = b(x, y);
+				if (std::memcmp(&p, &q, sizeof(P)) != 0)
+					return false;
+			}
+		return true;
+	}
+
+	bool report(const char* what, size_t width, bool ok)
+	{
+		std::printf("%s, %lu wide: %s\n", what, (unsigned long)width,
+			ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	bool check_copies(const FloatImage3& src)
+	{
+		const size_t w = src.width(), h = src.height();
+		bool ok = true;
+
+		// there and back, plain and padded
+		Planar3 planar, padded(1, 1, 3, w + 5);
+		planar = src;
+		padded = src;
+		FloatImage3 back, padded_back(2, 2, 1);
+		back = planar;
+		padded_back = padded;
+		ok = report("copied to planes and back", w,
+			same(src, planar) && same(src, padded) && same(src, back) &&
+			same(src, padded_back)) && ok;
+
+		// between pixel types, as Color assigns them, and planes to planes
+		BytePlanar3 bytes;
+		ByteImage3 interleaved;
+		bytes = src;
+		interleaved = src;
+		Planar3 from_bytes;
+		from_bytes = bytes;
+		FloatImage3 from_interleaved;
+		from_interleaved = interleaved;
+		ok = report("copied between pixel types", w,
+			same(interleaved, bytes) &&
+			same(from_interleaved, from_bytes)) && ok;
+
+		// crops, which read a tile at a time when they crop planes
+		const size_t cw = w > 2 ? w - 2 : w;
+		const FloatImage3& csrc = src;
+		SubImage<const FloatImage3> crop(csrc, w - cw, 1, cw, h - 2);
+		SubImage<Planar3> planar_crop(planar, w - cw, 1, cw, h - 2);
+		Planar3 from_crop, from_planar_crop;
+		FloatImage3 expected;
+		from_crop = crop;
+		from_planar_crop = planar_crop;
+		expected = crop;
+		ok = report("copied from crops", w,
+			same(expected, from_crop) &&
+			same(expected, from_planar_crop)) && ok;
+
+		// at an offset, into four channels that keep their alpha
+		Planar4 rgba(w + 3, h + 2);
+		FloatImage4 expected_rgba(w + 3, h + 2);
+		rgba.fill(Float4(1.0f, 2.0f, 3.0f, 0.25f));
+		expected_rgba.fill(Float4(1.0f, 2.0f, 3.0f, 0.25f));
+		rgba.replace(src, 2, 1);
+		expected_rgba.replace(src, 2, 1);
+		FloatImage3 rgb(w + 3, h + 2);
+		FloatImage3 expected_rgb(w + 3, h + 2);
+		rgb.fill(Float3(5, 6, 7));
+		expected_rgb.fill(Float3(5, 6, 7));
+		rgb.replace(planar, 3, 2);
+		expected_rgb.replace(src, 3, 2);
+		return report("replaced at an offset", w,
+			same(expected_rgba, rgba) && same(expected_rgb, rgb)) && ok;
+	}
+
+	// a filter into planes and the same into an interleaved image, from
+	// planes and from interleaved pixels, against the interleaved filter
+	template<class IntoPlanes, class IntoImage>
+	bool check_filter(const char* what, const IntoPlanes& into_planes,
+		const IntoImage& into_image, const FloatImage3& src)
+	{
+		const Planar3 planes(src);
+		FloatImage3 expected;
+		into_image(expected, src, Execution(Execution::SERIAL));
+
+		const Execution executions[] = {
+			Execution(Execution::SERIAL),
+			Execution(Execution::THREAD_POOL, 3, 7)
+		};
+		bool ok = true;
+		for (size_t i = 0; i < 2; ++i) {
+			FloatImage3 from_planes;
+			Planar3 to_planes, planar;
+			into_image(from_planes, planes, executions[i]);
+			into_planes(to_planes, src, executions[i]);
+			into_planes(planar, planes, executions[i]);
+			ok = ok && same(expected, from_planes) &&
+				same(expected, to_planes) && same(expected, planar);
+		}
+		return report(what, src.width(), ok);
+	}
+
+	bool check_filters(const FloatImage3& src)
+	{
+		bool ok = check_filter("box 9 x 5",
+			BoxFilter<Planar3>(9, 5), BoxFilter<FloatImage3>(9, 5), src);
+		ok = check_filter("gaussian 1.5, FIR",
+			GaussianFilter<Planar3>(1.5f, 1.5f),
+			GaussianFilter<FloatImage3>(1.5f, 1.5f), src) && ok;
+		ok = check_filter("gaussian 12, recursive",
+			GaussianFilter<Planar3>(12.0f, 12.0f),
+			GaussianFilter<FloatImage3>(12.0f, 12.0f), src) && ok;
+		return check_filter("iterated box 6",
+			BoxGaussianFilter<Planar3>(6.0f, 6.0f),
+			BoxGaussianFilter<FloatImage3>(6.0f, 6.0f), src) && ok;
+	}
+
+	bool check_pixels()
+	{
+		Planar4 rgba(5, 4);
+		rgba.fill(Float4(1, 2, 3, 4));
+		rgba(1, 2) = Float3(7, 8, 9);
+		rgba(3, 1)[2] = 11;
+		rgba(0, 0) = rgba(1, 2);
+		const Planar4& planes = rgba;
+		bool ok = planes(1, 2)[0] == 7 && planes(1, 2)[1] == 8 &&
+			planes(1, 2)[2] == 9 && planes(1, 2)[3] == 4;
+		ok = ok && planes(3, 1)[0] == 1 && planes(3, 1)[2] == 11 &&
+			planes(3, 1)[3] == 4;
+		ok = ok && same(Planar4(planes), planes) &&
+			planes(0, 0)[2] == 9 && planes(0, 0)[3] == 4;
+		for (size_t c = 0; c < 4; ++c)
+			ok = ok && &slice_image(rgba, c) == &rgba.plane(c) &&
+				rgba.plane(c)(3, 1) == planes(3, 1)[c];
+		std::printf("pixels through references and planes: %s\n",
+			ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	bool check_file(Scratch& scratch, const FloatImage3& src)
+	{
+		const std::string name = scratch.file("planes.pfm");
+		const Planar3 planes(src);
+		FILE* f = std::fopen(name.c_str(), "wb");
+		PfmWriter()(planes, f);
+		std::fclose(f);
+
+		Planar3 read_planes;
+		FloatImage3 read_image;
+		f = std::fopen(name.c_str(), "rb");
+		PfmReader()(read_planes, f);
+		std::fclose(f);
+		f = std::fopen(name.c_str(), "rb");
+		PfmReader()(read_image, f);
+		std::fclose(f);
+		return report("pfm written from planes and read", src.width(),
+			same(src, read_planes) && same(src, read_image));
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	const size_t widths[] = {
+		1, 3, GIL_PIPELINE_TILE, GIL_PIPELINE_TILE + 1, 700
+	};
+	bool ok = check_pixels();
+	for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); ++i) {
+		const FloatImage3 src = scene(widths[i], 45);
+		ok = check_copies(src) && ok;
+		ok = check_filters(src) && ok;
+		ok = check_file(scratch, src) && ok;
+	}
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,232 @@
+/* png_writer:
+ *   PngWriter against libpng, which decodes what it writes: 8 bit gray
+ *   and RGB and 16 bit RGBA, row filters of every kind, and deflate
+ *   blocks from one stream down to block_size 1. Every file must decode
+ *   to the pixels written, and be the same bytes at 1 and 4 threads.
+ *   block_size is clamped to PngOptions::MIN_BLOCK_SIZE and a filtered
+ *   row: a block_size of 1 must give the IDAT chunks of blocks of that
+ *   size. It is clamped to MAX_BLOCK_SIZE too, which zlib's 32 bit
+ *   lengths hold, also for one stream and for images of over 4 GiB,
+ *   whose block sizes are checked without writing them.
+ *
+ *     make test
+ */
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <png.h>
+
+#include "gil/core/Image.h"
+#include "gil/core/io/png.h"
+#include "scratch.h"
+
+using namespace gil;
+
+namespace {
+
+	// the samples of a PNG decoded by libpng, 16 bit ones in native order
+	struct Decoded {
+		size_t width;
+		size_t height;
+		size_t channels;
+		size_t depth;
+		std::vector<unsigned char> bytes;
+
+		unsigned int sample(size_t x, size_t y, size_t c) const
+		{
+			const size_t i = (y * width + x) * channels + c;
+			if (depth == 8)
+				return bytes[i];
+			return (bytes[2*i] << 8) | bytes[2*i + 1];
+		}
+	};
+
+	struct Cursor {
+		const std::string* data;
+		size_t at;
+	};
+
+	void read_memory(png_structp png, png_bytep out, png_size_t n)
+	{
+		Cursor* cursor = static_cast<Cursor*>(png_get_io_ptr(png));
+		if (cursor->at + n > cursor->data->size())
+			png_error(png, "read past the end");
+		std::memcpy(out, cursor->data->data() + cursor->at, n);
+		cursor->at += n;
+	}
+
+	// false if libpng cannot decode the file
+	bool decode(const std::string& file, Decoded& out)
+	{
+		std::vector<png_bytep> rows;
+		Cursor cursor = { &file, 0 };
+		png_structp png = png_create_read_struct(
+			PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+		png_infop info = png_create_info_struct(png);
+		if (setjmp(png_jmpbuf(png))) {
+			png_destroy_read_struct(&png, &info, NULL);
+			return false;
+		}
+		png_set_read_fn(png, &cursor, read_memory);
+		png_read_info(png, info);
+		out.width = png_get_image_width(png, info);
+		out.height = png_get_image_height(png, info);
+		out.channels = png_get_channels(png, info);
+		out.depth = png_get_bit_depth(png, info);
+		const size_t rowbytes = png_get_rowbytes(png, info);
+		out.bytes.resize(rowbytes * out.height);
+		rows.resize(out.height);
+		for (size_t y = 0; y < out.height; ++y)
+			rows[y] = &out.bytes[y * rowbytes];
+		png_read_image(png, &rows[0]);
+		png_read_end(png, NULL);
+		png_destroy_read_struct(&png, &info, NULL);
+		return true;
+	}
+
+	size_t idat_chunks(const std::string& file)
+	{
+		size_t n = 0;
+		for (size_t at = 8; at + 8 <= file.size(); ) {
+			const unsigned char* p =
+				reinterpret_cast<const unsigned char*>(file.data() + at);
+			const size_t length = (static_cast<size_t>(p[0]) << 24) |
+				(p[1] << 16) | (p[2] << 8) | p[3];
+			n += std::memcmp(p + 4, "IDAT", 4) == 0;
+			at += 12 + length;
+		}
+		return n;
+	}
+
+	template<typename I>
+	I scene(size_t w, size_t h, unsigned int range)
+	{
+		typedef typename I::value_type P;
+		I image(w, h);
+		unsigned int seed = 12345;
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				for (size_t c = 0; c < image.channels(); ++c) {
+					seed = seed * 1103515245u + 12345u;
+					// smooth where x is small, noise further right
+					const unsigned int smooth = (x * 7 + y * 3 + c * 50) % range;
+					ColorTrait<P>::select_channel(image(x, y), c) =
+						static_cast<typename ColorTrait<P>::BaseType>(
+							x < w / 2 ? smooth : (seed >> 8) % range);
+				}
+		return image;
+	}
+
+	template<typename I>
+	std::string encode(Scratch& scratch, const I& image,
+		const PngOptions& options, size_t threads)
+	{
+		const std::string name = scratch.file("out.png");
+		FILE* f = std::fopen(name.c_str(), "wb");
+		if (f == NULL)
+			return std::string();
+		PngWriter writer(options, Execution(Execution::THREAD_POOL, threads));
+		writer(image, f);
+		std::fclose(f);
+		return Scratch::bytes(name);
+	}
+
+	template<typename I>
+	bool check(Scratch& scratch, const char* what, const I& image,
+		size_t depth)
+	{
+		typedef typename I::value_type P;
+		const size_t blocks[] = { 0, 1, 1000, 40000, 256*1024 };
+		const PngFilter filters[] = {
+			PNG_ROW_FILTER_NONE, PNG_ROW_FILTER_SUB, PNG_ROW_FILTER_UP,
+			PNG_ROW_FILTER_AVERAGE, PNG_ROW_FILTER_PAETH,
+			PNG_ROW_FILTER_ADAPTIVE
+		};
+		bool ok = true;
+		for (size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); ++b)
+			for (size_t i = 0; i < sizeof(filters) / sizeof(filters[0]); ++i) {
+				PngOptions options;
+				options.bit_depth = depth;
+				options.block_size = blocks[b];
+				options.filter = filters[i];
+				const std::string one = encode(scratch, image, options, 1);
+				const std::string four = encode(scratch, image, options, 4);
+
+				Decoded decoded;
+				bool same = decode(one, decoded) &&
+					decoded.width == image.width() &&
+					decoded.height == image.height() &&
+					decoded.channels == image.channels() &&
+					decoded.depth == depth;
+				for (size_t y = 0; same && y < image.height(); ++y)
+					for (size_t x = 0; x < image.width(); ++x)
+						for (size_t c = 0; c < image.channels(); ++c)
+							same = same && decoded.sample(x, y, c) ==
+								ColorTrait<P>::select_channel(image(x, y), c);
+
+				// a chunk per block, between the zlib header and trailer
+				const size_t row = image.width() * image.channels() * depth / 8 + 1;
+				const size_t size = image.height() * row;
+				const size_t block = blocks[b] ? std::min(size, std::max(
+					blocks[b], std::max<size_t>(PngOptions::MIN_BLOCK_SIZE, row)
+				)) : size;
+				const size_t chunks = idat_chunks(one);
+				const bool clamped = chunks == 2 + (size + block - 1) / block;
+
+				if (!same || one != four || !clamped) {
+					std::printf("%s, block %lu, filter %d: %s%s%s\n", what,
+						(unsigned long)blocks[b], (int)filters[i],
+						same ? "" : "decoded wrong ",
+						one == four ? "" : "differs by threads ",
+						clamped ? "" : "too many chunks");
+					ok = false;
+				}
+				if (i == 0)
+					std::printf("%s, block %lu: %lu bytes, %lu IDAT\n", what,
+						(unsigned long)blocks[b], (unsigned long)one.size(),
+						(unsigned long)chunks);
+			}
+		std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	bool check_block_sizes()
+	{
+		const size_t MIN = PngOptions::MIN_BLOCK_SIZE;
+		const size_t MAX = PngOptions::MAX_BLOCK_SIZE;
+		const size_t HUGE_SIZE = size_t(5) << 30 | 123;
+		const size_t row = 40001;
+		bool ok = png_block_size(0, 100, 5000) == 5000 &&
+			png_block_size(1, 100, 5000) == 5000 &&
+			png_block_size(1, 100, 500000) == MIN &&
+			png_block_size(1, 70000, 500000) == 70001 &&
+			png_block_size(100000, 100, 500000) == 100000;
+		if (sizeof(size_t) > 4)
+			ok = ok && png_block_size(0, row, HUGE_SIZE) == MAX &&
+				png_block_size(HUGE_SIZE, row, HUGE_SIZE) == MAX &&
+				png_block_size(size_t(-1), row, HUGE_SIZE) == MAX &&
+				png_block_size(1000, row, HUGE_SIZE) == row + 1;
+		ok = ok && MAX <= 0xffffffffu;
+		std::printf("block sizes: %s\n", ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	bool ok = check(scratch, "gray 8",
+		scene<ByteImage1>(301, 257, 256), 8);
+	ok = check(scratch, "rgb 8",
+		scene<ByteImage3>(300, 217, 256), 8) && ok;
+	ok = check(scratch, "rgba 16",
+		scene<ShortImage4>(123, 190, 65536), 16) && ok;
+	ok = check_block_sizes() && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
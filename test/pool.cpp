@@ -0,0 +1,284 @@
+/* pool:
+ *   ImagePool and PoolAllocator. Size classes must hold the request and
+ *   waste at most a quarter of it. Every buffer must be aligned for SSE
+ *   loads, and a pooled image, padded or not, must put its rows on
+ *   Image::ALIGNMENT like any other image.
+ *
+ *   A freed buffer must be handed out again for the next request of its
+ *   class, the statistics must add up (what was allocated is in use,
+ *   cached or freed by a frame or trim), and a Frame must free the
+ *   buckets not used during it. Threads allocating and freeing at once
+ *   must leave nothing in use.
+ *
+ *   Filtering into pooled images must give the pixels of ordinary ones.
+ *   A Pyramid of pooled images reset with images of the same size must
+ *   stop allocating: its first reset may miss a temporary whose buffer
+ *   a level took over while it was built, the ones after it must not.
+ *   A Pyramid of ordinary images must do the same and give the same
+ *   levels, its blur buffer held in the pool rather than the heap.
+ *   The pyramid is built serially so that the bands, which each take
+ *   row buffers, are the same every time.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "gil/core/Image.h"
+#include "gil/core/Parallel.h"
+#include "gil/core/Pool.h"
+#include "gil/dip/BoxFilter.h"
+#include "gil/dip/GaussianFilter.h"
+#include "gil/dip/Pyramid.h"
+
+using namespace gil;
+
+namespace {
+
+	typedef Image<Float3, PoolAllocator> PooledImage3;
+
+	const size_t ALIGNMENT = PooledImage3::ALIGNMENT;
+
+	bool report(const char* what, bool ok)
+	{
+		std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	bool aligned(const void* p, size_t alignment)
+	{
+		return reinterpret_cast<size_t>(p) % alignment == 0;
+	}
+
+	// allocated counts what was ever obtained, some of it may be freed
+	bool balanced(const ImagePool::Statistics& s, size_t freed = 0)
+	{
+		return s.allocated == s.in_use + s.cached + freed &&
+			s.peak >= s.in_use;
+	}
+
+	bool check_size_classes()
+	{
+		bool ok = true;
+		size_t previous = 0;
+		for (size_t bytes = 1; bytes < (size_t(1) << 26);
+				bytes += bytes / 7 + 1) {
+			const size_t size = ImagePool::size_class(bytes);
+			ok = ok && size >= bytes && size >= previous;
+			ok = ok && (bytes <= 4096 || size - bytes <= bytes / 4);
+			ok = ok && ImagePool::size_class(size) == size && size % 16 == 0;
+			previous = size;
+		}
+		return report("size classes", ok);
+	}
+
+	bool check_alignment()
+	{
+		ImagePool pool;
+		bool ok = true;
+		std::vector<void*> blocks;
+		std::vector<size_t> sizes;
+		for (size_t bytes = 1; bytes < 300000; bytes = bytes * 3 + 1) {
+			blocks.push_back(pool.allocate(bytes));
+			sizes.push_back(bytes);
+			ok = ok && aligned(blocks.back(), 16);
+		}
+		for (size_t i = 0; i < blocks.size(); ++i)
+			pool.deallocate(blocks[i], sizes[i]);
+		ok = report("pool buffers on 16 bytes", ok);
+
+		// images of every pixel size, plain and padded
+		bool rows = true;
+		for (size_t w = 1; w < 70; w += 3) {
+			Image<Byte3, PoolAllocator> bytes(w, 5);
+			Image<Byte3, PoolAllocator> padded_bytes(w, 5, 2, w + 1);
+			PooledImage3 floats(w, 5), padded_floats(w, 5, 3);
+			Image<Float4, PoolAllocator> wide(w, 5, 1);
+			rows = rows && aligned(&bytes(0, 0), ALIGNMENT);
+			rows = rows && aligned(&floats(0, 0), ALIGNMENT);
+			for (size_t y = 0; y < 5; ++y) {
+				rows = rows && aligned(&padded_bytes(0, y), ALIGNMENT);
+				rows = rows && aligned(&padded_floats(0, y), ALIGNMENT);
+				rows = rows && aligned(&wide(0, y), ALIGNMENT);
+			}
+		}
+		return report("pooled image rows on Image::ALIGNMENT", rows) && ok;
+	}
+
+	bool check_reuse()
+	{
+		ImagePool pool;
+		void *a = pool.allocate(100000);
+		void *b = pool.allocate(5000);
+		ImagePool::Statistics s = pool.statistics();
+		bool ok = s.misses == 2 && s.hits == 0 && s.cached == 0 &&
+			s.in_use == ImagePool::size_class(100000) +
+				ImagePool::size_class(5000) && balanced(s);
+
+		pool.deallocate(a, 100000);
+		s = pool.statistics();
+		ok = ok && s.cached == ImagePool::size_class(100000) && balanced(s);
+
+		// any request of the same class gets the buffer back
+		void *c = pool.allocate(ImagePool::size_class(100000) - 7);
+		s = pool.statistics();
+		ok = ok && c == a && s.hits == 1 && s.misses == 2 && s.cached == 0 &&
+			balanced(s);
+		pool.deallocate(c, ImagePool::size_class(100000) - 7);
+		pool.deallocate(b, 5000);
+		ok = report("freed buffers reused", ok);
+
+		// both classes were used before the first frame ends; a frame
+		// after it that only uses the small class frees the large one
+		pool.end_frame();
+		{
+			ImagePool::Frame frame(pool);
+			pool.deallocate(pool.allocate(5000), 5000);
+		}
+		const size_t large = ImagePool::size_class(100000);
+		const size_t small = ImagePool::size_class(5000);
+		s = pool.statistics();
+		bool frames = s.cached == small && s.in_use == 0 &&
+			balanced(s, large);
+		{
+			ImagePool::Frame frame(pool);
+		}
+		s = pool.statistics();
+		frames = frames && s.cached == 0 && balanced(s, large + small);
+		ok = report("frames free the buckets they did not use", frames) && ok;
+
+		pool.deallocate(pool.allocate(3000), 3000);
+		pool.reset_statistics();
+		s = pool.statistics();
+		pool.trim();
+		const ImagePool::Statistics t = pool.statistics();
+		return report("statistics reset, pool trimmed",
+			s.hits == 0 && s.misses == 0 && s.peak == 0 &&
+			s.cached == ImagePool::size_class(3000) &&
+			t.cached == 0 && t.in_use == 0 &&
+			balanced(t, large + small + ImagePool::size_class(3000))) && ok;
+	}
+
+	// allocates, fills and frees buffers of several classes
+	struct Churn {
+		Churn(ImagePool& pool): pool(pool) {}
+
+		void operator ()(size_t i0, size_t i1) const
+		{
+			for (size_t i = i0; i < i1; ++i) {
+				const size_t bytes = 1000 + (i % 13) * 3001;
+				unsigned char *p =
+					static_cast<unsigned char*>(pool.allocate(bytes));
+				std::memset(p, int(i), bytes);
+				pool.deallocate(p, bytes);
+			}
+		}
+
+		ImagePool& pool;
+	};
+
+	bool check_threads()
+	{
+		ImagePool pool;
+		parallel_for(0, 20000, Churn(pool),
+			Execution(Execution::THREAD_POOL, 4, 10));
+		const ImagePool::Statistics s = pool.statistics();
+		return report("threads leave the pool balanced",
+			s.in_use == 0 && s.hits + s.misses == 20000 && balanced(s) &&
+			s.cached == s.allocated);
+	}
+
+	FloatImage3 scene(size_t w, size_t h)
+	{
+		FloatImage3 image(w, h);
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				image(x, y) =
+					Float3(float(x % 17), float(y % 5), float(x * y % 101));
+		return image;
+	}
+
+	template<class A, class B>
+	bool same(const A& a, const B& b)
+	{
+		if (a.width() != b.width() || a.height() != b.height())
+			return false;
+		for (size_t y = 0; y < a.height(); ++y)
+			for (size_t x = 0; x < a.width(); ++x)
+				for (size_t c = 0; c < 3; ++c)
+					if (a(x, y)[c] != b(x, y)[c])
+						return false;
+		return true;
+	}
+
+	// resets after the first, with the frame the pyramid was made of,
+	// hit the pool and never miss
+	template<class P, class I>
+	bool resets_hit(P& pyramid, const I& frame)
+	{
+		pyramid.reset(frame);
+		size_t misses = 0, hits = 0;
+		for (size_t i = 0; i < 3; ++i) {
+			ImagePool::global().reset_statistics();
+			pyramid.reset(frame);
+			const ImagePool::Statistics s = ImagePool::global().statistics();
+			misses += s.misses;
+			hits += s.hits;
+		}
+		std::printf("pyramid resets: %lu hits, %lu misses\n",
+			(unsigned long)hits, (unsigned long)misses);
+		return hits > 0 && misses == 0;
+	}
+
+	bool check_filters()
+	{
+		const FloatImage3 src = scene(150, 90);
+		const PooledImage3 pooled_src(src);
+		FloatImage3 blur, box;
+		PooledImage3 pooled_blur, pooled_box;
+		GaussianFilter<FloatImage3>(2.0f, 3.0f)(blur, src);
+		GaussianFilter<PooledImage3>(2.0f, 3.0f)(pooled_blur, pooled_src);
+		BoxFilter<FloatImage3>(7, 3)(box, src);
+		BoxFilter<PooledImage3>(7, 3)(pooled_box, pooled_src);
+		bool ok = report("filters into pooled images",
+			same(blur, pooled_blur) && same(box, pooled_box));
+
+		const Execution global = Execution::global();
+		Execution::global() = Execution(Execution::SERIAL);
+		const PooledImage3 frame(scene(161, 97));
+		Pyramid<PooledImage3> pyramid(frame);
+		ok = report("pooled pyramid resets of the same size do not allocate",
+			resets_hit(pyramid, frame)) && ok;
+
+		const FloatImage3 plain_frame(frame);
+		const size_t in_use = ImagePool::global().statistics().in_use;
+		Pyramid<FloatImage3> plain(plain_frame);
+		ok = report("pyramid of ordinary images blurs in the pool",
+			ImagePool::global().statistics().in_use > in_use) && ok;
+		ok = report("pyramid resets of the same size do not allocate",
+			resets_hit(plain, plain_frame)) && ok;
+		bool levels = plain.size() == pyramid.size();
+		for (size_t i = 0; levels && i < plain.size(); ++i) {
+			FloatImage3 a;
+			PooledImage3 b;
+			plain(a, static_cast<float>(i));
+			pyramid(b, static_cast<float>(i));
+			levels = same(a, b);
+		}
+		Execution::global() = global;
+		return report("pyramid levels, pooled or not", levels) && ok;
+	}
+
+} // namespace
+
+int main()
+{
+	bool ok = check_size_classes();
+	ok = check_alignment() && ok;
+	ok = check_reuse() && ok;
+	ok = check_threads() && ok;
+	ok = check_filters() && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,412 @@
+/* probe:
+ *   probe() on a header of each format it reads, made up in memory:
+ *   PNG, JPEG, TIFF of either byte order, BMP, TGA, PGM, PPM, PFM,
+ *   Radiance with and without RLE, EXR of scanlines and of tiles, and
+ *   FLT, which is told by its extension. Every field of the ImageInfo
+ *   must be what the header says. TIFF sample formats are given one
+ *   per file, one per channel past the IFD, and two in the entry.
+ *
+ *   EXR attributes may come in any order; the tiled files here give
+ *   their tiles before their data window, and the levels must still
+ *   be counted on the data window. Data windows wider than an int, or
+ *   of more samples than the reader takes, must throw InvalidFormat;
+ *   one just below that must not.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <string>
+
+#include "gil/core/Probe.h"
+#include "scratch.h"
+
+using namespace gil;
+
+namespace {
+
+	// the bytes of a header, appended in either byte order
+	struct Bytes {
+		Bytes& str(const std::string& s)
+		{
+			data += s;
+			return *this;
+		}
+
+		// with its terminating zero, as EXR names are
+		Bytes& name(const std::string& s)
+		{
+			data += s;
+			data += '\0';
+			return *this;
+		}
+
+		Bytes& u8(unsigned int v)
+		{
+			data += static_cast<char>(v & 0xff);
+			return *this;
+		}
+
+		Bytes& zeros(size_t n)
+		{
+			data.append(n, '\0');
+			return *this;
+		}
+
+		Bytes& le16(unsigned int v)
+		{
+			return u8(v).u8(v >> 8);
+		}
+
+		Bytes& le32(unsigned int v)
+		{
+			return le16(v).le16(v >> 16);
+		}
+
+		Bytes& be16(unsigned int v)
+		{
+			return u8(v >> 8).u8(v);
+		}
+
+		Bytes& be32(unsigned int v)
+		{
+			return be16(v >> 16).be16(v);
+		}
+
+		std::string data;
+	};
+
+	ImageInfo expect(
+		FileFormat format, size_t width, size_t height, size_t channels,
+		size_t bits, ImageInfo::Sample sample, const char* compression
+	)
+	{
+		ImageInfo info;
+		info.format = format;
+		info.width = width;
+		info.height = height;
+		info.channels = channels;
+		info.bits = bits;
+		info.sample = sample;
+		info.compression = compression;
+		return info;
+	}
+
+	ImageInfo tiles(ImageInfo info, size_t w, size_t h, size_t levels)
+	{
+		info.tiled = true;
+		info.tile_width = w;
+		info.tile_height = h;
+		info.levels = levels;
+		return info;
+	}
+
+	ImageInfo origin(ImageInfo info, int x, int y)
+	{
+		info.x = x;
+		info.y = y;
+		return info;
+	}
+
+	bool check(const char* what, const ImageInfo& got, const ImageInfo& want)
+	{
+		const bool ok = got.format == want.format &&
+			got.width == want.width && got.height == want.height &&
+			got.channels == want.channels && got.bits == want.bits &&
+			got.sample == want.sample && got.x == want.x && got.y == want.y &&
+			got.compression == want.compression &&
+			got.tiled == want.tiled && got.tile_width == want.tile_width &&
+			got.tile_height == want.tile_height && got.levels == want.levels;
+		std::printf("%-28s %lu x %lu at (%d, %d), %lu x %lu bits, sample %d, %s",
+			what, (unsigned long)got.width, (unsigned long)got.height,
+			got.x, got.y, (unsigned long)got.channels,
+			(unsigned long)got.bits, (int)got.sample, got.compression.c_str());
+		if (got.tiled)
+			std::printf(", tiles %lu x %lu, %lu levels",
+				(unsigned long)got.tile_width, (unsigned long)got.tile_height,
+				(unsigned long)got.levels);
+		std::printf(": %s\n", ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	bool check(const char* what, const Bytes& bytes, const ImageInfo& want)
+	{
+		try {
+			return check(what, probe(bytes.data.data(), bytes.data.size()), want);
+		} catch (const std::exception& e) {
+			std::printf("%-28s threw %s: FAILED\n", what, e.what());
+			return false;
+		}
+	}
+
+	bool check_png()
+	{
+		Bytes b;
+		b.str("\x89PNG\r\n\x1a\n").be32(13).str("IHDR");
+		b.be32(300).be32(200).u8(16).u8(6).u8(0).u8(0).u8(0).be32(0);
+		return check("png, 16 bit RGBA", b,
+			expect(FF_PNG, 300, 200, 4, 16, ImageInfo::UNSIGNED, "deflate"));
+	}
+
+	bool check_jpeg()
+	{
+		Bytes b;
+		b.u8(0xFF).u8(0xD8);
+		b.u8(0xFF).u8(0xE0).be16(16).str("JFIF").zeros(10);
+		b.u8(0xFF).u8(0xC2).be16(17).u8(8).be16(480).be16(640).u8(3).zeros(9);
+		return check("jpeg, progressive", b,
+			expect(FF_JPEG, 640, 480, 3, 8, ImageInfo::UNSIGNED, "progressive"));
+	}
+
+	bool check_tiff()
+	{
+		// little endian, bits per sample held apart, past the IFD
+		Bytes le;
+		le.str("II").le16(42).le32(8).le16(6);
+		le.le16(256).le16(4).le32(1).le32(1000);
+		le.le16(257).le16(3).le32(1).le16(750).le16(0);
+		le.le16(258).le16(3).le32(3).le32(8 + 2 + 6*12 + 4);
+		le.le16(259).le16(3).le32(1).le16(5).le16(0);
+		le.le16(277).le16(3).le32(1).le16(3).le16(0);
+		le.le16(339).le16(3).le32(1).le16(1).le16(0);
+		le.le32(0).le16(16).le16(16).le16(16);
+		bool ok = check("tiff, little endian", le,
+			expect(FF_TIFF, 1000, 750, 3, 16, ImageInfo::UNSIGNED, "lzw"));
+
+		// big endian, tiled floats
+		Bytes be;
+		be.str("MM").be16(42).be32(8).be16(8);
+		be.be16(256).be16(4).be32(1).be32(512);
+		be.be16(257).be16(4).be32(1).be32(256);
+		be.be16(258).be16(3).be32(1).be16(32).be16(0);
+		be.be16(259).be16(3).be32(1).be16(8).be16(0);
+		be.be16(277).be16(3).be32(1).be16(1).be16(0);
+		be.be16(322).be16(4).be32(1).be32(64);
+		be.be16(323).be16(4).be32(1).be32(32);
+		be.be16(339).be16(3).be32(1).be16(3).be16(0);
+		be.be32(0);
+		ok = check("tiff, big endian, tiled", be, tiles(
+			expect(FF_TIFF, 512, 256, 1, 32, ImageInfo::FLOAT, "deflate"),
+			64, 32, 1)) && ok;
+
+		// RGB floats as libtiff writes them, a sample format per
+		// channel held apart like the bits per sample
+		Bytes rgb;
+		rgb.str("II").le16(42).le32(8).le16(5);
+		rgb.le16(256).le16(4).le32(1).le32(300);
+		rgb.le16(257).le16(4).le32(1).le32(200);
+		rgb.le16(258).le16(3).le32(3).le32(8 + 2 + 5*12 + 4);
+		rgb.le16(277).le16(3).le32(1).le16(3).le16(0);
+		rgb.le16(339).le16(3).le32(3).le32(8 + 2 + 5*12 + 4 + 6);
+		rgb.le32(0).le16(32).le16(32).le16(32).le16(3).le16(3).le16(3);
+		ok = check("tiff, format per channel", rgb,
+			expect(FF_TIFF, 300, 200, 3, 32, ImageInfo::FLOAT, "none")) && ok;
+
+		// gray and alpha, the two sample formats held in the entry
+		Bytes ga;
+		ga.str("MM").be16(42).be32(8).be16(4);
+		ga.be16(256).be16(3).be32(1).be16(40).be16(0);
+		ga.be16(257).be16(3).be32(1).be16(30).be16(0);
+		ga.be16(277).be16(3).be32(1).be16(2).be16(0);
+		ga.be16(339).be16(3).be32(2).be16(3).be16(3);
+		ga.be32(0);
+		return check("tiff, two formats inline", ga,
+			expect(FF_TIFF, 40, 30, 2, 1, ImageInfo::FLOAT, "none")) && ok;
+	}
+
+	bool check_bmp()
+	{
+		Bytes b;
+		b.str("BM").le32(54 + 320*240*4).le32(0).le32(54);
+		b.le32(40).le32(320).le32(static_cast<unsigned int>(-240));
+		b.le16(1).le16(32).le32(3).zeros(20);
+		return check("bmp, top down, bitfields", b,
+			expect(FF_BMP, 320, 240, 4, 8, ImageInfo::UNSIGNED, "bitfields"));
+	}
+
+	bool check_targa()
+	{
+		Bytes b;
+		b.u8(0).u8(0).u8(3).zeros(5).le16(0).le16(0);
+		b.le16(128).le16(64).u8(8).u8(0).zeros(16);
+		return check("tga, gray", b,
+			expect(FF_TARGA, 128, 64, 1, 8, ImageInfo::UNSIGNED, "none"));
+	}
+
+	bool check_pnm()
+	{
+		Bytes pgm;
+		pgm.str("P5\n# a comment\n640 480\n65535\n").zeros(16);
+		bool ok = check("pgm, 16 bit", pgm,
+			expect(FF_PGM, 640, 480, 1, 16, ImageInfo::UNSIGNED, "none"));
+		Bytes ppm;
+		ppm.str("P6 3 2 255\n").zeros(18);
+		ok = check("ppm, 8 bit", ppm,
+			expect(FF_PPM, 3, 2, 3, 8, ImageInfo::UNSIGNED, "none")) && ok;
+		return ok;
+	}
+
+	bool check_pfm()
+	{
+		Bytes color, gray;
+		color.str("PF\n7 5\n-1.0\n").zeros(7*5*12);
+		gray.str("Pf\n7 5\n-1.0\n").zeros(7*5*4);
+		bool ok = check("pfm, color", color,
+			expect(FF_PFM, 7, 5, 3, 32, ImageInfo::FLOAT, "none"));
+		ok = check("pfm, gray", gray,
+			expect(FF_PFM, 7, 5, 1, 32, ImageInfo::FLOAT, "none")) && ok;
+		return ok;
+	}
+
+	bool check_hdr()
+	{
+		Bytes rle, flat;
+		rle.str("#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 20 +X 40\n");
+		rle.u8(2).u8(2).be16(40);
+		flat.str("#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y 2 +X 4\n");
+		flat.u8(128).u8(64).u8(32).u8(129);
+		bool ok = check("hdr, rle", rle,
+			expect(FF_HDR, 40, 20, 3, 8, ImageInfo::RGBE, "rle"));
+		ok = check("hdr, flat", flat,
+			expect(FF_HDR, 4, 2, 3, 8, ImageInfo::RGBE, "none")) && ok;
+		return ok;
+	}
+
+	// an EXR channel list of the channels given, of the types given
+	Bytes exr_channels(const char* const* names, const unsigned int* types,
+		size_t n)
+	{
+		Bytes list;
+		for (size_t i = 0; i < n; ++i)
+			list.name(names[i]).le32(types[i]).zeros(4).le32(1).le32(1);
+		list.u8(0);
+		return list;
+	}
+
+	Bytes& exr_attribute(Bytes& b, const char* name, const char* type,
+		const Bytes& value)
+	{
+		b.name(name).name(type).le32(static_cast<unsigned int>(value.data.size()));
+		return b.str(value.data);
+	}
+
+	Bytes exr_window(int x0, int y0, int x1, int y1)
+	{
+		Bytes box;
+		box.le32(x0).le32(y0).le32(x1).le32(y1);
+		return box;
+	}
+
+	bool check_exr()
+	{
+		// half RGB and a float Z, zip, a window off the origin
+		const char* const names[] = { "B", "G", "R", "Z" };
+		const unsigned int types[] = { 1, 1, 1, 2 };
+		Bytes compression;
+		compression.u8(3);
+		Bytes lines;
+		lines.le32(20000630).le32(2);
+		exr_attribute(lines, "channels", "chlist", exr_channels(names, types, 4));
+		exr_attribute(lines, "compression", "compression", compression);
+		exr_attribute(lines, "dataWindow", "box2i", exr_window(-10, 5, 89, 64));
+		lines.u8(0);
+		bool ok = check("exr, scanlines", lines, origin(
+			expect(FF_EXR, 100, 60, 4, 32, ImageInfo::FLOAT, "zip"), -10, 5));
+
+		// tiles before the data window: a mipmap rounded down, 100 x 60,
+		// and a ripmap rounded up, 100 x 300
+		const char* const y[] = { "Y" };
+		const unsigned int half[] = { 1 };
+		Bytes mip_tiles, rip_tiles;
+		mip_tiles.le32(32).le32(16).u8(0x01);
+		rip_tiles.le32(64).le32(64).u8(0x12);
+		Bytes mip, rip;
+		mip.le32(20000630).le32(0x202);
+		exr_attribute(mip, "tiles", "tiledesc", mip_tiles);
+		exr_attribute(mip, "channels", "chlist", exr_channels(y, half, 1));
+		exr_attribute(mip, "dataWindow", "box2i", exr_window(0, 0, 99, 59));
+		mip.u8(0);
+		rip.le32(20000630).le32(0x202);
+		exr_attribute(rip, "tiles", "tiledesc", rip_tiles);
+		exr_attribute(rip, "dataWindow", "box2i", exr_window(0, 0, 99, 299));
+		exr_attribute(rip, "channels", "chlist", exr_channels(y, half, 1));
+		rip.u8(0);
+		ok = check("exr, mipmap, tiles first", mip, tiles(
+			expect(FF_EXR, 100, 60, 1, 16, ImageInfo::FLOAT, "none"),
+			32, 16, 7)) && ok;
+		ok = check("exr, ripmap, tiles first", rip, tiles(
+			expect(FF_EXR, 100, 300, 1, 16, ImageInfo::FLOAT, "none"),
+			64, 64, 10)) && ok;
+		return ok;
+	}
+
+	// a scanline header of the window and channels given
+	Bytes exr_window_file(int x0, int y0, int x1, int y1, size_t channels)
+	{
+		const char* const names[] = { "A", "B", "G", "R" };
+		const unsigned int types[] = { 1, 1, 1, 1 };
+		Bytes file;
+		file.le32(20000630).le32(2);
+		exr_attribute(file, "channels", "chlist",
+			exr_channels(names, types, channels));
+		exr_attribute(file, "dataWindow", "box2i", exr_window(x0, y0, x1, y1));
+		file.u8(0);
+		return file;
+	}
+
+	bool refused(const char* what, const Bytes& bytes)
+	{
+		bool thrown = false;
+		try {
+			probe(bytes.data.data(), bytes.data.size());
+		} catch (const InvalidFormat&) {
+			thrown = true;
+		}
+		std::printf("%-28s %s\n", what, thrown ? "refused: ok" : "FAILED");
+		return thrown;
+	}
+
+	bool check_exr_windows()
+	{
+		const int MIN = -2147483647 - 1, MAX = 2147483647;
+		bool ok = refused("exr, window over an int",
+			exr_window_file(MIN, 0, MAX, 0, 1));
+		ok = refused("exr, window of 2^31 rows",
+			exr_window_file(0, -1, 0, MAX, 1)) && ok;
+		ok = refused("exr, window too large",
+			exr_window_file(0, 0, 99999, 99999, 4)) && ok;
+		ok = check("exr, window of 2^33 samples",
+			exr_window_file(MIN, 0, MIN + 65535, 65535, 2),
+			origin(expect(FF_EXR, 65536, 65536, 2, 16, ImageInfo::FLOAT, "none"),
+				MIN, 0)) && ok;
+		return ok;
+	}
+
+	// no magic number, told by the extension
+	bool check_flt(Scratch& scratch)
+	{
+		Bytes b;
+		b.le32(4).le32(3).zeros(4*3*3*4);
+		const std::string name = scratch.file("frame.flt", b.data);
+		return check("flt, by extension", probe(name),
+			expect(FF_FLT, 4, 3, 3, 32, ImageInfo::FLOAT, "none"));
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	bool ok = check_png();
+	ok = check_jpeg() && ok;
+	ok = check_tiff() && ok;
+	ok = check_bmp() && ok;
+	ok = check_targa() && ok;
+	ok = check_pnm() && ok;
+	ok = check_pfm() && ok;
+	ok = check_hdr() && ok;
+	ok = check_exr() && ok;
+	ok = check_exr_windows() && ok;
+	ok = check_flt(scratch) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+/* scratch.h:
+ *   a directory of its own for the files a test writes, made under
+ *   $TMPDIR or /tmp and removed with them when the test ends.
+ */
+#ifndef GIL_TEST_SCRATCH_H
+#define GIL_TEST_SCRATCH_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace gil {
+
+	class Scratch {
+		public:
+			Scratch()
+			{
+				const char* tmp = std::getenv("TMPDIR");
+				std::string pattern = std::string(tmp ? tmp : "/tmp") + "/gil-test-XXXXXX";
+				std::vector<char> name(pattern.begin(), pattern.end());
+				name.push_back(0);
+				if (mkdtemp(&name[0]) == NULL)
+					throw std::runtime_error("cannot make a scratch directory");
+				my_dir = &name[0];
+			}
+
+			~Scratch()
+			{
+				for (size_t i = 0; i < my_files.size(); ++i)
+					std::remove(my_files[i].c_str());
+				rmdir(my_dir.c_str());
+			}
+
+			// a file of the directory, removed with it
+			std::string file(const std::string& name)
+			{
+				const std::string path = my_dir + "/" + name;
+				my_files.push_back(path);
+				return path;
+			}
+
+			// the bytes given, as a file of the directory
+			std::string file(const std::string& name, const std::string& bytes)
+			{
+				const std::string path = file(name);
+				FILE* f = std::fopen(path.c_str(), "wb");
+				bool ok = f != NULL &&
+					std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+				ok = (f == NULL || std::fclose(f) == 0) && ok;
+				if (!ok)
+					throw std::runtime_error("cannot write " + path);
+				return path;
+			}
+
+			// the bytes of a file, empty if it cannot be read
+			static std::string bytes(const std::string& path)
+			{
+				std::string bytes;
+				FILE* f = std::fopen(path.c_str(), "rb");
+				if (f == NULL)
+					return bytes;
+				char buf[4096];
+				size_t n;
+				while ((n = std::fread(buf, 1, sizeof(buf), f)) > 0)
+					bytes.append(buf, n);
+				std::fclose(f);
+				return bytes;
+			}
+
+			static bool exists(const std::string& path)
+			{
+				FILE* f = std::fopen(path.c_str(), "rb");
+				if (f != NULL)
+					std::fclose(f);
+				return f != NULL;
+			}
+
+		private:
+			Scratch(const Scratch&);
+			Scratch& operator =(const Scratch&);
+
+			std::string my_dir;
+			std::vector<std::string> my_files;
+	};
+
+} // namespace gil
+
+#endif // GIL_TEST_SCRATCH_H
@@ -0,0 +1,264 @@
+/* sequence:
+ *   SequenceReader over numbered PFM files. Every frame must come out of
+ *   next() once, first to last, with its own pixels and frame() telling
+ *   its number, whatever the depth and the number of threads, with
+ *   frames of alternating sizes decoding at different speeds. A frame
+ *   that is missing must throw from next() in its turn, between the
+ *   frames around it. Frames of one size must be decoded into no more
+ *   images than the depth and the caller's.
+ *
+ *   cancel() must make next() return false, also a next() waiting for
+ *   a frame that is still being read, here a FIFO no one writes to yet.
+ *   Destroying a reader halfway must not hang. Builds without threads
+ *   only check what next() and cancel() return.
+ *
+ *   sequence_filename must expand %d, %4d and %04d as printf does.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <set>
+#include <string>
+
+#include "gil/core/Image.h"
+#include "gil/core/ImageIO.h"
+#include "gil/core/Sequence.h"
+#include "gil/core/io/pfm.h"
+#include "codec_stubs.h"
+#include "scratch.h"
+
+#ifdef GIL_THREADS
+#include <atomic>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace gil;
+
+namespace {
+
+	const int FIRST = 7, LAST = 36;
+
+	bool report(const char* what, bool ok)
+	{
+		std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	// frames of size and pixels telling their number
+	FloatImage1 frame(int n, bool same_size)
+	{
+		const size_t w = (same_size || n % 2) ? 23 : 301;
+		FloatImage1 image(w, 11 + (same_size ? 0 : n % 3));
+		for (size_t y = 0; y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				image(x, y) = float(n * 10000 + y * 100 + x % 100);
+		return image;
+	}
+
+	bool is_frame(const FloatImage1& image, int n, bool same_size)
+	{
+		const FloatImage1 expected = frame(n, same_size);
+		if (image.width() != expected.width() ||
+				image.height() != expected.height())
+			return false;
+		for (size_t y = 0; y < image.height(); ++y)
+			for (size_t x = 0; x < image.width(); ++x)
+				if (image(x, y) != expected(x, y))
+					return false;
+		return true;
+	}
+
+	// frames FIRST to LAST of name, but missing; the pattern of them
+	std::string write_frames(Scratch& scratch, const std::string& name,
+		bool same_size, int missing = FIRST - 1)
+	{
+		std::string path;
+		for (int n = FIRST; n <= LAST; ++n) {
+			path = scratch.file(sequence_filename(name, n));
+			if (n == missing)
+				continue;
+			FloatImage1 image = frame(n, same_size);
+			FILE* f = std::fopen(path.c_str(), "wb");
+			PfmWriter()(image, f);
+			std::fclose(f);
+		}
+		return path.substr(0, path.rfind('/') + 1) + name;
+	}
+
+	bool check_order(const std::string& pattern)
+	{
+		bool ok = true;
+		for (size_t depth = 1; depth <= 6; depth += 2)
+			for (size_t threads = 1; threads <= 4; ++threads) {
+				SequenceReader<FloatImage1> frames(pattern, FIRST, LAST,
+					depth, threads);
+				FloatImage1 image;
+				bool in_order = frames.frame() == FIRST - 1;
+				int n = FIRST;
+				for (; frames.next(image); ++n)
+					in_order = in_order && frames.frame() == n &&
+						is_frame(image, n, false);
+				in_order = in_order && n == LAST + 1 && !frames.next(image) &&
+					frames.statistics().frames == size_t(LAST - FIRST + 1);
+				if (!in_order)
+					std::printf("depth %lu, %lu threads: out of order\n",
+						(unsigned long)depth, (unsigned long)threads);
+				ok = ok && in_order;
+			}
+		return report("frames in order", ok);
+	}
+
+	bool check_missing(const std::string& pattern, int missing)
+	{
+		bool ok = true;
+		for (size_t threads = 1; threads <= 3; ++threads) {
+			SequenceReader<FloatImage1> frames(pattern, FIRST, LAST, 4, threads);
+			FloatImage1 image;
+			for (int n = FIRST; n <= LAST; ++n) {
+				bool thrown = false;
+				try {
+					ok = frames.next(image) && ok;
+				} catch (const IOError&) {
+					thrown = true;
+				}
+				ok = ok && thrown == (n == missing) &&
+					(thrown || (frames.frame() == n && is_frame(image, n, true)));
+			}
+			ok = ok && !frames.next(image);
+		}
+		return report("a missing frame throws in its turn", ok);
+	}
+
+	bool check_recycled(const std::string& pattern)
+	{
+		bool ok = true;
+		for (size_t depth = 1; depth <= 4; ++depth) {
+			SequenceReader<FloatImage1> frames(pattern, FIRST, LAST, depth, 2);
+			FloatImage1 image;
+			std::set<const float*> buffers;
+			while (frames.next(image))
+				buffers.insert(&image(0, 0));
+			ok = ok && buffers.size() <= depth + 1;
+		}
+		return report("frames decoded into recycled images", ok);
+	}
+
+	bool check_cancel(const std::string& pattern)
+	{
+		bool ok = true;
+		{
+			SequenceReader<FloatImage1> frames(pattern, FIRST, LAST, 3, 2);
+			FloatImage1 image;
+			ok = frames.next(image) && frames.next(image);
+			frames.cancel();
+			ok = ok && !frames.next(image) && !frames.next(image) &&
+				frames.frame() == FIRST + 1;
+		}
+		{
+			// destroyed with frames read ahead and being read
+			SequenceReader<FloatImage1> frames(pattern, FIRST, LAST, 5, 3);
+			FloatImage1 image;
+			ok = frames.next(image) && ok;
+		}
+		return report("cancelled", ok);
+	}
+
+#ifdef GIL_THREADS
+	struct Cancel {
+		Cancel(SequenceReader<FloatImage1>& frames, std::atomic<bool>& done)
+			: frames(frames), done(done) {}
+
+		void operator ()() const
+		{
+			usleep(100000);
+			frames.cancel();
+			done = true;
+		}
+
+		SequenceReader<FloatImage1>& frames;
+		std::atomic<bool>& done;
+	};
+
+	// a frame that is a FIFO: its reader blocks until someone opens it
+	bool check_cancel_waiting(Scratch& scratch)
+	{
+		const std::string fifo = scratch.file("fifo.0001.pfm");
+		if (mkfifo(fifo.c_str(), 0600) != 0)
+			return report("cancelled while waiting (no FIFO)", true);
+		const std::string pattern =
+			fifo.substr(0, fifo.rfind('/') + 1) + "fifo.%04d.pfm";
+
+		SequenceReader<FloatImage1> frames(pattern, 1, 1, 1, 1);
+		std::atomic<bool> done(false);
+		std::thread canceller(Cancel(frames, done));
+		FloatImage1 image;
+		const bool cancelled = !frames.next(image);
+
+		// let the reader out of the FIFO, so cancel() can join it
+		while (!done) {
+			const int fd = open(fifo.c_str(), O_WRONLY | O_NONBLOCK);
+			if (fd >= 0)
+				close(fd);
+			usleep(1000);
+		}
+		canceller.join();
+		return report("cancelled while waiting", cancelled);
+	}
+#endif
+
+	bool check_filenames()
+	{
+		const struct {
+			const char* pattern;
+			int n;
+			const char* name;
+		} cases[] = {
+			{ "a.%d.exr", 7, "a.7.exr" },
+			{ "a.%d.exr", -12, "a.-12.exr" },
+			{ "a.%04d.exr", 7, "a.0007.exr" },
+			{ "a.%04d.exr", 12345, "a.12345.exr" },
+			{ "a.%04d.exr", -7, "a.-007.exr" },
+			{ "a.%4d.exr", 7, "a.   7.exr" },
+			{ "a.%4d.exr", -7, "a.  -7.exr" },
+			{ "%d", 0, "0" },
+			{ "100%%.%d", 3, "100%%.3" },
+			{ "still.exr", 3, "still.exr" },
+			{ "a.%s.exr", 3, "a.%s.exr" }
+		};
+		bool ok = true;
+		for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+			const std::string name =
+				sequence_filename(cases[i].pattern, cases[i].n);
+			if (name != cases[i].name) {
+				std::printf("%s, %d: %s\n", cases[i].pattern, cases[i].n,
+					name.c_str());
+				ok = false;
+			}
+		}
+		return report("sequence file names", ok);
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	const std::string mixed = write_frames(scratch, "mixed.%04d.pfm", false);
+	const std::string same = write_frames(scratch, "same.%d.pfm", true);
+	const std::string holed = write_frames(scratch, "holed.%03d.pfm", true, 19);
+
+	bool ok = check_filenames();
+	ok = check_order(mixed) && ok;
+	ok = check_missing(holed, 19) && ok;
+	ok = check_recycled(same) && ok;
+	ok = check_cancel(mixed) && ok;
+#ifdef GIL_THREADS
+	ok = check_cancel_waiting(scratch) && ok;
+#endif
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/* stream:
+ *   stream() through a NullFilter. A frame must come out as it went in.
+ *   A destination that cannot be written must give false, not an
+ *   exception, whether the writer fails before the reader is done (a
+ *   tall frame) or after (a short one), and over many runs. A truncated
+ *   input must throw the reader's error and leave no partial output;
+ *   an input of unknown format must give false and leave a file already
+ *   at the destination alone.
+ *
+ *   A Radiance file, whose scanlines are decoded by several threads,
+ *   must still reach the stream a row at a time from the top.
+ *
+ *     make test
+ */
+#include <cstdio>
+#include <string>
+
+#include "gil/dip/Stream.h"
+#include "gil/dip/NullFilter.h"
+#include "codec_stubs.h"
+#include "scratch.h"
+
+using namespace gil;
+
+namespace {
+
+	typedef NullFilter<FloatImage3> Null;
+
+	FloatImage3 frame(size_t w, size_t h)
+	{
+		FloatImage3 image(w, h);
+		for (size_t y = 0; y < h; ++y)
+			for (size_t x = 0; x < w; ++x)
+				image(x, y) = Float3(float(x), float(y), float(x ^ y));
+		return image;
+	}
+
+	bool report(const char* what, bool ok)
+	{
+		std::printf("%s: %s\n", what, ok ? "ok" : "FAILED");
+		return ok;
+	}
+
+	bool same(const FloatImage3& a, const FloatImage3& b)
+	{
+		bool ok = a.width() == b.width() && a.height() == b.height();
+		for (size_t y = 0; ok && y < a.height(); ++y)
+			for (size_t x = 0; x < a.width(); ++x)
+				for (size_t c = 0; c < 3; ++c)
+					ok = ok && a(x, y)[c] == b(x, y)[c];
+		return ok;
+	}
+
+	bool check_copy(Scratch& scratch)
+	{
+		const FloatImage3 image = frame(16, 300);
+		const std::string in = scratch.file("copy.pfm");
+		const std::string out = scratch.file("copy_out.pfm");
+		FloatImage3 copy;
+		const bool ok = write<PfmWriter>(image, in) &&
+			stream<FloatImage3>(in, out, Null()) &&
+			read<PfmReader>(copy, out) && same(copy, image);
+		return report("frame streamed as it is", ok);
+	}
+
+	// decoded by four threads, a row each at a time
+	bool check_hdr(Scratch& scratch)
+	{
+		const std::string in = scratch.file("threads.hdr");
+		const std::string out = scratch.file("threads_out.pfm");
+		FloatImage3 image;
+		bool ok = write<HdrWriter>(frame(64, 400), in) &&
+			read<HdrReader>(image, in);
+
+		const Execution global = Execution::global();
+		Execution::global() = Execution(Execution::THREAD_POOL, 4, 1);
+		const size_t RUNS = 20;
+		size_t streamed = 0;
+		for (size_t i = 0; i < RUNS; ++i) {
+			FloatImage3 copy;
+			try {
+				streamed += stream<FloatImage3>(in, out, Null(), 8) &&
+					read<PfmReader>(copy, out) && same(copy, image);
+			} catch (const std::exception& e) {
+				std::printf("run %lu threw: %s\n", (unsigned long)i, e.what());
+			}
+		}
+		Execution::global() = global;
+		std::printf("hdr: %lu of %lu runs streamed\n",
+			(unsigned long)streamed, (unsigned long)RUNS);
+		return report("hdr decoded by threads, streamed", ok && streamed == RUNS);
+	}
+
+	bool check_unwritable(Scratch& scratch, size_t height, const char* what)
+	{
+		const std::string in = scratch.file(std::string(what) + ".pfm");
+		const std::string out = scratch.file("none") + "/out.pfm";
+		if (!write<PfmWriter>(frame(8, height), in))
+			return report(what, false);
+		const size_t RUNS = 50;
+		size_t refused = 0;
+		for (size_t i = 0; i < RUNS; ++i)
+			try {
+				refused += !stream<FloatImage3>(in, out, Null(), 8);
+			} catch (const std::exception& e) {
+				std::printf("run %lu threw: %s\n", (unsigned long)i, e.what());
+			}
+		std::printf("%s: %lu of %lu runs gave false\n", what,
+			(unsigned long)refused, (unsigned long)RUNS);
+		return report(what, refused == RUNS);
+	}
+
+	bool check_truncated(Scratch& scratch)
+	{
+		const std::string in = scratch.file("truncated.pfm");
+		const std::string out = scratch.file("truncated_out.pfm");
+		bool ok = write<PfmWriter>(frame(8, 2000), in);
+		const std::string bytes = Scratch::bytes(in);
+		scratch.file("truncated.pfm", bytes.substr(0, bytes.size() / 2));
+		bool thrown = false;
+		try {
+			stream<FloatImage3>(in, out, Null(), 8);
+		} catch (const std::exception&) {
+			thrown = true;
+		}
+		return report("truncated input, no partial output",
+			ok && thrown && !Scratch::exists(out));
+	}
+
+	bool check_unknown(Scratch& scratch)
+	{
+		const std::string in = scratch.file("unknown.pfm", "not an image\n");
+		const std::string out = scratch.file("kept.pfm", "kept\n");
+		const bool ok = !stream<FloatImage3>(in, out, Null()) &&
+			Scratch::bytes(out) == "kept\n";
+		return report("unknown input, destination kept", ok);
+	}
+
+} // namespace
+
+int main()
+{
+	Scratch scratch;
+	bool ok = check_copy(scratch);
+	ok = check_hdr(scratch) && ok;
+	ok = check_unwritable(scratch, 4000, "unwritable, tall frame") && ok;
+	ok = check_unwritable(scratch, 4, "unwritable, short frame") && ok;
+	ok = check_truncated(scratch) && ok;
+	ok = check_unknown(scratch) && ok;
+	std::printf(ok ? "ok\n" : "FAILED\n");
+	return ok ? 0 : 1;
+}